@@ -12,10 +12,14 @@
 #include <linux/fs.h>            /* needed for register_chrdev_region, file_operations */
 #include <linux/interrupt.h>
 #include <linux/cdev.h>          /* cdev definition */
+#include <linux/poll.h>          /* poll_wait, POLLIN */
 #include <linux/slab.h>		       /* kmalloc(),kfree() */
 #include <asm/uaccess.h>         /* copy_to copy_from _user */
 #include <linux/uaccess.h>
 #include <linux/io.h>
+#include <linux/spinlock.h>
+#include <linux/sched.h>         /* cond_resched */
+#include "seqring.h"             /* Registers, messages and command ring */
 
 /**
  * PL->PS IRQ0 [0-7] : 121 - 128
@@ -23,56 +27,31 @@
  * Look into: https://docs.amd.com/r/en-US/pg201-zynq-ultrascale-plus-processing-system/Programmable-Logic-Clocks-and-Interrupts
  */
 #define DRIVER_NAME "seqdriver"
-#define SEQ_IRQ 56  // Hard-coded value of IRQ vector (GIC: 121).
-
-// Structure that mimics the layout of the peripheral registers.
-// Vitis HLS skips some addresses in the register file. We introduce
-// padding fields to create the right mapping to registers with our structure,
-struct TRegs {
-  uint32_t control; // 0x00
-  uint32_t gier, ier, isr; // 0x04, 0x08, 0x0C
-  uint32_t bit_set_ref_1, bit_set_ref_2; // 0x10, 0x14
-  uint32_t padding1; // 0x18
-  uint32_t nseqt; // 0x1C
-  uint32_t padding2; // 0x20
-  uint32_t length_ref_1, length_ref_2; //0x24, 0x28
-  uint32_t padding3; // 0x2C
-  uint32_t bit_set_pat_1, bit_set_pat_2; // 0x30, 0x34
-  uint32_t padding4; // 0x38
-  uint32_t nseqp; // 0x3C
-  uint32_t padding5; // 0x40
-  uint32_t length_pat_1, length_pat_2; // 0x44, 0x48
-  uint32_t padding6; // 0x4C
-  uint32_t output_1, output_2; // 0x50, 0x54
-};
-
-// Type of waiting to the accelerator
-typedef enum {
-  INTERRUPT = 0x0,  // Wait for the interrupt
-  POLLING   = 0x1,  // Polling on the status register
-  CONTINUE  = 0x2,  // Do not wait and return to the user
-} read_type_t;
-
-// Structure used to pass commands between user-space and kernel-space.
-struct write_message {
-  uint64_t seq_t;         // Pointer to the target sequences
-  uint64_t seq_q;         // Pointer to the query sequences
-  uint32_t n_seq_t;       // Number of targets
-  uint32_t n_seq_q;       // Number of queries
-  uint64_t length_seq_t;  // Pointer to the target sequence lengths
-  uint64_t length_seq_q;  // Pointer to the target sequence lengths
-  uint64_t min_pos;       // Pointer to the min pos array
-  read_type_t wait_type;  // Type of waiting to the accelerator
-};
+#define SEQ_IRQ 56  // Default value of IRQ vector of the first instance (GIC: 121).
+#define SEQ_BASE_ADDR 0x00A0000000  // Default base address of the first instance.
+#define SEQ_ADDR_STRIDE 0x10000     // Default distance between the base addresses of the instances.
+#define SEQ_MEM_SIZE 0x10000        // Size of the register space of each instance.
+#define MAX_DEVICES 8
 
 int seq_major = 0;
 int seq_minor = 0;
 module_param(seq_major,int,S_IRUGO);
 module_param(seq_minor,int,S_IRUGO);
 
-// We declare a wait queue that will allow us to wait on a condition.
-wait_queue_head_t wq;
-int flag = 0;
+// Accelerator instances (compute units) in the bitstream. Instance i is exposed as /dev/seqdriver<i>.
+// If the base address or the IRQ of an instance is not given, it is derived from the previous one:
+//   insmod seqdriver.ko num_devices=2 base_addr=0xA0000000,0xA0010000 irqs=56,57
+static int num_devices = 1;
+static unsigned long base_addr[MAX_DEVICES] = {SEQ_BASE_ADDR};
+static int irqs[MAX_DEVICES] = {SEQ_IRQ};
+static int num_base_addr = 0, num_irqs = 0;
+module_param(num_devices, int, S_IRUGO);
+module_param_array(base_addr, ulong, &num_base_addr, S_IRUGO);
+module_param_array(irqs, int, &num_irqs, S_IRUGO);
+
+// Time that release() waits for the running job of the file before abandoning it.
+static unsigned int release_timeout_ms = 10000;
+module_param(release_timeout_ms, uint, S_IRUGO);
 
 // This structure contains the device information.
 struct seq_info {
@@ -81,16 +60,30 @@ struct seq_info {
   uint64_t memEnd;
   void __iomem  *baseAddr;
   struct cdev   cdev;            /* Char device structure               */
+  spinlock_t lock;               /* Protects the scheduler and the job queues against the IRQ handler */
+  struct seq_sched sched;        /* Jobs of the open files, served in turns */
+  int initialized;               /* Resources acquired by seq_init (to clean up) */
+};
+
+// Context of an open file: several processes can share an instance, each one
+// with its own jobs, waiting mode and notifications.
+struct seq_file_ctx {
+  struct seq_ctx q;              /* Queued jobs and notifications (see seqring.h) */
+  struct seq_info *seq;          /* Instance opened */
+  wait_queue_head_t wq;          /* Wait queue of the owner for the end of its jobs */
+  read_type_t wait_type;         /* Waiting mode programmed by the last write */
+  struct write_message staged;   /* Job programmed by write() and started by read() */
+  int staged_valid;              /* staged holds a job not started yet */
 };
 
-static struct seq_info seq_mem = {SEQ_IRQ, 0x00A0000000, 0x00A000FFFF};
-static read_type_t wait_type = INTERRUPT;
+static struct seq_info seq_mem[MAX_DEVICES];
 
 // Declare here the user-accessible functions that the driver implements.
 int seq_open(struct inode *inode, struct file *filp);
 int seq_release(struct inode *inode, struct file *filed_mem);
 ssize_t seq_read(struct file *filed_mem, char __user *buf, size_t count, loff_t *f_pos);
 ssize_t seq_write(struct file *filed_mem, const char __user *buf, size_t count, loff_t *f_pos);
+__poll_t seq_poll(struct file *filp, poll_table *wait);
 
 // IRQ handler function.
 static irq_handler_t  seqIRQHandler(unsigned int irq, void *dev_id, struct pt_regs *regs);
@@ -100,6 +93,7 @@ struct file_operations seq_fops = {
   .owner =    THIS_MODULE,
   .read =     seq_read,
   .write =    seq_write,
+  .poll =     seq_poll,
   .open =     seq_open,
   .release =  seq_release,
 };
@@ -108,16 +102,71 @@ struct file_operations seq_fops = {
 // Initialize the device and enable the interrups here.
 int seq_open(struct inode *inode, struct file *filp)
 {
+  struct seq_file_ctx *ctx = kzalloc(sizeof(struct seq_file_ctx), GFP_KERNEL);
+
+  if (!ctx)
+    return -ENOMEM;
+  // Keep the instance that corresponds to the minor number of the device node.
+  ctx->seq = container_of(inode->i_cdev, struct seq_info, cdev);
+  seq_ctx_init(&ctx->q);
+  init_waitqueue_head(&ctx->wq);
+  ctx->wait_type = INTERRUPT;
+  filp->private_data = ctx;
   pr_info("SEQ_DRIVER: Performing 'open' operation\n");
   return 0;         
 }
 
+// The job of the context is in the accelerator.
+static int seq_ctx_running(struct seq_file_ctx *ctx)
+{
+  unsigned long flags;
+  int running;
+
+  spin_lock_irqsave(&ctx->seq->lock, flags);
+  running = ctx->seq->sched.running == &ctx->q;
+  spin_unlock_irqrestore(&ctx->seq->lock, flags);
+  return running;
+}
+
+// Abandons the jobs of the file (see seq_sched_abort). Returns -EIO if the instance is
+// left faulted (the abandoned job may still be running in the kernel).
+static int seq_ctx_abort(struct seq_file_ctx *ctx)
+{
+  struct seq_info * seq = ctx->seq;
+  unsigned long flags;
+  int running, faulted;
+
+  spin_lock_irqsave(&seq->lock, flags);
+  running = seq_sched_abort(&seq->sched, &ctx->q, (struct TRegs*)seq->baseAddr);
+  faulted = seq->sched.faulted;
+  spin_unlock_irqrestore(&seq->lock, flags);
+  if (running)
+    pr_warn("SEQ_DRIVER: Job abandoned at 0x%08llX%s\n", (uint64_t)seq->memStart,
+      faulted ? " (the kernel is still busy)" : "");
+  return faulted ? -EIO : 0;
+}
+
 // Function that implements system call release() for our driver.
 // Used with close() or when the OS closes the descriptors held by
 // the process when it is closed (e.g., Ctrl-C).
 // Stop the interrupts and disable the device.
 int seq_release(struct inode *inode, struct file *filed_mem)
 {
+  struct seq_file_ctx *ctx = filed_mem->private_data;
+  unsigned long flags;
+  int running;
+
+  // The queued jobs are dropped, but a running one cannot be aborted: its end is
+  // notified (the context is idle then), so wait for it before freeing the context.
+  // A job that does not finish in time is abandoned, so that its completion never
+  // refers to the freed context.
+  spin_lock_irqsave(&ctx->seq->lock, flags);
+  running = seq_sched_drop(&ctx->seq->sched, &ctx->q);
+  spin_unlock_irqrestore(&ctx->seq->lock, flags);
+  if (running && !wait_event_timeout(ctx->wq, !seq_ctx_running(ctx), msecs_to_jiffies(release_timeout_ms)))
+    seq_ctx_abort(ctx);
+
+  kfree(ctx);
   pr_info("SEQ_DRIVER: Performing 'release' operation\n");
   return 0;
 }
@@ -129,97 +178,192 @@ int seq_release(struct inode *inode, struct file *filed_mem)
 void seq_cleanup_module(void)
 {
   dev_t devno = MKDEV(seq_major, seq_minor);
-  disable_irq(seq_mem.irq);
-  free_irq(seq_mem.irq,&seq_mem);
-  iounmap(seq_mem.baseAddr);
-  release_mem_region(seq_mem.memStart, seq_mem.memEnd - seq_mem.memStart + 1);
-  cdev_del(&seq_mem.cdev);
-  unregister_chrdev_region(devno, 1);        /* unregistering device */
+  int i;
+
+  for (i = 0; i < num_devices; i++) {
+    if (!seq_mem[i].initialized)
+      continue;
+    disable_irq(seq_mem[i].irq);
+    free_irq(seq_mem[i].irq, &seq_mem[i]);
+    iounmap(seq_mem[i].baseAddr);
+    release_mem_region(seq_mem[i].memStart, seq_mem[i].memEnd - seq_mem[i].memStart + 1);
+    cdev_del(&seq_mem[i].cdev);
+    seq_mem[i].initialized = 0;
+  }
+  unregister_chrdev_region(devno, num_devices);        /* unregistering device */
   pr_info("SEQ_DRIVER: Cdev deleted, seq device unmapped, chdev unregistered\n");
 }
 
 // Function that implements system call read() for our driver.
+// Queues the job programmed by the last write() and waits for it according to its wait type.
+// With the CHAIN wait type, it does not start anything: it returns (as an uint32_t in buf)
+// the number of jobs of the file finished since the previous read(), and rearms poll().
 ssize_t seq_read(struct file *filed_mem, char __user *buf, size_t count, loff_t *f_pos)
 {
-  volatile struct TRegs * slave_regs = (struct TRegs*)seq_mem.baseAddr;
-  uint32_t status;
-
-  // Enable interrupts (global and spacific to done).
-  iowrite32(1, (volatile void*)(&slave_regs->gier));
-  iowrite32(1, (volatile void*)(&slave_regs->ier));
-  mb();
-    
-  flag = 0;
-  // Start peripheral (start bit = 1)
-  status = ioread32((volatile void*)(&slave_regs->control));
-  status |= 1; 
-  iowrite32(status, (volatile void*)(&slave_regs->control));
-  mb();
-
-  if (wait_type == INTERRUPT) { // INTERRUPT
-    while(wait_event_interruptible(wq, flag !=0)) {
-      ;
-    }
-  } else if (wait_type == POLLING) { // POLLING
-    do {
-      status = slave_regs->control;
-    } while ( ( (status & 2) != 2) ); // wait until ap_done==1
+  struct seq_file_ctx *ctx = filed_mem->private_data;
+  struct seq_info * seq = ctx->seq;
+  volatile struct TRegs * slave_regs = (struct TRegs*)seq->baseAddr;
+  unsigned long flags;
+  unsigned long deadline;
+  uint32_t done;
+  long res;
+
+  if (ctx->wait_type == CHAIN) {
+    spin_lock_irqsave(&seq->lock, flags);
+    done = seq_ctx_collect(&seq->sched, &ctx->q);
+    spin_unlock_irqrestore(&seq->lock, flags);
+    if (count < sizeof(uint32_t))
+      return 0;
+    if (copy_to_user(buf, &done, sizeof(uint32_t)))
+      return -EFAULT;
+    return sizeof(uint32_t);
   }
 
-  // Disable interrupts.
-  iowrite32(0, (volatile void*)&slave_regs->gier);
-  iowrite32(0, (volatile void*)&slave_regs->ier);
-  mb();
+  // Every job is started once: read() needs a job programmed by write() since the last one.
+  if (!ctx->staged_valid) {
+    pr_err("SEQ_DRIVER: read() without a job programmed by write().\n");
+    return -EINVAL;
+  }
 
+  // The job waits for its turn if the accelerator is busy with the jobs of other files.
+  ctx->staged.notify = 1;
+  spin_lock_irqsave(&seq->lock, flags);
+  res = seq_sched_submit(&seq->sched, &ctx->q, &ctx->staged, 1, slave_regs);
+  spin_unlock_irqrestore(&seq->lock, flags);
+  if (res) {
+    pr_err("SEQ_DRIVER: The job queue of the file is full.\n");
+    return -EBUSY;
+  }
+  ctx->staged_valid = 0;
+
+  // With a timeout, a job that does not finish in time (hung kernel or lost IRQ) is
+  // abandoned and the user is told with -ETIMEDOUT.
+  if (ctx->wait_type == INTERRUPT) { // INTERRUPT
+    if (ctx->staged.timeout_ms == 0) {
+      // A signal abandons the job. It is staged again, so that a restarted read() runs it.
+      if (wait_event_interruptible(ctx->wq, ctx->q.flag != 0)) {
+        seq_ctx_abort(ctx);
+        ctx->staged_valid = 1;
+        return -ERESTARTSYS;
+      }
+    } else {
+      deadline = jiffies + msecs_to_jiffies(ctx->staged.timeout_ms);
+      do {
+        res = wait_event_interruptible_timeout(ctx->wq, ctx->q.flag != 0, (long)(deadline - jiffies));
+      } while (res == -ERESTARTSYS && time_before(jiffies, deadline));
+      if (res <= 0 && !READ_ONCE(ctx->q.flag)) {
+        seq_ctx_abort(ctx);
+        return -ETIMEDOUT;
+      }
+    }
+  } else if (ctx->wait_type == POLLING) { // POLLING
+    // The status register belongs to whichever job is running: spin on the
+    // completion of our job instead (set by the IRQ handler).
+    deadline = jiffies + msecs_to_jiffies(ctx->staged.timeout_ms);
+    while (!READ_ONCE(ctx->q.flag)) {
+      if (ctx->staged.timeout_ms != 0 && time_after(jiffies, deadline)) {
+        seq_ctx_abort(ctx);
+        return -ETIMEDOUT;
+      }
+      cpu_relax();
+      cond_resched();
+    }
+  } else { // CONTINUE
+    // Return to the user now. The IRQ handler signals the end (see seq_poll).
+    return 0;
+  }
+
+  spin_lock_irqsave(&seq->lock, flags);
+  seq_ctx_collect(&seq->sched, &ctx->q);
+  spin_unlock_irqrestore(&seq->lock, flags);
   return 0;
 }
 
 // Function that implements system call write() for our driver.
-// Returns 1 uint32_t with the number of times the interrupt has been detected.
+// A single message programs the job of the file (it is queued and started by read()).
+// An array of messages with the CHAIN wait type is queued right away: the IRQ handler
+// chains the jobs of all the files, taking one from each file in turn. A RESET message
+// abandons the jobs of the file (see seq_ctx_abort).
 ssize_t seq_write(struct file *filed_mem, const char __user *buf, size_t count, loff_t *f_pos)
 {
-  volatile struct TRegs * slave_regs = (struct TRegs*)seq_mem.baseAddr;
-  struct write_message message;
-
-  if (count < sizeof(struct write_message)) {
-    pr_err("SEQ_DRIVER: USer buffer too small.\n");
-    return -1;
+  struct seq_file_ctx *ctx = filed_mem->private_data;
+  struct seq_info * seq = ctx->seq;
+  volatile struct TRegs * slave_regs = (struct TRegs*)seq->baseAddr;
+  struct write_message message, *messages;
+  unsigned long flags;
+  size_t n = count / sizeof(struct write_message);
+  int res;
+
+  if (n == 0) {
+    pr_err("SEQ_DRIVER: User buffer too small.\n");
+    return -EINVAL;
   }
 
   // Copy the information from user-space to the kernel-space buffer.
-  if(raw_copy_from_user(&message, buf, sizeof(struct write_message)))
-  {
-    pr_err("SEQ_DRIVER: Raw copy from user buffer failed.\n");
-    return -1;
+  if (copy_from_user(&message, buf, sizeof(struct write_message))) {
+    pr_err("SEQ_DRIVER: Copy from user buffer failed.\n");
+    return -EFAULT;
+  }
+
+  if (message.wait_type == RESET) {
+    ctx->staged_valid = 0;
+    return seq_ctx_abort(ctx);
+  }
+
+  if (message.wait_type == CHAIN) {
+    if (n > SEQ_RING_SIZE) {
+      pr_err("SEQ_DRIVER: More than %d descriptors in one write.\n", SEQ_RING_SIZE);
+      return -ENOSPC;
+    }
+    messages = kmalloc(n * sizeof(struct write_message), GFP_KERNEL);
+    if (!messages)
+      return -ENOMEM;
+    if (copy_from_user(messages, buf, n * sizeof(struct write_message))) {
+      pr_err("SEQ_DRIVER: Copy from user buffer failed.\n");
+      kfree(messages);
+      return -EFAULT;
+    }
+
+    spin_lock_irqsave(&seq->lock, flags);
+    res = seq_sched_submit(&seq->sched, &ctx->q, messages, n, slave_regs);
+    spin_unlock_irqrestore(&seq->lock, flags);
+    kfree(messages);
+    if (res)
+      return -ENOSPC;
+    ctx->wait_type = CHAIN;
+    return 0;
   }
 
-  // Program the peripheral registers. 
-  // Reference / target
-  iowrite32((uint32_t)(message.seq_t & 0xFFFFFFFF)        , (volatile void*)(&slave_regs ->  bit_set_ref_1 ));
-  iowrite32((uint32_t)(message.seq_t >>32)                , (volatile void*)(&slave_regs ->  bit_set_ref_2 ));
-  iowrite32(message.n_seq_t                               , (volatile void*)(&slave_regs ->  nseqt         ));
-  iowrite32((uint32_t)(message.length_seq_t & 0xFFFFFFFF) , (volatile void*)(&slave_regs ->  length_ref_1  ));
-  iowrite32((uint32_t)(message.length_seq_t >>32)         , (volatile void*)(&slave_regs ->  length_ref_2  ));
-  // Query / pattern
-  iowrite32((uint32_t)(message.seq_q & 0xFFFFFFFF)        , (volatile void*)(&slave_regs ->  bit_set_pat_1 ));
-  iowrite32((uint32_t)(message.seq_q >>32)                , (volatile void*)(&slave_regs ->  bit_set_pat_2 ));
-  iowrite32(message.n_seq_q                               , (volatile void*)(&slave_regs ->  nseqp         ));
-  iowrite32((uint32_t)(message.length_seq_q & 0xFFFFFFFF) , (volatile void*)(&slave_regs ->  length_pat_1  ));
-  iowrite32((uint32_t)(message.length_seq_q >>32)         , (volatile void*)(&slave_regs ->  length_pat_2  ));
-  // Output
-  iowrite32((uint32_t)(message.min_pos & 0xFFFFFFFF)      , (volatile void*)(&slave_regs ->  output_1      ));
-  iowrite32((uint32_t)(message.min_pos >>32)              , (volatile void*)(&slave_regs ->  output_2      ));
-  wait_type = message.wait_type;
+  // Keep the job of the file. The registers belong to the running job, if any.
+  ctx->staged = message;
+  ctx->staged_valid = 1;
+  ctx->wait_type = message.wait_type;
 
   // pr_info("SEQ_DRIVER: Performed WRITE operation successfully\n");
   return 0;
 }
 
 
+// Function that implements system calls poll() and select() for our driver.
+// The device is readable when the last job started by the file has finished (or no job
+// was started), so that jobs started with the CONTINUE wait type can be waited for with
+// other descriptors. With CHAIN jobs, it is readable when a notification is pending (see seq_read).
+__poll_t seq_poll(struct file *filp, poll_table *wait)
+{
+  struct seq_file_ctx *ctx = filp->private_data;
+  __poll_t mask = 0;
+
+  poll_wait(filp, &ctx->wq, wait);
+  if (READ_ONCE(ctx->q.flag) != 0)
+    mask |= POLLIN | POLLRDNORM;
+  return mask;
+}
+
+
 // Set up the char_dev structure for this device.
-static void seq_setup_cdev(struct seq_info *_seq_mem)
+static void seq_setup_cdev(struct seq_info *_seq_mem, int index)
 {
-	int err, devno = MKDEV(seq_major, seq_minor);
+	int err, devno = MKDEV(seq_major, seq_minor + index);
 
 	cdev_init(&_seq_mem->cdev, &seq_fops);
 	_seq_mem->cdev.owner = THIS_MODULE;
@@ -233,60 +377,83 @@ static void seq_setup_cdev(struct seq_info *_seq_mem)
 }
 
 
-// The init function registers the chdev.
-// It allocates dynamically a new major number.
-// The major number corresponds to a different function driver.
-static int seq_init(void)
+// Acquires the register space and the IRQ of one instance.
+static int seq_init_device(struct seq_info *seq, int index)
 {
-  int result = 0;
-  dev_t dev = 0;
+  int result;
 
-  // Allocate a function number for our driver (major number).
-  // The minor number is the instance of the driver.
-  pr_info("SEQ_DRIVER: Allocating a new major number.\n");
-  result = alloc_chrdev_region(&dev, seq_minor, 1, "seq");
-  seq_major = MAJOR(dev);
-  if (result < 0) {
-    pr_err("SEQ_DRIVER: Can't get major %d\n", seq_major);
-    return result;
-  }
+  seq->memStart = (index < num_base_addr || index == 0) ? base_addr[index] : seq_mem[index - 1].memStart + SEQ_ADDR_STRIDE;
+  seq->memEnd = seq->memStart + SEQ_MEM_SIZE - 1;
+  seq->irq = (index < num_irqs || index == 0) ? irqs[index] : seq_mem[index - 1].irq + 1;
+  spin_lock_init(&seq->lock);
+  seq_sched_init(&seq->sched);
 
   // Request (exclusive) access to the memory address range of the peripheral.
-  if (!request_mem_region(seq_mem.memStart, seq_mem.memEnd - seq_mem.memStart + 1, DRIVER_NAME)) {
-    pr_err("SEQ_DRIVER: Couldn't lock memory region at %p\n", (void *)seq_mem.memStart);
-    unregister_chrdev_region(dev, 1);
+  if (!request_mem_region(seq->memStart, seq->memEnd - seq->memStart + 1, DRIVER_NAME)) {
+    pr_err("SEQ_DRIVER: Couldn't lock memory region at %p\n", (void *)seq->memStart);
     return -1;
   }
 
   // Obtain a "kernel virtual address" for the physical address of the peripheral.
-  seq_mem.baseAddr = ioremap(seq_mem.memStart, seq_mem.memEnd - seq_mem.memStart + 1);
-  if (!seq_mem.baseAddr) {
+  seq->baseAddr = ioremap(seq->memStart, seq->memEnd - seq->memStart + 1);
+  if (!seq->baseAddr) {
     pr_err("SEQ_DRIVER: Could not obtain virtual kernel address for iomem space.\n");
-    release_mem_region(seq_mem.memStart, seq_mem.memEnd - seq_mem.memStart + 1);
-    unregister_chrdev_region(dev, 1);
+    release_mem_region(seq->memStart, seq->memEnd - seq->memStart + 1);
     return -1;
   }
 
-  init_waitqueue_head(&wq);
-
   // Request registering our interrupt handler for the IRQ of the peripheral.
   // We configure the interrupt to be detected on the rising edge of the signal.
-  result = request_irq(seq_mem.irq, (irq_handler_t)seqIRQHandler, IRQF_TRIGGER_RISING, DRIVER_NAME, &seq_mem);
+  result = request_irq(seq->irq, (irq_handler_t)seqIRQHandler, IRQF_TRIGGER_RISING, DRIVER_NAME, seq);
   if(result) {
     printk(KERN_ALERT "SEQ_DRIVER: Failed to register interrupt handler (error=%d)\n", result);     
-    iounmap(seq_mem.baseAddr);
-    release_mem_region(seq_mem.memStart, seq_mem.memEnd - seq_mem.memStart + 1);
-    cdev_del(&seq_mem.cdev);
-    unregister_chrdev_region(dev, 1);
+    iounmap(seq->baseAddr);
+    release_mem_region(seq->memStart, seq->memEnd - seq->memStart + 1);
     return result;
   }
 
   // Enable the IRQ. From this moment on, we can receive the IRQ asynchronously at any time.
-  enable_irq(seq_mem.irq);
-  pr_info("SEQ_DRIVER: Interrupt %d registered\n", seq_mem.irq);
+  enable_irq(seq->irq);
+  pr_info("SEQ_DRIVER: Interrupt %d registered\n", seq->irq);
+
+  pr_info("SEQ_DRIVER: driver %d at 0x%08llX mapped to 0x%08llX\n", index, (uint64_t)seq->memStart, (uint64_t)seq->baseAddr); 
+  seq_setup_cdev(seq, index);
+  seq->initialized = 1;
 
-  pr_info("SEQ_DRIVER: driver at 0x%08llX mapped to 0x%08llX\n", (uint64_t)seq_mem.memStart, (uint64_t)seq_mem.baseAddr); 
-  seq_setup_cdev(&seq_mem);
+  return 0;
+}
+
+
+// The init function registers the chdev.
+// It allocates dynamically a new major number.
+// The major number corresponds to a different function driver.
+static int seq_init(void)
+{
+  int result = 0, i;
+  dev_t dev = 0;
+
+  if (num_devices < 1 || num_devices > MAX_DEVICES) {
+    pr_err("SEQ_DRIVER: num_devices must be between 1 and %d\n", MAX_DEVICES);
+    return -EINVAL;
+  }
+
+  // Allocate a function number for our driver (major number).
+  // The minor number is the instance of the driver.
+  pr_info("SEQ_DRIVER: Allocating a new major number.\n");
+  result = alloc_chrdev_region(&dev, seq_minor, num_devices, "seq");
+  seq_major = MAJOR(dev);
+  if (result < 0) {
+    pr_err("SEQ_DRIVER: Can't get major %d\n", seq_major);
+    return result;
+  }
+
+  for (i = 0; i < num_devices; i++) {
+    result = seq_init_device(&seq_mem[i], i);
+    if (result) {
+      seq_cleanup_module();
+      return result;
+    }
+  }
 
   return 0;
 }
@@ -313,18 +480,24 @@ module_exit(seq_exit);
 // interact with the interrupt handler.
 static irq_handler_t seqIRQHandler(unsigned int irq, void *dev_id, struct pt_regs *regs)
 {
-  volatile struct TRegs * slave_regs = (struct TRegs*)seq_mem.baseAddr;
+  struct seq_info * seq = dev_id;  // Instance that raised the IRQ (given to request_irq)
+  volatile struct TRegs * slave_regs = (struct TRegs*)seq->baseAddr;
+  struct seq_ctx *owner;
   // Clean the interrupt in the peripheral, so that we can detect new rising transition.
   // The ISR is toggle-on-write (TOW), which means that its bits toggle when they are
   // written, whatever it was their previous value. Therefore, we write (1) to the 
   // 'done' bit to toggle it, so that it becomes 0 and the interrupt is disarmed.
   iowrite32(1, (volatile void*)&slave_regs->isr);
-  mb();
 
-  // Signal that it is us waking the main thread.
-	flag = 1;
-  // Wake the main thread.
-	wake_up_interruptible(&wq);
+  // Retire the job, start the next one (the interrupts are disabled if there is none),
+  // and wake the owner of the job if it asked to be notified. The owner is woken with
+  // the lock held: release() frees the context once it is not running, which it checks
+  // under the lock, so the context cannot be freed before wake_up() returns.
+  spin_lock(&seq->lock);
+  owner = seq_sched_complete(&seq->sched, slave_regs);
+  if (owner)
+    wake_up(&container_of(owner, struct seq_file_ctx, q)->wq);
+  spin_unlock(&seq->lock);
 	return (irq_handler_t) IRQ_HANDLED;      // Announce that the IRQ has been handled correctly
   // In case of error, or if it was not our device which generated the IRQ, return IRQ_NONE.
 }
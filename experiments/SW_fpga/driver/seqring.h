@@ -0,0 +1,319 @@
+/*** Command rings and job scheduling of the seqdriver.
+ ***
+ *** Every open file of an instance has a context with its own ring of jobs
+ *** (write_message descriptors). The scheduler of the instance keeps the contexts
+ *** with queued jobs in round-robin order and starts one job at a time, taking a
+ *** job from each context in turn, so that the processes sharing a device node
+ *** are served fairly. The IRQ handler retires the job of its owner and starts
+ *** the next one itself: a batch of jobs written with the CHAIN wait type costs
+ *** a single write(), and the owner is only notified for the descriptors flagged
+ *** with 'notify' and when it has no more jobs queued or running.
+ ***
+ *** A job that does not finish (the kernel hung, or its IRQ was lost) can be
+ *** abandoned by its owner: the HLS kernel cannot be stopped, so the instance is
+ *** marked as faulted and starts no more jobs until it reports idle again.
+ ***
+ *** This file has no kernel dependencies: out of the kernel, the registers are plain
+ *** memory, so the queues can be exercised against a simulated register block
+ *** (struct TRegs in memory, completions signalled by calling seq_sched_complete()).
+ *** The functions do not lock: the driver calls them with the instance lock held.
+ ***/
+
+#ifndef SEQRING_H
+#define SEQRING_H
+
+// Requires <linux/types.h> and <linux/io.h> in the kernel, <stdint.h> elsewhere
+
+#ifdef __KERNEL__
+#define SEQ_REG_WRITE(regs, reg, value) iowrite32((value), (volatile void*)(&(regs)->reg))
+#define SEQ_REG_READ(regs, reg) ioread32((volatile void*)(&(regs)->reg))
+#define SEQ_REG_BARRIER() mb()
+#else
+#define SEQ_REG_WRITE(regs, reg, value) ((regs)->reg = (value))
+#define SEQ_REG_READ(regs, reg) ((regs)->reg)
+#define SEQ_REG_BARRIER() __sync_synchronize()
+#endif
+
+#define SEQ_RING_SIZE 64  // Descriptors in the ring (power of 2)
+#define SEQ_AP_IDLE 0x4   // ap_idle bit of the control register
+
+// Structure that mimics the layout of the peripheral registers.
+// Vitis HLS skips some addresses in the register file. We introduce
+// padding fields to create the right mapping to registers with our structure,
+struct TRegs {
+  uint32_t control; // 0x00
+  uint32_t gier, ier, isr; // 0x04, 0x08, 0x0C
+  uint32_t bit_set_ref_1, bit_set_ref_2; // 0x10, 0x14
+  uint32_t padding1; // 0x18
+  uint32_t nseqt; // 0x1C
+  uint32_t padding2; // 0x20
+  uint32_t length_ref_1, length_ref_2; //0x24, 0x28
+  uint32_t padding3; // 0x2C
+  uint32_t bit_set_pat_1, bit_set_pat_2; // 0x30, 0x34
+  uint32_t padding4; // 0x38
+  uint32_t nseqp; // 0x3C
+  uint32_t padding5; // 0x40
+  uint32_t length_pat_1, length_pat_2; // 0x44, 0x48
+  uint32_t padding6; // 0x4C
+  uint32_t output_1, output_2; // 0x50, 0x54
+};
+
+// Type of waiting to the accelerator
+typedef enum {
+  INTERRUPT = 0x0,  // Wait for the interrupt
+  POLLING   = 0x1,  // Polling on the status register
+  CONTINUE  = 0x2,  // Do not wait and return to the user
+  CHAIN     = 0x3,  // Queue in the command ring (started by write(), collected by read())
+  RESET     = 0x4,  // Abandon the jobs of the file (written alone, when the owner's watchdog expires)
+} read_type_t;
+
+// Structure used to pass commands between user-space and kernel-space.
+struct write_message {
+  uint64_t seq_t;         // Pointer to the target sequences
+  uint64_t seq_q;         // Pointer to the query sequences
+  uint32_t n_seq_t;       // Number of targets
+  uint32_t n_seq_q;       // Number of queries
+  uint64_t length_seq_t;  // Pointer to the target sequence lengths
+  uint64_t length_seq_q;  // Pointer to the target sequence lengths
+  uint64_t min_pos;       // Pointer to the min pos array
+  read_type_t wait_type;  // Type of waiting to the accelerator
+  uint32_t notify;        // CHAIN: notify the user when this descriptor finishes
+  uint32_t timeout_ms;    // INTERRUPT and POLLING: abandon the job after this time (0: no limit)
+  uint32_t reserved;
+};
+
+// FIFO of the jobs of one context, not started yet.
+struct seq_ring {
+  struct write_message desc[SEQ_RING_SIZE];
+  uint32_t head;          // Next free descriptor (free-running counter)
+  uint32_t tail;          // Next descriptor to start
+};
+
+// Context of an open file.
+struct seq_ctx {
+  struct seq_ring ring;   // Jobs queued by this file
+  uint32_t done;          // Jobs finished since the last collection
+  int flag;               // Set when the owner must be notified (cleared by the owner)
+  int ready;              // In the ready list of the scheduler
+  struct seq_ctx * next;  // Next context in the ready list
+};
+
+// Scheduler of one accelerator instance.
+struct seq_sched {
+  struct seq_ctx * ready_head, * ready_tail;  // Contexts with queued jobs, in round-robin order
+  struct seq_ctx * running;                   // Owner of the job in the accelerator
+  int notify;                                 // The running job is flagged with 'notify'
+  int faulted;                                // An abandoned job may still be in the kernel
+};
+
+// Program the registers of a job (does not start it).
+static inline void seq_program(volatile struct TRegs * regs, const struct write_message * msg)
+{
+  // Reference / target
+  SEQ_REG_WRITE(regs, bit_set_ref_1, (uint32_t)(msg->seq_t & 0xFFFFFFFF));
+  SEQ_REG_WRITE(regs, bit_set_ref_2, (uint32_t)(msg->seq_t >> 32));
+  SEQ_REG_WRITE(regs, nseqt, msg->n_seq_t);
+  SEQ_REG_WRITE(regs, length_ref_1, (uint32_t)(msg->length_seq_t & 0xFFFFFFFF));
+  SEQ_REG_WRITE(regs, length_ref_2, (uint32_t)(msg->length_seq_t >> 32));
+  // Query / pattern
+  SEQ_REG_WRITE(regs, bit_set_pat_1, (uint32_t)(msg->seq_q & 0xFFFFFFFF));
+  SEQ_REG_WRITE(regs, bit_set_pat_2, (uint32_t)(msg->seq_q >> 32));
+  SEQ_REG_WRITE(regs, nseqp, msg->n_seq_q);
+  SEQ_REG_WRITE(regs, length_pat_1, (uint32_t)(msg->length_seq_q & 0xFFFFFFFF));
+  SEQ_REG_WRITE(regs, length_pat_2, (uint32_t)(msg->length_seq_q >> 32));
+  // Output
+  SEQ_REG_WRITE(regs, output_1, (uint32_t)(msg->min_pos & 0xFFFFFFFF));
+  SEQ_REG_WRITE(regs, output_2, (uint32_t)(msg->min_pos >> 32));
+}
+
+// Enable (or disable) the interrupts (global and specific to done).
+static inline void seq_enable_irq(volatile struct TRegs * regs, uint32_t enable)
+{
+  SEQ_REG_WRITE(regs, gier, enable);
+  SEQ_REG_WRITE(regs, ier, enable);
+  SEQ_REG_BARRIER();
+}
+
+// Start the peripheral (start bit = 1).
+static inline void seq_start(volatile struct TRegs * regs)
+{
+  uint32_t status = SEQ_REG_READ(regs, control);
+  SEQ_REG_WRITE(regs, control, status | 1);
+  SEQ_REG_BARRIER();
+}
+
+static inline uint32_t seq_ring_pending(const struct seq_ring * ring)
+{
+  return ring->head - ring->tail;
+}
+
+static inline void seq_ctx_init(struct seq_ctx * ctx)
+{
+  ctx->ring.head = ctx->ring.tail = 0;
+  ctx->done = 0;
+  ctx->flag = 1;  // Idle
+  ctx->ready = 0;
+  ctx->next = 0;
+}
+
+static inline void seq_sched_init(struct seq_sched * sched)
+{
+  sched->ready_head = sched->ready_tail = 0;
+  sched->running = 0;
+  sched->notify = 0;
+  sched->faulted = 0;
+}
+
+// The context has no jobs queued or running.
+static inline int seq_ctx_idle(const struct seq_sched * sched, const struct seq_ctx * ctx)
+{
+  return seq_ring_pending(&ctx->ring) == 0 && sched->running != ctx;
+}
+
+static inline void seq_sched_append(struct seq_sched * sched, struct seq_ctx * ctx)
+{
+  ctx->next = 0;
+  ctx->ready = 1;
+  if (sched->ready_tail)
+    sched->ready_tail->next = ctx;
+  else
+    sched->ready_head = ctx;
+  sched->ready_tail = ctx;
+}
+
+// Starts the next job if the accelerator is idle: the first job of the context at the
+// head of the ready list, which goes to the back if it has more jobs. Returns 1 if started.
+static inline int seq_sched_kick(struct seq_sched * sched, volatile struct TRegs * regs)
+{
+  struct seq_ctx * ctx = sched->ready_head;
+  const struct write_message * msg;
+
+  if (sched->running || !ctx)
+    return 0;
+  // After an abandoned job, wait until the kernel is idle (or its late completion arrives).
+  if (sched->faulted) {
+    if (!(SEQ_REG_READ(regs, control) & SEQ_AP_IDLE))
+      return 0;
+    sched->faulted = 0;
+  }
+  sched->ready_head = ctx->next;
+  if (!sched->ready_head)
+    sched->ready_tail = 0;
+  ctx->ready = 0;
+
+  msg = &ctx->ring.desc[ctx->ring.tail & (SEQ_RING_SIZE - 1)];
+  ctx->ring.tail++;
+  if (seq_ring_pending(&ctx->ring) > 0)
+    seq_sched_append(sched, ctx);
+
+  seq_program(regs, msg);
+  sched->notify = msg->notify != 0;
+  sched->running = ctx;
+  seq_enable_irq(regs, 1);
+  seq_start(regs);
+  return 1;
+}
+
+// Queues n jobs of a context, all or none, and starts one if the accelerator is idle.
+// Returns -1 if they do not fit in the ring of the context.
+static inline int seq_sched_submit(struct seq_sched * sched, struct seq_ctx * ctx,
+  const struct write_message * msgs, uint32_t n, volatile struct TRegs * regs)
+{
+  struct seq_ring * ring = &ctx->ring;
+  uint32_t i;
+
+  if (n > SEQ_RING_SIZE - seq_ring_pending(ring))
+    return -1;
+  if (seq_ctx_idle(sched, ctx))
+    ctx->flag = 0;  // Nothing to report until the next notification
+  for (i = 0; i < n; i++)
+    ring->desc[(ring->head + i) & (SEQ_RING_SIZE - 1)] = msgs[i];
+  ring->head += n;
+  if (!ctx->ready && n > 0)
+    seq_sched_append(sched, ctx);
+  seq_sched_kick(sched, regs);
+  return 0;
+}
+
+// Called when the running job finishes (from the IRQ handler): retires it and starts
+// the next one. Returns the owner if it must be notified (its flag is set), i.e., the
+// job was flagged or the owner has no more jobs; NULL otherwise.
+static inline struct seq_ctx * seq_sched_complete(struct seq_sched * sched, volatile struct TRegs * regs)
+{
+  struct seq_ctx * ctx = sched->running;
+  int notify = sched->notify;
+
+  if (!ctx) {
+    // Late completion of an abandoned job: the kernel is free again.
+    sched->faulted = 0;
+    if (!seq_sched_kick(sched, regs))
+      seq_enable_irq(regs, 0);
+    return 0;
+  }
+  sched->running = 0;
+  ctx->done++;
+  if (!seq_sched_kick(sched, regs))
+    seq_enable_irq(regs, 0);
+  if (notify || seq_ctx_idle(sched, ctx)) {
+    ctx->flag = 1;
+    return ctx;
+  }
+  return 0;
+}
+
+// Returns the jobs of the context finished since the previous call, and rearms its
+// notification unless it is idle.
+static inline uint32_t seq_ctx_collect(const struct seq_sched * sched, struct seq_ctx * ctx)
+{
+  uint32_t done = ctx->done;
+  ctx->done = 0;
+  ctx->flag = seq_ctx_idle(sched, ctx);
+  return done;
+}
+
+// Drops the queued jobs of a context (e.g., its file is closed). A running job cannot
+// be aborted: returns 1 if the context still owns the accelerator.
+static inline int seq_sched_drop(struct seq_sched * sched, struct seq_ctx * ctx)
+{
+  struct seq_ctx ** link = &sched->ready_head;
+
+  while (*link && *link != ctx)
+    link = &(*link)->next;
+  if (*link) {
+    *link = ctx->next;
+    if (sched->ready_tail == ctx) {
+      struct seq_ctx * prev = sched->ready_head;
+      while (prev && prev->next)
+        prev = prev->next;
+      sched->ready_tail = prev;
+    }
+  }
+  ctx->ready = 0;
+  ctx->next = 0;
+  ctx->ring.tail = ctx->ring.head;
+  return sched->running == ctx;
+}
+
+// Abandons the jobs of a context: the queued ones are dropped and the running one is
+// forgotten (its completion, if it ever arrives, is ignored). If the kernel is still
+// busy the instance is faulted (see seq_sched_kick); a faulted instance that is idle
+// again is released, so the owner can also use it to probe the instance.
+// Returns 1 if a job was running.
+static inline int seq_sched_abort(struct seq_sched * sched, struct seq_ctx * ctx, volatile struct TRegs * regs)
+{
+  int running = seq_sched_drop(sched, ctx);
+
+  if (running)
+    sched->running = 0;
+  if (running || sched->faulted) {
+    sched->faulted = !(SEQ_REG_READ(regs, control) & SEQ_AP_IDLE);
+    // The interrupts stay enabled while faulted, to catch the late completion.
+    if (!seq_sched_kick(sched, regs) && !sched->faulted)
+      seq_enable_irq(regs, 0);
+  }
+  ctx->done = 0;
+  ctx->flag = 1;  // Idle
+  return running;
+}
+
+#endif // SEQRING_H
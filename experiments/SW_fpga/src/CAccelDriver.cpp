@@ -1,20 +1,56 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <map>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
 #include "CAccelDriver.hpp"
+#ifndef NO_LIBXLNK
 extern "C" {
 #include <libxlnk_cma.h>  // Required for memory-mapping functions from Xilinx
 }
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+// Mapping of the registers of a peripheral. Without libxlnk_cma, the same mapping through /dev/mem.
+static void * MapRegisters(uint64_t PhysAddr, uint32_t Size)
+{
+#ifndef NO_LIBXLNK
+  return cma_mmap(PhysAddr, Size);
+#else
+  int fd = open("/dev/mem", O_RDWR | O_SYNC);
+  void * virtAddr;
+
+  if (fd < 0)
+    return (void *)-1;
+  virtAddr = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, PhysAddr);
+  close(fd);
+  return (virtAddr == MAP_FAILED) ? (void *)-1 : virtAddr;
+#endif
+}
+
+static void UnmapRegisters(void * VirtAddr, uint32_t Size)
+{
+#ifndef NO_LIBXLNK
+  cma_munmap(VirtAddr, Size);
+#else
+  munmap(VirtAddr, Size);
+#endif
+}
 
 uint32_t CAccelDriver::numModules = 0;
-std::map<uint64_t, uint64_t> CAccelDriver::dmaMappings;
 bool CAccelDriver::logging = false;
-int CAccelDriver::driver = 0;
 
 //////////////////////////// CAccelDriver() ///////////////////////////////////
 CAccelDriver::CAccelDriver(bool Logging)
-  : accelRegs(NULL), baseAddr(0), mappingSize(0)
+  : accelRegs(NULL), baseAddr(0), mappingSize(0), driver(0)
 {
   logging = Logging;
   if (logging)
@@ -32,7 +68,7 @@ CAccelDriver::~CAccelDriver()
 
   if (accelRegs != NULL) {
     // Unmap the physical address of the peripheral registers
-    cma_munmap((void*)accelRegs, mappingSize);
+    UnmapRegisters((void*)accelRegs, mappingSize);
     if (logging)
       printf("Mapping undone for peripheral physical address 0x%016lX mapped at 0x%016lX\n",
           baseAddr, (uint64_t)accelRegs);
@@ -60,7 +96,7 @@ uint32_t CAccelDriver::Open(uint64_t BaseAddr, uint32_t MappingSize, volatile vo
   baseAddr = BaseAddr;
   
   // Map the physical address of the accelerator into this app virtual address space
-  accelRegs = (void *)cma_mmap(baseAddr, mappingSize);
+  accelRegs = MapRegisters(baseAddr, mappingSize);
   if ((int64_t)accelRegs == -1) {
     if (logging)
       printf("Error mapping the peripheral address (0x%016lX)!\n", baseAddr);
@@ -89,6 +125,7 @@ uint32_t CAccelDriver::OpenDriver(const char * driver_name)
   driver = open(driver_name, O_RDWR);
   if (driver == -1) {
     printf("ERR: cannot open driver %s\n", driver_name);
+    driver = 0;
     return ERROR_OPENING_DRIVER;
   }
 
@@ -102,41 +139,72 @@ void CAccelDriver::CloseDriver()
 
   if (driver != 0)
     close(driver);
+  driver = 0;
 
   return;
 }
 
+/////////////////////////////// DMAArena() /////////////////////////////////////
+CDmaArena & CAccelDriver::DMAArena()
+{
+  // Never destroyed: the instances may be static objects, destroyed after any other static
+  // object. The regions are returned to the pool when the last instance is destroyed.
+  static CDmaArena * arena = new CDmaArena(CDmaBackend::Create(DEFAULT_DMA_BACKEND));
+  return *arena;
+}
+
+////////////////////////////// SetDMABackend() ////////////////////////////////
+bool CAccelDriver::SetDMABackend(CDmaBackend * Backend)
+{
+  return DMAArena().SetBackend(Backend);
+}
+
+bool CAccelDriver::SetDMABackend(const char * Spec)
+{
+  CDmaBackend * backend = CDmaBackend::Create(Spec);
+
+  if (backend == NULL)
+    return false;
+  if (!SetDMABackend(backend)) {
+    printf("Error: The DMA backend cannot be changed after the first allocation.\n");
+    delete backend;
+    return false;
+  }
+  if (logging)
+    printf("CAccelDriver::SetDMABackend(%s)\n", backend->Name());
+  return true;
+}
+
 //////////////////////// AllocDMACompatible() /////////////////////////////////
-void * CAccelDriver::AllocDMACompatible(uint32_t Size, uint32_t Cacheable)
+void * CAccelDriver::AllocDMACompatible(uint64_t Size, uint32_t Cacheable)
 {
   void * virtualAddr = NULL;
-  uint64_t physicalAddr = 0;
 
   if (logging)
-    printf("CAccelDriver::AllocDMACompatible(Size = %u, Cacheable = %u)\n", Size, Cacheable);
+    printf("CAccelDriver::AllocDMACompatible(Size = %lu, Cacheable = %u)\n", Size, Cacheable);
 
-  virtualAddr = cma_alloc(Size, Cacheable);
-  if ( (int64_t)virtualAddr == -1) {
+  virtualAddr = DMAArena().Alloc(Size, Cacheable != 0);
+  if (virtualAddr == NULL) {
     if (logging)
-      printf("Error allocating DMA memory for %u bytes.\n", Size);
+      printf("Error allocating DMA memory for %lu bytes.\n", Size);
     return NULL;
   }
 
-  physicalAddr = cma_get_phy_addr(virtualAddr);
-  if (physicalAddr == 0) {
-    if (logging)
-      printf("Error obtaining physical addr for virtual address 0x%016lX (%lu).\n", (uint64_t)virtualAddr, (uint64_t)virtualAddr);
-    cma_free(virtualAddr);
-    return NULL;
-  }
+  if (logging)
+    printf("DMA memory allocated - Virtual addr: 0x%016lX (%lu) // Physical addr: 0x%016lX\n",
+            (uint64_t)virtualAddr, (uint64_t)virtualAddr, GetDMAPhysicalAddr(virtualAddr));
 
-  dmaMappings[(uint64_t)virtualAddr] = physicalAddr;
+  return virtualAddr;
+}
 
+
+////////////////////////// AllocDMABuffer() ///////////////////////////////////
+CDmaBuffer CAccelDriver::AllocDMABuffer(uint64_t Size, uint32_t Cacheable)
+{
   if (logging)
-    printf("DMA memory allocated - Virtual addr: 0x%016lX (%lu) // Physical addr: 0x%016lX (%lu)\n",
-            (uint64_t)virtualAddr, (uint64_t)virtualAddr, physicalAddr, physicalAddr);
+    printf("CAccelDriver::AllocDMABuffer(Size = %lu, Cacheable = %u)\n", Size, Cacheable);
 
-  return virtualAddr;
+  return DMAArena().Allocate(Size, Cacheable != 0);
 }
 
 
@@ -146,31 +214,41 @@ bool CAccelDriver::FreeDMACompatible(void * VirtAddr)
   if (logging)
     printf("CAccelDriver::FreeDMACompatible(Addr = 0x%016lX)\n", (uint64_t)VirtAddr);
 
-  if (logging) {
-    if (dmaMappings.count((uint64_t)VirtAddr) == 0)
-      printf("No virtual address 0x%016lX present in the dictionary of mappings.\n", (uint64_t)VirtAddr);
+  if (!DMAArena().Free(VirtAddr)) {
+    if (logging)
+      printf("No DMA block allocated at virtual address 0x%016lX.\n", (uint64_t)VirtAddr);
+    return false;
   }
+  return true;
+}
 
-  dmaMappings.erase((uint64_t)VirtAddr);
-  cma_free(VirtAddr);
 
-  return true;
+/////////////////////////////// FlushDMA() /////////////////////////////////////
+void CAccelDriver::FlushDMA(const void * VirtAddr, uint64_t Size)
+{
+  DMAArena().Flush(VirtAddr, Size);
+}
+
+
+///////////////////////////// InvalidateDMA() ///////////////////////////////////
+void CAccelDriver::InvalidateDMA(const void * VirtAddr, uint64_t Size)
+{
+  DMAArena().Invalidate(VirtAddr, Size);
 }
 
 
 ////////////////////////// GetDMAPhysicalAddr() ///////////////////////////////
 uint64_t CAccelDriver::GetDMAPhysicalAddr(void * VirtAddr)
 {
-  if (logging)
-    printf("CAccelDriver::GetDMAPhysicalAddr(Addr = 0x%016lX)\n", (uint64_t)VirtAddr);
+  uint64_t physicalAddr = DMAArena().PhysAddr(VirtAddr);
 
-  if (dmaMappings.count((uint64_t)VirtAddr) == 0) {
-    if (logging)
-      printf("No virtual address 0x%016lX present in the dictionary of mappings.\n", (uint64_t)VirtAddr);
-    return 0;
+  if (logging) {
+    printf("CAccelDriver::GetDMAPhysicalAddr(Addr = 0x%016lX)\n", (uint64_t)VirtAddr);
+    if (physicalAddr == 0)
+      printf("No DMA block contains the virtual address 0x%016lX.\n", (uint64_t)VirtAddr);
   }
-  
-  return dmaMappings[(uint64_t)VirtAddr];
+
+  return physicalAddr;
 }
 
 
@@ -178,25 +256,14 @@ uint64_t CAccelDriver::GetDMAPhysicalAddr(void * VirtAddr)
 // Called by the destructor to free any dangling DMA allocations.
 void CAccelDriver::InternalEmptyDMAAllocs()
 {
-  uint32_t numMappings = dmaMappings.size();
-
   if (logging)
-    printf("CAccelDriver::InternalEmptyDMAAllocs(DMA dict size = %u, numModules = %u)\n",
-      numMappings, numModules);
+    printf("CAccelDriver::InternalEmptyDMAAllocs(DMA buffers = %u, numModules = %u)\n",
+      DMAArena().GetStats().buffers, numModules);
 
   if (numModules == 0) {
-    if (numMappings > 0)
+    if (DMAArena().Release() > 0)
       printf("DMA MEMORY WAS NOT CORRECTLY FREED. PERFORMING EMERGENCY RELEASE OF KERNEL DMA MEMORY IN DESTRUCTOR. PLEASE, FIX THIS ISSUE.\n");
-
-    for (auto it = dmaMappings.begin(); it != dmaMappings.end(); ++ it) {
-      uint64_t virtAddr = it->first;
-      if (logging)
-        printf("Releasing DMA (virtual) pointer 0x%016lX\n", virtAddr);
-      cma_free((void*)virtAddr);
-    }
   }
-
-  dmaMappings.clear();
 }
 
 
@@ -4,26 +4,30 @@
 // Requires <map>, <stdint.h>
 
 //  This class takes care of the low-level configuration of addresses.
-// The class stores internally the address of the device registers in the application virtual space,
-// and a map of DMA-compatible memory allocations that relates virtual with physical addresses.
+// The class stores internally the address of the device registers in the application virtual space.
+// DMA-compatible memory comes from an arena shared by all the instances (CDmaArena.hpp), which
+// relates virtual with physical addresses.
+
+class CDmaBackend;
+class CDmaArena;
+class CDmaBuffer;
 
 class CAccelDriver {
   protected:
     volatile void * accelRegs;
     uint64_t baseAddr, mappingSize;
+    int driver;  // File descriptor of the device node of this instance (0: not opened)
 
   protected:  //Static 
-    // Map of virtual addresses to physical addresses
-    static std::map<uint64_t, uint64_t> dmaMappings;
     static uint32_t numModules; // Number of created modules.
     // Called by the destructor to free any dangling DMA allocations.
     static void InternalEmptyDMAAllocs();
     static bool logging;
-    static int driver;
 
   public:
     typedef enum {OK = 0, DEVICE_ALREADY_INITIALIZED = 1, DEVICE_NOT_INITIALIZED = 2, ERROR_MAPPING_BASE_ADDR = 3,
-                VIRT_ADDR_NOT_FOUND = 4, ERROR_OPENING_DRIVER = 5} TErrors;
+                VIRT_ADDR_NOT_FOUND = 4, ERROR_OPENING_DRIVER = 5, TIMEOUT = 6, ERROR_WAITING = 7, ERROR_SUBMITTING = 8,
+                DEVICE_BUSY = 9} TErrors;
 
   public:
     CAccelDriver(bool Logging = false);
@@ -37,12 +41,27 @@ class CAccelDriver {
     // Static methods
 
     // Allocates a block of DMA-compatible memory and returns the corresponding address in this application virtual address space.
-    // The class keeps an internal map of virtual to physical addresses, so that derived classes can translate the virtual 
-    // addresses supplied by the applications.
-    static void * AllocDMACompatible(uint32_t Size, uint32_t Cacheable = 0);
+    // The block is taken from the arena, which translates the virtual addresses supplied by the applications for the
+    // derived classes.
+    static void * AllocDMACompatible(uint64_t Size, uint32_t Cacheable = 0);
     static bool FreeDMACompatible(void * VirtAddr);
+    // Same, with a handle that frees the block when it is destroyed (requires "CDmaArena.hpp").
+    static CDmaBuffer AllocDMABuffer(uint64_t Size, uint32_t Cacheable = 0);
+    // Cache maintenance of a range of a cacheable block: Flush() after the CPU writes data for the
+    // accelerator, Invalidate() before the CPU reads data written by the accelerator. Nothing is
+    // done on non-cacheable blocks.
+    static void FlushDMA(const void * VirtAddr, uint64_t Size);
+    static void InvalidateDMA(const void * VirtAddr, uint64_t Size);
+    // Physical address of any address inside a DMA-compatible block (0 if it is not in one).
     // The application should never use the physical address. This is just for debugging purposes.
     static uint64_t GetDMAPhysicalAddr(void * VirtAddr);
+    // Arena of the DMA-compatible memory of all the instances.
+    static CDmaArena & DMAArena();
+    // Source of the DMA-compatible memory (DEFAULT_DMA_BACKEND by default, CDmaBackend.hpp). Only before
+    // the first allocation: returns false otherwise. The backend can be given by its specification
+    // (CDmaBackend::Create(), e.g., "dma-heap:linux,cma").
+    static bool SetDMABackend(CDmaBackend * Backend);
+    static bool SetDMABackend(const char * Spec);
     static void SetLogging(bool Logging = false) { logging = Logging; }
 };
 
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sequences.h"
+#include "daemon_protocol.h"
+#include "CAlignClient.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads or writes the whole buffer, retrying on signals and short transfers.
+static bool Transfer(int fd, void * buf, size_t size, bool send)
+{
+  char * p = (char*)buf;
+
+  while (size > 0) {
+    ssize_t n = send ? write(fd, p, size) : read(fd, p, size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CAlignClient::CAlignClient()
+  : sock(-1), region(-1), base(NULL), regionSize(0), nt(0), blockQueries(0), nq(0),
+    scores(NULL), computeTime(0), latency(0)
+{
+  queries.sequences = queries.descriptions = NULL;
+  queries.length = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CAlignClient::Connect(const char * path)
+{
+  struct sockaddr_un addr;
+  struct TDaemonHello hello;
+
+  Close();
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return ERROR_CONNECTING;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    printf("Error: Cannot connect to the daemon at %s (errno %d).\n", path, errno);
+    Close();
+    return ERROR_CONNECTING;
+  }
+
+  if (!Transfer(sock, &hello, sizeof(hello), false) || hello.magic != DAEMON_MAGIC || hello.version != DAEMON_VERSION) {
+    printf("Error: Unexpected answer from the daemon at %s.\n", path);
+    Close();
+    return ERROR_PROTOCOL;
+  }
+  nt = hello.nt;
+  blockQueries = hello.blockQueries;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CAlignClient::FreeRegion()
+{
+  if (base != NULL)
+    munmap(base, regionSize);
+  if (region >= 0)
+    close(region);
+  base = NULL;
+  region = -1;
+  regionSize = 0;
+  nq = 0;
+  queries.sequences = NULL;
+  queries.length = NULL;
+  scores = NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CAlignClient::Close()
+{
+  FreeRegion();
+  if (sock >= 0)
+    close(sock);
+  sock = -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CAlignClient::Reserve(int32_t Nq)
+{
+  uint64_t size = RegionSize(nt, Nq);
+
+  if (sock < 0)
+    return ERROR_CONNECTING;
+  if (Nq <= 0)
+    return ERROR_ALLOCATING;
+
+  // The region is only replaced when it is too small.
+  if (size > regionSize) {
+    FreeRegion();
+    // The daemon maps the region: it only accepts it sealed against shrinking.
+    region = memfd_create("seqmatcher-queries", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (region < 0 || ftruncate(region, size) != 0 || fcntl(region, F_ADD_SEALS, F_SEAL_SHRINK) != 0) {
+      FreeRegion();
+      return ERROR_ALLOCATING;
+    }
+    base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, region, 0);
+    if (base == MAP_FAILED) {
+      base = NULL;
+      FreeRegion();
+      return ERROR_ALLOCATING;
+    }
+    regionSize = size;
+  }
+
+  nq = Nq;
+  queries.length = (int32_t*)base;
+  queries.sequences = base + RegionSequences(nq);
+  scores = (uint32_t*)(base + RegionScores(nq));
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CAlignClient::Align(uint32_t Priority)
+{
+  struct TDaemonRequest request = {DAEMON_MAGIC, nq, regionSize, Priority, 0};
+  struct TDaemonReply reply;
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr * cmsg;
+
+  if (sock < 0)
+    return ERROR_CONNECTING;
+  if (base == NULL)
+    return ERROR_ALLOCATING;
+
+  // The request carries the descriptor of the region.
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &request;
+  iov.iov_len = sizeof(request);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &region, sizeof(int));
+
+  if (sendmsg(sock, &msg, 0) != sizeof(request) || !Transfer(sock, &reply, sizeof(reply), false))
+    return ERROR_PROTOCOL;
+
+  computeTime = reply.computeTime;
+  latency = reply.latency;
+  return (reply.status == DAEMON_OK) ? OK : DAEMON_ERROR;
+}
@@ -0,0 +1,57 @@
+#ifndef CALIGNCLIENT_HPP
+#define CALIGNCLIENT_HPP
+
+// Requires <stdint.h>, "sequences.h", "daemon_protocol.h"
+
+//  Client of the alignment daemon (seqmatcherd), which keeps a target set resident
+// in the DMA memory. The queries are written directly in a shared-memory region
+// (Queries()) and the daemon writes the results in the same region (Scores()), so
+// nothing is copied through the socket. The region is reused between requests
+// and grows when more queries are reserved.
+//
+//   CAlignClient client;
+//   client.Connect("/tmp/seqmatcherd.sock");
+//   client.Reserve(nq);                  // fill client.Queries() (sequences + lengths)
+//   client.Align();                      // client.Scores()[t * nq + q]
+
+class CAlignClient {
+  public:
+    typedef enum {OK = 0, ERROR_CONNECTING = 1, ERROR_PROTOCOL = 2, ERROR_ALLOCATING = 3,
+                  DAEMON_ERROR = 4} TErrors;
+
+  protected:
+    int sock;                 // Connection to the daemon (-1: not connected)
+    int region;               // Shared-memory region (memfd)
+    char * base;
+    uint64_t regionSize;
+    int32_t nt, blockQueries; // Resident targets and queries per chunk in the daemon
+    int32_t nq;               // Queries reserved
+    SetSequences queries;     // Queries in the region
+    uint32_t * scores;        // Results in the region
+    uint64_t computeTime;     // Time computing the last request in the daemon (ns)
+    uint64_t latency;         // Time of the last request in the daemon, including the waiting (ns)
+
+    void FreeRegion();
+
+  public:
+    CAlignClient();
+    ~CAlignClient() { Close(); }
+
+    uint32_t Connect(const char * path);
+    void Close();
+
+    // Prepares the region for Nq queries. The previous contents are not preserved.
+    uint32_t Reserve(int32_t Nq);
+    // Aligns the reserved queries against the resident targets. The daemon interleaves
+    // the requests of all its clients by priority (DAEMON_INTERACTIVE, _NORMAL or _BULK).
+    uint32_t Align(uint32_t Priority = DAEMON_NORMAL);
+
+    SetSequences & Queries() { return queries; }
+    const uint32_t * Scores() const { return scores; }
+    int32_t Targets() const { return nt; }
+    int32_t BlockQueries() const { return blockQueries; }
+    uint64_t GetComputeTime() const { return computeTime; }
+    uint64_t GetLatency() const { return latency; }
+};
+
+#endif  // CALIGNCLIENT_HPP
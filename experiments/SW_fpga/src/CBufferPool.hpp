@@ -0,0 +1,32 @@
+#ifndef CBUFFERPOOL_HPP
+#define CBUFFERPOOL_HPP
+
+// Requires <stdint.h>, <atomic>, <vector>, <thread>, <chrono>, "util.h", "CRingQueue.hpp"
+
+//  Pool of preallocated buffers passed between the stages of a pipeline, so that
+// no buffer is allocated while the pipeline runs. The free buffers are kept in a
+// CMpmcRing: Acquire() blocks while all of them are in use, which bounds the
+// items in flight, and the time it waits is the backpressure of the pipeline on
+// its first stage. Buffers are given back in any order and from any thread.
+// The pool does not own the buffers (e.g., DMA memory allocated by the caller).
+
+template <class T> class CBufferPool {
+  protected:
+    CMpmcRing<T *> free;
+
+  public:
+    CBufferPool(uint32_t Capacity) : free(Capacity) {}
+
+    // Adds a buffer to the pool (at most Capacity).
+    bool Add(T * buffer) { return free.TryPush(buffer); }
+
+    // Takes a free buffer, waiting for one. Returns false if the pool was closed.
+    bool Acquire(T * & buffer) { return free.Pop(buffer); }
+    bool TryAcquire(T * & buffer) { return free.TryPop(buffer); }
+    void Release(T * buffer) { free.TryPush(buffer); }
+
+    // The ring of free buffers, to register the pool as an input of a stage.
+    CRing * Ring() { return &free; }
+};
+
+#endif  // CBUFFERPOOL_HPP
@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include "sequences.h"
+#include "CTilePlanner.hpp"
+#include "CChunkTuner.hpp"
+
+#define TUNE_MAX_CHUNKS 64      // Most chunks a query tile is split in
+#define TUNE_MIN_QUERIES 64     // Fewest queries per tile (unless the plan has fewer)
+#define TUNE_MIN_GAIN 0.01      // Smaller tiles are used only if they are predicted this much faster
+#define TUNE_MIN_CLASS 16       // Shortest length class
+#define TUNE_LINE 512
+
+///////////////////////////////////////////////////////////////////////////////
+CChunkTuner::CChunkTuner(const char * Path, const char * Bitstream, uint32_t LengthClass)
+  : path(Path), cachedNt(0), cachedNq(0), cached(false)
+{
+  key = std::string(Bitstream) + "/" + std::to_string(LengthClass);
+  for (size_t i = 0; i < key.size(); ++i)
+    if (key[i] == ' ' || key[i] == '\t')
+      key[i] = '_';
+  model.overhead = model.cellsPerSec = 0;
+  model.uploadBytesPerSec = model.writeBytesPerSec = 0;
+  choice.tileQueries = 0;
+  choice.chunks = 1;
+  choice.predicted = choice.largest = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CChunkTuner::LengthClass(const SetSequences * set, int32_t n)
+{
+  uint64_t total = 0;
+  uint32_t lengthClass = TUNE_MIN_CLASS;
+
+  for (int32_t i = 0; i < n; ++i)
+    total += set->length[i];
+  while (n > 0 && lengthClass < total / n && lengthClass < MAX_SEQ_LENGTH)
+    lengthClass <<= 1;
+  return lengthClass;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CChunkTuner::Load()
+{
+  FILE * fp = fopen(path.c_str(), "r");
+  char line[TUNE_LINE], name[TUNE_LINE];
+  int32_t nt, nq;
+  TModel entry;
+  TChoice last;
+
+  cached = false;
+  if (fp == NULL)
+    return NOT_CACHED;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (sscanf(line, "%511s %d %d %d %u %lf %lf %lf %lf", name, &nt, &nq, &last.tileQueries, &last.chunks,
+          &entry.overhead, &entry.cellsPerSec, &entry.uploadBytesPerSec, &entry.writeBytesPerSec) != 9 || key != name)
+      continue;
+    model = entry;
+    cachedNt = nt;
+    cachedNq = nq;
+    choice.tileQueries = last.tileQueries;
+    choice.chunks = last.chunks;
+    cached = true;
+  }
+  fclose(fp);
+  return cached ? OK : NOT_CACHED;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CChunkTuner::Save() const
+{
+  std::string tmp = path + ".tmp";
+  std::vector<std::string> others;
+  char line[TUNE_LINE], name[TUNE_LINE];
+  FILE * fp = fopen(path.c_str(), "r");
+
+  // The entries of other bitstreams and length classes are kept.
+  if (fp != NULL) {
+    while (fgets(line, sizeof(line), fp) != NULL)
+      if (sscanf(line, "%511s", name) == 1 && key != name)
+        others.push_back(line);
+    fclose(fp);
+  }
+
+  fp = fopen(tmp.c_str(), "w");
+  if (fp == NULL) {
+    printf("Warning: The chunk tuning cache %s could not be written.\n", path.c_str());
+    return ERROR_WRITING;
+  }
+  for (size_t i = 0; i < others.size(); ++i)
+    fputs(others[i].c_str(), fp);
+  fprintf(fp, "%s %d %d %d %u %.9e %.9e %.9e %.9e\n", key.c_str(), cachedNt, cachedNq, choice.tileQueries, choice.chunks,
+    model.overhead, model.cellsPerSec, model.uploadBytesPerSec, model.writeBytesPerSec);
+  if (fclose(fp) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+    printf("Warning: The chunk tuning cache %s could not be written.\n", path.c_str());
+    return ERROR_WRITING;
+  }
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CChunkTuner::SetEngines(double cellsSmall, uint64_t timeSmall, double cellsLarge, uint64_t timeLarge)
+{
+  if (cellsLarge > cellsSmall && timeLarge > timeSmall) {
+    double secPerCell = ((timeLarge - timeSmall) / 1e9) / (cellsLarge - cellsSmall);
+    model.cellsPerSec = 1.0 / secPerCell;
+    model.overhead = timeSmall / 1e9 - cellsSmall * secPerCell;
+    if (model.overhead < 0)
+      model.overhead = 0;
+  } else {
+    model.cellsPerSec = cellsLarge / (timeLarge / 1e9 + 1e-9);
+    model.overhead = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CChunkTuner::SetUpload(uint64_t bytes, uint64_t time)
+{
+  if (bytes > 0 && time > 0)
+    model.uploadBytesPerSec = bytes / (time / 1e9);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CChunkTuner::SetWrite(uint64_t bytes, uint64_t time)
+{
+  if (bytes > 0 && time > 0)
+    model.writeBytesPerSec = bytes / (time / 1e9);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Predicted time (s) of the plan with tq queries per tile. The upload and write times of a tile
+// are the averages over the plan (the outer set is uploaded less often than the inner one).
+double CChunkTuner::Predict(const CTilePlanner & planner, int32_t nt, int32_t nq, int32_t tq, uint32_t depth) const
+{
+  int32_t tt = planner.TileTargets();
+  uint64_t tiles = (uint64_t)((nt + tt - 1) / tt) * ((nq + tq - 1) / tq);
+  double cells = (double)nt * nq / tiles;
+  double writeRate = (model.writeBytesPerSec > 0) ? model.writeBytesPerSec : model.uploadBytesPerSec;
+  double upload = 0, write = 0, compute, total, period;
+
+  if (model.uploadBytesPerSec > 0)
+    upload = (double)planner.UploadBytes(nt, nq, tt, tq, planner.TargetsOuter()) / tiles / model.uploadBytesPerSec;
+  if (writeRate > 0)
+    write = cells * sizeof(uint32_t) / writeRate;
+  compute = model.overhead + cells / model.cellsPerSec;
+
+  total = upload + compute + write;
+  period = std::max(std::max(upload, compute), std::max(write, total / (depth > 0 ? depth : 1)));
+  return total + (tiles - 1) * period;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+const CChunkTuner::TChoice & CChunkTuner::Choose(const CTilePlanner & planner, int32_t nt, int32_t nq, uint32_t depth)
+{
+  int32_t largest = planner.TileQueries(), previous = 0;
+
+  // Same sizes as the cached choice: it is kept (e.g., the tiles of a resumed run).
+  if (Cached(nt, nq) && choice.tileQueries > 0 && choice.tileQueries <= largest) {
+    if (model.cellsPerSec > 0) {
+      choice.predicted = Predict(planner, nt, nq, choice.tileQueries, depth);
+      choice.largest = Predict(planner, nt, nq, largest, depth);
+    }
+    return choice;
+  }
+
+  choice.tileQueries = largest;
+  choice.chunks = 1;
+  choice.predicted = choice.largest = 0;
+  if (model.cellsPerSec <= 0 || largest <= 0)
+    return choice;
+
+  for (uint32_t k = 1; k <= TUNE_MAX_CHUNKS; ++k) {
+    int32_t tq = (largest + k - 1) / k;
+    if (k > 1 && tq < TUNE_MIN_QUERIES)
+      break;
+    tq = (nq + (nq + tq - 1) / tq - 1) / ((nq + tq - 1) / tq); // Balance the query tiles, as the planner
+    if (tq == previous)
+      continue;
+    previous = tq;
+    double time = Predict(planner, nt, nq, tq, depth);
+    if (k == 1) {
+      choice.largest = choice.predicted = time;
+    } else if (time < choice.predicted * (1 - TUNE_MIN_GAIN)) {
+      choice.predicted = time;
+      choice.tileQueries = tq;
+      choice.chunks = k;
+    }
+  }
+  cachedNt = nt;
+  cachedNq = nq;
+  cached = true;
+  return choice;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CChunkTuner::Print() const
+{
+  printf("Chunk tuner (%s): %.1f us + %.3e pairs/s per tile, upload %.0f MB/s, write %.0f MB/s -> %d queries per tile "
+    "(%u chunks of the largest), predicted %.3f s (%.3f s with the largest tiles)\n", key.c_str(), model.overhead * 1e6,
+    model.cellsPerSec, model.uploadBytesPerSec / 1e6, model.writeBytesPerSec / 1e6, choice.tileQueries, choice.chunks,
+    choice.predicted, choice.largest);
+}
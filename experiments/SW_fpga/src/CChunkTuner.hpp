@@ -0,0 +1,80 @@
+#ifndef CCHUNKTUNER_HPP
+#define CCHUNKTUNER_HPP
+
+// Requires <stdint.h>, <vector>, <string>, "sequences.h", "CTilePlanner.hpp"
+
+//  Autotuner of the tile (chunk) size of the pipeline.
+// The planner (CTilePlanner) uses the largest tiles that fit in the DMA memory: the
+// fewest launches, but the upload of the first tile and the writing of the last one
+// are not overlapped with any computation, and a tile is the unit of progress of the
+// journal. The tuner splits the query tiles of the plan in k chunks and predicts the
+// end-to-end time of each k for n tiles with upload, compute and write times u, c, w:
+//   T(k) = u + c + w + (n - 1) * max(u, c, w, (u + c + w) / depth)
+// where c = overhead + cells / rate, and depth is the number of tiles in flight (a
+// slot holds a tile from its upload to its write). The k with the smallest T is used.
+//
+// The overhead and rate are measured on the engines in use (accelerators and host
+// workers, through two probe tiles), and the upload rate on the probes. The write
+// rate is only known after a run, so it comes from the previous runs. The model and
+// the choice are cached in a text file per bitstream and length class (the mean
+// length of the sequences, rounded up to a power of 2): a run with the same sizes
+// reuses the choice without probing, so the tiles of an interrupted run are the same
+// when it is resumed.
+
+class CChunkTuner {
+  public:
+    typedef enum {OK = 0, NOT_CACHED = 1, ERROR_WRITING = 2} TErrors;
+
+    struct TModel {
+      double overhead;              // Fixed time of a tile in the engines (s)
+      double cellsPerSec;           // Pairs per second of all the engines together
+      double uploadBytesPerSec;     // 0: unknown
+      double writeBytesPerSec;      // 0: unknown (the upload rate is assumed)
+    };
+
+    struct TChoice {
+      int32_t tileQueries;          // Queries per tile
+      uint32_t chunks;              // Chunks of the largest query tile
+      double predicted;             // Predicted time (s)
+      double largest;               // Predicted time with the largest tiles (s)
+    };
+
+  protected:
+    std::string path;               // Cache file
+    std::string key;                // Bitstream and length class
+    TModel model;
+    int32_t cachedNt, cachedNq;     // Sizes of the cached choice
+    TChoice choice;
+    bool cached;
+
+    double Predict(const CTilePlanner & planner, int32_t nt, int32_t nq, int32_t tq, uint32_t depth) const;
+
+  public:
+    CChunkTuner(const char * Path, const char * Bitstream, uint32_t LengthClass);
+    ~CChunkTuner() {}
+
+    // Mean length of the sequences [0, n) of the set, rounded up to a power of 2.
+    static uint32_t LengthClass(const SetSequences * set, int32_t n);
+
+    // Reads the cache entry of the bitstream and length class. Returns NOT_CACHED if there is none.
+    uint32_t Load();
+    // Stores the model and the choice in the cache, replacing the entry of the bitstream and length class.
+    uint32_t Save() const;
+
+    // The cached choice, if it was made for the same sizes.
+    bool Cached(int32_t nt, int32_t nq) const { return cached && nt == cachedNt && nq == cachedNq; }
+
+    // Fits the overhead and the rate to the compute time (ns) of two probes of the given cells.
+    void SetEngines(double cellsSmall, uint64_t timeSmall, double cellsLarge, uint64_t timeLarge);
+    void SetUpload(uint64_t bytes, uint64_t time);
+    void SetWrite(uint64_t bytes, uint64_t time);
+
+    // Chooses the queries per tile for the plan of nt x nq with depth tiles in flight.
+    const TChoice & Choose(const CTilePlanner & planner, int32_t nt, int32_t nq, uint32_t depth);
+
+    const TModel & GetModel() const { return model; }
+    const TChoice & GetChoice() const { return choice; }
+    void Print() const;
+};
+
+#endif  // CCHUNKTUNER_HPP
@@ -0,0 +1,790 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/mman.h>
+#include <map>
+#include <algorithm>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include "util.h"
+#include "sequences.h"
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+
+#define HOST_BLOCK_ROWS 32      // Rows taken by a host worker from the remaining rows
+#define HOST_STEP_ROWS 4        // Rows computed between two visits to the scheduler
+#define MIN_ACCEL_TILE_TIME 20  // Minimum accelerator tile duration, in launch overheads
+#define PROBE_ROWS_SMALL 8
+#define PROBE_ROWS_LARGE 128
+#define PROBE_HOST_QUERIES 256
+#define WATCHDOG_FACTOR 10      // Deadline of an accelerator tile, in expected durations
+#define WATCHDOG_MIN_MS 1000    // Shortest deadline
+#define WATCHDOG_PROBE_MS 30000 // Deadline of the calibration probes (no cost model yet)
+#define WATCHDOG_MAX_MS 1000000000
+#define WAIT_GUARD_NS 60000     // Shortest guard before the predicted end (wake-up latency of a sleep)
+#define WAIT_DEVIATIONS 3       // Guard, in mean errors of the prediction
+#define WAIT_MIN_SPIN_NS 50000  // Shortest spin window
+#define WAIT_MAX_SPIN 0.05      // Longest guard and spin window, in predicted durations
+#define WAIT_WEIGHT 0.125       // Weight of a new duration in the averages of the prediction
+#define WAIT_TIMER_SLACK_NS 1000 // Timer slack of the threads that wait (default 50 us)
+
+///////////////////////////////////////////////////////////////////////////////
+CCoScheduler::CCoScheduler(const std::vector<CSeqMatcher *> & Accels, bool UseDriver, const CHostMatcher * Host, uint32_t NumWorkers)
+  : accels(Accels), useDriver(UseDriver), driverBatch(1), host(Host), numWorkers(NumWorkers),
+    accTotalCellsPerSec(0), hostCellsPerSec(1e6), calibrated(false),
+    watchdogFactor(WATCHDOG_FACTOR), hybridWait(true),
+    replicatedSequences(NULL), replicatedLength(NULL), replicatedRows(0),
+    nextRow(0), endRow(0), blockRows(0), q0(0), nq(0), output(NULL), accError(OK)
+{
+  accCellsPerSec.assign(accels.size(), 1e9);
+  accOverhead.assign(accels.size(), 0);
+  accTotalCellsPerSec = 1e9 * accels.size();
+  accFaulted.assign(accels.size(), false);
+  waitRatio.assign(accels.size(), 1);
+  waitDeviation.assign(accels.size(), 0);
+  slots.resize(numWorkers);
+  ResetStats();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CCoScheduler::~CCoScheduler()
+{
+  FreeReplicas();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::SetDriverBatch(uint32_t Batch)
+{
+  driverBatch = std::max(1u, std::min(Batch, (uint32_t)MAX_DRIVER_BATCH));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::ResetStats()
+{
+  stats.accRows = stats.hostRows = 0;
+  stats.accTiles = stats.hostTiles = stats.steals = 0;
+  stats.accTime = stats.totalTime = stats.hostTime = 0;
+  stats.hangs = 0;
+  stats.fallbackRows = 0;
+  stats.waits = stats.waitsEarly = stats.waitsLate = 0;
+  stats.spinTime = 0;
+  stats.remoteSteals = 0;
+  stats.replicaTime = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::SetNuma(const std::vector<TNumaNode> & Nodes)
+{
+  uint64_t cpus = 0, before = 0;
+
+  FreeReplicas();
+  numaNodes.clear();
+  workerNode.clear();
+  replicas.clear();
+  if (Nodes.size() < 2 || numWorkers == 0)
+    return;
+
+  numaNodes = Nodes;
+  replicas.resize(numaNodes.size());
+  for (auto & replica : replicas) {
+    replica.memory = NULL;
+    replica.bytes = 0;
+    replica.rows = 0;
+  }
+  // Contiguous groups of workers, so the first nodes get the workers when there are few.
+  for (uint32_t n = 0; n < numaNodes.size(); ++n)
+    cpus += numaNodes[n].cpus.size();
+  for (uint32_t w = 0, n = 0; w < numWorkers; ++w) {
+    while (n + 1 < numaNodes.size() && (before + numaNodes[n].cpus.size()) * numWorkers <= (uint64_t)w * cpus)
+      before += numaNodes[n++].cpus.size();
+    workerNode.push_back(n);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::FreeReplicas()
+{
+  for (auto & replica : replicas) {
+    if (replica.memory != NULL)
+      munmap(replica.memory, replica.bytes);
+    replica.memory = NULL;
+    replica.bytes = 0;
+    replica.rows = 0;
+  }
+  replicatedRows = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies the targets [0, nt) of the host engine to the replica of the node n, from a thread
+// pinned to the node. The mapping is kept for the next blocks, so its pages stay on the node.
+void CCoScheduler::ReplicateNode(uint32_t n, int32_t nt)
+{
+  TReplica & replica = replicas[n];
+  const SetSequences * targets = host->Targets();
+  size_t bytes = (size_t)nt * (MAX_SEQ_LENGTH + sizeof(int32_t));
+
+  replica.rows = 0;
+  if (!BindToNode(numaNodes[n]))
+    return;
+  if (replica.bytes < bytes) {
+    if (replica.memory != NULL)
+      munmap(replica.memory, replica.bytes);
+    replica.memory = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    replica.bytes = bytes;
+    if (replica.memory == MAP_FAILED) {
+      replica.memory = NULL;
+      replica.bytes = 0;
+      return;
+    }
+  }
+  replica.targets.sequences = replica.memory;
+  replica.targets.descriptions = NULL;
+  replica.targets.length = (int32_t *)(replica.memory + (size_t)nt * MAX_SEQ_LENGTH);
+  memcpy(replica.targets.sequences, targets->sequences, (size_t)nt * MAX_SEQ_LENGTH);
+  memcpy(replica.targets.length, targets->length, (size_t)nt * sizeof(int32_t));
+  replica.rows = nt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Replicates the targets on the nodes with host workers, unless the replicas already hold
+// them (e.g., the resident targets of a daemon). A node whose replica could not be made (e.g.,
+// out of memory) reads the shared set.
+void CCoScheduler::Replicate(int32_t nt)
+{
+  const SetSequences * targets = host->Targets();
+  std::vector<std::thread> copiers;
+  struct timespec start, end;
+
+  if (nt == replicatedRows && targets->sequences == replicatedSequences && targets->length == replicatedLength)
+    return;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  for (uint32_t n = 0; n < numaNodes.size(); ++n)
+    if (std::find(workerNode.begin(), workerNode.end(), n) != workerNode.end())
+      copiers.emplace_back(&CCoScheduler::ReplicateNode, this, n, nt);
+  for (auto & copier : copiers)
+    copier.join();
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  stats.replicaTime += CalcTimeDiff(end, start);
+  replicatedSequences = targets->sequences;
+  replicatedLength = targets->length;
+  replicatedRows = nt;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::PrintNuma() const
+{
+  if (numaNodes.empty())
+    return;
+  printf("NUMA placement: host workers");
+  for (uint32_t n = 0; n < numaNodes.size(); ++n)
+    printf(" %ld on node %d,", std::count(workerNode.begin(), workerNode.end(), n), numaNodes[n].id);
+  printf(" targets replicated in %.3f s, %u steals across nodes\n", stats.replicaTime / 1e9, stats.remoteSteals);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Expected time (s) of a launch of tiles with the given cells in the instance a (0: no cost model yet).
+double CCoScheduler::Expected(uint32_t a, uint32_t tiles, double cells) const
+{
+  return calibrated ? tiles * accOverhead[a] + cells / accCellsPerSec[a] : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Deadline (ms) of a launch of tiles with the given cells in the instance a. 0: no watchdog.
+uint32_t CCoScheduler::Deadline(uint32_t a, uint32_t tiles, double cells) const
+{
+  if (watchdogFactor <= 0)
+    return 0;
+  if (!calibrated)
+    return WATCHDOG_PROBE_MS;
+  double ms = watchdogFactor * Expected(a, tiles, cells) * 1e3;
+  return (uint32_t)std::min(std::max(ms, (double)WATCHDOG_MIN_MS), (double)WATCHDOG_MAX_MS);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Splits the wait of a launch with the expected time (s) of the cost model in the instance a:
+// sleepNs before checking the completion, then spinNs checking it without sleeping.
+void CCoScheduler::PlanWait(uint32_t a, double expected, uint64_t & sleepNs, uint64_t & spinNs) const
+{
+  double predicted = waitRatio[a] * expected * 1e9;
+  double guard = std::max((double)WAIT_GUARD_NS, WAIT_DEVIATIONS * waitDeviation[a]);
+
+  sleepNs = spinNs = 0;
+  if (!hybridWait)
+    return;
+  // Long tiles: the guard is bounded, so the spin is a small part of the wait.
+  guard = std::min(guard, std::max((double)WAIT_GUARD_NS, WAIT_MAX_SPIN * predicted));
+  sleepNs = (predicted > guard) ? (uint64_t)(predicted - guard) : 0;
+  spinNs = (uint64_t)std::max((double)WAIT_MIN_SPIN_NS, 2 * guard);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Feeds the time observed for a launch (ns, from its start to its completion) back into the prediction.
+void CCoScheduler::ObserveWait(uint32_t a, double expected, uint64_t observed, uint64_t sleepNs, uint64_t spinNs)
+{
+  if (!hybridWait || expected <= 0)
+    return;
+  double predicted = waitRatio[a] * expected * 1e9;
+  waitDeviation[a] += WAIT_WEIGHT * (fabs(observed - predicted) - waitDeviation[a]);
+  waitRatio[a] += WAIT_WEIGHT * (observed / (expected * 1e9) - waitRatio[a]);
+
+  std::lock_guard<std::mutex> guard(lock);
+  ++ stats.waits;
+  if (observed < sleepNs) {
+    ++ stats.waitsEarly;
+  } else if (observed > sleepNs + spinNs) {
+    ++ stats.waitsLate;
+    stats.spinTime += spinNs;
+  } else {
+    stats.spinTime += observed - sleepNs;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::PrintWaits() const
+{
+  if (stats.waits == 0)
+    return;
+  printf("Completion waits: %u, %.0f%% ended before the spin window, %.0f%% after it, spinning %.3f s (%.1f%% of the accelerator time)\n",
+    stats.waits, 100.0 * stats.waitsEarly / stats.waits, 100.0 * stats.waitsLate / stats.waits, stats.spinTime / 1e9,
+    stats.accTime > 0 ? 100.0 * stats.spinTime / stats.accTime : 0.0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CCoScheduler::ResetAccel(uint32_t a)
+{
+  return useDriver ? accels[a]->AlignmentDriverReset() : accels[a]->AlignmentReset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The tiles of the instance a exceeded their deadline: resets it and computes them on the host.
+// If the instance is still busy, the Run fails instead: it may write into the buffers of the
+// block at any time, so they cannot be given back.
+void CCoScheduler::Recover(uint32_t a, const std::vector<TSlot> & tiles)
+{
+  struct timespec start, end;
+  uint32_t res = ResetAccel(a);
+  uint64_t rows = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    ++ stats.hangs;
+    if (res != CSeqMatcher::OK) {
+      printf("Error: Accelerator %u hung on rows [%d, %d) and is still busy: its buffers cannot be reused until it is idle.\n",
+        a, tiles.front().next, tiles.back().end);
+      accFaulted[a] = true;
+      accError = ACCEL_HUNG;
+      return;
+    }
+    printf("Warning: Accelerator %u hung on rows [%d, %d). They are computed on the host.\n", a,
+      tiles.front().next, tiles.back().end);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  for (uint32_t i = 0; i < tiles.size(); ++i) {
+    host->Compute(tiles[i].next, tiles[i].end, q0, q0 + nq, output + (uint64_t)tiles[i].next * nq, nq);
+    rows += tiles[i].end - tiles[i].next;
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+  std::lock_guard<std::mutex> guard(lock);
+  stats.fallbackRows += rows;
+  stats.hostRows += rows;
+  stats.hostTime += CalcTimeDiff(end, start);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::PrintFaults() const
+{
+  if (stats.hangs > 0)
+    printf("Watchdog: %u accelerator tiles hung, %lu rows computed on the host\n", stats.hangs, stats.fallbackRows);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CCoScheduler::AccelTile(uint32_t a, int32_t t0, int32_t rows)
+{
+  CSeqMatcher * accel = accels[a];
+  uint32_t deadline = Deadline(a, 1, (double)rows * nq);
+  double expected = Expected(a, 1, (double)rows * nq);
+  struct timespec start, end;
+  uint64_t sleepNs, spinNs;
+  uint32_t res;
+
+  // The tile is a contiguous band of the output: rows [t0, t0 + rows) start at t0 * nq.
+  // Returns TIMEOUT if it exceeds its deadline.
+  if (useDriver) {
+    res = accel->AlignmentDriverConfig(t0, rows, t0, q0, nq, q0, t0 * nq, CSeqMatcher::INTERRUPT, deadline);
+    if (res == CSeqMatcher::OK)
+      res = accel->AlignmentDriverStart();
+  } else {
+    PlanWait(a, expected, sleepNs, spinNs);
+    res = accel->AlignmentConfig(t0, rows, t0, q0, nq, q0, t0 * nq);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    if (res == CSeqMatcher::OK)
+      res = accel->AlignmentStart();
+    if (res == CSeqMatcher::OK)
+      res = accel->AlignmentWait((deadline > 0) ? deadline : WAIT_FOREVER, sleepNs, spinNs);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    if (res == CSeqMatcher::OK)
+      ObserveWait(a, expected, CalcTimeDiff(end, start), sleepNs, spinNs);
+  }
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CCoScheduler::Calibrate(int32_t nt, int32_t Q0, int32_t Nq, uint32_t * Output)
+{
+  struct timespec start, end;
+  uint64_t timeSmall, timeLarge;
+  uint32_t res;
+
+  q0 = Q0;
+  nq = Nq;
+  output = Output;
+
+  accTotalCellsPerSec = 0;
+  for (uint32_t a = 0; a < accels.size(); ++a) {
+    int32_t rowsSmall = nt < PROBE_ROWS_SMALL ? nt : PROBE_ROWS_SMALL;
+    int32_t rowsLarge = nt < PROBE_ROWS_LARGE ? nt : PROBE_ROWS_LARGE;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    res = AccelTile(a, 0, rowsSmall);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    timeSmall = CalcTimeDiff(end, start);
+
+    if (res == CSeqMatcher::OK) {
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      res = AccelTile(a, 0, rowsLarge);
+      clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+      timeLarge = CalcTimeDiff(end, start);
+    }
+    // A hung instance is left out (with the default model) until the next Run. If it is still
+    // busy, the block cannot be reused.
+    if (res == CSeqMatcher::TIMEOUT) {
+      accFaulted[a] = true;
+      ++ stats.hangs;
+      if (ResetAccel(a) != CSeqMatcher::OK) {
+        printf("Error: Accelerator %u hung during the calibration and is still busy.\n", a);
+        return ACCEL_HUNG;
+      }
+      printf("Warning: Accelerator %u hung during the calibration: not used in it.\n", a);
+      continue;
+    }
+    if (res != CSeqMatcher::OK)
+      return ACCEL_ERROR;
+
+    // Fit time = overhead + cells / rate with the two probes.
+    double cellsSmall = (double)rowsSmall * Nq, cellsLarge = (double)rowsLarge * Nq;
+    if (rowsLarge > rowsSmall && timeLarge > timeSmall) {
+      double secPerCell = ((timeLarge - timeSmall) / 1e9) / (cellsLarge - cellsSmall);
+      accCellsPerSec[a] = 1.0 / secPerCell;
+      accOverhead[a] = timeSmall / 1e9 - cellsSmall * secPerCell;
+      if (accOverhead[a] < 0)
+        accOverhead[a] = 0;
+    } else {
+      accCellsPerSec[a] = cellsLarge / (timeLarge / 1e9 + 1e-9);
+      accOverhead[a] = 0;
+    }
+    accTotalCellsPerSec += accCellsPerSec[a];
+  }
+  if (accTotalCellsPerSec == 0)
+    accTotalCellsPerSec = 1e9 * accels.size();
+  calibrated = true;
+
+  if (numWorkers > 0 || accels.empty()) {
+    int32_t probeQueries = Nq < PROBE_HOST_QUERIES ? Nq : PROBE_HOST_QUERIES;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    host->Compute(0, 1, Q0, Q0 + probeQueries, Output, Nq);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    hostCellsPerSec = probeQueries / (CalcTimeDiff(end, start) / 1e9 + 1e-9);
+  }
+
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::PrintModel() const
+{
+  printf("Cost model:");
+  for (uint32_t a = 0; a < accels.size(); ++a)
+    printf(" accelerator %u %.3e pairs/s + %.1f us per launch,", a, accCellsPerSec[a], accOverhead[a] * 1e6);
+  if (accels.empty())
+    printf(" no accelerator,");
+  printf(" host %u x %.3e pairs/s\n", numWorkers, hostCellsPerSec);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CCoScheduler::NextAccelTile(uint32_t a, int32_t & t0, int32_t & t1)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  int32_t remaining = endRow - nextRow;
+
+  if (accError != OK || accFaulted[a])
+    return false;
+
+  if (remaining > 0) {
+    int32_t rows;
+    if (numWorkers == 0) {
+      // Accelerators only: proportional shard of the block, in a single launch.
+      rows = (int32_t)(blockRows * accCellsPerSec[a] / accTotalCellsPerSec + 1);
+    } else {
+      // Half of the expected share of this instance, but long enough to amortize the launch.
+      double share = accCellsPerSec[a] / (accTotalCellsPerSec + numWorkers * hostCellsPerSec);
+      double minRows = MIN_ACCEL_TILE_TIME * accOverhead[a] * accCellsPerSec[a] / nq;
+      rows = (int32_t)(remaining * share / 2 + 1);
+      if (rows < minRows)
+        rows = (int32_t)minRows + 1;
+    }
+    if (rows > remaining)
+      rows = remaining;
+    t0 = nextRow;
+    t1 = nextRow + rows;
+    nextRow = t1;
+    return true;
+  }
+
+  // Tail: take the part of the largest host block that the accelerator finishes first.
+  // With r pending rows, stealing k of them balances when (r - k) * c = o + k * a.
+  int32_t victim = -1, pending = 0;
+  for (uint32_t w = 0; w < numWorkers; ++w) {
+    if (slots[w].end - slots[w].next > pending) {
+      pending = slots[w].end - slots[w].next;
+      victim = w;
+    }
+  }
+  if (victim < 0)
+    return false;
+  double c = nq / hostCellsPerSec, at = nq / accCellsPerSec[a];
+  int32_t k = (int32_t)((pending * c - accOverhead[a]) / (c + at));
+  if (k < 1)
+    return false;
+  t1 = slots[victim].end;
+  t0 = t1 - k;
+  slots[victim].end = t0;
+  ++ stats.steals;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CCoScheduler::NextHostRows(uint32_t w, int32_t & t0, int32_t & t1)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  TSlot & slot = slots[w];
+
+  if (slot.next >= slot.end) {
+    int32_t remaining = endRow - nextRow;
+    if (remaining > 0) {
+      // New block from the back of the remaining rows.
+      int32_t rows = remaining < HOST_BLOCK_ROWS ? remaining : HOST_BLOCK_ROWS;
+      slot.end = endRow;
+      endRow -= rows;
+      slot.next = endRow;
+      ++ stats.hostTiles;
+    } else {
+      // Tail: steal half of the largest pending block of another worker, of the same
+      // NUMA node if any is left there.
+      int32_t victim = -1, pending = 1;
+      bool local = true;
+      for (uint32_t pass = 0; pass < 2 && victim < 0; ++pass) {
+        local = (pass == 0);
+        for (uint32_t v = 0; v < numWorkers; ++v) {
+          bool same = numaNodes.empty() || workerNode[v] == workerNode[w];
+          if (v != w && same == local && slots[v].end - slots[v].next > pending) {
+            pending = slots[v].end - slots[v].next;
+            victim = v;
+          }
+        }
+      }
+      if (victim < 0)
+        return false;
+      if (!local)
+        ++ stats.remoteSteals;
+      slot.end = slots[victim].end;
+      slot.next = slot.end - pending / 2;
+      slots[victim].end = slot.next;
+      ++ stats.hostTiles;
+      ++ stats.steals;
+    }
+  }
+
+  t0 = slot.next;
+  t1 = (slot.end - t0 > HOST_STEP_ROWS) ? t0 + HOST_STEP_ROWS : slot.end;
+  slot.next = t1;
+  stats.hostRows += t1 - t0;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::AccelLoop(uint32_t a)
+{
+  struct timespec start, end;
+  int32_t t0, t1;
+
+  // The sleeps of the hybrid waits end close to the requested time.
+  if (hybridWait)
+    prctl(PR_SET_TIMERSLACK, WAIT_TIMER_SLACK_NS);
+  while (NextAccelTile(a, t0, t1)) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    uint32_t res = AccelTile(a, t0, t1 - t0);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    if (res == CSeqMatcher::TIMEOUT) {
+      Recover(a, std::vector<TSlot>(1, TSlot{t0, t1}));
+      continue;
+    }
+
+    std::lock_guard<std::mutex> guard(lock);
+    if (res != CSeqMatcher::OK) {
+      printf("Error: Accelerator %u tile [%d, %d) failed.\n", a, t0, t1);
+      accError = ACCEL_ERROR;
+      return;
+    }
+    stats.accTime += CalcTimeDiff(end, start);
+    stats.accRows += t1 - t0;
+    ++ stats.accTiles;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Takes the next tiles of the accelerator (up to the driver batch) and starts them
+// without waiting for their end. Returns false if there was nothing to submit.
+// Deadline is the time (ms) they have to finish (0: no watchdog), Expected their time (s) in the cost model.
+bool CCoScheduler::SubmitAccelTiles(uint32_t a, std::vector<TSlot> & tiles, uint32_t & deadline, double & expected)
+{
+  std::vector<CSeqMatcher::TJob> jobs;
+  int32_t t0, t1;
+  uint32_t res;
+  double cells = 0;
+
+  tiles.clear();
+  while (tiles.size() < driverBatch && NextAccelTile(a, t0, t1)) {
+    CSeqMatcher::TJob job = {t0, t1 - t0, t0, q0, nq, q0, t0 * nq};
+    tiles.push_back({t0, t1});
+    jobs.push_back(job);
+    cells += (double)(t1 - t0) * nq;
+  }
+  if (tiles.empty())
+    return false;
+  deadline = Deadline(a, tiles.size(), cells);
+  expected = Expected(a, tiles.size(), cells);
+
+  if (driverBatch == 1) {
+    const TSlot & tile = tiles.front();
+    res = accels[a]->AlignmentDriverConfig(tile.next, tile.end - tile.next, tile.next, q0, nq, q0, tile.next * nq, CSeqMatcher::CONTINUE);
+    if (res == CSeqMatcher::OK)
+      res = accels[a]->AlignmentDriverStart();
+  } else {
+    res = accels[a]->AlignmentDriverSubmit(jobs.data(), jobs.size());
+  }
+  if (res != CSeqMatcher::OK) {
+    std::lock_guard<std::mutex> guard(lock);
+    printf("Error: Accelerator %u tiles [%d, %d) failed.\n", a, tiles.front().next, tiles.back().end);
+    accError = ACCEL_ERROR;
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::AccelEventLoop()
+{
+  // Tiles in flight of every instance
+  struct TFlight {
+    std::vector<TSlot> tiles;
+    struct timespec started;
+    uint32_t deadline;
+    double expected;
+    uint64_t sleepNs, spinNs;
+  };
+  std::vector<struct pollfd> fds(accels.size());
+  std::vector<TFlight> flight(accels.size(), TFlight{std::vector<TSlot>(), {0, 0}, 0, 0, 0, 0});
+  struct timespec now;
+  uint32_t inFlight = 0, done;
+
+  // The sleeps of the hybrid waits end close to the requested time.
+  if (hybridWait)
+    prctl(PR_SET_TIMERSLACK, WAIT_TIMER_SLACK_NS);
+  // A negative descriptor is ignored by poll(): instances without tiles in flight.
+  for (uint32_t a = 0; a < accels.size(); ++a) {
+    fds[a].fd = -1;
+    fds[a].events = POLLIN;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &flight[a].started);
+    if (SubmitAccelTiles(a, flight[a].tiles, flight[a].deadline, flight[a].expected)) {
+      fds[a].fd = accels[a]->GetPollFd();
+      PlanWait(a, flight[a].expected, flight[a].sleepNs, flight[a].spinNs);
+      ++ inFlight;
+    }
+  }
+
+  while (inFlight > 0) {
+    // Block until the first deadline or spin window of the tiles in flight (or a completion).
+    // Within a spin window, the device nodes are polled without blocking.
+    int64_t timeout = -1;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    for (uint32_t a = 0; a < accels.size(); ++a) {
+      if (fds[a].fd < 0)
+        continue;
+      int64_t elapsed = CalcTimeDiff(now, flight[a].started), left = -1;
+      if (flight[a].deadline > 0)
+        left = std::max((int64_t)flight[a].deadline * 1000000 - elapsed, (int64_t)0);
+      if (elapsed < (int64_t)flight[a].sleepNs)
+        left = (left < 0) ? flight[a].sleepNs - elapsed : std::min(left, (int64_t)flight[a].sleepNs - elapsed);
+      else if (elapsed < (int64_t)(flight[a].sleepNs + flight[a].spinNs))
+        left = 0;
+      if (left >= 0 && (timeout < 0 || left < timeout))
+        timeout = left;
+    }
+
+    struct timespec wait = {(time_t)(timeout / 1000000000), (long)(timeout % 1000000000)};
+    if (ppoll(fds.data(), fds.size(), (timeout < 0) ? NULL : &wait, NULL) < 0) {
+      if (errno == EINTR)
+        continue;
+      // Without completions, wait for the tiles in flight one by one.
+      std::lock_guard<std::mutex> guard(lock);
+      printf("Error: Waiting for the accelerators failed (errno %d).\n", errno);
+      accError = ACCEL_ERROR;
+      for (uint32_t a = 0; a < accels.size(); ++a)
+        if (fds[a].fd >= 0 && accels[a]->AlignmentDriverWait(flight[a].deadline > 0 ? (int32_t)flight[a].deadline : -1) != CSeqMatcher::OK &&
+          ResetAccel(a) != CSeqMatcher::OK) {
+          accFaulted[a] = true;
+          accError = ACCEL_HUNG;
+        }
+      return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    for (uint32_t a = 0; a < accels.size(); ++a) {
+      if (fds[a].fd < 0)
+        continue;
+      if (!(fds[a].revents & POLLIN)) {
+        if (flight[a].deadline == 0 || CalcTimeDiff(now, flight[a].started) < (uint64_t)flight[a].deadline * 1000000)
+          continue;
+        // Watchdog: the tiles in flight are abandoned and computed on the host.
+        Recover(a, flight[a].tiles);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+      } else {
+        // The batch is notified once, when its last tile finishes.
+        if (driverBatch > 1 && accels[a]->AlignmentDriverCollect(done) != CSeqMatcher::OK) {
+          std::lock_guard<std::mutex> guard(lock);
+          printf("Error: Accelerator %u completions could not be read.\n", a);
+          accError = ACCEL_ERROR;
+        }
+        ObserveWait(a, flight[a].expected, CalcTimeDiff(now, flight[a].started), flight[a].sleepNs, flight[a].spinNs);
+        std::lock_guard<std::mutex> guard(lock);
+        stats.accTime += CalcTimeDiff(now, flight[a].started);
+        for (uint32_t i = 0; i < flight[a].tiles.size(); ++i)
+          stats.accRows += flight[a].tiles[i].end - flight[a].tiles[i].next;
+        stats.accTiles += flight[a].tiles.size();
+      }
+      -- inFlight;
+      fds[a].fd = -1;
+      flight[a].started = now;
+      if (SubmitAccelTiles(a, flight[a].tiles, flight[a].deadline, flight[a].expected)) {
+        fds[a].fd = accels[a]->GetPollFd();
+        PlanWait(a, flight[a].expected, flight[a].sleepNs, flight[a].spinNs);
+        ++ inFlight;
+      }
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCoScheduler::HostLoop(uint32_t w)
+{
+  struct timespec start, end;
+  uint64_t busy = 0;
+  int32_t t0, t1;
+  const CHostMatcher * engine = host;
+  const TReplica * replica = numaNodes.empty() ? NULL : &replicas[workerNode[w]];
+  CHostMatcher local(replica != NULL ? &replica->targets : NULL, host->Queries());
+  // The output may be uncached DMA memory: the rows are computed in cached memory and copied at once.
+  std::vector<uint32_t> rows((uint64_t)HOST_STEP_ROWS * nq);
+
+  // An unpinned worker still computes, only its reads are not local.
+  if (replica != NULL && BindToNode(numaNodes[workerNode[w]]) && replica->rows >= blockRows)
+    engine = &local;
+
+  while (NextHostRows(w, t0, t1)) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    engine->Compute(t0, t1, q0, q0 + nq, rows.data(), nq);
+    memcpy(output + (uint64_t)t0 * nq, rows.data(), (uint64_t)(t1 - t0) * nq * sizeof(uint32_t));
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    busy += CalcTimeDiff(end, start);
+  }
+
+  std::lock_guard<std::mutex> guard(lock);
+  stats.hostTime += busy;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CCoScheduler::Run(int32_t nt, int32_t Q0, int32_t Nq, uint32_t * Output)
+{
+  struct timespec start, end;
+  std::vector<std::thread> workers;
+  uint32_t hostWorkers = numWorkers;
+
+  if (accels.empty() && numWorkers == 0)
+    return NO_ENGINES;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  q0 = Q0;
+  nq = Nq;
+  output = Output;
+  nextRow = 0;
+  endRow = nt;
+  blockRows = nt;
+  accError = OK;
+  for (auto & slot : slots)
+    slot.next = slot.end = 0;
+  if (!numaNodes.empty())
+    Replicate(nt);
+  // Instances left busy by a hung tile are used again once they are idle. Until then they
+  // may write into the buffers they were given, which are not to be reused: nothing runs.
+  for (uint32_t a = 0; a < accels.size(); ++a) {
+    if (accFaulted[a])
+      accFaulted[a] = (ResetAccel(a) != CSeqMatcher::OK);
+    if (accFaulted[a]) {
+      printf("Error: Accelerator %u is still busy with a hung tile.\n", a);
+      return ACCEL_HUNG;
+    }
+  }
+
+  // The calling thread drives the accelerators (all of them with the driver, the first one
+  // otherwise) or, without accelerators, is one of the host workers (if they are not placed
+  // on the NUMA nodes: the calling thread is not pinned).
+  if (accels.empty() && numaNodes.empty())
+    -- hostWorkers;
+  for (uint32_t w = 0; w < hostWorkers; ++w)
+    workers.emplace_back(&CCoScheduler::HostLoop, this, w);
+  for (uint32_t a = 1; !useDriver && a < accels.size(); ++a)
+    workers.emplace_back(&CCoScheduler::AccelLoop, this, a);
+  if (accels.empty()) {
+    if (hostWorkers < numWorkers)
+      HostLoop(hostWorkers);
+  } else if (useDriver)
+    AccelEventLoop();
+  else
+    AccelLoop(0);
+  for (auto & worker : workers)
+    worker.join();
+
+  // Rows left by hung instances, without host workers to take them.
+  if (accError == OK && nextRow < endRow) {
+    host->Compute(nextRow, endRow, q0, q0 + nq, output + (uint64_t)nextRow * nq, nq);
+    stats.fallbackRows += endRow - nextRow;
+    stats.hostRows += endRow - nextRow;
+    nextRow = endRow;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  stats.totalTime += CalcTimeDiff(end, start);
+  return accError;
+}
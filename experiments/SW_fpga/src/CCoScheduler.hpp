@@ -0,0 +1,148 @@
+#ifndef CCOSCHEDULER_HPP
+#define CCOSCHEDULER_HPP
+
+// Requires <stdint.h>, <vector>, <mutex>, "CAccelDriver.hpp", "CSeqMatcher.hpp", "CHostMatcher.hpp", "numa.h"
+
+//  Heterogeneous scheduler for one block of the target x query matrix.
+// The block (all targets x a range of queries) is split into tiles of target rows
+// that are dispatched dynamically to the accelerator instances (one CSeqMatcher
+// each) and to host engine workers. Both write into the same output buffer with the
+// layout used by the accelerator (output[t * nq + q]), so no merge step is needed.
+//
+// Scheduling:
+// - A cost model is calibrated at startup: each accelerator instance is modelled as
+//   launch overhead + cells / rate, and every host worker as cells / rate.
+// - The accelerators take tiles from the front of the remaining rows, of half their
+//   expected share of the remaining work (guided self-scheduling).
+// - Host workers take small blocks of rows from the back.
+// - Tail stealing: idle host workers steal half of the rows pending in the block of
+//   another worker, and the accelerators the part they can finish before the host.
+// - Watchdog: a tile that exceeds a multiple of its expected time is computed on the host.
+//   The core has no reset line of its own (ap_rst_n is the reset of the whole PL): if it is
+//   still busy after the tile is disarmed, it may go on writing into the buffers of the
+//   block, so the Run (and the next ones, until it is idle) fails with ACCEL_HUNG.
+
+class CCoScheduler {
+  public:
+    typedef enum {OK = 0, NO_ENGINES = 1, ACCEL_ERROR = 2, ACCEL_HUNG = 3} TErrors;
+
+    struct TStats {
+      uint64_t accRows, hostRows;     // Target rows computed by each engine
+      uint32_t accTiles, hostTiles;   // Number of tiles dispatched to each engine
+      uint32_t steals;                // Tiles obtained by tail stealing
+      uint64_t accTime, totalTime;    // Time busy in the accelerators / wall time (ns)
+      uint64_t hostTime;              // Time busy in the host workers (ns)
+      uint32_t hangs;                 // Accelerator tiles that exceeded their deadline
+      uint64_t fallbackRows;          // Rows of those tiles, computed on the host
+      uint32_t waits;                 // Completion waits of the accelerators
+      uint32_t waitsEarly, waitsLate; // Completions before / after the spin window
+      uint64_t spinTime;              // Time spinning in those waits (ns)
+      uint32_t remoteSteals;          // Host steals from a worker of another NUMA node
+      uint64_t replicaTime;           // Copying the targets to the NUMA nodes (ns)
+    };
+
+  protected:
+    // Rows [next, end) assigned to one engine and not computed yet.
+    struct TSlot {
+      int32_t next, end;
+    };
+
+    std::vector<CSeqMatcher *> accels;  // Accelerator instances (may be empty)
+    bool useDriver;               // Use the kernel driver (true) or the direct register access
+    uint32_t driverBatch;         // Tiles submitted at once to the command ring of the driver
+    const CHostMatcher * host;
+    uint32_t numWorkers;          // Host engine workers
+
+    // Cost model
+    std::vector<double> accCellsPerSec, accOverhead;  // Per accelerator instance
+    double accTotalCellsPerSec, hostCellsPerSec;
+    bool calibrated;
+
+    // Watchdog
+    double watchdogFactor;        // Deadline of a tile, in expected durations (0: disabled)
+    std::vector<bool> accFaulted; // Instances left busy by a hung tile
+
+    // Completion waits
+    bool hybridWait;              // Sleep and then spin (true) or block / poll from the start
+    std::vector<double> waitRatio, waitDeviation;  // Per instance: observed / expected time, error (ns)
+
+    // NUMA placement
+    struct TReplica {
+      char * memory;              // Mapping, local to the node
+      size_t bytes;
+      SetSequences targets;       // Copy of the targets of the block in the mapping
+      int32_t rows;               // Targets copied (0: the shared set is used)
+    };
+    std::vector<TNumaNode> numaNodes;   // Empty: no placement
+    std::vector<uint32_t> workerNode;   // Node of each host worker
+    std::vector<TReplica> replicas;     // One per node
+    const char * replicatedSequences;   // Targets copied to the replicas
+    const int32_t * replicatedLength;
+    int32_t replicatedRows;             // 0: the replicas must be made again
+
+    // Current block
+    std::mutex lock;
+    int32_t nextRow, endRow;      // Rows not assigned yet
+    int32_t blockRows;            // Rows of the block
+    std::vector<TSlot> slots;     // One per host worker
+    int32_t q0, nq;
+    uint32_t * output;
+    uint32_t accError;
+    TStats stats;
+
+    double Expected(uint32_t a, uint32_t tiles, double cells) const;
+    uint32_t Deadline(uint32_t a, uint32_t tiles, double cells) const;
+    void PlanWait(uint32_t a, double expected, uint64_t & sleepNs, uint64_t & spinNs) const;
+    void ObserveWait(uint32_t a, double expected, uint64_t observed, uint64_t sleepNs, uint64_t spinNs);
+    uint32_t ResetAccel(uint32_t a);
+    void Recover(uint32_t a, const std::vector<TSlot> & tiles);
+    uint32_t AccelTile(uint32_t a, int32_t t0, int32_t rows);
+    bool NextAccelTile(uint32_t a, int32_t & t0, int32_t & t1);
+    bool NextHostRows(uint32_t w, int32_t & t0, int32_t & t1);
+    void AccelLoop(uint32_t a);
+    bool SubmitAccelTiles(uint32_t a, std::vector<TSlot> & tiles, uint32_t & deadline, double & expected);
+    void AccelEventLoop();
+    void HostLoop(uint32_t w);
+    void Replicate(int32_t nt);
+    void ReplicateNode(uint32_t n, int32_t nt);
+    void FreeReplicas();
+
+  public:
+    // Accels can be empty (host only) and NumWorkers 0 (accelerators only).
+    CCoScheduler(const std::vector<CSeqMatcher *> & Accels, bool UseDriver, const CHostMatcher * Host, uint32_t NumWorkers);
+    ~CCoScheduler();
+
+    // Calibrates the cost model running probes on the given block. The output contents are not preserved.
+    uint32_t Calibrate(int32_t nt, int32_t Q0, int32_t Nq, uint32_t * Output);
+    // Computes targets [0, nt) x queries [Q0, Q0 + Nq). Output must be the buffer given to
+    // CSeqMatcher::InitConfig(), the result of (t, q) is stored in Output[t * Nq + (q - Q0)].
+    // ACCEL_HUNG: an instance hung and is still busy; the buffers it was given must not be
+    // reused until a Run succeeds.
+    uint32_t Run(int32_t nt, int32_t Q0, int32_t Nq, uint32_t * Output);
+
+    // Host engine of the next blocks (e.g., bound to other buffers).
+    void SetHost(const CHostMatcher * Host) { host = Host; }
+    // The targets of the host engine were rewritten in place: the NUMA replicas are made again
+    // at the next Run (they are only made when the targets or their number change).
+    void TargetsChanged() { replicatedRows = 0; }
+    // Tiles chained by the driver per submission (1: a job per submission, the default).
+    void SetDriverBatch(uint32_t Batch);
+    // Deadline of an accelerator tile, in times its expected duration (0: no watchdog).
+    void SetWatchdog(double Factor) { watchdogFactor = Factor; }
+    // Hybrid (sleep, then spin) completion waits of the accelerators (the default).
+    void SetHybridWait(bool Hybrid) { hybridWait = Hybrid; }
+    // Places the host workers on the NUMA nodes (ReadNumaNodes()). Fewer than 2 nodes: no placement.
+    void SetNuma(const std::vector<TNumaNode> & Nodes);
+
+    const TStats & GetStats() const { return stats; }
+    void ResetStats();
+    void PrintModel() const;
+    // Prints the watchdog expirations, if any.
+    void PrintFaults() const;
+    // Prints how the completions of the accelerators were waited for.
+    void PrintWaits() const;
+    // Prints the placement of the host workers on the NUMA nodes, if any.
+    void PrintNuma() const;
+};
+
+#endif  // CCOSCHEDULER_HPP
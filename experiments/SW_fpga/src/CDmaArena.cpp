@@ -0,0 +1,261 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <iterator>
+#include <vector>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+CDmaBuffer & CDmaBuffer::operator=(CDmaBuffer && Other)
+{
+  if (this != &Other) {
+    Reset();
+    arena = Other.arena;
+    virt = Other.virt;
+    size = Other.size;
+    Other.arena = NULL;
+    Other.virt = NULL;
+    Other.size = 0;
+  }
+  return *this;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaBuffer::Reset()
+{
+  if (arena != NULL && virt != NULL)
+    arena->Free(virt);
+  arena = NULL;
+  virt = NULL;
+  size = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CDmaBuffer::PhysAddr() const
+{
+  return (arena != NULL) ? arena->PhysAddr(virt) : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaBuffer::Flush(uint64_t Offset, uint64_t Bytes) const
+{
+  if (arena != NULL && Offset < size)
+    arena->Flush((char *)virt + Offset, (Bytes > 0 && Bytes < size - Offset) ? Bytes : size - Offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaBuffer::Invalidate(uint64_t Offset, uint64_t Bytes) const
+{
+  if (arena != NULL && Offset < size)
+    arena->Invalidate((char *)virt + Offset, (Bytes > 0 && Bytes < size - Offset) ? Bytes : size - Offset);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CDmaArena::SetBackend(CDmaBackend * Backend)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  if (!regions.empty())
+    return false;
+  backend = Backend;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Reserves a region from the backend and registers it in the granules it touches. Returns its index (-1: error).
+int32_t CDmaArena::AddRegion(uint64_t Size, bool Cacheable)
+{
+  TRegion region;
+  uint64_t bytes = (Size + DMA_ALIGN - 1) / DMA_ALIGN * DMA_ALIGN;
+
+  region.virt = (char *)backend->Alloc(bytes, Cacheable, region.phys);
+  if (region.virt == NULL)
+    return -1;
+  region.size = bytes;
+  region.cacheable = Cacheable;
+  region.free[0] = bytes;
+  regions.push_back(region);
+
+  uint64_t first = (uint64_t)region.virt >> DMA_GRANULE_SHIFT;
+  uint64_t last = ((uint64_t)region.virt + bytes - 1) >> DMA_GRANULE_SHIFT;
+  for (uint64_t g = first; g <= last; ++g)
+    granules[g].push_back(regions.size() - 1);
+  return regions.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Region that contains the address (-1: none). A granule holds at most a few regions.
+int32_t CDmaArena::Find(const void * VirtAddr) const
+{
+  auto it = granules.find((uint64_t)VirtAddr >> DMA_GRANULE_SHIFT);
+
+  if (it == granules.end())
+    return -1;
+  for (uint32_t r : it->second) {
+    const TRegion & region = regions[r];
+    if ((const char *)VirtAddr >= region.virt && (const char *)VirtAddr < region.virt + region.size)
+      return r;
+  }
+  return -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// First fit in the free blocks of the region. Size is aligned.
+void * CDmaArena::Take(uint32_t r, uint64_t Size)
+{
+  TRegion & region = regions[r];
+
+  for (auto it = region.free.begin(); it != region.free.end(); ++it) {
+    if (it->second < Size)
+      continue;
+    uint64_t offset = it->first, rest = it->second - Size;
+    region.free.erase(it);
+    if (rest > 0)
+      region.free[offset + Size] = rest;
+    return region.virt + offset;
+  }
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CDmaArena::Reserve(uint64_t Size, bool Cacheable)
+{
+  std::lock_guard<std::mutex> guard(lock);
+
+  for (auto & region : regions)
+    if (region.cacheable == Cacheable)
+      for (auto & block : region.free)
+        if (block.second >= Size)
+          return OK;
+  return AddRegion(Size, Cacheable) < 0 ? ERROR_ALLOCATING : OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void * CDmaArena::Alloc(uint64_t Size, bool Cacheable)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  uint64_t bytes = ((Size > 0 ? Size : 1) + DMA_ALIGN - 1) / DMA_ALIGN * DMA_ALIGN;
+  void * virtAddr = NULL;
+  int32_t r = -1;
+
+  for (uint32_t i = 0; virtAddr == NULL && i < regions.size(); ++i)
+    if (regions[i].cacheable == Cacheable && (virtAddr = Take(i, bytes)) != NULL)
+      r = i;
+  if (virtAddr == NULL) {
+    // A new region, of the default size if the buffer is smaller. When the pool cannot give
+    // that much, a region of the size of the buffer is tried.
+    r = AddRegion(bytes > regionSize ? bytes : regionSize, Cacheable);
+    if (r < 0 && bytes < regionSize)
+      r = AddRegion(bytes, Cacheable);
+    if (r < 0)
+      return NULL;
+    virtAddr = Take(r, bytes);
+  }
+
+  buffers[(uint64_t)virtAddr] = TBuffer{(uint32_t)r, bytes};
+  used += bytes;
+  return virtAddr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CDmaArena::Free(void * VirtAddr)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = buffers.find((uint64_t)VirtAddr);
+
+  if (it == buffers.end())
+    return false;
+
+  TRegion & region = regions[it->second.region];
+  uint64_t offset = (char *)VirtAddr - region.virt, size = it->second.size;
+  used -= size;
+  buffers.erase(it);
+
+  // Coalesce with the free blocks after and before it.
+  auto next = region.free.lower_bound(offset);
+  if (next != region.free.end() && next->first == offset + size) {
+    size += next->second;
+    next = region.free.erase(next);
+  }
+  if (next != region.free.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += size;
+      return true;
+    }
+  }
+  region.free[offset] = size;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CDmaBuffer CDmaArena::Allocate(uint64_t Size, bool Cacheable)
+{
+  void * virtAddr = Alloc(Size, Cacheable);
+
+  return (virtAddr != NULL) ? CDmaBuffer(this, virtAddr, Size) : CDmaBuffer();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CDmaArena::PhysAddr(const void * VirtAddr) const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  int32_t r = Find(VirtAddr);
+
+  if (r < 0)
+    return 0;
+  return regions[r].phys + ((const char *)VirtAddr - regions[r].virt);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaArena::Maintain(const void * VirtAddr, uint64_t Size, bool Flush) const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  int32_t r = Find(VirtAddr);
+
+  if (r < 0 || !regions[r].cacheable || Size == 0)
+    return;
+  const TRegion & region = regions[r];
+  uint64_t offset = (const char *)VirtAddr - region.virt;
+  if (Size > region.size - offset)
+    Size = region.size - offset;
+  if (Flush)
+    backend->Flush(region.virt + offset, region.phys + offset, Size);
+  else
+    backend->Invalidate(region.virt + offset, region.phys + offset, Size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CDmaArena::Release()
+{
+  std::lock_guard<std::mutex> guard(lock);
+  uint32_t lost = buffers.size();
+
+  for (auto & region : regions)
+    backend->Free(region.virt, region.size);
+  regions.clear();
+  granules.clear();
+  buffers.clear();
+  used = 0;
+  return lost;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CDmaArena::TStats CDmaArena::GetStats() const
+{
+  std::lock_guard<std::mutex> guard(lock);
+  TStats stats;
+
+  stats.regions = regions.size();
+  stats.reserved = 0;
+  for (auto & region : regions)
+    stats.reserved += region.size;
+  stats.used = used;
+  stats.buffers = buffers.size();
+  return stats;
+}
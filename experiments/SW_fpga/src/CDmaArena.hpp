@@ -0,0 +1,140 @@
+#ifndef CDMAARENA_HPP
+#define CDMAARENA_HPP
+
+// Requires <stdint.h>, <vector>, <map>, <unordered_map>, <mutex>, "CDmaBackend.hpp"
+
+//  Arena of DMA-compatible memory.
+// Allocating every buffer from the CMA pool fragments it (the buffers of a run are
+// freed and allocated again with other sizes) and gives physical addresses only for
+// the start of each buffer. The arena reserves large regions from a backend
+// (CDmaBackend: the CMA pool, a dma-heap, u-dma-buf or memfd) and sub-allocates the
+// buffers in them, aligned to DMA_ALIGN, with first fit and coalescing of the free
+// blocks. A buffer that fits in no region gets a new one of its size (at least
+// DMA_REGION_SIZE, so small buffers share regions), unless the caller reserved a
+// region for a group of buffers. Regions are kept until Release(), so the next
+// buffers reuse them.
+//
+// Translation: the virtual address space is divided in granules of 2^DMA_GRANULE_SHIFT
+// bytes, and a hash table maps every granule touched by a region to the regions in it.
+// The physical address of any address inside a region (not only the start of a
+// buffer) is found in O(1): hash of the granule, then the offset in the region.
+//
+// CDmaBuffer is a move-only handle that returns its buffer to the arena when it is
+// destroyed or reset.
+//
+// Cacheable buffers are much faster for the CPU (no uncached load or store per word),
+// but their cache maintenance is explicit: Flush() after the CPU writes data the
+// accelerator reads, Invalidate() before the CPU reads data the accelerator wrote. Both
+// do nothing on non-cacheable buffers. A cacheable buffer must not be written by the CPU
+// and the accelerator at the same time: a cache line written back by the CPU would
+// overwrite the words of the line written by the accelerator.
+
+#define DMA_ALIGN 4096              // Alignment of the buffers (a page)
+#define DMA_REGION_SIZE (4 << 20)   // Smallest region reserved when a buffer does not fit
+#define DMA_GRANULE_SHIFT 21        // Granules of 2 MB for the translation
+
+class CDmaArena;
+
+class CDmaBuffer {
+  protected:
+    CDmaArena * arena;
+    void * virt;
+    uint64_t size;
+
+  public:
+    CDmaBuffer() : arena(NULL), virt(NULL), size(0) {}
+    CDmaBuffer(CDmaArena * Arena, void * Virt, uint64_t Size) : arena(Arena), virt(Virt), size(Size) {}
+    CDmaBuffer(const CDmaBuffer &) = delete;
+    CDmaBuffer & operator=(const CDmaBuffer &) = delete;
+    CDmaBuffer(CDmaBuffer && Other) : arena(Other.arena), virt(Other.virt), size(Other.size) {
+      Other.arena = NULL;
+      Other.virt = NULL;
+      Other.size = 0;
+    }
+    CDmaBuffer & operator=(CDmaBuffer && Other);
+    ~CDmaBuffer() { Reset(); }
+
+    // Returns the buffer to the arena.
+    void Reset();
+
+    void * Get() const { return virt; }
+    template <typename T> T * As() const { return (T *)virt; }
+    uint64_t Size() const { return size; }
+    uint64_t PhysAddr() const;
+    explicit operator bool() const { return virt != NULL; }
+
+    // Cache maintenance of Bytes bytes from Offset (0: up to the end of the buffer).
+    void Flush(uint64_t Offset = 0, uint64_t Bytes = 0) const;
+    void Invalidate(uint64_t Offset = 0, uint64_t Bytes = 0) const;
+};
+
+class CDmaArena {
+  public:
+    typedef enum {OK = 0, ERROR_ALLOCATING = 1} TErrors;
+
+    struct TStats {
+      uint32_t regions;
+      uint64_t reserved, used;      // Bytes in the regions / in live buffers
+      uint32_t buffers;             // Live buffers
+    };
+
+  protected:
+    struct TRegion {
+      char * virt;
+      uint64_t phys, size;
+      bool cacheable;
+      std::map<uint64_t, uint64_t> free;  // Free blocks: offset -> size
+    };
+
+    struct TBuffer {
+      uint32_t region;
+      uint64_t size;                // Size taken in the region (aligned)
+    };
+
+    CDmaBackend * backend;
+    uint64_t regionSize;
+    std::vector<TRegion> regions;
+    std::unordered_map<uint64_t, std::vector<uint32_t>> granules;  // Granule -> regions in it
+    std::unordered_map<uint64_t, TBuffer> buffers;                 // Live buffers by address
+    uint64_t used;
+    mutable std::mutex lock;
+
+    int32_t AddRegion(uint64_t Size, bool Cacheable);
+    int32_t Find(const void * VirtAddr) const;
+    void Maintain(const void * VirtAddr, uint64_t Size, bool Flush) const;
+    void * Take(uint32_t r, uint64_t Size);
+
+  public:
+    CDmaArena(CDmaBackend * Backend, uint64_t RegionSize = DMA_REGION_SIZE)
+      : backend(Backend), regionSize(RegionSize), used(0) {}
+    ~CDmaArena() { Release(); }
+
+    // Changes the backend. Only possible while no region is reserved (returns false otherwise).
+    bool SetBackend(CDmaBackend * Backend);
+    CDmaBackend * GetBackend() const { return backend; }
+
+    // Makes sure that Size bytes can be allocated in one block (e.g., all the buffers of a run):
+    // reserves a region of that size, unless a free block that large is already available.
+    uint32_t Reserve(uint64_t Size, bool Cacheable = false);
+
+    // Allocates a buffer of Size bytes, aligned to DMA_ALIGN. Returns NULL if it does not fit.
+    void * Alloc(uint64_t Size, bool Cacheable = false);
+    // Returns a buffer given by Alloc(). Returns false if it is not a buffer of the arena.
+    bool Free(void * VirtAddr);
+    // Same as Alloc(), with a handle that frees the buffer.
+    CDmaBuffer Allocate(uint64_t Size, bool Cacheable = false);
+
+    // Physical address of any address inside a region (0 if it is not in the arena).
+    uint64_t PhysAddr(const void * VirtAddr) const;
+
+    // Cache maintenance of a range inside a buffer (nothing if its region is not cacheable).
+    void Flush(const void * VirtAddr, uint64_t Size) const { Maintain(VirtAddr, Size, true); }
+    void Invalidate(const void * VirtAddr, uint64_t Size) const { Maintain(VirtAddr, Size, false); }
+
+    // Returns all the regions to the backend. Buffers still allocated are lost (returns their number).
+    uint32_t Release();
+
+    TStats GetStats() const;
+};
+
+#endif  // CDMAARENA_HPP
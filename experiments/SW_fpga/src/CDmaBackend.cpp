@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/dma-heap.h>
+#include <linux/dma-buf.h>
+#include <iterator>
+#include <map>
+#include <string>
+#include "CDmaBackend.hpp"
+#ifndef NO_LIBXLNK
+extern "C" {
+#include <libxlnk_cma.h>  // Required for memory-mapping functions from Xilinx
+}
+#endif
+
+#define PAGE_BYTES 4096       // Alignment of the regions of the mapped backends (a page)
+#define CMA_MAX_RANGE (1u << 30)  // Largest range of a cache operation of the library (32-bit sizes)
+#define DMA_HEAP_DIR "/dev/dma_heap/"
+#define UDMABUF_SYSFS "/sys/class/u-dma-buf/"
+#define UDMABUF_TO_DEVICE 1   // sync_direction of the u-dma-buf driver (DMA_TO_DEVICE)
+#define UDMABUF_FROM_DEVICE 2 // (DMA_FROM_DEVICE)
+#define PAGEMAP_PFN_MASK ((1ull << 55) - 1)
+
+///////////////////////////////////////////////////////////////////////////////
+CDmaBackend * CDmaBackend::Create(const char * Spec)
+{
+  std::string name(Spec), args;
+  size_t colon = name.find(':');
+
+  if (colon != std::string::npos) {
+    args = name.substr(colon + 1);
+    name.resize(colon);
+  }
+
+#ifndef NO_LIBXLNK
+  if (name == "cma")
+    return new CCmaBackend();
+#endif
+  if (name == "memfd")
+    return new CMemfdBackend();
+  if (name == "dma-heap") {
+    size_t comma = args.find(',');
+    std::string heap = args.substr(0, comma), uncached = (comma != std::string::npos) ? args.substr(comma + 1) : "";
+    CDmaHeapBackend * backend = new CDmaHeapBackend(heap.empty() ? "linux,cma" : heap.c_str(), uncached.c_str());
+    if (!backend->Open()) {
+      delete backend;
+      return NULL;
+    }
+    return backend;
+  }
+  if (name == "udmabuf") {
+    CUdmaBufBackend * backend = new CUdmaBufBackend(args.empty() ? "udmabuf0" : args.c_str());
+    if (!backend->Open()) {
+      delete backend;
+      return NULL;
+    }
+    return backend;
+  }
+  printf("Error: Unknown DMA backend %s.\n", Spec);
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Physical address of a mapping, if its pages are contiguous (0 otherwise).
+static uint64_t ContiguousPhysAddr(char * VirtAddr, uint64_t Size)
+{
+  uint64_t pages = (Size + PAGE_BYTES - 1) / PAGE_BYTES;
+  uint64_t * entries = (uint64_t *)malloc(pages * sizeof(uint64_t));
+  uint64_t phys = 0;
+  int fd = open("/proc/self/pagemap", O_RDONLY);
+
+  // The pages must be present for their entries to be read.
+  for (uint64_t p = 0; p < pages; ++p)
+    *(volatile char *)(VirtAddr + p * PAGE_BYTES);
+  if (fd >= 0 && entries != NULL &&
+      pread(fd, entries, pages * sizeof(uint64_t), (uint64_t)VirtAddr / PAGE_BYTES * sizeof(uint64_t)) ==
+        (ssize_t)(pages * sizeof(uint64_t))) {
+    uint64_t first = entries[0] & PAGEMAP_PFN_MASK, p = 1;
+    while (p < pages && (entries[p] & PAGEMAP_PFN_MASK) == first + p)
+      ++p;
+    if (first != 0 && p == pages)
+      phys = first * PAGE_BYTES;
+  }
+  if (fd >= 0)
+    close(fd);
+  free(entries);
+  return phys;
+}
+
+#ifndef NO_LIBXLNK
+///////////////////////////////////////////////////////////////////////////////
+void * CCmaBackend::Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr)
+{
+  void * virtAddr;
+
+  // The library takes 32-bit sizes.
+  if (Size == 0 || Size > UINT32_MAX)
+    return NULL;
+  virtAddr = cma_alloc(Size, Cacheable ? 1 : 0);
+  if ((int64_t)virtAddr == -1)
+    return NULL;
+  PhysAddr = cma_get_phy_addr(virtAddr);
+  if (PhysAddr == 0) {
+    cma_free(virtAddr);
+    return NULL;
+  }
+  return virtAddr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCmaBackend::Free(void * VirtAddr, uint64_t /*Size*/)
+{
+  cma_free(VirtAddr);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCmaBackend::Flush(void * VirtAddr, uint64_t PhysAddr, uint64_t Size)
+{
+  for (uint64_t done = 0; done < Size; done += CMA_MAX_RANGE) {
+    uint64_t bytes = (Size - done < CMA_MAX_RANGE) ? Size - done : CMA_MAX_RANGE;
+    cma_flush_cache((char *)VirtAddr + done, PhysAddr + done, bytes);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CCmaBackend::Invalidate(void * VirtAddr, uint64_t PhysAddr, uint64_t Size)
+{
+  for (uint64_t done = 0; done < Size; done += CMA_MAX_RANGE) {
+    uint64_t bytes = (Size - done < CMA_MAX_RANGE) ? Size - done : CMA_MAX_RANGE;
+    cma_invalidate_cache((char *)VirtAddr + done, PhysAddr + done, bytes);
+  }
+}
+#endif  // NO_LIBXLNK
+
+///////////////////////////////////////////////////////////////////////////////
+CDmaHeapBackend::~CDmaHeapBackend()
+{
+  for (auto & region : regions) {
+    munmap(region.first, region.second.size);
+    close(region.second.fd);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CDmaHeapBackend::Open()
+{
+  std::string path = DMA_HEAP_DIR + heap;
+
+  if (access(path.c_str(), R_OK) != 0) {
+    printf("Error: The dma-heap %s cannot be opened.\n", path.c_str());
+    return false;
+  }
+  path = DMA_HEAP_DIR + uncachedHeap;
+  if (!uncachedHeap.empty() && access(path.c_str(), R_OK) != 0) {
+    printf("Error: The dma-heap %s cannot be opened.\n", path.c_str());
+    return false;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void * CDmaHeapBackend::Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr)
+{
+  struct dma_heap_allocation_data data;
+  std::string path = DMA_HEAP_DIR + (Cacheable ? heap : uncachedHeap);
+  uint64_t bytes = (Size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+  char * virtAddr;
+  int fd;
+
+  if (!Cacheable && uncachedHeap.empty()) {
+    printf("Error: The dma-heap %s only gives cacheable memory (--dma=dma-heap:%s,<uncached heap>).\n",
+      heap.c_str(), heap.c_str());
+    return NULL;
+  }
+  if (bytes == 0 || (fd = open(path.c_str(), O_RDONLY | O_CLOEXEC)) < 0)
+    return NULL;
+  memset(&data, 0, sizeof(data));
+  data.len = bytes;
+  data.fd_flags = O_RDWR | O_CLOEXEC;
+  if (ioctl(fd, DMA_HEAP_IOCTL_ALLOC, &data) != 0) {
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  virtAddr = (char *)mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, data.fd, 0);
+  if (virtAddr == MAP_FAILED) {
+    close(data.fd);
+    return NULL;
+  }
+  PhysAddr = ContiguousPhysAddr(virtAddr, bytes);
+  if (PhysAddr == 0) {
+    printf("Error: The physical address of a buffer of the dma-heap %s cannot be read, or it is not contiguous.\n",
+      path.c_str());
+    munmap(virtAddr, bytes);
+    close(data.fd);
+    return NULL;
+  }
+  regions[virtAddr] = {(int)data.fd, bytes};
+  return virtAddr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaHeapBackend::Free(void * VirtAddr, uint64_t /*Size*/)
+{
+  auto it = regions.find((char *)VirtAddr);
+
+  if (it == regions.end())
+    return;
+  munmap(it->first, it->second.size);
+  close(it->second.fd);
+  regions.erase(it);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// dma-buf of the region that contains the address (-1: none).
+int CDmaHeapBackend::Region(void * VirtAddr) const
+{
+  auto it = regions.upper_bound((char *)VirtAddr);
+
+  if (it == regions.begin())
+    return -1;
+  --it;
+  return ((char *)VirtAddr < it->first + it->second.size) ? it->second.fd : -1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CDmaHeapBackend::Sync(void * VirtAddr, uint64_t Flags) const
+{
+  struct dma_buf_sync sync;
+  int fd = Region(VirtAddr);
+
+  if (fd < 0)
+    return;
+  sync.flags = Flags;
+  if (ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) != 0)
+    printf("Warning: The cache maintenance of a dma-buf failed.\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The end of a CPU write access cleans the caches for the device.
+void CDmaHeapBackend::Flush(void * VirtAddr, uint64_t /*PhysAddr*/, uint64_t /*Size*/)
+{
+  Sync(VirtAddr, DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The start of a CPU read access invalidates the caches.
+void CDmaHeapBackend::Invalidate(void * VirtAddr, uint64_t /*PhysAddr*/, uint64_t /*Size*/)
+{
+  Sync(VirtAddr, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CUdmaBufBackend::~CUdmaBufBackend()
+{
+  if (cached != NULL)
+    munmap(cached, size);
+  if (uncached != NULL)
+    munmap(uncached, size);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CUdmaBufBackend::Open()
+{
+  std::string attrs = UDMABUF_SYSFS + device + "/", path = "/dev/" + device;
+  FILE * fp;
+  int fd;
+
+  fp = fopen((attrs + "phys_addr").c_str(), "r");
+  if (fp == NULL || fscanf(fp, "%lx", &phys) != 1)
+    phys = 0;
+  if (fp != NULL)
+    fclose(fp);
+  fp = fopen((attrs + "size").c_str(), "r");
+  if (fp == NULL || fscanf(fp, "%lu", &size) != 1)
+    size = 0;
+  if (fp != NULL)
+    fclose(fp);
+  if (phys == 0 || size == 0) {
+    printf("Error: The u-dma-buf %s cannot be found (%s).\n", device.c_str(), attrs.c_str());
+    return false;
+  }
+
+  // Without O_SYNC the driver maps the buffer cacheable, with it uncached.
+  for (int sync = 0; sync < 2; ++sync) {
+    char * mapping = (char *)MAP_FAILED;
+    if ((fd = open(path.c_str(), O_RDWR | (sync ? O_SYNC : 0))) >= 0) {
+      mapping = (char *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      close(fd);
+    }
+    if (mapping == MAP_FAILED) {
+      printf("Error: The u-dma-buf %s cannot be mapped.\n", path.c_str());
+      return false;
+    }
+    (sync ? uncached : cached) = mapping;
+  }
+  holes[0] = size / PAGE_BYTES * PAGE_BYTES;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CUdmaBufBackend::Offset(const void * VirtAddr) const
+{
+  if ((const char *)VirtAddr >= uncached && (const char *)VirtAddr < uncached + size)
+    return (const char *)VirtAddr - uncached;
+  return (const char *)VirtAddr - cached;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// First fit in the free blocks of the buffer.
+void * CUdmaBufBackend::Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr)
+{
+  uint64_t bytes = (Size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+
+  for (auto it = holes.begin(); bytes > 0 && it != holes.end(); ++it) {
+    if (it->second < bytes)
+      continue;
+    uint64_t offset = it->first, rest = it->second - bytes;
+    holes.erase(it);
+    if (rest > 0)
+      holes[offset + bytes] = rest;
+    PhysAddr = phys + offset;
+    return (Cacheable ? cached : uncached) + offset;
+  }
+  return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CUdmaBufBackend::Free(void * VirtAddr, uint64_t Size)
+{
+  uint64_t offset = Offset(VirtAddr), bytes = (Size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+  auto next = holes.lower_bound(offset);
+
+  // Coalesced with the neighbouring free blocks.
+  if (next != holes.end() && next->first == offset + bytes) {
+    bytes += next->second;
+    next = holes.erase(next);
+  }
+  if (next != holes.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == offset) {
+      previous->second += bytes;
+      return;
+    }
+  }
+  holes[offset] = bytes;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CUdmaBufBackend::WriteAttr(const char * Attr, uint64_t Value) const
+{
+  std::string path = UDMABUF_SYSFS + device + "/" + Attr;
+  FILE * fp = fopen(path.c_str(), "w");
+  bool ok;
+
+  if (fp == NULL)
+    return false;
+  ok = fprintf(fp, "%lu", Value) > 0;
+  return (fclose(fp) == 0) && ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CUdmaBufBackend::Sync(void * VirtAddr, uint64_t Size, bool ForDevice) const
+{
+  if (!WriteAttr("sync_offset", Offset(VirtAddr)) || !WriteAttr("sync_size", Size) ||
+      !WriteAttr("sync_direction", ForDevice ? UDMABUF_TO_DEVICE : UDMABUF_FROM_DEVICE) ||
+      !WriteAttr(ForDevice ? "sync_for_device" : "sync_for_cpu", 1))
+    printf("Warning: The cache maintenance of the u-dma-buf %s failed.\n", device.c_str());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CUdmaBufBackend::Flush(void * VirtAddr, uint64_t /*PhysAddr*/, uint64_t Size)
+{
+  Sync(VirtAddr, Size, true);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CUdmaBufBackend::Invalidate(void * VirtAddr, uint64_t /*PhysAddr*/, uint64_t Size)
+{
+  Sync(VirtAddr, Size, false);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void * CMemfdBackend::Alloc(uint64_t Size, bool /*Cacheable*/, uint64_t & PhysAddr)
+{
+  uint64_t bytes = (Size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES;
+  void * virtAddr = MAP_FAILED;
+  int fd = (bytes > 0) ? memfd_create("dma-fake", MFD_CLOEXEC) : -1;
+
+  // The mapping keeps the memory: the file is not needed after it. Its pages are zero,
+  // so that runs on the fake are repeatable.
+  if (fd >= 0 && ftruncate(fd, bytes) == 0)
+    virtAddr = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (fd >= 0)
+    close(fd);
+  if (virtAddr == MAP_FAILED)
+    return NULL;
+  PhysAddr = nextPhys;
+  nextPhys += bytes;
+  return virtAddr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CMemfdBackend::Free(void * VirtAddr, uint64_t Size)
+{
+  munmap(VirtAddr, (Size + PAGE_BYTES - 1) / PAGE_BYTES * PAGE_BYTES);
+}
@@ -0,0 +1,138 @@
+#ifndef CDMABACKEND_HPP
+#define CDMABACKEND_HPP
+
+// Requires <stdint.h>, <map>, <string>
+
+//  Source of the physically contiguous memory of the DMA arena (CDmaArena).
+// The arena takes a few large regions from the backend and sub-allocates the
+// buffers in them, so a backend is only called to reserve and release regions,
+// always with the lock of the arena held.
+//
+// Cacheable memory is not coherent with the accelerator: the CPU writes must be
+// flushed (cleaned to memory) before the accelerator reads them, and the CPU copy must
+// be invalidated before the CPU reads what the accelerator wrote.
+//
+// The backend is chosen at runtime with a specification "name[:arguments]" (Create()):
+//   cma                         CMA pool of the PYNQ images (libxlnk_cma)
+//   dma-heap[:heap[,uncached]]  Linux dma-heap (/dev/dma_heap/<heap>, "linux,cma" by default)
+//   udmabuf[:device]            Buffer of the u-dma-buf driver (/dev/<device>, "udmabuf0" by default)
+//   memfd                       Ordinary memory with synthetic physical addresses (no device)
+// Builds without libxlnk_cma (NO_LIBXLNK, e.g., off-board) have no cma backend, and
+// use memfd by default.
+
+#ifdef NO_LIBXLNK
+  #define DEFAULT_DMA_BACKEND "memfd"
+#else
+  #define DEFAULT_DMA_BACKEND "cma"
+#endif
+
+class CDmaBackend {
+  public:
+    virtual ~CDmaBackend() {}
+
+    // Allocates Size bytes of physically contiguous memory. Returns its virtual address,
+    // and its physical (bus) address in PhysAddr, or NULL if it could not be allocated.
+    virtual void * Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr) = 0;
+    virtual void Free(void * VirtAddr, uint64_t Size) = 0;
+    virtual const char * Name() const = 0;
+
+    // Cache maintenance of a range of a cacheable region (nothing to do for coherent memory).
+    virtual void Flush(void * /*VirtAddr*/, uint64_t /*PhysAddr*/, uint64_t /*Size*/) {}
+    virtual void Invalidate(void * /*VirtAddr*/, uint64_t /*PhysAddr*/, uint64_t /*Size*/) {}
+
+    // Backend of the specification (see above), or NULL (with an error message) if it is
+    // unknown or cannot be opened.
+    static CDmaBackend * Create(const char * Spec);
+};
+
+#ifndef NO_LIBXLNK
+// CMA pool of the PYNQ images (libxlnk_cma).
+class CCmaBackend : public CDmaBackend {
+  public:
+    void * Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr);
+    void Free(void * VirtAddr, uint64_t Size);
+    const char * Name() const { return "cma"; }
+    void Flush(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+    void Invalidate(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+};
+#endif
+
+// Linux dma-heap: every region is a dma-buf of the heap, mapped in the process. The
+// physical address is read from /proc/self/pagemap (CAP_SYS_ADMIN), so only heaps of
+// contiguous memory (CMA, carveouts) can be used. The buffers of the heaps are cacheable:
+// uncached regions are taken from a second heap, if one is given. The cache maintenance
+// of dma-bufs has no ranges, it is done on the whole region.
+class CDmaHeapBackend : public CDmaBackend {
+  protected:
+    std::string heap, uncachedHeap;   // Names in /dev/dma_heap
+    struct TRegion {
+      int fd;                         // dma-buf
+      uint64_t size;
+    };
+    std::map<char *, TRegion> regions;  // By mapping
+
+    int Region(void * VirtAddr) const;
+    void Sync(void * VirtAddr, uint64_t Flags) const;
+
+  public:
+    CDmaHeapBackend(const char * Heap, const char * UncachedHeap)
+      : heap(Heap), uncachedHeap(UncachedHeap) {}
+    ~CDmaHeapBackend();
+
+    // Checks that the heaps exist.
+    bool Open();
+
+    void * Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr);
+    void Free(void * VirtAddr, uint64_t Size);
+    const char * Name() const { return "dma-heap"; }
+    void Flush(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+    void Invalidate(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+};
+
+// Buffer of the u-dma-buf driver (a contiguous buffer reserved at boot, with its physical
+// address in sysfs). It is mapped twice, cacheable and uncached (O_SYNC), and the regions
+// are first-fit allocations inside it. The cache maintenance uses the sync attributes of
+// the driver, with ranges.
+class CUdmaBufBackend : public CDmaBackend {
+  protected:
+    std::string device;
+    char * cached;                    // Mappings of the whole buffer
+    char * uncached;
+    uint64_t phys, size;
+    std::map<uint64_t, uint64_t> holes; // Offset -> size of the free blocks
+
+    uint64_t Offset(const void * VirtAddr) const;
+    bool WriteAttr(const char * Attr, uint64_t Value) const;
+    void Sync(void * VirtAddr, uint64_t Size, bool ForDevice) const;
+
+  public:
+    CUdmaBufBackend(const char * Device)
+      : device(Device), cached(NULL), uncached(NULL), phys(0), size(0) {}
+    ~CUdmaBufBackend();
+
+    // Reads the address and size of the buffer and maps it.
+    bool Open();
+
+    void * Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr);
+    void Free(void * VirtAddr, uint64_t Size);
+    const char * Name() const { return "udmabuf"; }
+    void Flush(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+    void Invalidate(void * VirtAddr, uint64_t PhysAddr, uint64_t Size);
+};
+
+// Ordinary memory (memfd) with synthetic physical addresses, for tests and machines
+// without DMA memory. The addresses are unique and contiguous within a region, but no
+// device can use them.
+class CMemfdBackend : public CDmaBackend {
+  protected:
+    uint64_t nextPhys;
+
+  public:
+    CMemfdBackend() : nextPhys(0x100000000ull) {}
+
+    void * Alloc(uint64_t Size, bool Cacheable, uint64_t & PhysAddr);
+    void Free(void * VirtAddr, uint64_t Size);
+    const char * Name() const { return "memfd"; }
+};
+
+#endif  // CDMABACKEND_HPP
@@ -0,0 +1,20 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "sequences.h"
+#include "myers.h"
+#include "CHostMatcher.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+void CHostMatcher::Compute(int32_t t0, int32_t t1, int32_t q0, int32_t q1, uint32_t * output, uint64_t stride) const
+{
+  TPeq peq;
+
+  // The query is the bit-vector: build its match masks once and sweep the targets.
+  for (int32_t q = q0; q < q1; ++q) {
+    BuildPeq(queries->sequences + (uint64_t)q * MAX_SEQ_LENGTH, queries->length[q], peq);
+    for (int32_t t = t0; t < t1; ++t)
+      output[(uint64_t)(t - t0) * stride + (q - q0)] =
+        MyersEndPos(peq, targets->sequences + (uint64_t)t * MAX_SEQ_LENGTH, targets->length[t]);
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef CHOSTMATCHER_HPP
+#define CHOSTMATCHER_HPP
+
+// Requires <stdint.h>, "sequences.h"
+
+//  Host (CPU) engine. Computes the same result as the accelerator (end position
+// of the best match of each query in each target) with the bit-vector model of
+// myers.h, so its output can be merged with the accelerator output.
+
+class CHostMatcher {
+  protected:
+    const SetSequences * targets;
+    const SetSequences * queries;
+
+  public:
+    CHostMatcher(const SetSequences * Targets, const SetSequences * Queries)
+      : targets(Targets), queries(Queries) {}
+    ~CHostMatcher() {}
+
+    const SetSequences * Targets() const { return targets; }
+    const SetSequences * Queries() const { return queries; }
+
+    // Computes targets [t0, t1) x queries [q0, q1). The result of the pair (t, q) is stored in
+    // output[(t - t0) * stride + (q - q0)], i.e., with the same layout the accelerator uses.
+    void Compute(int32_t t0, int32_t t1, int32_t q0, int32_t q1, uint32_t * output, uint64_t stride) const;
+};
+
+#endif  // CHOSTMATCHER_HPP
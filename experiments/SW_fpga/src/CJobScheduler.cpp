@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "util.h"
+#include "CJobScheduler.hpp"
+
+static const char * classNames[JOB_CLASSES] = {"interactive", "normal", "bulk"};
+
+///////////////////////////////////////////////////////////////////////////////
+CJobScheduler::CJobScheduler(int32_t ChunkQueries)
+  : globalPass(0), chunkQueries(ChunkQueries > 0 ? ChunkQueries : 1)
+{
+  static const double defaultWeights[JOB_CLASSES] = {100, 10, 1};
+
+  for (uint32_t c = 0; c < JOB_CLASSES; ++c) {
+    weights[c] = defaultWeights[c];
+    pass[c] = 0;
+    stats[c].jobs = stats[c].chunks = 0;
+    stats[c].busyTime = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJobScheduler::SetWeight(uint32_t cls, double weight)
+{
+  if (cls < JOB_CLASSES && weight > 0)
+    weights[cls] = weight;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJobScheduler::Submit(TJob * job)
+{
+  if (job->cls >= JOB_CLASSES)
+    job->cls = NORMAL;
+  job->next = job->done = 0;
+  // An idle class joins at the current pass: it does not keep credit from its idle time.
+  if (queues[job->cls].empty())
+    pass[job->cls] = std::max(pass[job->cls], globalPass);
+  queues[job->cls].push_back(job);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJobScheduler::Cancel(TJob * job)
+{
+  if (job->cls >= JOB_CLASSES)
+    return;
+  std::deque<TJob *> & queue = queues[job->cls];
+  queue.erase(std::remove(queue.begin(), queue.end(), job), queue.end());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CJobScheduler::Pending() const
+{
+  for (uint32_t c = 0; c < JOB_CLASSES; ++c)
+    if (!queues[c].empty())
+      return true;
+  return false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CJobScheduler::Next(TChunk & chunk)
+{
+  int32_t best = -1;
+
+  // Lowest pass first; ties go to the higher priority class.
+  for (uint32_t c = 0; c < JOB_CLASSES; ++c)
+    if (!queues[c].empty() && (best < 0 || pass[c] < pass[best]))
+      best = c;
+  if (best < 0)
+    return false;
+
+  TJob * job = queues[best].front();
+  chunk.job = job;
+  chunk.q0 = job->next;
+  chunk.count = std::min(chunkQueries, job->nq - job->next);
+  job->next += chunk.count;
+  // The job leaves the queue with its last chunk. It is finished when that chunk is completed.
+  if (job->next >= job->nq)
+    queues[best].pop_front();
+
+  globalPass = pass[best];
+  pass[best] += 1.0 / weights[best];
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CJobScheduler::Complete(const TChunk & chunk, uint64_t busyTime)
+{
+  TJob * job = chunk.job;
+  TClassStats & s = stats[job->cls];
+  struct timespec now;
+
+  ++ s.chunks;
+  s.busyTime += busyTime;
+  job->done += chunk.count;
+  if (job->done < job->nq)
+    return false;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  ++ s.jobs;
+  s.latencies.push_back(CalcTimeDiff(now, job->arrival));
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJobScheduler::PrintStats() const
+{
+  for (uint32_t c = 0; c < JOB_CLASSES; ++c) {
+    const TClassStats & s = stats[c];
+    if (s.jobs == 0)
+      continue;
+    std::vector<uint64_t> sorted(s.latencies);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t sum = 0;
+    for (size_t i = 0; i < sorted.size(); ++i)
+      sum += sorted[i];
+    printf("Class %-11s (weight %g): %u jobs, %u chunks, busy %.3f s, latency mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+      classNames[c], weights[c], s.jobs, s.chunks, s.busyTime / 1e9, sum / 1e6 / sorted.size(),
+      sorted[sorted.size() / 2] / 1e6, sorted[(sorted.size() * 99) / 100] / 1e6, sorted.back() / 1e6);
+  }
+}
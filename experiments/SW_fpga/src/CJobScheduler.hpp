@@ -0,0 +1,77 @@
+#ifndef CJOBSCHEDULER_HPP
+#define CJOBSCHEDULER_HPP
+
+// Requires <stdint.h>, <time.h>, <vector>, <deque>
+
+//  Scheduler of the jobs of several clients sharing the engines. Every job (a
+// batch of queries against the resident targets) is computed in chunks of a few
+// queries, and the next chunk is chosen at every chunk boundary, so that a job
+// of a higher class preempts the running one after at most a chunk.
+//
+// Scheduling:
+// - Jobs belong to a priority class. Within a class, jobs are served in order
+//   of arrival (FIFO), one chunk at a time.
+// - Classes share the engines by weight (stride scheduling): every class with
+//   pending chunks has a pass value that advances by 1 / weight per chunk, and
+//   the class with the lowest pass goes next. A class that was idle restarts
+//   from the current pass, so it cannot accumulate credit. With weights
+//   100:10:1, an interactive job gets ~90% of the chunks while bulk work is
+//   running, and bulk jobs still make progress.
+// - The latency of every job (arrival to last chunk) is kept per class.
+
+#define JOB_CLASSES 3
+
+class CJobScheduler {
+  public:
+    typedef enum {INTERACTIVE = 0, NORMAL = 1, BULK = 2} TClass;
+
+    struct TJob {
+      int32_t nq;               // Queries of the job
+      int32_t next;             // First query not dispatched yet
+      int32_t done;             // Queries computed
+      uint32_t cls;             // TClass
+      struct timespec arrival;
+      void * user;              // Owner data (not used by the scheduler)
+    };
+
+    struct TChunk {
+      TJob * job;
+      int32_t q0, count;        // Queries [q0, q0 + count) of the job
+    };
+
+    struct TClassStats {
+      uint32_t jobs, chunks;
+      uint64_t busyTime;                // Time computing chunks of the class (ns)
+      std::vector<uint64_t> latencies;  // Of the finished jobs (ns)
+    };
+
+  protected:
+    std::deque<TJob *> queues[JOB_CLASSES];
+    double weights[JOB_CLASSES];
+    double pass[JOB_CLASSES];
+    double globalPass;            // Pass of the last chunk dispatched
+    int32_t chunkQueries;
+    TClassStats stats[JOB_CLASSES];
+
+  public:
+    CJobScheduler(int32_t ChunkQueries);
+    ~CJobScheduler() {}
+
+    // Weight of a class (> 0).
+    void SetWeight(uint32_t cls, double weight);
+
+    // Queues a job. The job must stay valid until it is finished or cancelled.
+    void Submit(TJob * job);
+    // Removes a job that is not finished (e.g., its client left). Chunks already dispatched are not undone.
+    void Cancel(TJob * job);
+    // Chooses the next chunk. Returns false if there is no work.
+    bool Next(TChunk & chunk);
+    // Records a computed chunk. Returns true if it was the last one of its job.
+    bool Complete(const TChunk & chunk, uint64_t busyTime);
+
+    bool Pending() const;
+    const TClassStats & GetStats(uint32_t cls) const { return stats[cls]; }
+    void PrintStats() const;
+};
+
+#endif  // CJOBSCHEDULER_HPP
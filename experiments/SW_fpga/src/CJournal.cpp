@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "util.h"
+#include "sequences.h"
+#include "reorder.h"
+#include "CResultWriter.hpp"
+#include "CJournal.hpp"
+
+#define JOURNAL_MAGIC 0x4a514553  // "SEQJ"
+#define JOURNAL_VERSION 1
+
+static const uint64_t FNV_OFFSET = 0xcbf29ce484222325ULL;
+static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+///////////////////////////////////////////////////////////////////////////////
+static uint64_t HashBytes(const void * data, size_t size, uint64_t h)
+{
+  const unsigned char * p = (const unsigned char*)data;
+
+  for (size_t i = 0; i < size; ++i)
+    h = (h ^ p[i]) * FNV_PRIME;
+  return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CJournal::Check(const void * data, size_t size)
+{
+  return HashBytes(data, size, FNV_OFFSET ^ JOURNAL_MAGIC);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CJournal::Fingerprint(const SetSequences * targets, int32_t ntc, const SetSequences * queries,
+  int32_t nqc, const TIndexMap & tMap, const TIndexMap & qMap)
+{
+  uint64_t h = FNV_OFFSET;
+
+  h = HashBytes(targets->length, ntc * sizeof(int32_t), h);
+  for (int32_t t = 0; t < ntc; ++t)
+    h = HashBytes(targets->sequences + (uint64_t)t * MAX_SEQ_LENGTH, targets->length[t], h);
+  h = HashBytes(queries->length, nqc * sizeof(int32_t), h);
+  for (int32_t q = 0; q < nqc; ++q)
+    h = HashBytes(queries->sequences + (uint64_t)q * MAX_SEQ_LENGTH, queries->length[q], h);
+  h = HashBytes(tMap.data(), tMap.size() * sizeof(int32_t), h);
+  h = HashBytes(qMap.data(), qMap.size() * sizeof(int32_t), h);
+  return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CJournal::Create(const char * path, THeader & header)
+{
+  std::string tmp = std::string(path) + ".tmp";
+  std::string dir(path);
+
+  Close();
+  header.magic = JOURNAL_MAGIC;
+  header.version = JOURNAL_VERSION;
+  header.check = Check(&header, offsetof(THeader, check));
+
+  // The header is written aside and renamed: the journal is never seen half-written.
+  int tmpFd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (tmpFd < 0) {
+    printf("Error creating the journal %s\n", tmp.c_str());
+    return ERROR_OPENING_FILE;
+  }
+  if (write(tmpFd, &header, sizeof(header)) != sizeof(header) || fdatasync(tmpFd) != 0 ||
+      rename(tmp.c_str(), path) != 0) {
+    close(tmpFd);
+    unlink(tmp.c_str());
+    printf("Error writing the journal %s\n", path);
+    return ERROR_WRITING;
+  }
+  close(tmpFd);
+  int dirFd = open(dirname(&dir[0]), O_RDONLY | O_DIRECTORY);
+  if (dirFd >= 0) {
+    fsync(dirFd);
+    close(dirFd);
+  }
+
+  fd = open(path, O_WRONLY);
+  if (fd < 0)
+    return ERROR_OPENING_FILE;
+  offset = sizeof(header);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CJournal::ReadHeader(const char * path, THeader & header)
+{
+  int headerFd = open(path, O_RDONLY);
+  bool valid;
+
+  if (headerFd < 0)
+    return NO_JOURNAL;
+  valid = pread(headerFd, &header, sizeof(header), 0) == sizeof(header) && header.magic == JOURNAL_MAGIC &&
+    header.version == JOURNAL_VERSION && header.check == Check(&header, offsetof(THeader, check));
+  close(headerFd);
+  return valid ? OK : NO_JOURNAL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CJournal::Resume(const char * path, THeader & header, std::vector<TEntry> & done)
+{
+  THeader saved;
+  TEntry entry;
+
+  Close();
+  done.clear();
+  fd = open(path, O_RDWR);
+  if (fd < 0)
+    return NO_JOURNAL;
+
+  header.magic = JOURNAL_MAGIC;
+  header.version = JOURNAL_VERSION;
+  header.check = Check(&header, offsetof(THeader, check));
+  if (pread(fd, &saved, sizeof(saved), 0) != sizeof(saved) || memcmp(&saved, &header, sizeof(header)) != 0) {
+    close(fd);
+    fd = -1;
+    return MISMATCH;
+  }
+
+  // Records up to the first invalid one (a commit torn by the interruption).
+  offset = sizeof(saved);
+  while (pread(fd, &entry, sizeof(entry), offset) == sizeof(entry) && entry.check == Check(&entry, offsetof(TEntry, check))) {
+    done.push_back(entry);
+    offset += sizeof(entry);
+  }
+  if (ftruncate(fd, offset) != 0) {
+    close(fd);
+    fd = -1;
+    return ERROR_WRITING;
+  }
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJournal::Start(CResultWriter * Results, uint32_t Interval)
+{
+  results = Results;
+  interval = Interval;
+  stopping = false;
+  error = OK;
+  if (fd >= 0 && !committer.joinable())
+    committer = std::thread(&CJournal::CommitLoop, this);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJournal::Add(int32_t t0, int32_t nt, int32_t block, uint64_t checksum)
+{
+  TEntry entry;
+
+  memset(&entry, 0, sizeof(entry));
+  entry.t0 = t0;
+  entry.nt = nt;
+  entry.block = block;
+  entry.checksum = checksum;
+  entry.check = Check(&entry, offsetof(TEntry, check));
+  std::lock_guard<std::mutex> guard(lock);
+  pending.push_back(entry);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Makes the results of the entries durable, then the entries.
+uint32_t CJournal::Commit(std::vector<TEntry> & entries)
+{
+  struct timespec t1, t2;
+  ssize_t bytes = entries.size() * sizeof(TEntry);
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+  if (results->Sync() != CResultWriter::OK || pwrite(fd, entries.data(), bytes, offset) != bytes || fdatasync(fd) != 0)
+    return ERROR_WRITING;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+  offset += bytes;
+  ++ stats.commits;
+  stats.entries += entries.size();
+  stats.syncTime += CalcTimeDiff(t2, t1);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJournal::CommitLoop()
+{
+  std::vector<TEntry> entries;
+  bool last = false;
+
+  while (!last) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      changed.wait_for(guard, std::chrono::milliseconds(interval), [&]() { return stopping; });
+      last = stopping;
+      entries.swap(pending);
+    }
+    if (!entries.empty() && error == OK)
+      error = Commit(entries);
+    entries.clear();
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CJournal::Close()
+{
+  uint32_t res;
+
+  if (committer.joinable()) {
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      stopping = true;
+    }
+    changed.notify_all();
+    committer.join();
+  }
+  res = error;
+  if (fd >= 0) {
+    close(fd);
+    if (res != OK)
+      printf("Error writing the journal: the last tiles will be computed again if the run is resumed.\n");
+  }
+  fd = -1;
+  pending.clear();
+  error = OK;
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CJournal::ResetStats()
+{
+  stats.commits = stats.entries = 0;
+  stats.syncTime = 0;
+}
@@ -0,0 +1,90 @@
+#ifndef CJOURNAL_HPP
+#define CJOURNAL_HPP
+
+// Requires <stdint.h>, <vector>, <thread>, <mutex>, <condition_variable>, "sequences.h", "reorder.h",
+//   "CResultWriter.hpp"
+
+//  Progress journal of a run, so that an interrupted run can be resumed (--resume)
+// computing only the tiles that are missing in the results file. The journal
+// starts with a header that identifies the run (sizes, tile shape and a fingerprint
+// of the computed sets) and is followed by one record per tile written, with the
+// checksum of its results in the file (CResultWriter).
+//
+// Records are committed in groups by a background thread, every interval: the
+// results file is synced first and then the records are appended and synced, so a
+// record never describes results that are not on the disk. Every record carries
+// its own check value: a record torn by a crash is discarded (with the ones after
+// it) when the journal is loaded. The header is written to a temporary file that is
+// renamed, so a journal is either complete or absent.
+
+class CJournal {
+  public:
+    typedef enum {OK = 0, ERROR_OPENING_FILE = 1, ERROR_WRITING = 2, NO_JOURNAL = 3, MISMATCH = 4} TErrors;
+
+    struct THeader {
+      uint32_t magic, version;
+      int32_t nt, nq;                     // Original targets and queries
+      int32_t ntc, nqc;                   // Computed targets and queries
+      int32_t tileTargets, tileQueries;
+      uint64_t fingerprint;               // Of the computed sets and the index maps (Fingerprint())
+      uint64_t check;
+    };
+
+    struct TEntry {
+      int32_t t0, nt, block;              // Tile (see CTilePlanner::TTile)
+      uint32_t reserved;
+      uint64_t checksum;                  // Of its results in the file (CResultWriter::WriteTile())
+      uint64_t check;
+    };
+
+    struct TStats {
+      uint32_t commits, entries;
+      uint64_t syncTime;                  // Time syncing the results and the journal (ns)
+    };
+
+  protected:
+    int fd;
+    uint64_t offset;                      // End of the valid records
+    std::vector<TEntry> pending;          // Records waiting for the next commit
+    CResultWriter * results;
+    uint32_t interval;                    // Between commits (ms)
+    std::thread committer;
+    std::mutex lock;
+    std::condition_variable changed;
+    bool stopping;
+    uint32_t error;
+    TStats stats;
+
+    static uint64_t Check(const void * data, size_t size);
+    uint32_t Commit(std::vector<TEntry> & entries);
+    void CommitLoop();
+
+  public:
+    CJournal() : fd(-1), offset(0), results(NULL), interval(0), stopping(false), error(OK) { ResetStats(); }
+    ~CJournal() { Close(); }
+
+    // Fingerprint of the computed sets: the sequences [0, ntc) x [0, nqc) and the index maps.
+    static uint64_t Fingerprint(const SetSequences * targets, int32_t ntc, const SetSequences * queries,
+      int32_t nqc, const TIndexMap & tMap, const TIndexMap & qMap);
+
+    // Creates a new journal for the run, replacing the previous one.
+    uint32_t Create(const char * path, THeader & header);
+    // Reads the header of the journal at path, without opening it for the run (e.g., to take
+    // the tile shape of the interrupted run). Returns NO_JOURNAL if there is no valid one.
+    static uint32_t ReadHeader(const char * path, THeader & header);
+    // Opens the journal of an interrupted run and returns the tiles committed. Returns NO_JOURNAL
+    // if there is no journal and MISMATCH if it belongs to another run (sets, sizes or tiles).
+    uint32_t Resume(const char * path, THeader & header, std::vector<TEntry> & done);
+
+    // Starts committing the records every Interval ms. Results is the file they describe.
+    void Start(CResultWriter * Results, uint32_t Interval);
+    // Records a tile whose results were written. Thread-safe.
+    void Add(int32_t t0, int32_t nt, int32_t block, uint64_t checksum);
+    // Commits the pending records and stops. Returns the first error of the commits.
+    uint32_t Close();
+
+    const TStats & GetStats() const { return stats; }
+    void ResetStats();
+};
+
+#endif  // CJOURNAL_HPP
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "sequences.h"
+#include "reorder.h"
+#include "CResultWriter.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// FNV-1a over the values.
+uint64_t CResultWriter::Hash(const uint32_t * data, int32_t count, uint64_t h)
+{
+  for (int32_t i = 0; i < count; ++i)
+    h = (h ^ data[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CResultWriter::Open(const char * path, int32_t Nt, int32_t Nq, const TIndexMap & tMap, int32_t ntc, const TIndexMap & QMap,
+  bool Keep)
+{
+  Close();
+  nt = Nt;
+  nq = Nq;
+  qMap = QMap;
+  tiles = 0;
+
+  // Inverse of the target map (counting sort of the original targets by computed row).
+  rowStart.assign(ntc + 1, 0);
+  rowOrig.resize(nt);
+  for (int32_t t = 0; t < nt; ++t)
+    ++ rowStart[(tMap.empty() ? t : tMap[t]) + 1];
+  for (int32_t r = 0; r < ntc; ++r)
+    rowStart[r + 1] += rowStart[r];
+  std::vector<int32_t> next(rowStart.begin(), rowStart.end() - 1);
+  for (int32_t t = 0; t < nt; ++t)
+    rowOrig[next[tMap.empty() ? t : tMap[t]]++] = t;
+
+  fd = open(path, O_RDWR | O_CREAT | (Keep ? 0 : O_TRUNC), 0644);
+  if (fd < 0) {
+    printf("Error opening the results file %s\n", path);
+    return ERROR_OPENING_FILE;
+  }
+  // The file has its final size from the start: its size does not tell which tiles were written.
+  if (ftruncate(fd, (off_t)nt * nq * sizeof(uint32_t)) != 0) {
+    printf("Error sizing the results file %s\n", path);
+    Close();
+    return ERROR_WRITING;
+  }
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CResultWriter::WriteTile(const uint32_t * output, int32_t t0, int32_t rows, int32_t u0, int32_t nu, int32_t q0, int32_t count,
+  uint64_t * checksum)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  segment.resize(count);
+  staging.resize(nu);
+
+  for (int32_t r = t0; r < t0 + rows; ++r) {
+    // One wide copy of the row: the output may be uncached DMA memory.
+    const uint32_t * src = staging.data();
+    memcpy(staging.data(), output + (uint64_t)(r - t0) * nu, nu * sizeof(uint32_t));
+    const uint32_t * data = src + (q0 - u0);
+    if (!qMap.empty()) {
+      for (int32_t q = 0; q < count; ++q)
+        segment[q] = src[qMap[q0 + q] - u0];
+      data = segment.data();
+    }
+    for (int32_t i = rowStart[r]; i < rowStart[r + 1]; ++i) {
+      uint64_t offset = ((uint64_t)rowOrig[i] * nq + q0) * sizeof(uint32_t);
+      ssize_t bytes = (ssize_t)count * sizeof(uint32_t);
+      if (pwrite(fd, data, bytes, offset) != bytes)
+        return ERROR_WRITING;
+      if (checksum != NULL)
+        h = Hash(data, count, h);
+    }
+  }
+  if (checksum != NULL)
+    *checksum = h;
+  ++ tiles;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CResultWriter::Checksum(int32_t t0, int32_t rows, int32_t q0, int32_t count, uint64_t & checksum)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+
+  segment.resize(count);
+  for (int32_t r = t0; r < t0 + rows; ++r) {
+    for (int32_t i = rowStart[r]; i < rowStart[r + 1]; ++i) {
+      uint64_t offset = ((uint64_t)rowOrig[i] * nq + q0) * sizeof(uint32_t);
+      ssize_t bytes = (ssize_t)count * sizeof(uint32_t);
+      if (pread(fd, segment.data(), bytes, offset) != bytes)
+        return ERROR_READING;
+      h = Hash(segment.data(), count, h);
+    }
+  }
+  checksum = h;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CResultWriter::Sync()
+{
+  if (fd < 0 || fdatasync(fd) != 0)
+    return ERROR_WRITING;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CResultWriter::Read(int32_t t, int32_t q, uint32_t & value) const
+{
+  uint64_t offset = ((uint64_t)t * nq + q) * sizeof(uint32_t);
+
+  if (pread(fd, &value, sizeof(value), offset) != sizeof(value))
+    return ERROR_READING;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CResultWriter::Close()
+{
+  if (fd >= 0)
+    close(fd);
+  fd = -1;
+}
@@ -0,0 +1,58 @@
+#ifndef CRESULTWRITER_HPP
+#define CRESULTWRITER_HPP
+
+// Requires <stdint.h>, <vector>, "reorder.h"
+
+//  Writes the results of the tiles to a file with the whole target x query matrix
+// in the original order of the sequences (uint32_t, row-major: (t * nq + q) * 4).
+// Tiles are computed on the reordered/collapsed sets: the index maps give the
+// computed position of every original sequence. Every original target of a tile
+// is written with a single pwrite() of the original queries of the tile, which
+// must be a contiguous range of original queries. The checksum of the results of
+// a tile can be computed as they are written and read back later (CJournal).
+// The output of a tile may be in uncached DMA memory: each row is read once, with a
+// single copy to a cached row, and the results are gathered and written from there.
+
+class CResultWriter {
+  public:
+    typedef enum {OK = 0, ERROR_OPENING_FILE = 1, ERROR_WRITING = 2, ERROR_READING = 3} TErrors;
+
+  protected:
+    int fd;
+    int32_t nt, nq;                 // Original targets and queries
+    std::vector<int32_t> rowStart;  // Original targets of the computed target r:
+    std::vector<int32_t> rowOrig;   //   rowOrig[rowStart[r] .. rowStart[r + 1])
+    TIndexMap qMap;
+    std::vector<uint32_t> segment;
+    std::vector<uint32_t> staging;  // Row of the tile being written
+    uint32_t tiles;                 // Tiles written since Open()
+
+    static uint64_t Hash(const uint32_t * data, int32_t count, uint64_t h);
+
+  public:
+    CResultWriter() : fd(-1), nt(0), nq(0), tiles(0) {}
+    ~CResultWriter() { Close(); }
+
+    // Creates the file for Nt x Nq results, with its final size. tMap and QMap map the original sequences to the
+    // computed ones (empty: identity), ntc is the number of computed targets. With Keep, the
+    // results already in the file are preserved (resumed run).
+    uint32_t Open(const char * path, int32_t Nt, int32_t Nq, const TIndexMap & tMap, int32_t ntc, const TIndexMap & QMap,
+      bool Keep = false);
+    // Writes the computed targets [t0, t0 + rows) x computed queries [u0, u0 + nu), with the layout
+    // output[(t - t0) * nu + (q - u0)]. They hold the original queries [q0, q0 + count).
+    // If checksum is not NULL, it receives the checksum of the results written.
+    uint32_t WriteTile(const uint32_t * output, int32_t t0, int32_t rows, int32_t u0, int32_t nu, int32_t q0, int32_t count,
+      uint64_t * checksum = NULL);
+    // Checksum of the results of the computed targets [t0, t0 + rows) x original queries [q0, q0 + count)
+    // in the file, as returned by WriteTile().
+    uint32_t Checksum(int32_t t0, int32_t rows, int32_t q0, int32_t count, uint64_t & checksum);
+    // Makes the results written so far durable.
+    uint32_t Sync();
+    // Reads back the result of the original pair (t, q).
+    uint32_t Read(int32_t t, int32_t q, uint32_t & value) const;
+    // Tiles written successfully since Open().
+    uint32_t TilesWritten() const { return tiles; }
+    void Close();
+};
+
+#endif  // CRESULTWRITER_HPP
@@ -0,0 +1,241 @@
+#ifndef CRINGQUEUE_HPP
+#define CRINGQUEUE_HPP
+
+// Requires <stdint.h>, <time.h>, <atomic>, <vector>, <thread>, <chrono>, "util.h"
+
+//  Bounded lock-free queues that connect the stages of a pipeline (CStagePipeline).
+// CSpscRing is a ring for a single producer and a single consumer: each side owns
+// one index and only reads the other one. CMpmcRing accepts any number of producers
+// and consumers: every cell carries a sequence number that tells whether it is
+// ready to be written or read in the current lap of the ring (Vyukov's queue).
+//
+// Push() and Pop() block while the ring is full or empty, spinning first and then
+// sleeping. Once the ring is closed, a blocked Push() fails, and Pop() fails when
+// the remaining items are drained. The time spent blocked is counted in the
+// statistics of the ring: a producer waiting for space is backpressure from the
+// next stage, a consumer waiting for items is starved by the previous one.
+
+#define RING_SPIN_TRIES 64      // Tries before yielding the processor
+#define RING_YIELD_TRIES 256    // Tries before sleeping
+#define RING_SLEEP_US 50
+
+// Non-template part of the rings: closing and statistics.
+class CRing {
+  public:
+    struct TStats {
+      std::atomic<uint64_t> pushes, pops;
+      std::atomic<uint64_t> pushWaits, popWaits;        // Operations that found the ring full / empty
+      std::atomic<uint64_t> pushWaitTime, popWaitTime;  // Time blocked on them (ns)
+    };
+
+  protected:
+    std::atomic<bool> closed;
+    TStats stats;
+
+    // Backoff of a blocked operation after the given number of failed tries.
+    static void Backoff(uint32_t tries) {
+      if (tries < RING_SPIN_TRIES)
+        return;
+      if (tries < RING_YIELD_TRIES)
+        std::this_thread::yield();
+      else
+        std::this_thread::sleep_for(std::chrono::microseconds(RING_SLEEP_US));
+    }
+    static void Blocked(std::atomic<uint64_t> & waits, std::atomic<uint64_t> & waitTime, const struct timespec & start) {
+      struct timespec end;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+      waits.fetch_add(1, std::memory_order_relaxed);
+      waitTime.fetch_add(CalcTimeDiff(end, start), std::memory_order_relaxed);
+    }
+
+  public:
+    CRing() : closed(false) { ResetStats(); }
+    virtual ~CRing() {}
+
+    // Wakes up the blocked operations: Push() fails if the ring is full and Pop() if it is empty.
+    void Close() { closed.store(true, std::memory_order_release); }
+    bool Closed() const { return closed.load(std::memory_order_acquire); }
+
+    const TStats & GetStats() const { return stats; }
+    void ResetStats() {
+      stats.pushes = stats.pops = 0;
+      stats.pushWaits = stats.popWaits = 0;
+      stats.pushWaitTime = stats.popWaitTime = 0;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <class T> class CSpscRing : public CRing {
+  protected:
+    std::vector<T> items;
+    uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head;  // Next item to pop (written by the consumer)
+    alignas(64) std::atomic<uint64_t> tail;  // Next free cell (written by the producer)
+
+  public:
+    // The capacity is rounded up to a power of 2.
+    CSpscRing(uint32_t Capacity) : head(0), tail(0) {
+      uint64_t size = 1;
+      while (size < Capacity)
+        size <<= 1;
+      items.resize(size);
+      mask = size - 1;
+    }
+
+    bool TryPush(const T & item) {
+      uint64_t t = tail.load(std::memory_order_relaxed);
+      if (t - head.load(std::memory_order_acquire) > mask)
+        return false;
+      items[t & mask] = item;
+      tail.store(t + 1, std::memory_order_release);
+      stats.pushes.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    bool TryPop(T & item) {
+      uint64_t h = head.load(std::memory_order_relaxed);
+      if (h == tail.load(std::memory_order_acquire))
+        return false;
+      item = items[h & mask];
+      head.store(h + 1, std::memory_order_release);
+      stats.pops.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    bool Push(const T & item) {
+      struct timespec start;
+      uint32_t tries = 0;
+      if (TryPush(item))
+        return true;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      while (!TryPush(item)) {
+        if (Closed()) {
+          Blocked(stats.pushWaits, stats.pushWaitTime, start);
+          return false;
+        }
+        Backoff(++ tries);
+      }
+      Blocked(stats.pushWaits, stats.pushWaitTime, start);
+      return true;
+    }
+
+    bool Pop(T & item) {
+      struct timespec start;
+      uint32_t tries = 0;
+      if (TryPop(item))
+        return true;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      while (!TryPop(item)) {
+        // Closed and empty: the items pushed before Close() are still delivered.
+        if (Closed() && !TryPop(item)) {
+          Blocked(stats.popWaits, stats.popWaitTime, start);
+          return false;
+        }
+        Backoff(++ tries);
+      }
+      Blocked(stats.popWaits, stats.popWaitTime, start);
+      return true;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+template <class T> class CMpmcRing : public CRing {
+  protected:
+    struct TCell {
+      std::atomic<uint64_t> sequence;  // pos: free for the push of pos; pos + 1: ready for its pop
+      T item;
+    };
+
+    std::vector<TCell> cells;
+    uint64_t mask;
+    alignas(64) std::atomic<uint64_t> head;  // Next pop
+    alignas(64) std::atomic<uint64_t> tail;  // Next push
+
+  public:
+    // The capacity is rounded up to a power of 2.
+    CMpmcRing(uint32_t Capacity) : head(0), tail(0) {
+      uint64_t size = 1;
+      while (size < Capacity)
+        size <<= 1;
+      cells = std::vector<TCell>(size);
+      for (uint64_t i = 0; i < size; ++i)
+        cells[i].sequence.store(i, std::memory_order_relaxed);
+      mask = size - 1;
+    }
+
+    bool TryPush(const T & item) {
+      uint64_t pos = tail.load(std::memory_order_relaxed);
+      for (;;) {
+        TCell & cell = cells[pos & mask];
+        int64_t diff = (int64_t)cell.sequence.load(std::memory_order_acquire) - (int64_t)pos;
+        if (diff == 0) {
+          if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.item = item;
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            stats.pushes.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;  // Full: the cell still holds the item of the previous lap
+        } else {
+          pos = tail.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    bool TryPop(T & item) {
+      uint64_t pos = head.load(std::memory_order_relaxed);
+      for (;;) {
+        TCell & cell = cells[pos & mask];
+        int64_t diff = (int64_t)cell.sequence.load(std::memory_order_acquire) - (int64_t)(pos + 1);
+        if (diff == 0) {
+          if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            item = cell.item;
+            cell.sequence.store(pos + mask + 1, std::memory_order_release);
+            stats.pops.fetch_add(1, std::memory_order_relaxed);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;  // Empty
+        } else {
+          pos = head.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    bool Push(const T & item) {
+      struct timespec start;
+      uint32_t tries = 0;
+      if (TryPush(item))
+        return true;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      while (!TryPush(item)) {
+        if (Closed()) {
+          Blocked(stats.pushWaits, stats.pushWaitTime, start);
+          return false;
+        }
+        Backoff(++ tries);
+      }
+      Blocked(stats.pushWaits, stats.pushWaitTime, start);
+      return true;
+    }
+
+    bool Pop(T & item) {
+      struct timespec start;
+      uint32_t tries = 0;
+      if (TryPop(item))
+        return true;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      while (!TryPop(item)) {
+        if (Closed() && !TryPop(item)) {
+          Blocked(stats.popWaits, stats.popWaitTime, start);
+          return false;
+        }
+        Backoff(++ tries);
+      }
+      Blocked(stats.popWaits, stats.popWaitTime, start);
+      return true;
+    }
+};
+
+#endif  // CRINGQUEUE_HPP
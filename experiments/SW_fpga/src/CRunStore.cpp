@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "sequences.h"
+#include "CRunStore.hpp"
+
+#define STORE_MAGIC 0x53514553  // "SEQS"
+#define STORE_VERSION 1
+#define COPY_BLOCK (1 << 20)
+
+// Index of a stored run, followed by the hashes of its targets and queries.
+struct TStoreIndex {
+  uint32_t magic, version;
+  int32_t nt, nq;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CRunStore::HashBytes(const void * data, size_t size, uint64_t h)
+{
+  const unsigned char * p = (const unsigned char*)data;
+
+  for (size_t i = 0; i < size; ++i)
+    h = (h ^ p[i]) * 0x100000001b3ULL;
+  return h;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CRunStore::HashSet(const SetSequences * set, int32_t n, std::vector<uint64_t> & hashes)
+{
+  hashes.resize(n);
+  for (int32_t i = 0; i < n; ++i) {
+    uint64_t h = HashBytes(&set->length[i], sizeof(int32_t), 0xcbf29ce484222325ULL);
+    hashes[i] = HashBytes(set->sequences + (uint64_t)i * MAX_SEQ_LENGTH, set->length[i], h);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::string CRunStore::Name(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes)
+{
+  char name[64];
+
+  snprintf(name, sizeof(name), "%016lx-%016lx", (unsigned long)HashBytes(tHashes.data(), tHashes.size() * sizeof(uint64_t),
+    0xcbf29ce484222325ULL), (unsigned long)HashBytes(qHashes.data(), qHashes.size() * sizeof(uint64_t), 0xcbf29ce484222325ULL));
+  return name;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CRunStore::Copy(const char * from, const char * to)
+{
+  std::vector<char> buffer(COPY_BLOCK);
+  uint32_t res = OK;
+  ssize_t n;
+
+  int in = open(from, O_RDONLY);
+  if (in < 0)
+    return ERROR_OPENING_FILE;
+  int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    close(in);
+    return ERROR_OPENING_FILE;
+  }
+  while (res == OK && (n = read(in, buffer.data(), buffer.size())) > 0)
+    if (write(out, buffer.data(), n) != n)
+      res = ERROR_WRITING;
+  if (n < 0)
+    res = ERROR_READING;
+  close(in);
+  close(out);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CRunStore::ReadEntry(const std::string & name, int32_t & nt, int32_t & nq, std::vector<uint64_t> & hashes) const
+{
+  TStoreIndex index;
+  struct stat info;
+
+  int fd = open(File(name, ".idx").c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  bool valid = read(fd, &index, sizeof(index)) == sizeof(index) && index.magic == STORE_MAGIC &&
+    index.version == STORE_VERSION && index.nt > 0 && index.nq > 0;
+  if (valid) {
+    hashes.resize((uint64_t)index.nt + index.nq);
+    ssize_t bytes = hashes.size() * sizeof(uint64_t);
+    valid = read(fd, hashes.data(), bytes) == bytes;
+  }
+  close(fd);
+  // The results must have the size of the matrix.
+  valid = valid && stat(File(name, ".bin").c_str(), &info) == 0 &&
+    (uint64_t)info.st_size == (uint64_t)index.nt * index.nq * sizeof(uint32_t);
+  nt = index.nt;
+  nq = index.nq;
+  return valid;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CRunStore::Find(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes, TMatch & match) const
+{
+  DIR * d = opendir(dir.c_str());
+  struct dirent * entry;
+  std::vector<uint64_t> hashes;
+  int32_t nt, nq;
+
+  match.reused = 0;
+  if (d == NULL)
+    return NOT_FOUND;
+  while ((entry = readdir(d)) != NULL) {
+    std::string file(entry->d_name);
+    if (file.size() < 5 || file.compare(file.size() - 4, 4, ".idx") != 0)
+      continue;
+    std::string name = file.substr(0, file.size() - 4);
+    if (!ReadEntry(name, nt, nq, hashes))
+      continue;
+
+    // Sequences of the new sets found in the stored run (the first copy of a duplicate).
+    std::unordered_map<uint64_t, int32_t> rows, cols;
+    std::vector<int32_t> tOld(tHashes.size(), -1), qOld(qHashes.size(), -1);
+    uint64_t knownT = 0, knownQ = 0;
+    for (int32_t t = 0; t < nt; ++t)
+      rows.insert(std::make_pair(hashes[t], t));
+    for (int32_t q = 0; q < nq; ++q)
+      cols.insert(std::make_pair(hashes[nt + q], q));
+    for (size_t t = 0; t < tHashes.size(); ++t) {
+      auto it = rows.find(tHashes[t]);
+      if (it != rows.end()) {
+        tOld[t] = it->second;
+        ++ knownT;
+      }
+    }
+    for (size_t q = 0; q < qHashes.size(); ++q) {
+      auto it = cols.find(qHashes[q]);
+      if (it != cols.end()) {
+        qOld[q] = it->second;
+        ++ knownQ;
+      }
+    }
+    if (knownT * knownQ > match.reused) {
+      match.base = name;
+      match.nt = nt;
+      match.nq = nq;
+      match.tOld.swap(tOld);
+      match.qOld.swap(qOld);
+      match.reused = knownT * knownQ;
+    }
+  }
+  closedir(d);
+  return (match.reused > 0) ? OK : NOT_FOUND;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CRunStore::Stitch(const TMatch & match, int32_t nt, int32_t nq, const char * rows, const char * cols, const char * output) const
+{
+  std::vector<int32_t> newQueries;      // Column in cols of every new query
+  std::vector<uint32_t> oldRow(match.nq), out(nq), colRow;
+  int32_t nb = 0, newRank = 0, knownRank = 0;
+  uint32_t res = OK;
+  int fdRows = -1, fdCols = -1;
+
+  newQueries.resize(nq, -1);
+  for (int32_t q = 0; q < nq; ++q)
+    if (match.qOld[q] < 0)
+      newQueries[q] = nb++;
+  colRow.resize(nb);
+
+  int fdOld = open(File(match.base, ".bin").c_str(), O_RDONLY);
+  int fdOut = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (rows != NULL)
+    fdRows = open(rows, O_RDONLY);
+  if (cols != NULL && nb > 0)
+    fdCols = open(cols, O_RDONLY);
+  if (fdOld < 0 || fdOut < 0 || (rows != NULL && fdRows < 0) || (cols != NULL && nb > 0 && fdCols < 0))
+    res = ERROR_OPENING_FILE;
+
+  for (int32_t t = 0; t < nt && res == OK; ++t) {
+    ssize_t bytes = (ssize_t)nq * sizeof(uint32_t);
+    if (match.tOld[t] < 0) {
+      // New target: the whole row was computed.
+      if (fdRows < 0 || pread(fdRows, out.data(), bytes, (uint64_t)newRank++ * bytes) != bytes)
+        res = ERROR_READING;
+    } else {
+      ssize_t oldBytes = (ssize_t)match.nq * sizeof(uint32_t), colBytes = (ssize_t)nb * sizeof(uint32_t);
+      if (pread(fdOld, oldRow.data(), oldBytes, (uint64_t)match.tOld[t] * oldBytes) != oldBytes ||
+          (nb > 0 && pread(fdCols, colRow.data(), colBytes, (uint64_t)knownRank * colBytes) != colBytes))
+        res = ERROR_READING;
+      for (int32_t q = 0; q < nq; ++q)
+        out[q] = (match.qOld[q] >= 0) ? oldRow[match.qOld[q]] : colRow[newQueries[q]];
+      ++ knownRank;
+    }
+    if (res == OK && write(fdOut, out.data(), bytes) != bytes)
+      res = ERROR_WRITING;
+  }
+
+  if (fdOld >= 0)
+    close(fdOld);
+  if (fdOut >= 0)
+    close(fdOut);
+  if (fdRows >= 0)
+    close(fdRows);
+  if (fdCols >= 0)
+    close(fdCols);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CRunStore::Save(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes, const char * results,
+  const std::string & base)
+{
+  std::string name = Name(tHashes, qHashes);
+  std::string tmp = File(name, ".idx.tmp");
+  TStoreIndex index = {STORE_MAGIC, STORE_VERSION, (int32_t)tHashes.size(), (int32_t)qHashes.size()};
+  ssize_t tBytes = tHashes.size() * sizeof(uint64_t), qBytes = qHashes.size() * sizeof(uint64_t);
+
+  // The results first, durable: an index is only visible with complete results.
+  // The caller only saves results where every tile (or stitched row) was written.
+  int fd = open(results, O_RDONLY);
+  if (fd < 0)
+    return ERROR_OPENING_FILE;
+  bool synced = fsync(fd) == 0;
+  close(fd);
+  if (!synced || rename(results, File(name, ".bin").c_str()) != 0)
+    return ERROR_WRITING;
+  fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return ERROR_OPENING_FILE;
+  bool written = write(fd, &index, sizeof(index)) == sizeof(index) && write(fd, tHashes.data(), tBytes) == tBytes &&
+    write(fd, qHashes.data(), qBytes) == qBytes && fsync(fd) == 0;
+  close(fd);
+  if (!written || rename(tmp.c_str(), File(name, ".idx").c_str()) != 0) {
+    unlink(tmp.c_str());
+    return ERROR_WRITING;
+  }
+
+  // The run it was built from is only removed once the new entry reads back complete.
+  std::vector<uint64_t> hashes;
+  int32_t nt, nq;
+  if (!ReadEntry(name, nt, nq, hashes) || nt != index.nt || nq != index.nq ||
+      memcmp(hashes.data(), tHashes.data(), tBytes) != 0 || memcmp(hashes.data() + nt, qHashes.data(), qBytes) != 0) {
+    unlink(File(name, ".idx").c_str());
+    unlink(File(name, ".bin").c_str());
+    return ERROR_WRITING;
+  }
+  if (!base.empty() && base != name) {
+    unlink(File(base, ".idx").c_str());
+    unlink(File(base, ".bin").c_str());
+  }
+  return OK;
+}
@@ -0,0 +1,62 @@
+#ifndef CRUNSTORE_HPP
+#define CRUNSTORE_HPP
+
+// Requires <stdint.h>, <vector>, <string>, "sequences.h"
+
+//  Persistent store of the results of previous runs, for incremental updates of the
+// target (or query) database. Every run is stored as its results matrix (layout of
+// scores.bin) and an index with the content hash of every target and query, and is
+// named after the hashes of both sets.
+//
+// For a new run, the stored run that shares the most pairs with it is found by
+// matching the sequences by hash, so appended (or reordered) sequences are
+// recognized. Only the pairs of new targets (all the queries) and of known targets
+// with new queries have to be computed: Stitch() assembles the full matrix from
+// the stored run and the two delta blocks. The stitched run replaces the one it
+// was built from.
+
+class CRunStore {
+  public:
+    typedef enum {OK = 0, ERROR_OPENING_FILE = 1, ERROR_READING = 2, ERROR_WRITING = 3, NOT_FOUND = 4} TErrors;
+
+    struct TMatch {
+      std::string base;               // Name of the stored run
+      int32_t nt, nq;                 // Its targets and queries
+      std::vector<int32_t> tOld;      // Row of every new target in the stored run (-1: not there)
+      std::vector<int32_t> qOld;      // Column of every new query in the stored run (-1: not there)
+      uint64_t reused;                // Pairs available in the stored run
+    };
+
+  protected:
+    std::string dir;
+
+    static uint64_t HashBytes(const void * data, size_t size, uint64_t h);
+    // Reads the index of a stored run. False if it is not valid or its results do not have the size of the matrix.
+    bool ReadEntry(const std::string & name, int32_t & nt, int32_t & nq, std::vector<uint64_t> & hashes) const;
+
+  public:
+    CRunStore(const char * Dir) : dir(Dir) {}
+    ~CRunStore() {}
+
+    // Content hash of every sequence of a set.
+    static void HashSet(const SetSequences * set, int32_t n, std::vector<uint64_t> & hashes);
+    // Name of the run of the given sets.
+    static std::string Name(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes);
+    // Copies a file (the results of a run).
+    static uint32_t Copy(const char * from, const char * to);
+
+    // Finds the stored run with most pairs in common with the given sets. Returns NOT_FOUND if none shares any.
+    uint32_t Find(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes, TMatch & match) const;
+    // Path of a file of the store: name + ext (e.g., the results of a run are in name.bin).
+    std::string File(const std::string & name, const char * ext) const { return dir + "/" + name + ext; }
+
+    // Writes the nt x nq matrix of the new run to output. The pairs of the stored run are copied, rows holds
+    // the new targets x all the queries and cols the known targets x the new queries, in order of index.
+    uint32_t Stitch(const TMatch & match, int32_t nt, int32_t nq, const char * rows, const char * cols, const char * output) const;
+    // Stores the complete results of a run (renamed into the store) and, once the new entry is
+    // verified, removes the run it was built from.
+    uint32_t Save(const std::vector<uint64_t> & tHashes, const std::vector<uint64_t> & qHashes, const char * results,
+      const std::string & base);
+};
+
+#endif  // CRUNSTORE_HPP
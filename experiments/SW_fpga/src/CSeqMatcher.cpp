@@ -2,24 +2,24 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <map>
+#include <vector>
 #include "CAccelDriver.hpp"
 #include "CSeqMatcher.hpp"
 
-uint64_t CSeqMatcher::phy_reference_c = 0;
-uint64_t CSeqMatcher::phy_length_ref = 0;
-uint64_t CSeqMatcher::phy_pattern_c = 0;
-uint64_t CSeqMatcher::phy_length_pat = 0;
-uint64_t CSeqMatcher::phy_output = 0;
-uint32_t CSeqMatcher::max_seq_length_internal = 0;
-bool CSeqMatcher::phy_initialized = false;
+#define AP_DONE 0x2  // Bits of the control register
+#define AP_IDLE 0x4
 
 ///////////////////////////////////////////////////////////////////////////////
-uint32_t CSeqMatcher::AlignmentWait()
+uint32_t CSeqMatcher::AlignmentWait(uint32_t timeout_ms, uint64_t sleep_ns, uint64_t spin_ns)
 {
   volatile TRegs * regs = (TRegs*)accelRegs;
+  struct timespec start, now;
+  uint64_t elapsed;
   uint32_t status;
-  uint64_t count = 0;
 
   if (accelRegs == NULL) {
     if (logging)
@@ -27,19 +27,45 @@ uint32_t CSeqMatcher::AlignmentWait()
     return DEVICE_NOT_INITIALIZED;
   }
 
-  do {
-    status = regs->control;
-    ++ count;
-    if (count> 500000) {
-      printf("TIMEOUT!!!\n");
-      break;
-    }
-    usleep(1);
-  } while ( ( (status & 2) != 2) ); // wait until ap_done==1
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  if (sleep_ns > 0) {
+    struct timespec left = {(time_t)(sleep_ns / 1000000000), (long)(sleep_ns % 1000000000)};
+    while (nanosleep(&left, &left) < 0 && errno == EINTR)
+      ;
+  }
+  while (((status = regs->control) & AP_DONE) != AP_DONE) { // wait until ap_done==1
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    elapsed = (uint64_t)(now.tv_sec - start.tv_sec) * 1000000000 + now.tv_nsec - start.tv_nsec;
+    if (timeout_ms != WAIT_FOREVER && elapsed >= (uint64_t)timeout_ms * 1000000)
+      return TIMEOUT;
+    // Spin window: the register is read again right away.
+    if (elapsed >= sleep_ns + spin_ns)
+      usleep(1);
+  }
 
   return OK;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+bool CSeqMatcher::IsIdle() const
+{
+  return (((volatile TRegs*)accelRegs)->control & AP_IDLE) != 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CSeqMatcher::AlignmentReset()
+{
+  volatile TRegs * regs = (TRegs*)accelRegs;
+
+  if (accelRegs == NULL)
+    return DEVICE_NOT_INITIALIZED;
+  // Disarm the interrupt of the job and acknowledge it, in case it arrives late.
+  regs->gier = 0;
+  regs->ier = 0;
+  regs->isr = regs->isr;
+  return IsIdle() ? OK : DEVICE_BUSY;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 uint32_t CSeqMatcher::GetPhyAddress(void * virtAddr, uint64_t & phyAddr)
 {
@@ -167,12 +193,26 @@ uint32_t CSeqMatcher::AlignmentStart()
   return OK;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Physical addresses of a job, as expected by the driver.
+void CSeqMatcher::BuildMessage(const TJob & job, read_type_t wait_type, struct write_message & message) const
+{
+  message.seq_t = phy_reference_c + ((uint64_t)job.reference_c_off * max_seq_length_internal);
+  message.seq_q = phy_pattern_c + ((uint64_t)job.pattern_c_off * max_seq_length_internal);
+  message.n_seq_t = (uint32_t)job.nseqt;
+  message.n_seq_q = (uint32_t)job.nseqp;
+  message.length_seq_t = phy_length_ref + ((uint64_t)job.length_ref_off * 4); // the size of the length is 4 bytes
+  message.length_seq_q = phy_length_pat + ((uint64_t)job.length_pat_off * 4); // the size of the length is 4 bytes
+  message.min_pos = phy_output + ((uint64_t)job.output_off * 4); // the size of the output is 4 bytes
+  message.wait_type = wait_type;
+  message.notify = 0;
+  message.timeout_ms = 0;
+  message.reserved = 0;
+}
+
 uint32_t CSeqMatcher::AlignmentDriverConfig(int32_t reference_c_off, int32_t nseqt, int32_t length_ref_off,
       int32_t pattern_c_off, int32_t nseqp, int32_t length_pat_off,
-      int32_t output_off){
-
-  uint64_t phy_reference_c_temp, phy_length_ref_temp, phy_pattern_c_temp, phy_length_pat_temp, phy_output_temp;
-  uint32_t res = OK;
+      int32_t output_off, read_type_t wait_type, uint32_t timeout_ms){
 
   if (logging)
     printf("CSeqMatcher::AlignmentDriverConfig("
@@ -193,22 +233,10 @@ uint32_t CSeqMatcher::AlignmentDriverConfig(int32_t reference_c_off, int32_t nse
     return DEVICE_NOT_INITIALIZED;
   }
 
-  phy_reference_c_temp = phy_reference_c + ((uint64_t)reference_c_off * max_seq_length_internal);
-  phy_length_ref_temp = phy_length_ref + ((uint64_t)length_ref_off * 4); // the size of the length is 4 bytes
-  phy_pattern_c_temp = phy_pattern_c + ((uint64_t)pattern_c_off * max_seq_length_internal);
-  phy_length_pat_temp = phy_length_pat + ((uint64_t)length_pat_off * 4); // the size of the length is 4 bytes
-  phy_output_temp = phy_output + ((uint64_t)output_off * 4); // the size of the output is 4 bytes
-
-  struct write_message message ={
-    phy_reference_c_temp,
-    phy_pattern_c_temp,
-    (uint32_t) nseqt,
-    (uint32_t) nseqp,
-    phy_length_ref_temp,
-    phy_length_pat_temp,
-    phy_output_temp,
-    INTERRUPT,
-  };
+  TJob job = {reference_c_off, nseqt, length_ref_off, pattern_c_off, nseqp, length_pat_off, output_off};
+  struct write_message message;
+  BuildMessage(job, wait_type, message);
+  message.timeout_ms = timeout_ms;
 
   int32_t readBytes = write(driver, (void *)&message, sizeof(message));
   if (readBytes != 0)
@@ -228,7 +256,97 @@ uint32_t CSeqMatcher::AlignmentDriverStart()
   if (logging)
     printf("\nStarting accel...\n");
   
-  int32_t readBytes = read(driver, NULL, 0);
+  if (read(driver, NULL, 0) < 0)
+    return (errno == ETIMEDOUT) ? TIMEOUT : ERROR_WAITING;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CSeqMatcher::AlignmentDriverWait(int32_t timeout_ms)
+{
+  struct pollfd fds;
+  int res;
+
+  if (driver == 0) {
+    if (logging)
+      printf("Error: Calling AlignmentDriverWait() on a non-initialized accelerator.\n");
+    return DEVICE_NOT_INITIALIZED;
+  }
+
+  fds.fd = driver;
+  fds.events = POLLIN;
+  do {
+    res = poll(&fds, 1, timeout_ms);
+  } while (res < 0 && errno == EINTR);
+
+  if (res < 0)
+    return ERROR_WAITING;
+  return (res == 0) ? TIMEOUT : OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool CSeqMatcher::AlignmentDriverDone()
+{
+  return AlignmentDriverWait(0) == OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CSeqMatcher::AlignmentDriverSubmit(const TJob * jobs, uint32_t njobs, uint32_t NotifyEvery)
+{
+  std::vector<struct write_message> messages(njobs);
+
+  if (driver == 0 || !phy_initialized) {
+    if (logging)
+      printf("Error: Calling AlignmentDriverSubmit() on a non-initialized accelerator.\n");
+    return DEVICE_NOT_INITIALIZED;
+  }
+  // The driver takes a whole batch into the ring of the file, or nothing.
+  if (njobs > MAX_DRIVER_BATCH) {
+    if (logging)
+      printf("Error: A batch has at most %u jobs (%u given).\n", MAX_DRIVER_BATCH, njobs);
+    return ERROR_SUBMITTING;
+  }
+
+  for (uint32_t j = 0; j < njobs; ++j) {
+    BuildMessage(jobs[j], CHAIN, messages[j]);
+    messages[j].notify = (j == njobs - 1) || (NotifyEvery > 0 && (j + 1) % NotifyEvery == 0);
+  }
+
+  // The driver queues the whole batch or nothing, and starts it if the accelerator is idle.
+  if (write(driver, messages.data(), njobs * sizeof(struct write_message)) != 0) {
+    if (logging)
+      printf("Error: The driver rejected a batch of %u jobs (errno %d).\n", njobs, errno);
+    return ERROR_SUBMITTING;
+  }
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CSeqMatcher::AlignmentDriverCollect(uint32_t & Done)
+{
+  Done = 0;
+  if (driver == 0) {
+    if (logging)
+      printf("Error: Calling AlignmentDriverCollect() on a non-initialized accelerator.\n");
+    return DEVICE_NOT_INITIALIZED;
+  }
+
+  if (read(driver, &Done, sizeof(Done)) != sizeof(Done))
+    return ERROR_WAITING;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CSeqMatcher::AlignmentDriverReset()
+{
+  struct write_message message = {};
+
+  if (driver == 0)
+    return DEVICE_NOT_INITIALIZED;
+
+  message.wait_type = RESET;
+  if (write(driver, &message, sizeof(message)) != 0)
+    return (errno == EIO) ? DEVICE_BUSY : ERROR_WAITING;
   return OK;
 }
 
@@ -1,58 +1,48 @@
 #ifndef CSEQMATCHER_HPP
 #define CSEQMATCHER_HPP
 
-class CSeqMatcher : public CAccelDriver {
-  protected:
-    // Structure that mimics the layout of the peripheral registers.
-    // Vitis HLS skips some addresses in the register file. We introduce
-    // padding fields to create the right mapping to registers with our structure.
-    struct TRegs {
-      uint32_t control; // 0x00
-      uint32_t gier, ier, isr; // 0x04, 0x08, 0x0C
-      uint32_t bit_set_ref_1, bit_set_ref_2; // 0x10, 0x14
-      uint32_t padding1; // 0x18
-      uint32_t nseqt; // 0x1C
-      uint32_t padding2; // 0x20
-      uint32_t length_ref_1, length_ref_2; //0x24, 0x28
-      uint32_t padding3; // 0x2C
-      uint32_t bit_set_pat_1, bit_set_pat_2; // 0x30, 0x34
-      uint32_t padding4; // 0x38
-      uint32_t nseqp; // 0x3C
-      uint32_t padding5; // 0x40
-      uint32_t length_pat_1, length_pat_2; // 0x44, 0x48
-      uint32_t padding6; // 0x4C
-      uint32_t output_1, output_2; // 0x50, 0x54
-    };
+// Requires <stdint.h>, "CAccelDriver.hpp"
+
+// Registers, commands and wait types shared with the driver.
+#include "../driver/seqring.h"
+
+#define MAX_DRIVER_BATCH SEQ_RING_SIZE  // Jobs in the command ring of the driver
+#define WAIT_DEFAULT_MS 30000            // Default timeout of AlignmentWait()
+#define WAIT_FOREVER 0                   // Timeout of a wait without limit
 
-    // Type of waiting to the accelerator
-    typedef enum {
-      INTERRUPT = 0x0,  // Wait for the interrupt
-      POLLING   = 0x1,  // Polling on the status register
-      CONTINUE  = 0x2,  // Do not wait and return to the user
-    } read_type_t;
+class CSeqMatcher : public CAccelDriver {
+  public:
+    // Type of waiting to the accelerator (read_type_t in driver/seqring.h)
+    typedef ::read_type_t read_type_t;
+    static const read_type_t INTERRUPT = ::INTERRUPT;  // Wait for the interrupt
+    static const read_type_t POLLING = ::POLLING;      // Polling on the status register
+    static const read_type_t CONTINUE = ::CONTINUE;    // Do not wait and return to the user
+    static const read_type_t CHAIN = ::CHAIN;          // Queue in the command ring of the driver
+    static const read_type_t RESET = ::RESET;          // Abandon the jobs of this file in the driver
 
-    // Structure used to pass commands between user-space and kernel-space.
-    struct write_message {
-      uint64_t seq_t;         // Pointer to the target sequences
-      uint64_t seq_q;         // Pointer to the query sequences
-      uint32_t n_seq_t;       // Number of targets
-      uint32_t n_seq_q;       // Number of queries
-      uint64_t length_seq_t;  // Pointer to the target sequence lengths
-      uint64_t length_seq_q;  // Pointer to the target sequence lengths
-      uint64_t min_pos;       // Pointer to the min pos array
-      read_type_t wait_type;  // Type of waiting to the accelerator
+    // Job of a batch for the command ring (offsets as in AlignmentDriverConfig).
+    // A batch has at most MAX_DRIVER_BATCH jobs (size of the ring in the driver).
+    struct TJob {
+      int32_t reference_c_off, nseqt, length_ref_off;
+      int32_t pattern_c_off, nseqp, length_pat_off;
+      int32_t output_off;
     };
 
+  protected:
     uint32_t GetPhyAddress(void * virtAddr, uint64_t & phyAddr);
+    void BuildMessage(const TJob & job, read_type_t wait_type, struct write_message & message) const;
+    bool IsIdle() const;
 
   protected:
-    static uint64_t phy_reference_c, phy_length_ref, phy_pattern_c, phy_length_pat, phy_output;
-    static uint32_t max_seq_length_internal;
-    static bool phy_initialized;
+    // Physical addresses of the buffers, per instance (several compute units can work on different buffers).
+    uint64_t phy_reference_c, phy_length_ref, phy_pattern_c, phy_length_pat, phy_output;
+    uint32_t max_seq_length_internal;
+    bool phy_initialized;
 
   public:
     CSeqMatcher(bool Logging = false)
-      : CAccelDriver(Logging) {}
+      : CAccelDriver(Logging), phy_reference_c(0), phy_length_ref(0), phy_pattern_c(0),
+        phy_length_pat(0), phy_output(0), max_seq_length_internal(0), phy_initialized(false) {}
 
     ~CSeqMatcher() {}
 
@@ -64,13 +54,38 @@ class CSeqMatcher : public CAccelDriver {
       int32_t pattern_c_off, int32_t nseqp, int32_t length_pat_off,
       int32_t output_off);
     uint32_t AlignmentStart();
-    uint32_t AlignmentWait();
+    // Returns TIMEOUT if the accelerator has not finished after timeout_ms (WAIT_FOREVER:
+    // no limit, which hangs the caller if the kernel never finishes). Hybrid wait: it first sleeps sleep_ns (the part of the job surely not finished yet),
+    // then spins on the status register during spin_ns, and then polls it with short sleeps.
+    uint32_t AlignmentWait(uint32_t timeout_ms = WAIT_DEFAULT_MS, uint64_t sleep_ns = 0, uint64_t spin_ns = 0);
+    // Disarms a job that did not finish. The kernel cannot be stopped (its ap_rst_n is the
+    // reset of the whole PL): returns DEVICE_BUSY if it is still running, and the instance
+    // should not be started again, nor its buffers reused, until it is idle.
+    uint32_t AlignmentReset();
 
-    // Driver implementation
+    // Driver implementation. With the CONTINUE wait type, AlignmentDriverStart() returns
+    // as soon as the accelerator starts: the device node (GetPollFd()) becomes readable
+    // for poll()/select() when the job finishes, or AlignmentDriverWait() can be used.
     uint32_t AlignmentDriverConfig(int32_t reference_c_off, int32_t nseqt, int32_t length_ref_off,
       int32_t pattern_c_off, int32_t nseqp, int32_t length_pat_off,
-      int32_t output_off);
+      int32_t output_off, read_type_t wait_type = INTERRUPT, uint32_t timeout_ms = 0);
+    // Returns TIMEOUT if the job did not finish in the timeout given to AlignmentDriverConfig()
+    // (the driver abandoned it).
     uint32_t AlignmentDriverStart();
+    uint32_t AlignmentDriverWait(int32_t timeout_ms = -1);
+    bool AlignmentDriverDone();
+    int GetPollFd() const { return driver; }
+
+    // Command ring of the driver: the jobs of a batch are queued with a single write() and
+    // chained by the driver without returning to the user. The device node becomes readable
+    // after every NotifyEvery jobs (0: only after the last one) and when the ring drains.
+    // AlignmentDriverCollect() returns in Done the jobs finished since the previous call.
+    uint32_t AlignmentDriverSubmit(const TJob * jobs, uint32_t njobs, uint32_t NotifyEvery = 0);
+    uint32_t AlignmentDriverCollect(uint32_t & Done);
+    // Abandons the jobs of this instance queued or running in the driver (e.g., a watchdog
+    // expired). Returns DEVICE_BUSY if the kernel is still running the abandoned job: the
+    // driver starts no other job until it is idle.
+    uint32_t AlignmentDriverReset();
 
     // Logs
     void PrintRegs();
@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include "util.h"
+#include "CRingQueue.hpp"
+#include "CStagePipeline.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CStagePipeline::AddStage(const char * Name, uint32_t Threads, const std::vector<int> & Cpus, TBody Body,
+  const std::vector<CRing *> & Inputs, const std::vector<CRing *> & Outputs)
+{
+  TStage stage;
+
+  stage.name = Name;
+  stage.threads = (Threads > 0) ? Threads : 1;
+  stage.cpus = Cpus;
+  stage.body = Body;
+  stage.inputs = Inputs;
+  stage.outputs = Outputs;
+  stage.running = 0;
+  stage.stats.runTime = stage.stats.inputWait = stage.stats.outputWait = stage.stats.items = 0;
+  stages.push_back(stage);
+  rings.insert(rings.end(), Inputs.begin(), Inputs.end());
+  rings.insert(rings.end(), Outputs.begin(), Outputs.end());
+  return stages.size() - 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CStagePipeline::Worker(uint32_t s, uint32_t w)
+{
+  TStage & stage = stages[s];
+  struct timespec end;
+
+  if (!stage.cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < stage.cpus.size(); ++i)
+      CPU_SET(stage.cpus[i], &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      printf("Warning: The %s stage could not be pinned to its CPUs.\n", stage.name.c_str());
+  }
+
+  stage.body(w);
+
+  // The last thread of the stage closes its outputs.
+  std::lock_guard<std::mutex> guard(lock);
+  if (-- stage.running == 0) {
+    for (size_t i = 0; i < stage.outputs.size(); ++i)
+      stage.outputs[i]->Close();
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    stage.stats.runTime = CalcTimeDiff(end, start);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CStagePipeline::Run()
+{
+  std::vector<std::thread> threads;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  for (uint32_t s = 0; s < stages.size(); ++s)
+    stages[s].running = stages[s].threads;
+  for (uint32_t s = 0; s < stages.size(); ++s)
+    for (uint32_t w = 0; w < stages[s].threads; ++w)
+      threads.emplace_back(&CStagePipeline::Worker, this, s, w);
+  for (auto & thread : threads)
+    thread.join();
+
+  for (uint32_t s = 0; s < stages.size(); ++s) {
+    TStage & stage = stages[s];
+    for (size_t i = 0; i < stage.inputs.size(); ++i) {
+      stage.stats.inputWait += stage.inputs[i]->GetStats().popWaitTime;
+      stage.stats.items += stage.inputs[i]->GetStats().pops;
+    }
+    for (size_t i = 0; i < stage.outputs.size(); ++i)
+      stage.stats.outputWait += stage.outputs[i]->GetStats().pushWaitTime;
+  }
+  return aborted ? ABORTED : OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CStagePipeline::Abort()
+{
+  aborted = true;
+  for (size_t i = 0; i < rings.size(); ++i)
+    rings[i]->Close();
+}
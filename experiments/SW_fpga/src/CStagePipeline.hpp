@@ -0,0 +1,70 @@
+#ifndef CSTAGEPIPELINE_HPP
+#define CSTAGEPIPELINE_HPP
+
+// Requires <stdint.h>, <atomic>, <vector>, <string>, <functional>, <mutex>, <thread>, <chrono>, "util.h",
+//   "CRingQueue.hpp"
+
+//  Runtime of a pipeline of host stages connected by rings (CRingQueue.hpp).
+// Every stage is a function run by its own threads, optionally pinned to a set of
+// CPUs, that pops items from its input rings and pushes them to its output rings
+// (the item types are the ones of the rings). A stage ends when its function
+// returns in all its threads: its outputs are closed then, so the next stage sees
+// the end of its input once it has drained it. Abort() closes all the rings, so
+// every blocked stage returns (e.g., after an error).
+//
+// The statistics of every stage come from its rings: the time its threads were
+// blocked waiting for input (starved) and for space in the outputs (backpressure).
+// They show which stage limits the pipeline and where more threads or other
+// CPUs are needed.
+
+class CStagePipeline {
+  public:
+    typedef enum {OK = 0, ABORTED = 1} TErrors;
+    typedef std::function<void(uint32_t worker)> TBody;
+
+    struct TStageStats {
+      uint64_t runTime;     // From the start of the pipeline to the end of the stage (ns)
+      uint64_t inputWait;   // Time its threads waited for input (ns)
+      uint64_t outputWait;  // Time they waited for space in the outputs: backpressure (ns)
+      uint64_t items;       // Items taken from its inputs
+    };
+
+  protected:
+    struct TStage {
+      std::string name;
+      uint32_t threads;
+      std::vector<int> cpus;            // Empty: not pinned
+      TBody body;
+      std::vector<CRing *> inputs, outputs;
+      uint32_t running;                 // Threads still running
+      TStageStats stats;
+    };
+
+    std::vector<TStage> stages;
+    std::vector<CRing *> rings;         // All the rings, for Abort()
+    std::mutex lock;
+    std::atomic<bool> aborted;
+    struct timespec start;
+
+    void Worker(uint32_t s, uint32_t w);
+
+  public:
+    CStagePipeline() : aborted(false) {}
+    ~CStagePipeline() {}
+
+    // Adds a stage run by Threads threads (at least 1) pinned to Cpus (empty: not pinned).
+    // Body receives the index of the thread in the stage. Returns the index of the stage.
+    uint32_t AddStage(const char * Name, uint32_t Threads, const std::vector<int> & Cpus, TBody Body,
+      const std::vector<CRing *> & Inputs, const std::vector<CRing *> & Outputs);
+
+    // Runs all the stages until they end. Returns ABORTED if Abort() was called.
+    uint32_t Run();
+    void Abort();
+    bool Aborted() const { return aborted.load(); }
+
+    uint32_t NumStages() const { return stages.size(); }
+    const char * Name(uint32_t s) const { return stages[s].name.c_str(); }
+    const TStageStats & GetStats(uint32_t s) const { return stages[s].stats; }
+};
+
+#endif  // CSTAGEPIPELINE_HPP
@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <map>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include "util.h"
+#include "sequences.h"
+#include "reorder.h"
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+#include "CTilePlanner.hpp"
+#include "CResultWriter.hpp"
+#include "CJournal.hpp"
+#include "CRingQueue.hpp"
+#include "CBufferPool.hpp"
+#include "CStagePipeline.hpp"
+#include "CTilePipeline.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+// Copies the sequences [first, first + count) of a host set to DMA buffers and
+// points the window of the host engine to them. The buffers are cacheable: the
+// copy is flushed before the accelerators read it.
+static void UploadSet(const SetSequences * set, int32_t first, int32_t count, SetSequences & dma, SetSequences & window)
+{
+  memcpy(dma.sequences, set->sequences + (uint64_t)first * MAX_SEQ_LENGTH, (uint64_t)count * MAX_SEQ_LENGTH);
+  memcpy(dma.length, set->length + first, count * sizeof(int32_t));
+  CSeqMatcher::FlushDMA(dma.sequences, (uint64_t)count * MAX_SEQ_LENGTH);
+  CSeqMatcher::FlushDMA(dma.length, count * sizeof(int32_t));
+  window.sequences = set->sequences + (uint64_t)first * MAX_SEQ_LENGTH;
+  window.length = set->length + first;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A set of n sequences takes a single DMA buffer: the sequences, then the lengths at the next
+// DMA_ALIGN boundary (the arena translates addresses inside a buffer).
+static uint64_t LengthsOffset(int32_t n)
+{
+  return ((uint64_t)n * MAX_SEQ_LENGTH + DMA_ALIGN - 1) / DMA_ALIGN * DMA_ALIGN;
+}
+
+static uint64_t DmaBytes(uint64_t bytes)
+{
+  return (bytes + DMA_ALIGN - 1) / DMA_ALIGN * DMA_ALIGN;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+static void MapSet(const CDmaBuffer & buffer, int32_t n, SetSequences & set)
+{
+  set.sequences = buffer.As<char>();
+  set.length = buffer ? (int32_t *)(buffer.As<char>() + LengthsOffset(n)) : NULL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+CTilePipeline::CTilePipeline(const SetSequences * Targets, const SetSequences * Queries,
+  const std::vector<CSeqMatcher *> & Accels, CCoScheduler * Scheduler)
+  : targets(Targets), queries(Queries), accels(Accels), scheduler(Scheduler),
+    targetsShared(false), numSlots(1), error(OK)
+{
+  for (uint32_t s = 0; s < PIPELINE_SLOTS; ++s) {
+    slots[s].dmaTargets.sequences = slots[s].dmaQueries.sequences = NULL;
+    slots[s].dmaTargets.descriptions = slots[s].dmaQueries.descriptions = NULL;
+    slots[s].dmaTargets.length = slots[s].dmaQueries.length = NULL;
+    slots[s].hostTargets.descriptions = slots[s].hostQueries.descriptions = NULL;
+  }
+  ResetStats();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePipeline::Alloc(const CTilePlanner & planner)
+{
+  int32_t tt = planner.TileTargets(), tq = planner.TileQueries();
+  uint64_t targetsBytes = LengthsOffset(tt) + tt * sizeof(int32_t);
+  uint64_t queriesBytes = LengthsOffset(tq) + tq * sizeof(int32_t);
+  uint64_t outputBytes = (uint64_t)tt * tq * sizeof(uint32_t), total = 0;
+
+  Free();
+  targetsShared = planner.TargetsOuter();
+  numSlots = planner.Buffers() < PIPELINE_SLOTS ? planner.Buffers() : PIPELINE_SLOTS;
+
+  // The inputs are only written by the CPU (cacheable, flushed after every upload). The output is
+  // written by the accelerators and the host workers at once, in rows that do not fill whole cache
+  // lines, so it is not cacheable: it is only accessed through cached staging rows.
+  for (uint32_t s = 0; s < numSlots; ++s)
+    total += ((s == 0 || !targetsShared) ? DmaBytes(targetsBytes) : 0) +
+      ((s == 0 || targetsShared) ? DmaBytes(queriesBytes) : 0);
+  CSeqMatcher::DMAArena().Reserve(total, true);
+  CSeqMatcher::DMAArena().Reserve(numSlots * DmaBytes(outputBytes));
+  std::vector<uint32_t> fill(tq, 27334);
+
+  for (uint32_t s = 0; s < numSlots; ++s) {
+    TSlot & slot = slots[s];
+    // The buffer of the outer set belongs to the first slot.
+    if (s == 0 || !targetsShared) {
+      slot.targetsBuffer = CSeqMatcher::AllocDMABuffer(targetsBytes, 1);
+      MapSet(slot.targetsBuffer, tt, slot.dmaTargets);
+    } else {
+      slot.dmaTargets = slots[0].dmaTargets;
+    }
+    if (s == 0 || targetsShared) {
+      slot.queriesBuffer = CSeqMatcher::AllocDMABuffer(queriesBytes, 1);
+      MapSet(slot.queriesBuffer, tq, slot.dmaQueries);
+    } else {
+      slot.dmaQueries = slots[0].dmaQueries;
+    }
+    slot.outputBuffer = CSeqMatcher::AllocDMABuffer(outputBytes);
+    slot.output = slot.outputBuffer.As<uint32_t>();
+    if (slot.dmaTargets.sequences == NULL || slot.dmaQueries.sequences == NULL || slot.output == NULL) {
+      printf("Error allocating DMA memory for the tiles.\n");
+      Free();
+      return ERROR_ALLOCATING;
+    }
+    for (int32_t t = 0; t < tt; ++t)
+      memcpy(slot.output + (uint64_t)t * tq, fill.data(), tq * sizeof(uint32_t));
+  }
+
+  Invalidate();
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CTilePipeline::Free()
+{
+  for (uint32_t s = 0; s < PIPELINE_SLOTS; ++s) {
+    TSlot & slot = slots[s];
+    slot.targetsBuffer.Reset();
+    slot.queriesBuffer.Reset();
+    slot.outputBuffer.Reset();
+    slot.dmaTargets.sequences = slot.dmaQueries.sequences = NULL;
+    slot.dmaTargets.length = slot.dmaQueries.length = NULL;
+    slot.output = NULL;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CTilePipeline::Invalidate()
+{
+  for (uint32_t s = 0; s < PIPELINE_SLOTS; ++s)
+    slots[s].t0 = slots[s].block = -1;
+  scheduler->TargetsChanged();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CTilePipeline::ResetStats()
+{
+  stats.uploadTime = stats.computeTime = stats.writeTime = stats.totalTime = 0;
+  stats.uploadBytes = stats.writeBytes = 0;
+  stats.tiles = 0;
+  for (uint32_t s = 0; s < NUM_STAGES; ++s)
+    stageStats[s].runTime = stageStats[s].inputWait = stageStats[s].outputWait = stageStats[s].items = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Uploads the sets of the tile that are not resident in the slot. If the shared (outer)
+// set changes, the other slots must be free: their windows are updated too.
+void CTilePipeline::Upload(TSlot & slot, const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks)
+{
+  int32_t u0 = qBlocks[tile.block], nu = qBlocks[tile.block + 1] - u0;
+
+  if (slot.t0 != tile.t0) {
+    UploadSet(targets, tile.t0, tile.nt, slot.dmaTargets, slot.hostTargets);
+    slot.t0 = tile.t0;
+    stats.uploadBytes += (uint64_t)tile.nt * (MAX_SEQ_LENGTH + sizeof(int32_t));
+    for (uint32_t s = 0; targetsShared && s < numSlots; ++s) {
+      slots[s].t0 = slot.t0;
+      slots[s].hostTargets = slot.hostTargets;
+    }
+  }
+  if (slot.block != tile.block) {
+    UploadSet(queries, u0, nu, slot.dmaQueries, slot.hostQueries);
+    slot.block = tile.block;
+    stats.uploadBytes += (uint64_t)nu * (MAX_SEQ_LENGTH + sizeof(int32_t));
+    for (uint32_t s = 0; !targetsShared && s < numSlots; ++s) {
+      slots[s].block = slot.block;
+      slots[s].hostQueries = slot.hostQueries;
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Points the accelerators and the host engine to the buffers of the slot.
+uint32_t CTilePipeline::Bind(TSlot & slot)
+{
+  uint32_t res;
+
+  for (uint32_t a = 0; a < accels.size(); ++a) {
+    res = accels[a]->InitConfig(slot.dmaTargets.sequences, slot.dmaTargets.length, slot.dmaQueries.sequences,
+      slot.dmaQueries.length, slot.output, MAX_SEQ_LENGTH);
+    if (res != CSeqMatcher::OK) {
+      printf("Error in the InitConfig of the accelerator %u.\n", a);
+      return ACCEL_ERROR;
+    }
+  }
+  scheduler->SetHost(&slot.host);
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePipeline::Compute(TSlot & slot, const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks)
+{
+  if (Bind(slot) != OK)
+    return ACCEL_ERROR;
+  if (scheduler->Run(tile.nt, 0, qBlocks[tile.block + 1] - qBlocks[tile.block], slot.output) != CCoScheduler::OK)
+    return ACCEL_ERROR;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePipeline::Calibrate(const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks)
+{
+  Upload(slots[0], tile, qBlocks);
+  if (Bind(slots[0]) != OK)
+    return ACCEL_ERROR;
+  if (scheduler->Calibrate(tile.nt, 0, qBlocks[tile.block + 1] - qBlocks[tile.block], slots[0].output) != CCoScheduler::OK)
+    return ACCEL_ERROR;
+  return OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePipeline::RunTile(const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks)
+{
+  struct timespec t1, t2, t3;
+  uint32_t res;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+  Upload(slots[0], tile, qBlocks);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+  res = Compute(slots[0], tile, qBlocks);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &t3);
+  stats.uploadTime += CalcTimeDiff(t2, t1);
+  stats.computeTime += CalcTimeDiff(t3, t2);
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePipeline::Run(const std::vector<CTilePlanner::TTile> & tiles, const std::vector<int32_t> & qBlocks,
+  CResultWriter * writer, int32_t qSize, int32_t nq, CJournal * journal)
+{
+  struct timespec start, end;
+  uint32_t res = OK;
+  CStagePipeline stages;
+  CBufferPool<TSlot> freeSlots(PIPELINE_SLOTS);
+  CSpscRing<TItem> uploaded(PIPELINE_SLOTS), computed(PIPELINE_SLOTS);
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  error = OK;
+  stats.tiles += tiles.size();
+  for (uint32_t s = 0; s < numSlots; ++s)
+    freeSlots.Add(&slots[s]);
+
+  // Upload stage: fills the slots in order, as soon as they are free.
+  stages.AddStage("upload", 1, stageCpus[UPLOAD_STAGE], [&](uint32_t) {
+    struct timespec t1, t2;
+    for (size_t k = 0; k < tiles.size(); ++k) {
+      TSlot * slot, * other[PIPELINE_SLOTS];
+      uint32_t held = 0;
+      if (!freeSlots.Acquire(slot))
+        return;
+      // The shared set is replaced once the other slots are free too.
+      bool sharedChange = targetsShared ? slot->t0 != tiles[k].t0 : slot->block != tiles[k].block;
+      while (sharedChange && held + 1 < numSlots && freeSlots.Acquire(other[held]))
+        ++ held;
+      if (sharedChange && held + 1 < numSlots)
+        return;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+      Upload(*slot, tiles[k], qBlocks);
+      clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+      stats.uploadTime += CalcTimeDiff(t2, t1);
+      for (uint32_t h = 0; h < held; ++h)
+        freeSlots.Release(other[h]);
+      if (!uploaded.Push(TItem{slot, k}))
+        return;
+    }
+  }, {freeSlots.Ring()}, {&uploaded});
+
+  // Compute stage: the accelerators and the host engine, through the co-scheduler.
+  stages.AddStage("compute", 1, stageCpus[COMPUTE_STAGE], [&](uint32_t) {
+    struct timespec t1, t2;
+    TItem item;
+    while (uploaded.Pop(item)) {
+      const CTilePlanner::TTile & tile = tiles[item.tile];
+      clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+      // A failed slot is not given back: a hung accelerator may still write into its buffers.
+      if (Compute(*item.slot, tile, qBlocks) != OK) {
+        printf("Error computing the targets [%d, %d) x block %d of queries.\n", tile.t0, tile.t0 + tile.nt, tile.block);
+        res = ACCEL_ERROR;
+        stages.Abort();
+        return;
+      }
+      clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+      stats.computeTime += CalcTimeDiff(t2, t1);
+      if (writer == NULL)
+        freeSlots.Release(item.slot);
+      else if (!computed.Push(item))
+        return;
+    }
+  }, {&uploaded}, {&computed});
+
+  // Write stage: drains the output of the computed tiles to the results file.
+  if (writer != NULL)
+    stages.AddStage("write", 1, stageCpus[WRITE_STAGE], [&](uint32_t) {
+      struct timespec t1, t2;
+      TItem item;
+      while (computed.Pop(item)) {
+        const CTilePlanner::TTile & tile = tiles[item.tile];
+        int32_t q0 = tile.block * qSize;
+        uint64_t checksum;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t1);
+        uint32_t written = writer->WriteTile(item.slot->output, tile.t0, tile.nt, qBlocks[tile.block],
+          qBlocks[tile.block + 1] - qBlocks[tile.block], q0, (q0 + qSize < nq) ? qSize : nq - q0,
+          (journal != NULL) ? &checksum : NULL);
+        // The journal commits the record later, in its own thread.
+        if (written == CResultWriter::OK && journal != NULL)
+          journal->Add(tile.t0, tile.nt, tile.block, checksum);
+        clock_gettime(CLOCK_MONOTONIC_RAW, &t2);
+        stats.writeTime += CalcTimeDiff(t2, t1);
+        stats.writeBytes += (uint64_t)tile.nt * (qBlocks[tile.block + 1] - qBlocks[tile.block]) * sizeof(uint32_t);
+        if (written != CResultWriter::OK) {
+          printf("Error writing the results of the targets [%d, %d).\n", tile.t0, tile.t0 + tile.nt);
+          error = ERROR_WRITING;
+          stages.Abort();
+          return;
+        }
+        freeSlots.Release(item.slot);
+      }
+    }, {&computed}, {});
+
+  stages.Run();
+  for (uint32_t s = 0; s < stages.NumStages(); ++s) {
+    const CStagePipeline::TStageStats & stage = stages.GetStats(s);
+    stageStats[s].runTime += stage.runTime;
+    stageStats[s].inputWait += stage.inputWait;
+    stageStats[s].outputWait += stage.outputWait;
+    stageStats[s].items += stage.items;
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  stats.totalTime += CalcTimeDiff(end, start);
+
+  return (error != OK) ? error : res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void CTilePipeline::PrintStats() const
+{
+  double hostWork = (stats.uploadTime + stats.writeTime) / 1e9;
+  double exposed = (stats.totalTime - stats.computeTime) / 1e9;
+  double hidden = hostWork > exposed ? hostWork - exposed : 0;
+
+  printf("Pipeline: %u tiles, upload %.3f s (%.1f MB), compute %.3f s, write %.3f s, wall %.3f s",
+    stats.tiles, stats.uploadTime / 1e9, stats.uploadBytes / 1e6, stats.computeTime / 1e9,
+    stats.writeTime / 1e9, stats.totalTime / 1e9);
+  if (hostWork > 0)
+    printf(" (%.0f%% of the upload and write time hidden)", 100.0 * hidden / hostWork);
+  printf("\n");
+
+  // Time waiting for input (a free slot for the upload) and blocked on a full output.
+  printf("Stages: upload waited %.3f s for slots, compute starved %.3f s and blocked %.3f s, write starved %.3f s\n",
+    stageStats[UPLOAD_STAGE].inputWait / 1e9, stageStats[COMPUTE_STAGE].inputWait / 1e9,
+    stageStats[COMPUTE_STAGE].outputWait / 1e9, stageStats[WRITE_STAGE].inputWait / 1e9);
+}
@@ -0,0 +1,103 @@
+#ifndef CTILEPIPELINE_HPP
+#define CTILEPIPELINE_HPP
+
+// Requires <stdint.h>, <atomic>, <vector>, <string>, <functional>, <mutex>, <thread>, <chrono>, "sequences.h",
+//   "reorder.h", "CDmaBackend.hpp", "CDmaArena.hpp", "CAccelDriver.hpp", "CSeqMatcher.hpp", "CHostMatcher.hpp", "numa.h", "CCoScheduler.hpp",
+//   "CTilePlanner.hpp", "CResultWriter.hpp", "CJournal.hpp", "CRingQueue.hpp", "CBufferPool.hpp", "CStagePipeline.hpp"
+
+#define PIPELINE_SLOTS 2  // Tiles in flight (ping-pong buffers)
+
+//  Double-buffered execution of the tiles of a plan.
+// Three stages of a CStagePipeline run concurrently on consecutive tiles: one
+// uploads tile i + 1 to the DMA buffers of a free slot, another computes tile i
+// (accelerators and host engine through the co-scheduler) and the last drains the
+// output of tile i - 1 to the results file. The stages pass the slots through
+// rings, and a slot returns to the pool of free slots once its tile is written.
+// The outer set of the plan has a single DMA buffer shared by the slots: it is
+// replaced only when no other tile is in flight. The inner set and the output
+// have a buffer per slot, and the sets resident in them are not uploaded again.
+// Each stage can be pinned to its own CPUs (e.g., to keep the upload and the
+// write away from the cores of the host engine).
+
+class CTilePipeline {
+  public:
+    typedef enum {OK = 0, ERROR_ALLOCATING = 1, ACCEL_ERROR = 2, ERROR_WRITING = 3} TErrors;
+
+    struct TStats {
+      uint64_t uploadTime, computeTime, writeTime;  // Time busy in each stage (ns)
+      uint64_t totalTime;                           // Wall time (ns)
+      uint64_t uploadBytes, writeBytes;
+      uint32_t tiles;
+    };
+
+  protected:
+    struct TSlot {
+      CDmaBuffer targetsBuffer, queriesBuffer, outputBuffer;
+      SetSequences dmaTargets, dmaQueries;    // Sets in the DMA buffers of the tile
+      SetSequences hostTargets, hostQueries;  // Windows of the host sets (host engine)
+      CHostMatcher host;
+      uint32_t * output;
+      int32_t t0, block;      // Sets resident in the buffers (-1: none)
+
+      TSlot() : host(&hostTargets, &hostQueries), output(NULL), t0(-1), block(-1) {}
+    };
+
+    struct TItem {
+      TSlot * slot;
+      size_t tile;
+    };
+
+    typedef enum {UPLOAD_STAGE = 0, COMPUTE_STAGE = 1, WRITE_STAGE = 2, NUM_STAGES = 3} TStage;
+
+    const SetSequences * targets, * queries;  // Host sets, in computed order
+    std::vector<CSeqMatcher *> accels;
+    CCoScheduler * scheduler;
+    bool targetsShared;                       // The targets (outer set) have a single buffer
+    uint32_t numSlots;
+    TSlot slots[PIPELINE_SLOTS];
+    std::vector<int> stageCpus[NUM_STAGES];   // Empty: not pinned
+    CStagePipeline::TStageStats stageStats[NUM_STAGES];
+    uint32_t error;
+    TStats stats;
+
+    void Upload(TSlot & slot, const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks);
+    uint32_t Bind(TSlot & slot);
+    uint32_t Compute(TSlot & slot, const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks);
+
+  public:
+    CTilePipeline(const SetSequences * Targets, const SetSequences * Queries,
+      const std::vector<CSeqMatcher *> & Accels, CCoScheduler * Scheduler);
+    ~CTilePipeline() { Free(); }
+
+    // Allocates the buffers for the tiles of the plan.
+    uint32_t Alloc(const CTilePlanner & planner);
+    void Free();
+
+    // The host sets were modified (e.g., reordered): the resident sets are not valid anymore.
+    void Invalidate();
+
+    // Uploads a tile to the first slot and calibrates the co-scheduler on it.
+    uint32_t Calibrate(const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks);
+    // Computes a single tile in the first slot (no pipelining, no writing). Its upload and
+    // compute times are added to the statistics.
+    uint32_t RunTile(const CTilePlanner::TTile & tile, const std::vector<int32_t> & qBlocks);
+    // Pins the threads of the upload, compute and write stages to the given CPUs (empty: not pinned).
+    void SetStageCpus(const std::vector<int> & Upload, const std::vector<int> & Compute, const std::vector<int> & Write) {
+      stageCpus[UPLOAD_STAGE] = Upload;
+      stageCpus[COMPUTE_STAGE] = Compute;
+      stageCpus[WRITE_STAGE] = Write;
+    }
+
+    // Computes all the tiles, pipelined. If writer is not NULL, the output of every tile is written
+    // with it: block b of the computed queries holds the original queries [b * qSize, (b + 1) * qSize).
+    // If journal is not NULL, every tile written is recorded in it.
+    uint32_t Run(const std::vector<CTilePlanner::TTile> & tiles, const std::vector<int32_t> & qBlocks,
+      CResultWriter * writer, int32_t qSize, int32_t nq, CJournal * journal = NULL);
+
+    const uint32_t * Output() const { return slots[0].output; }
+    const TStats & GetStats() const { return stats; }
+    void ResetStats();
+    void PrintStats() const;
+};
+
+#endif  // CTILEPIPELINE_HPP
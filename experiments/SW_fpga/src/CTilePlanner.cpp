@@ -0,0 +1,124 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include "sequences.h"
+#include "CTilePlanner.hpp"
+
+#define SLOT_BYTES (MAX_SEQ_LENGTH + sizeof(int32_t)) // Sequence and length of one sequence
+#define MIN_TILE_TARGETS 512 // The accelerator workers take one target each: keep them busy
+#define KERNEL_QUERY_BLOCK 10240 // Queries held by the kernel at once (QUERY_BLOCK_SIZE in fpga_design/HLS_v0/globals.h)
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CTilePlanner::TileBytes(int32_t tt, int32_t tq, bool tOuter) const
+{
+  uint64_t outer = tOuter ? tt : tq, inner = tOuter ? tq : tt;
+
+  return outer * SLOT_BYTES + buffers * (inner * SLOT_BYTES + (uint64_t)tt * tq * sizeof(uint32_t));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int32_t CTilePlanner::MaxTileQueries(int32_t tt, bool tOuter) const
+{
+  uint64_t fixed = (tOuter ? 1 : buffers) * (uint64_t)tt * SLOT_BYTES;
+  uint64_t perQuery = (tOuter ? buffers : 1) * SLOT_BYTES + (uint64_t)buffers * tt * sizeof(uint32_t);
+
+  if (budget <= fixed)
+    return 0;
+  uint64_t tq = (budget - fixed) / perQuery;
+  return tq > 0x7FFFFFFF ? 0x7FFFFFFF : (int32_t)tq;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CTilePlanner::UploadBytes(int32_t nt, int32_t nq, int32_t tt, int32_t tq, bool tOuter) const
+{
+  uint64_t tTiles = (nt + tt - 1) / tt, qTiles = (nq + tq - 1) / tq;
+  uint64_t outerTiles = tOuter ? tTiles : qTiles, innerTiles = tOuter ? qTiles : tTiles;
+
+  // The inner set is uploaded again for every outer tile, unless it fits in one tile:
+  // then it stays resident in each of the buffers.
+  uint64_t innerUploads = innerTiles > 1 ? outerTiles : (outerTiles < buffers ? outerTiles : buffers);
+  if (tOuter)
+    return ((uint64_t)nt + innerUploads * nq) * SLOT_BYTES;
+  return ((uint64_t)nq + innerUploads * nt) * SLOT_BYTES;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t CTilePlanner::KernelBytes(int32_t nt, int32_t nq, int32_t tt, int32_t tq) const
+{
+  uint64_t tTiles = (nt + tt - 1) / tt, qTiles = (nq + tq - 1) / tq;
+  uint64_t blocks = (tq + KERNEL_QUERY_BLOCK - 1) / KERNEL_QUERY_BLOCK;
+
+  // Every tile reads its queries once and its targets once per block of queries.
+  return ((uint64_t)nt * qTiles * blocks + (uint64_t)nq * tTiles) * SLOT_BYTES;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTilePlanner::Plan(int32_t nt, int32_t nq)
+{
+  uint64_t best = 0, bestTiles = 0;  // Bytes uploaded and read by the kernel
+  bool fitsAll = false;
+  int32_t widest = 0;       // Widest target tile that fits
+
+  tileTargets = tileQueries = 0;
+  uploadBytes = 0;
+  if (nt <= 0 || nq <= 0)
+    return OK;
+
+  // Every split of the targets in k tiles, with the widest query tile that fits in the budget.
+  for (int32_t k = 1; k <= nt && !fitsAll; ++k) {
+    int32_t tt = (nt + k - 1) / k;
+    if (k > 1 && tt == (nt + k - 2) / (k - 1))
+      continue; // Same tile as k - 1
+    // Narrow target tiles are only used if nothing wider fits.
+    if (tt < MIN_TILE_TARGETS && tt < widest)
+      break;
+
+    for (int32_t outer = 0; outer < 2; ++outer) {
+      int32_t tq = MaxTileQueries(tt, outer == 1);
+      if (tq <= 0)
+        continue;
+      if (widest == 0)
+        widest = tt;
+      if (tq >= nq)
+        tq = nq;
+      tq = (nq + (nq + tq - 1) / tq - 1) / ((nq + tq - 1) / tq); // Balance the query tiles
+      uint64_t tiles = (uint64_t)k * ((nq + tq - 1) / tq);
+      uint64_t bytes = UploadBytes(nt, nq, tt, tq, outer == 1) + KernelBytes(nt, nq, tt, tq);
+      if (best == 0 || bytes < best || (bytes == best && tiles < bestTiles)) {
+        best = bytes;
+        bestTiles = tiles;
+        tileTargets = tt;
+        tileQueries = tq;
+        targetsOuter = (outer == 1);
+      }
+      // Narrower target tiles only add re-uploads once the queries fit in a single tile.
+      if (tq == nq)
+        fitsAll = true;
+    }
+  }
+
+  if (tileTargets > 0)
+    uploadBytes = UploadBytes(nt, nq, tileTargets, tileQueries, targetsOuter);
+  return tileTargets > 0 ? OK : BUDGET_TOO_SMALL;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::vector<CTilePlanner::TTile> CTilePlanner::Tiles(int32_t nt, const std::vector<int32_t> & qBlocks) const
+{
+  std::vector<TTile> tiles;
+  int32_t numBlocks = qBlocks.size() - 1;
+  int32_t tTiles = (nt + tileTargets - 1) / tileTargets;
+  TTile tile;
+
+  for (int32_t i = 0; i < (targetsOuter ? tTiles : numBlocks); ++i) {
+    for (int32_t j = 0; j < (targetsOuter ? numBlocks : tTiles); ++j) {
+      int32_t tTile = targetsOuter ? i : j;
+      tile.t0 = tTile * tileTargets;
+      tile.nt = (tile.t0 + tileTargets < nt) ? tileTargets : nt - tile.t0;
+      tile.block = targetsOuter ? j : i;
+      tiles.push_back(tile);
+    }
+  }
+  return tiles;
+}
@@ -0,0 +1,63 @@
+#ifndef CTILEPLANNER_HPP
+#define CTILEPLANNER_HPP
+
+// Requires <stdint.h>, <vector>
+
+//  Out-of-core planner for the target x query matrix.
+// The sets stay in host memory and every tile (a range of targets x a range of
+// queries) is uploaded to reusable DMA buffers: the targets and queries of the
+// tile plus its output. The planner picks the tile shape that fits the DMA budget
+// and moves the fewest sequences: with the queries in the outer loop, every query
+// is uploaded once and the targets once per query tile (unless they all fit in a
+// single tile), and the other way round with the targets in the outer loop.
+// Consecutive tiles share the outer set, which only has to be uploaded once.
+// The kernel also reads every target of a tile again for each block of queries it
+// holds (read_in), so narrow query tiles re-read the targets many times: the
+// planner minimizes the uploads plus these reads.
+// With several buffers (pipelining), the outer set has a single buffer shared by
+// all of them, and the inner set and the output have one buffer each.
+
+class CTilePlanner {
+  public:
+    typedef enum {OK = 0, BUDGET_TOO_SMALL = 1} TErrors;
+
+    struct TTile {
+      int32_t t0, nt;       // Targets [t0, t0 + nt)
+      int32_t block;        // Block of queries (see Tiles())
+    };
+
+  protected:
+    uint64_t budget;        // Bytes of DMA memory available
+    uint32_t buffers;       // Buffers of the inner set and the output (e.g., 2 for double buffering)
+    int32_t tileTargets, tileQueries;
+    bool targetsOuter;
+    uint64_t uploadBytes;   // Sequences and lengths uploaded by the plan
+
+    int32_t MaxTileQueries(int32_t tt, bool tOuter) const;
+
+  public:
+    CTilePlanner(uint64_t Budget, uint32_t Buffers = 1)
+      : budget(Budget), buffers(Buffers), tileTargets(0), tileQueries(0), targetsOuter(false), uploadBytes(0) {}
+    ~CTilePlanner() {}
+
+    // Bytes of sequences and lengths uploaded by a plan of nt x nq with tiles of tt x tq.
+    uint64_t UploadBytes(int32_t nt, int32_t nq, int32_t tt, int32_t tq, bool tOuter) const;
+    // Bytes of sequences and lengths read by the kernel in a plan of nt x nq with tiles of tt x tq.
+    uint64_t KernelBytes(int32_t nt, int32_t nq, int32_t tt, int32_t tq) const;
+    // DMA bytes used by the buffers of tiles of tt targets x tq queries.
+    uint64_t TileBytes(int32_t tt, int32_t tq, bool tOuter) const;
+
+    // Chooses the tile shape for nt targets x nq queries.
+    uint32_t Plan(int32_t nt, int32_t nq);
+    // Tiles in execution order. The queries are given as blocks: block b holds the
+    // queries [qBlocks[b], qBlocks[b + 1]), each of them at most TileQueries() long.
+    std::vector<TTile> Tiles(int32_t nt, const std::vector<int32_t> & qBlocks) const;
+
+    int32_t TileTargets() const { return tileTargets; }
+    int32_t TileQueries() const { return tileQueries; }
+    bool TargetsOuter() const { return targetsOuter; }
+    uint32_t Buffers() const { return buffers; }
+    uint64_t GetUploadBytes() const { return uploadBytes; }
+};
+
+#endif  // CTILEPLANNER_HPP
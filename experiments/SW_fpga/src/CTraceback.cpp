@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include "sequences.h"
+#include "myers.h"
+#include "CTraceback.hpp"
+
+///////////////////////////////////////////////////////////////////////////////
+int32_t CTraceback::Score(int32_t row, int32_t col) const
+{
+  if (col < 0)
+    return row;
+
+  // D[0][col] = 0 (free start in the target). Add the vertical deltas of the rows above.
+  int32_t score = 0;
+  int32_t fullWords = row >> 6;
+  for (int32_t w = 0; w < fullWords; ++w)
+    score += __builtin_popcountll(columns[col].vp[w]) - __builtin_popcountll(columns[col].vn[w]);
+  if (row & 63) {
+    uint64_t mask = ((uint64_t)1 << (row & 63)) - 1;
+    score += __builtin_popcountll(columns[col].vp[fullWords] & mask) - __builtin_popcountll(columns[col].vn[fullWords] & mask);
+  }
+  return score;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTraceback::Align(const char * target, int32_t tlen, const char * query, int32_t qlen, THit & hit)
+{
+  TMyersColumn col;
+  int32_t lastCol, score, minValue, minPos;
+
+  hit.cigar.clear();
+  hit.startPos = -1;
+
+  if (qlen <= 0) {
+    hit.status = EMPTY_QUERY;
+    return hit.status;
+  }
+  if (tlen <= 0) {
+    hit.status = EMPTY_TARGET;
+    return hit.status;
+  }
+  if (hit.endPos >= tlen) {
+    hit.status = INVALID_END_POS;
+    return hit.status;
+  }
+
+  // Forward pass. Only the columns up to the end position are needed.
+  BuildPeq(query, qlen, peq);
+  MyersInit(col, peq.words);
+  lastCol = (hit.endPos >= 0) ? hit.endPos : tlen - 1;
+  score = minValue = qlen;
+  minPos = 0;
+  for (int32_t j = 0; j <= lastCol; ++j) {
+    score += MyersStep(peq.eq[BaseCode(target[j])], col, peq.words, qlen - 1);
+    columns[j] = col;
+    if (score < minValue) {
+      minValue = score;
+      minPos = j;
+    }
+  }
+
+  if (hit.endPos < 0)
+    hit.endPos = minPos;
+  score = Score(qlen, hit.endPos);
+  if (hit.distance >= 0 && hit.distance != score) {
+    hit.status = DISTANCE_MISMATCH;
+    return hit.status;
+  }
+  hit.distance = score;
+
+  // Backward pass from (qlen, endPos) to the first row.
+  std::string ops;
+  int32_t i = qlen, j = hit.endPos;
+  while (i > 0) {
+    if (j < 0) {
+      ops.push_back('I');
+      -- i;
+      continue;
+    }
+    int32_t d = Score(i, j);
+    bool match = BaseCode(query[i - 1]) == BaseCode(target[j]);
+    if (Score(i - 1, j - 1) + (match ? 0 : 1) == d) {
+      ops.push_back(match ? '=' : 'X');
+      -- i;
+      -- j;
+    } else if (Score(i - 1, j) + 1 == d) {
+      ops.push_back('I');
+      -- i;
+    } else {
+      ops.push_back('D');
+      -- j;
+    }
+  }
+  hit.startPos = j + 1;
+
+  // Run-length encode the operations (they were collected backwards).
+  char number[16];
+  for (int32_t k = (int32_t)ops.size() - 1; k >= 0; ) {
+    int32_t run = 1;
+    while (k - run >= 0 && ops[k - run] == ops[k])
+      ++ run;
+    snprintf(number, sizeof(number), "%d", run);
+    hit.cigar += number;
+    hit.cigar.push_back(ops[k]);
+    k -= run;
+  }
+
+  hit.status = OK;
+  return hit.status;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t CTraceback::AlignBatch(const SetSequences * targets, const SetSequences * queries,
+  std::vector<THit> & hits, uint32_t NumThreads)
+{
+  std::atomic<size_t> next(0);
+  std::atomic<uint32_t> errors(0);
+  std::vector<std::thread> workers;
+
+  if (NumThreads == 0)
+    NumThreads = 1;
+  if (NumThreads > hits.size())
+    NumThreads = hits.size() > 0 ? hits.size() : 1;
+
+  // Each worker owns one traceback instance (bounded column store) and pulls hits dynamically.
+  auto worker = [&]() {
+    CTraceback * tb = new CTraceback();
+    for (size_t h = next++; h < hits.size(); h = next++) {
+      THit & hit = hits[h];
+      if (tb->Align(targets->sequences + (uint64_t)hit.target * MAX_SEQ_LENGTH, targets->length[hit.target],
+                    queries->sequences + (uint64_t)hit.query * MAX_SEQ_LENGTH, queries->length[hit.query], hit) != OK)
+        ++ errors;
+    }
+    delete tb;
+  };
+
+  for (uint32_t t = 1; t < NumThreads; ++t)
+    workers.emplace_back(worker);
+  worker();
+  for (auto & w : workers)
+    w.join();
+
+  return errors;
+}
@@ -0,0 +1,49 @@
+#ifndef CTRACEBACK_HPP
+#define CTRACEBACK_HPP
+
+// Requires <stdint.h>, <string>, <vector>, "sequences.h", "myers.h"
+
+//  This class rebuilds full alignments (CIGAR strings) for selected hits.
+// The accelerator only reports the end position of the best match of a query
+// inside a target. For the few pairs that are kept, the traceback replays the
+// Myers recurrence up to that end position storing the VP/VN bit-vectors of
+// every column, and then walks back through the DP matrix reconstructing the
+// scores from the stored vertical deltas. Sequences are at most MAX_SEQ_LENGTH
+// bases, so the column store has a fixed size (~34 KB) per instance and the
+// memory stays bounded whatever the number of hits.
+
+class CTraceback {
+  public:
+    struct THit {
+      int32_t target, query;  // Indices in the target and query sets
+      int32_t endPos;         // Last target base of the alignment (-1: compute it)
+      int32_t distance;       // Edit distance (-1: compute it)
+      int32_t startPos;       // First target base of the alignment (output)
+      std::string cigar;      // Extended CIGAR: '=' match, 'X' mismatch, 'I' insertion, 'D' deletion (output)
+      uint32_t status;        // TErrors code of the traceback (output)
+    };
+
+    typedef enum {OK = 0, EMPTY_QUERY = 1, INVALID_END_POS = 2, DISTANCE_MISMATCH = 3, EMPTY_TARGET = 4} TErrors;
+
+  protected:
+    TPeq peq;
+    TMyersColumn columns[MAX_SEQ_LENGTH];  // Column j holds the deltas after target base j
+
+    // Score of cell (row, col) of the DP matrix, with col = -1 the column before the target.
+    int32_t Score(int32_t row, int32_t col) const;
+
+  public:
+    CTraceback() {}
+    ~CTraceback() {}
+
+    // Aligns one query against one target. Fills startPos, cigar and status of the hit
+    // (and endPos/distance if they were -1).
+    uint32_t Align(const char * target, int32_t tlen, const char * query, int32_t qlen, THit & hit);
+
+    // Aligns a batch of hits from the given sets using NumThreads worker threads.
+    // Returns the number of hits whose traceback failed.
+    static uint32_t AlignBatch(const SetSequences * targets, const SetSequences * queries,
+      std::vector<THit> & hits, uint32_t NumThreads);
+};
+
+#endif  // CTRACEBACK_HPP
@@ -6,184 +6,347 @@
 #include <math.h>
 #include <map>
 #include <iostream>
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
 #include "pmt.h"
 #include <unistd.h>
+#include <sys/mman.h>
 #include "util.h"
+#include "sequences.h"
+#include "seqio.h"
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
 #include "CAccelDriver.hpp"
 #include "CSeqMatcher.hpp"
+#include "accels.h"
+#include "myers.h"
+#include "CTraceback.hpp"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+#include "reorder.h"
+#include "dedup.h"
+#include "CTilePlanner.hpp"
+#include "CResultWriter.hpp"
+#include "CJournal.hpp"
+#include "CRunStore.hpp"
+#include "CRingQueue.hpp"
+#include "CBufferPool.hpp"
+#include "CStagePipeline.hpp"
+#include "CTilePipeline.hpp"
+#include "CChunkTuner.hpp"
+#include "options.h"
 
-#define USE_DRIVER (true)
 #define LOGGING (false)
-#define MAX_MODULES 1
 #define MIN_EXEC_TIME 100 // in seconds
-const char * driver_name = "/dev/seqdriver";
-const uint32_t BASE_ADDR = 0x00A0000000;
+#define TUNE_PROBE_TARGETS 256   // Targets of the probe tiles of the chunk tuner
+#define TUNE_PROBE_QUERIES 256   // Queries of the larger probe tile (the smaller has 1/8)
 const uint64_t MAX_CMA_MALLOC = 420e6; // In Bytes. (grep -i cma /proc/meminfo)
-CSeqMatcher seqMatchers;
-uint64_t current_alloc = 0;
-
-#define MAX_SEQ_LENGTH 360
-#define MAX_DESCRIPTION_LENGTH 724
-#define BUFFER_SIZE (MAX_SEQ_LENGTH + MAX_DESCRIPTION_LENGTH)
-
-typedef struct {
-  char *sequences, *descriptions;
-  int32_t *length;
-} SetSequences;
+const char * hits_file = NULL; // Pairs "target query" to align with CIGAR (--hits=<file>)
+bool sort_lengths = false;     // Sort targets and queries by length before the upload (--sort-lengths)
+bool dedup = false;            // Compute duplicated targets and queries once (--dedup)
+bool resume = false;           // Compute only the tiles missing in the journal of an interrupted run (--resume)
+const char * journal_file = "scores.journal"; // Progress journal of the run (--journal=<file>)
+uint32_t checkpoint_ms = 5000; // Interval between commits of the journal (--checkpoint-interval=<s>)
+const char * store_dir = NULL; // Run store for incremental updates of the sets (--store=<dir>)
+double watchdog = 10;          // Deadline of an accelerator tile, in expected durations (--watchdog=<factor>, 0: none)
+bool hybrid_wait = true;       // Sleep and then spin in the completion waits of the accelerators (--no-spin: off)
+bool tune_chunks = true;       // Autotune the queries per tile (--no-tune: the largest that fit)
+const char * tune_cache = "chunks.tuning"; // Cache of the tuner (--tune-cache=<file>)
+const char * bitstream = NULL; // Name of the bitstream loaded, key of the tuning cache (--bitstream=<name>)
+std::vector<int> upload_cpus;  // CPUs of the upload stage of the pipeline (--upload-cpus=<list>)
+std::vector<int> compute_cpus; // CPUs of the compute stage (--compute-cpus=<list>)
+std::vector<int> write_cpus;   // CPUs of the write stage (--write-cpus=<list>)
 
 ///////////////////////////////////////////////////////////////////////////////
-SetSequences* read_file(const char *path, const uint32_t MAX_SEQUENCES) {
-  FILE *file = fopen(path, "rb");
-  if (file == NULL) {
-    perror("Error al abrir el archivo");
-    exit(EXIT_FAILURE);
+// Reads a list of CPUs such as "0-2,5" from the option. Invalid lists are ignored (not pinned).
+void get_cpus(int argc, char const *argv[], const char * option, std::vector<int> & cpus)
+{
+  const char * list = GetOption(argc, argv, option);
+  if (list != NULL && !ParseCpuList(list, cpus)) {
+    printf("Warning: Invalid list of CPUs in --%s=%s.\n", option, list);
+    cpus.clear();
   }
+}
 
-  bool ignore = false;
-  char buffer[BUFFER_SIZE];
+///////////////////////////////////////////////////////////////////////////////
+inline int32_t min(int32_t a, int32_t b) {
+    return (a < b) ? a : b;
+}
 
-  SetSequences * customData = (SetSequences *)malloc(sizeof(SetSequences));
-  if (customData == NULL) {
-    printf("Error allocating memory for customData\n");
-    return NULL;
+///////////////////////////////////////////////////////////////////////////////
+// Hit-output path: full alignments (CIGAR) for the selected pairs only.
+// The end positions are read back from the results file; the traceback recomputes
+// them if they are not available. The sets are the computed ones: the maps give
+// the position of every original sequence.
+void write_hits(SetSequences *seq_target, SetSequences *seq_query, int32_t nt, int32_t nq,
+  const TIndexMap & t_map, const TIndexMap & q_map, const CResultWriter & scores) {
+  FILE * fp;
+  std::vector<CTraceback::THit> hits;
+  std::vector<std::pair<int32_t, int32_t>> pairs; // Original indices of the hits
+  CTraceback::THit hit;
+  int32_t t, q;
+  uint32_t errors, endPos;
+
+  fp = fopen(hits_file, "r");
+  if (fp == NULL) {
+    printf("Error opening the hits file %s\n", hits_file);
+    return;
   }
-
-  customData->descriptions = (char*)CSeqMatcher::AllocDMACompatible(MAX_SEQUENCES * MAX_DESCRIPTION_LENGTH * sizeof(char));
-  customData->sequences = (char*)CSeqMatcher::AllocDMACompatible(MAX_SEQUENCES * MAX_SEQ_LENGTH * sizeof(char));
-  customData->length = (int32_t*)CSeqMatcher::AllocDMACompatible(MAX_SEQUENCES * sizeof(int32_t));
-  if ( (customData->descriptions == NULL) || (customData->sequences == NULL) ||
-        (customData->length == NULL) ) {
-    printf("Error allocating DMA memory.\n");
-    free(customData);
-    return NULL;
+  while (fscanf(fp, "%d %d", &t, &q) == 2) {
+    if (t < 0 || t >= nt || q < 0 || q >= nq) {
+      printf("Warning: Ignoring hit (%d, %d) out of range.\n", t, q);
+      continue;
+    }
+    hit.target = t_map.empty() ? t : t_map[t];
+    hit.query = q_map.empty() ? q : q_map[q];
+    hit.endPos = (scores.Read(t, q, endPos) == CResultWriter::OK) ? (int32_t)endPos : -1;
+    hit.distance = -1;
+    hits.push_back(hit);
+    pairs.push_back(std::make_pair(t, q));
   }
-  current_alloc += MAX_SEQUENCES * MAX_SEQ_LENGTH * sizeof(char);
-  current_alloc += MAX_SEQUENCES * sizeof(int32_t);
+  fclose(fp);
 
-  for (int32_t i = 0; i < MAX_SEQUENCES; ++i) {
-    *(customData->descriptions + i * MAX_DESCRIPTION_LENGTH) = '\0';
-    *(customData->sequences + i * MAX_SEQ_LENGTH) = '\0';
-    customData->length[i] = 0;
-  }
+  errors = CTraceback::AlignBatch(seq_target, seq_query, hits, num_threads);
+  if (errors > 0)
+    printf("Warning: %u tracebacks failed.\n", errors);
 
+  fp = fopen("hits.tsv", "w");
+  fprintf(fp, "target\tquery\tstart\tend\tdistance\tcigar\n");
+  for (size_t i = 0; i < hits.size(); ++i) {
+    const CTraceback::THit & h = hits[i];
+    if (h.status == CTraceback::OK)
+      fprintf(fp, "%d\t%d\t%d\t%d\t%d\t%s\n", pairs[i].first, pairs[i].second, h.startPos, h.endPos, h.distance, h.cigar.c_str());
+  }
+  fclose(fp);
+}
 
-  int32_t sequenceCount = 0;
-  int32_t cnt=0;
-  while (fgets(buffer, BUFFER_SIZE, file) != NULL) {
-    if (strncmp(buffer, "@T", 2) == 0) {
-      if (sequenceCount < MAX_SEQUENCES) {
-        for (uint32_t jj = 0; jj < MAX_SEQ_LENGTH; ++jj) {
-          *(customData->descriptions+sequenceCount*MAX_DESCRIPTION_LENGTH+jj)=buffer[jj];
-          if (buffer[jj] == '\0')
-            break;
-        }
-        ignore=false;
-      }
-      else {
-        break; 
-      }
-      sequenceCount++;
-    }
-    else if (buffer[0] == '+') {
-      ignore=true;
-    }
-    else {
-      if(ignore==false){
-        cnt=0;
-        for (uint32_t jj = 0; jj < MAX_SEQ_LENGTH; ++jj) {
-          if(buffer[jj] != '\n') {
-            *(customData->sequences+(sequenceCount-1)*MAX_SEQ_LENGTH+jj)=buffer[jj];
-            //printf("%c", buffer[jj]);
-            if (buffer[jj] == '\0')
-              break;
-            cnt++;
-          }
-        }
-        // printf("\n");
-        *(customData->length + sequenceCount - 1) = cnt;
-      }
+///////////////////////////////////////////////////////////////////////////////
+// Tiles of the plan that have to be computed when a run is resumed: the ones that are not
+// in the journal, or whose results in the file do not match the checksum in the journal.
+std::vector<CTilePlanner::TTile> missing_tiles(const std::vector<CTilePlanner::TTile> & tiles,
+  const std::vector<CJournal::TEntry> & done, CResultWriter & writer, int32_t qSize, int32_t nq) {
+  std::map<std::pair<int32_t, int32_t>, const CJournal::TEntry *> committed;
+  std::vector<CTilePlanner::TTile> todo;
+  uint32_t corrupt = 0;
+  uint64_t checksum;
+
+  for (size_t i = 0; i < done.size(); ++i)
+    committed[std::make_pair(done[i].t0, done[i].block)] = &done[i];
+  for (size_t k = 0; k < tiles.size(); ++k) {
+    const CTilePlanner::TTile & tile = tiles[k];
+    auto it = committed.find(std::make_pair(tile.t0, tile.block));
+    if (it != committed.end() && it->second->nt == tile.nt) {
+      int32_t q0 = tile.block * qSize;
+      if (writer.Checksum(tile.t0, tile.nt, q0, min(qSize, nq - q0), checksum) == CResultWriter::OK &&
+          checksum == it->second->checksum)
+        continue;
+      ++ corrupt;
     }
+    todo.push_back(tile);
   }
-  fclose(file);
-
-  CSeqMatcher::FreeDMACompatible(customData->descriptions);
-
-  return customData;
+  printf("Resuming: %zu of %zu tiles done (%u failed the verification and are computed again)\n",
+    tiles.size() - todo.size(), tiles.size(), corrupt);
+  return todo;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-inline int32_t min(int32_t a, int32_t b) {
-    return (a < b) ? a : b;
+// Chooses the queries per tile with the chunk tuner. The engines are probed on two tiles of
+// the first targets with few and more queries, unless the cache has a choice for these sizes.
+int32_t tune_tiles(CTilePipeline & pipeline, const CTilePlanner & planner, CChunkTuner & tuner, int32_t nt, int32_t nq) {
+  uint32_t depth = min(planner.Buffers(), PIPELINE_SLOTS);
+
+  tuner.Load();
+  if (!tuner.Cached(nt, nq)) {
+    int32_t rows = min(planner.TileTargets(), TUNE_PROBE_TARGETS);
+    int32_t queries[2] = {min(planner.TileQueries(), TUNE_PROBE_QUERIES / 8), min(planner.TileQueries(), TUNE_PROBE_QUERIES)};
+    uint64_t time[2];
+    pipeline.ResetStats();
+    for (int p = 0; p < 2; ++p) {
+      std::vector<int32_t> block = {0, queries[p]};
+      uint64_t before = pipeline.GetStats().computeTime;
+      pipeline.Invalidate();
+      if (pipeline.RunTile(CTilePlanner::TTile{0, rows, 0}, block) != CTilePipeline::OK)
+        return planner.TileQueries();
+      time[p] = pipeline.GetStats().computeTime - before;
+    }
+    tuner.SetEngines((double)rows * queries[0], time[0], (double)rows * queries[1], time[1]);
+    tuner.SetUpload(pipeline.GetStats().uploadBytes, pipeline.GetStats().uploadTime);
+  }
+  int32_t tq = tuner.Choose(planner, nt, nq, depth).tileQueries;
+  tuner.Save();
+  tuner.Print();
+  return tq;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-void split_block(SetSequences *seq_target, SetSequences *seq_query, int32_t nt, int32_t nq) {
+// Computes the nt x nq matrix into output. Unless measure is set, the tiles are computed once
+// and the time and energy are not recorded. Returns false on errors.
+bool split_block(SetSequences *seq_target, SetSequences *seq_query, int32_t nt, int32_t nq, const char * output,
+  const char * journal_path, bool measure) {
   FILE * fp;
   struct timespec start, end;
   pmt::State pmt_start, pmt_end;
   std::unique_ptr<pmt::PMT> sensor(pmt::xilinx::Xilinx::Create(pmt::xilinx::Xilinx::ultrascale_ZCU104().c_str()));
-  uint32_t res = CSeqMatcher::OK;
-  uint32_t * output = 0;
   uint64_t time;
   double power;
   double energy;
   uint32_t repetitions;
-  int32_t qSize;
-  
-  // Calculate the total number of computations
-  int64_t availableMemory = MAX_CMA_MALLOC - current_alloc;
-  if (availableMemory < 0) {
-    printf("Error: Memory maximum was already exceeded. Aborting.\n");
-    return;
+  int32_t tSize, qSize;
+  int32_t ntc = nt;               // Targets computed
+  TIndexMap t_map, q_map;         // Position of the original sequences in the computed sets
+  std::vector<int32_t> q_blocks;  // Computed queries of every block: [q_blocks[b], q_blocks[b + 1])
+  CResultWriter writer;
+  CJournal journal;
+  CJournal::THeader header;
+  std::vector<CJournal::TEntry> done;
+  bool resumed = resume;
+
+  // Exact-duplicate collapsing of the targets. The tiles depend on the targets computed.
+  if (dedup)
+    ntc = CollapseDuplicates(seq_target, 0, nt, 0, t_map);
+
+  // Tiling of the matrix in the DMA memory: inputs, lengths and output of the tiles in flight.
+  CTilePlanner planner(MAX_CMA_MALLOC, PIPELINE_SLOTS);
+  if (planner.Plan(ntc, nq) != CTilePlanner::OK) {
+    printf("Error: Not even one pair fits in the DMA memory. Aborting.\n");
+    return false;
   }
-  int64_t maxComputations = floor(availableMemory / sizeof(uint32_t));
-  if (nt > maxComputations) {
-    printf("Error: The number of targets exceeds the maximum number of computations. Aborting.\n");
-    return;
+  tSize = planner.TileTargets();
+  qSize = planner.TileQueries();
+
+  // Accelerator instances and host engine workers share every tile. The tiles are pipelined:
+  // upload, computation and writing of consecutive tiles overlap.
+  std::vector<CSeqMatcher *> accels = engine_accels();
+  CCoScheduler scheduler(accels, USE_DRIVER, NULL, cpu_workers);
+  configure_scheduler(scheduler);
+  scheduler.SetWatchdog(watchdog);
+  scheduler.SetHybridWait(hybrid_wait);
+  CTilePipeline pipeline(seq_target, seq_query, accels, &scheduler);
+  pipeline.SetStageCpus(upload_cpus, compute_cpus, write_cpus);
+  if (pipeline.Alloc(planner) != CTilePipeline::OK)
+    return false;
+  // The engines are calibrated on the first tile of the sets as read (before the queries are collapsed).
+  std::vector<int32_t> first_block = {0, min(qSize, nq)};
+  if (pipeline.Calibrate(CTilePlanner::TTile{0, min(tSize, ntc), 0}, first_block) != CTilePipeline::OK) {
+    printf("Error calibrating the engines.\n");
+    return false;
+  }
+  if (cpu_workers > 0 || num_accels > 1 || LOGGING)
+    scheduler.PrintModel();
+
+  // Chunk size: smaller query tiles than the largest that fit, if the tuner predicts a shorter run.
+  std::string engines = (bitstream != NULL) ? bitstream : (num_accels > 0 ? "accels" : "host");
+  engines += ":" + std::to_string(num_accels) + "x" + std::to_string(cpu_workers);
+  CChunkTuner tuner(tune_cache, engines.c_str(),
+    std::max(CChunkTuner::LengthClass(seq_target, ntc), CChunkTuner::LengthClass(seq_query, nq)));
+  // A resumed run keeps the tiles of its journal: the cache of the tuner may have changed since.
+  if (resumed && CJournal::ReadHeader(journal_path, header) == CJournal::OK && header.nt == nt && header.nq == nq &&
+      header.ntc == ntc && header.tileTargets == tSize && header.tileQueries > 0 && header.tileQueries <= qSize)
+    qSize = header.tileQueries;
+  else if (tune_chunks) {
+    qSize = tune_tiles(pipeline, planner, tuner, ntc, nq);
+    pipeline.Invalidate();
   }
-  qSize = floor(maxComputations / nt); // maximum
 
-  // Check if the total size exceeds the maximum
-  if (qSize >= nq) {
-    qSize = nq;
-  } else {
-    printf("Warning: The total number of computations exceeds the maximum memory allocation. The computation will be divided into chunks.\n");
-    printf("Current allocation: %lu Bytes\n", current_alloc);
-    printf("Available Memory: %lu Bytes\n", availableMemory);
-    printf("Number of queries per chunk: %d / %d\n", qSize, nq);
+  // Queries are collapsed within each block of qSize queries, so that every block covers the
+  // same original queries and the results can be expanded back block by block.
+  q_blocks.push_back(0);
+  for (int qid = 0 ; qid < nq ; qid += qSize ) {
+    int32_t count = min(qSize, nq - qid);
+    if (dedup)
+      count = CollapseDuplicates(seq_query, qid, qid + count, q_blocks.back(), q_map);
+    q_blocks.push_back(q_blocks.back() + count);
   }
-  
-  // Allocate memory for the output
-  output = (uint32_t*)CSeqMatcher::AllocDMACompatible(nt * qSize * sizeof(uint32_t));  
-  if (output == NULL) {
-    printf("Error allocating DMA memory for output.\n");
-    return;
+  if (dedup)
+    printf("Duplicate collapsing: %d -> %d targets, %d -> %d queries (%.1f%% of the pairs computed)\n",
+      nt, ntc, nq, q_blocks.back(), 100.0 * ntc * q_blocks.back() / ((double)nt * nq));
+
+  std::vector<CTilePlanner::TTile> tiles = planner.Tiles(ntc, q_blocks);
+  if (tiles.size() > 1) {
+    printf("Warning: The matrix exceeds the DMA memory. The computation will be divided into tiles.\n");
+    printf("Tiles: %zu of %d targets x %d queries (%s in the outer loop), %.1f MB uploaded per run\n",
+      tiles.size(), tSize, qSize, planner.TargetsOuter() ? "targets" : "queries",
+      planner.UploadBytes(ntc, nq, tSize, qSize, planner.TargetsOuter()) / 1e6);
+  }
+  // The first tile is used for comparisons and warm-up.
+
+  // Length-bucketed dispatch. The accelerator time does not depend on the order: its workers take
+  // the queries of a target in round-robin, so they all see the same length_ref. Sorting only changes
+  // how the co-scheduler splits the rows, since its cost model charges every row the same: the
+  // accelerators (from the front) get the short targets and the host workers (from the back) the
+  // long ones. The first tile is timed both ways to tell whether that helps on the input.
+  // Queries are sorted within each block, as for the duplicate collapsing.
+  if (sort_lengths) {
+    std::vector<int32_t> t_order, q_order;
+    CCoScheduler::TStats unsorted, sorted;
+    scheduler.ResetStats();
+    pipeline.RunTile(tiles[0], q_blocks);
+    unsorted = scheduler.GetStats();
+
+    SortByLength(seq_target, 0, ntc, t_order);
+    for (uint32_t b = 0 ; b + 1 < q_blocks.size() ; ++b )
+      SortByLength(seq_query, q_blocks[b], q_blocks[b + 1], q_order);
+    ApplyOrder(seq_target, t_order);
+    ApplyOrder(seq_query, q_order);
+    ComposeOrder(t_map, t_order);
+    ComposeOrder(q_map, q_order);
+    pipeline.Invalidate();
+
+    scheduler.ResetStats();
+    pipeline.RunTile(tiles[0], q_blocks);
+    sorted = scheduler.GetStats();
+    printf("Length sorting (first tile): accelerator %.3f -> %.3f s, host engine %.3f -> %.3f s, total %.3f -> %.3f s\n",
+      unsorted.accTime / 1e9, sorted.accTime / 1e9, unsorted.hostTime / 1e9, sorted.hostTime / 1e9,
+      unsorted.totalTime / 1e9, sorted.totalTime / 1e9);
   }
-  for (int32_t i = 0; i < nt * qSize; ++i)
-  	output[i] = 27334;
 
-  res = seqMatchers.InitConfig( seq_target->sequences, seq_target->length, seq_query->sequences, seq_query->length, output, MAX_SEQ_LENGTH);
-  if (res != CSeqMatcher::OK) {
-    printf("Error in the InitConfig of the accelerator.\n");
-    CSeqMatcher::FreeDMACompatible(output);
-    return;
+  // Progress journal. It is only valid for the same sets, in the same order, and the same tiles.
+  memset(&header, 0, sizeof(header));
+  header.nt = nt;
+  header.nq = nq;
+  header.ntc = ntc;
+  header.nqc = q_blocks.back();
+  header.tileTargets = tSize;
+  header.tileQueries = qSize;
+  header.fingerprint = CJournal::Fingerprint(seq_target, ntc, seq_query, q_blocks.back(), t_map, q_map);
+  if (resumed) {
+    uint32_t res = journal.Resume(journal_path, header, done);
+    if (res == CJournal::MISMATCH) {
+      printf("Error: The journal %s belongs to another run (sets, options or tiles). Remove it to start again.\n", journal_path);
+      return false;
+    }
+    if (res != CJournal::OK) {
+      printf("No journal to resume in %s: starting from scratch.\n", journal_path);
+      resumed = false;
+    }
   }
+  if (!resumed && journal.Create(journal_path, header) != CJournal::OK)
+    return false;
+
+  // The results are written to the file during the last repetition (overlapped with the computation).
+  // A resumed run keeps the results of the tiles already done.
+  if (writer.Open(output, nt, nq, t_map, ntc, q_map, resumed) != CResultWriter::OK)
+    return false;
+  std::vector<CTilePlanner::TTile> todo = resumed ? missing_tiles(tiles, done, writer, qSize, nq) : tiles;
 
   // HW execution and measurement of the minimum set only (warmup)
-  if ( nt < 100000 ) {
+  if (resumed || !measure) {
+    repetitions = 1;
+  } else if ( nt < 100000 ) {
     clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-    #if USE_DRIVER
-    seqMatchers.AlignmentDriverConfig( 0, nt, 0, 0, qSize, 0, 0);
-    seqMatchers.AlignmentDriverStart();
-    #else
-    seqMatchers.AlignmentConfig( 0, nt, 0, 0, nq, 0, 0);
-    seqMatchers.AlignmentStart();
-    seqMatchers.AlignmentWait();
-    #endif
+    pipeline.RunTile(tiles[0], q_blocks);
     clock_gettime(CLOCK_MONOTONIC_RAW, &end);
     // Calculate the number of repetitions
     time = CalcTimeDiff(end, start);
-    time = time * floor(nq / qSize); // Scale the computation to the total duration
+    time = time * tiles.size(); // Scale the computation to the total duration
     repetitions = ceil(MIN_EXEC_TIME / (time/1e9));
   } else {
     repetitions = 1;
@@ -192,53 +355,80 @@ void split_block(SetSequences *seq_target, SetSequences *seq_query, int32_t nt,
   if(LOGGING) 
     printf("Time reported: %lu ns. Executing %u times\n", time, repetitions);
 
-  // HW execution and measurement (measure)
+  // HW execution and measurement (measure). The tiles written are committed to the journal
+  // by its own thread, so the pipeline does not wait for the disk.
+  journal.Start(&writer, checkpoint_ms);
+  scheduler.ResetStats();
   pmt_start = sensor->Read();
   clock_gettime(CLOCK_MONOTONIC_RAW, &start);
-  for (int i = 0 ; i < repetitions ; i++ ) {
-    #if USE_DRIVER
-    for (int qid = 0 ; qid < (nq - qSize + 1) ; qid+=qSize ) {
-      seqMatchers.AlignmentDriverConfig( 0, nt, 0, qid, qSize, qid, 0 );
-      seqMatchers.AlignmentDriverStart();
-    }
-    if (nq % qSize > 0) { // Do the remaining queries if needed
-      seqMatchers.AlignmentDriverConfig( 0, nt, 0, nq - nq % qSize, 182, nq - nq % qSize, 0 );
-      seqMatchers.AlignmentDriverStart();
-    }
-    #else
-    for (int qid = 0 ; qid < (nq - qSize + 1) ; qid+=qSize ) {
-      seqMatchers.AlignmentConfig( 0, nt, 0, qid, qSize, qid, 0 );
-      seqMatchers.AlignmentStart();
-      seqMatchers.AlignmentWait();
-    }
-    if (nq % qSize > 0) { // Do the remaining queries if needed
-      seqMatchers.AlignmentConfig( 0, nt, 0, nq - nq % qSize, 182, nq - nq % qSize, 0 );
-      seqMatchers.AlignmentStart();
-      seqMatchers.AlignmentWait();
-    }
-    #endif
+  uint32_t run_error = CTilePipeline::OK;
+  for (uint32_t i = 0 ; i < repetitions && run_error == CTilePipeline::OK ; i++ ) {
+    if (i == repetitions - 1)
+      pipeline.ResetStats();
+    run_error = pipeline.Run(todo, q_blocks, (i == repetitions - 1) ? &writer : NULL, qSize, nq,
+      (i == repetitions - 1) ? &journal : NULL);
   }
   clock_gettime(CLOCK_MONOTONIC_RAW, &end);
   pmt_end = sensor->Read();
+  uint32_t journal_error = journal.Close();
+  // Every tile must be in the file: the file is created with its final size, so nothing else tells.
+  if (run_error == CTilePipeline::OK && writer.TilesWritten() != todo.size()) {
+    printf("Error: Only %u of %zu tiles were written.\n", writer.TilesWritten(), todo.size());
+    run_error = CTilePipeline::ERROR_WRITING;
+  }
+  // The tiles written before the failure stay in the journal: --resume computes the rest.
+  if (run_error != CTilePipeline::OK) {
+    printf("Error: The computation of the tiles failed (error %u). No time or energy is recorded.\n", run_error);
+    writer.Close();
+    pipeline.Free();
+    return false;
+  }
 
   time = CalcTimeDiff(end, start);
   time = time / repetitions;
-  fp = fopen ("times.txt", "a");
-  fprintf(fp,"%lu\n", time);
-  fclose (fp);
-
-  power = sensor->watts(pmt_start, pmt_end);
-  // We add a constant 2.25W to the power due to the second power sensor on the UltraScale+ ZCU104.
-  // This secondary sensor measures the utils outside the SoC such as the LDO.
-  // We tested that this sensor does not vary during the execution of any application.
-  energy = (power + 2.25) * ((double)time/1e9);
-  fp = fopen ("energy.txt", "a");
-  fprintf(fp,"%lf\n", energy);
-  fclose (fp);
-
-  fp = fopen("scores.bin", "wb");
-  fwrite(output, sizeof(uint32_t), nt * qSize, fp);
-  fclose(fp);
+  // The time of a resumed run only covers the missing tiles: it is not a measurement.
+  if (resumed) {
+    printf("Resumed run: %zu tiles in %.3f s (times.txt and energy.txt are not updated)\n", todo.size(), time / 1e9);
+  } else if (!measure) {
+    printf("Computed %d targets x %d queries in %.3f s\n", nt, nq, time / 1e9);
+  } else {
+    fp = fopen ("times.txt", "a");
+    fprintf(fp,"%lu\n", time);
+    fclose (fp);
+
+    power = sensor->watts(pmt_start, pmt_end);
+    // We add a constant 2.25W to the power due to the second power sensor on the UltraScale+ ZCU104.
+    // This secondary sensor measures the utils outside the SoC such as the LDO.
+    // We tested that this sensor does not vary during the execution of any application.
+    energy = (power + 2.25) * ((double)time/1e9);
+    fp = fopen ("energy.txt", "a");
+    fprintf(fp,"%lf\n", energy);
+    fclose (fp);
+  }
+
+  if (cpu_workers > 0 || num_accels > 1) {
+    const CCoScheduler::TStats & stats = scheduler.GetStats();
+    printf("Co-scheduling: accelerator %lu rows in %u tiles (busy %.3f s), host %lu rows in %u tiles (busy %.3f s), %u steals\n",
+      stats.accRows, stats.accTiles, stats.accTime / 1e9, stats.hostRows, stats.hostTiles, stats.hostTime / 1e9, stats.steals);
+  }
+  scheduler.PrintFaults();
+  scheduler.PrintWaits();
+  scheduler.PrintNuma();
+  // The write rate of the run is kept for the next choices of the tuner.
+  if (tune_chunks && pipeline.GetStats().writeTime > 0) {
+    tuner.SetWrite(pipeline.GetStats().writeBytes, pipeline.GetStats().writeTime);
+    tuner.Save();
+  }
+  if (tiles.size() > 1 || LOGGING) {
+    const CJournal::TStats & jstats = journal.GetStats();
+    pipeline.PrintStats();
+    printf("Journal: %u tiles in %u commits (sync %.3f s, in the background)\n", jstats.entries, jstats.commits,
+      jstats.syncTime / 1e9);
+  }
+
+  if (hits_file != NULL)
+    write_hits(seq_target, seq_query, nt, nq, t_map, q_map, writer);
+  writer.Close();
 
   if(LOGGING) {
     std::cout<<"PMT stats:"<<std::endl;
@@ -250,60 +440,159 @@ void split_block(SetSequences *seq_target, SetSequences *seq_query, int32_t nt,
 
     printf("OUTPUT VALUES (nt*nq=%d):\n", nt*nq);
     for(int32_t i = 0; i <5; i++) {
-      printf("%u ", output[i]);
+      printf("%u ", pipeline.Output()[i]);
     }
     printf("\n");
   }
 
-  CSeqMatcher::FreeDMACompatible(output);
+  pipeline.Free();
+  return journal_error == CJournal::OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Incremental update (--store): the run is assembled from the stored run that shares the most
+// pairs with it. Only the new targets (against all the queries) and the new queries (against
+// the known targets) are computed, as two smaller runs, and stitched into the stored results.
+// The new run replaces the stored one and its results are copied to scores.bin. Returns false on errors.
+bool incremental_run(SetSequences *seq_target, SetSequences *seq_query, int32_t nt, int32_t nq) {
+  CRunStore store(store_dir);
+  CRunStore::TMatch match;
+  std::vector<uint64_t> t_hashes, q_hashes;
+  std::vector<int32_t> new_targets, old_targets, new_queries, all_queries;
+  struct timespec start, end;
+  bool done = true;
+
+  CRunStore::HashSet(seq_target, nt, t_hashes);
+  CRunStore::HashSet(seq_query, nq, q_hashes);
+  std::string name = CRunStore::Name(t_hashes, q_hashes);
+  std::string result = store.File(name, ".bin.tmp");
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  if (store.Find(t_hashes, q_hashes, match) != CRunStore::OK) {
+    printf("Run store: no stored run shares pairs with this one. Computing %d targets x %d queries.\n", nt, nq);
+    done = split_block(seq_target, seq_query, nt, nq, result.c_str(), store.File(name, ".journal").c_str(), false);
+    unlink(store.File(name, ".journal").c_str());
+  } else {
+    for (int32_t t = 0; t < nt; ++t)
+      (match.tOld[t] < 0 ? new_targets : old_targets).push_back(t);
+    for (int32_t q = 0; q < nq; ++q) {
+      all_queries.push_back(q);
+      if (match.qOld[q] < 0)
+        new_queries.push_back(q);
+    }
+    printf("Run store: %.1f%% of the pairs reused from %s (%zu new targets, %zu new queries)\n",
+      100.0 * match.reused / ((double)nt * nq), match.base.c_str(), new_targets.size(), new_queries.size());
+
+    // The delta runs compute copies: split_block reorders the sets it is given.
+    std::string rows = store.File(name, ".rows"), cols = store.File(name, ".cols");
+    if (!new_targets.empty()) {
+      SetSequences * targets = gather_sequences(seq_target, new_targets);
+      SetSequences * queries = gather_sequences(seq_query, all_queries);
+      done = targets != NULL && queries != NULL && split_block(targets, queries, new_targets.size(), nq, rows.c_str(),
+        (rows + ".journal").c_str(), false);
+      free_sequences(targets);
+      free_sequences(queries);
+    }
+    if (done && !new_queries.empty() && !old_targets.empty()) {
+      SetSequences * targets = gather_sequences(seq_target, old_targets);
+      SetSequences * queries = gather_sequences(seq_query, new_queries);
+      done = targets != NULL && queries != NULL && split_block(targets, queries, old_targets.size(), new_queries.size(),
+        cols.c_str(), (cols + ".journal").c_str(), false);
+      free_sequences(targets);
+      free_sequences(queries);
+    }
+    if (done && store.Stitch(match, nt, nq, new_targets.empty() ? NULL : rows.c_str(),
+        new_queries.empty() ? NULL : cols.c_str(), result.c_str()) != CRunStore::OK) {
+      printf("Error stitching the results of %s\n", match.base.c_str());
+      done = false;
+    }
+    unlink(rows.c_str());
+    unlink(cols.c_str());
+    unlink((rows + ".journal").c_str());
+    unlink((cols + ".journal").c_str());
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+
+  if (!done || store.Save(t_hashes, q_hashes, result.c_str(), match.reused > 0 ? match.base : "") != CRunStore::OK ||
+      CRunStore::Copy(store.File(name, ".bin").c_str(), "scores.bin") != CRunStore::OK) {
+    printf("Error updating the run store %s\n", store_dir);
+    unlink(result.c_str());
+    return false;
+  }
+  printf("Run store: %s updated in %.3f s\n", name.c_str(), CalcTimeDiff(end, start) / 1e9);
+  return true;
 }
 
 ///////////////////////////////////////////////////////////////////////////////
 int main(int argc, char const *argv[]) {
   SetSequences *seq_target=0, *seq_query=0;  
-  uint64_t address_sequences_p, address_sequences_t, address_descriptions_p,
-    address_descriptions_t, address_length_p, address_length_t;
 
   CSeqMatcher::SetLogging(false);
-  #if USE_DRIVER
-  if ( seqMatchers.OpenDriver(driver_name) != CAccelDriver::OK ) {
-    printf("Error opening accelerator!\n");
-    return -1;
-  }
-  #else
-  if ( seqMatchers.Open(BASE_ADDR) != CAccelDriver::OK ) {
-    printf("Error opening accelerator!\n");
-    return -1;
-  }
-  #endif
 
   const char* target = argv[1];
   const char* query = argv[2];
   int nq = atoi(argv[3]);
   int nt = atoi(argv[4]);
+  if (!read_engine_options(argc, argv))
+    return 1;
+  hits_file = GetOption(argc, argv, "hits");
+  sort_lengths = GetOption(argc, argv, "sort-lengths") != NULL;
+  dedup = GetOption(argc, argv, "dedup") != NULL;
+  spill_dir = GetOption(argc, argv, "spill-dir");
+  resume = GetOption(argc, argv, "resume") != NULL;
+  if (GetOption(argc, argv, "journal") != NULL)
+    journal_file = GetOption(argc, argv, "journal");
+  if (GetOption(argc, argv, "checkpoint-interval") != NULL)
+    checkpoint_ms = atof(GetOption(argc, argv, "checkpoint-interval")) * 1000;
+  store_dir = GetOption(argc, argv, "store");
+  if (store_dir != NULL && (hits_file != NULL || resume)) {
+    printf("Warning: --hits and --resume are ignored with --store.\n");
+    hits_file = NULL;
+    resume = false;
+  }
+  if (GetOption(argc, argv, "watchdog") != NULL)
+    watchdog = atof(GetOption(argc, argv, "watchdog"));
+  hybrid_wait = GetOption(argc, argv, "no-spin") == NULL;
+  tune_chunks = GetOption(argc, argv, "no-tune") == NULL;
+  if (GetOption(argc, argv, "tune-cache") != NULL)
+    tune_cache = GetOption(argc, argv, "tune-cache");
+  bitstream = GetOption(argc, argv, "bitstream");
+  get_cpus(argc, argv, "upload-cpus", upload_cpus);
+  get_cpus(argc, argv, "compute-cpus", compute_cpus);
+  get_cpus(argc, argv, "write-cpus", write_cpus);
+  // Host workers pinned explicitly (--compute-cpus) stay on those CPUs.
+  if (!compute_cpus.empty())
+    numa = false;
+  if (!open_engines())
+    return 1;
+  int status = 0;
   seq_target = read_file(target, nt);
   seq_query = read_file(query, nq);
 
   if ( (seq_target == NULL) || (seq_query == NULL) ) {
     printf("Error reading seq_target or seq_query\n");
+    status = 1;
   }
-  else {
-    split_block(seq_target, seq_query, nt, nq);
+  else if (store_dir != NULL) {
+    if (!incremental_run(seq_target, seq_query, nt, nq))
+      status = 1;
+  }
+  else if (!split_block(seq_target, seq_query, nt, nq, "scores.bin", journal_file, true)) {
+    status = 1;
   }
 
-  CSeqMatcher::FreeDMACompatible(seq_target->sequences);
-  // CSeqMatcher::FreeDMACompatible(seq_target->descriptions);
-  CSeqMatcher::FreeDMACompatible(seq_target->length);
-  CSeqMatcher::FreeDMACompatible(seq_query->sequences);
-  // CSeqMatcher::FreeDMACompatible(seq_query->descriptions);
-  CSeqMatcher::FreeDMACompatible(seq_query->length);
-  seqMatchers.CloseDriver();
-
-  if (seq_target != NULL)
+  if (seq_target != NULL) {
+    free_host(seq_target->sequences);
+    free_host(seq_target->length);
     free(seq_target);
-  if (seq_query != NULL)
+  }
+  if (seq_query != NULL) {
+    free_host(seq_query->sequences);
+    free_host(seq_query->length);
     free(seq_query);
+  }
+  close_engines();
 
-  return 0;
+  return status;
 }
 
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <map>
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "accels.h"
+
+const char * driver_name = "/dev/seqdriver";
+const uint64_t BASE_ADDR = 0x00A0000000;
+const uint64_t ACCEL_ADDR_STRIDE = 0x10000; // Distance between the register spaces of the instances
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t open_accels(CSeqMatcher * matchers, uint32_t max_accels, bool discover) {
+  uint32_t num_accels = 0;
+
+  #if USE_DRIVER
+  (void)discover; // Every node of the driver is a real instance
+  char node_name[64];
+  for (uint32_t a = 0; a < max_accels; ++a) {
+    snprintf(node_name, sizeof(node_name), "%s%u", driver_name, a);
+    if (access(node_name, F_OK) != 0 || matchers[num_accels].OpenDriver(node_name) != CAccelDriver::OK)
+      break;
+    ++ num_accels;
+  }
+  if (num_accels == 0 && max_accels > 0 && matchers[0].OpenDriver(driver_name) == CAccelDriver::OK)
+    num_accels = 1;
+  #else
+  if (discover && max_accels > 1)
+    max_accels = 1;
+  for (uint32_t a = 0; a < max_accels; ++a) {
+    if (matchers[num_accels].Open(BASE_ADDR + a * ACCEL_ADDR_STRIDE) != CAccelDriver::OK)
+      break;
+    ++ num_accels;
+  }
+  #endif
+
+  return num_accels;
+}
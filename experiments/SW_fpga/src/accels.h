@@ -0,0 +1,18 @@
+#ifndef ACCELS_H
+#define ACCELS_H
+
+// Requires <stdint.h>, "CAccelDriver.hpp", "CSeqMatcher.hpp"
+
+// Discovery of the accelerator instances (compute units) of the bitstream.
+
+#define USE_DRIVER (true)
+#define MAX_MODULES 8 // Maximum number of accelerator instances (compute units)
+
+///////////////////////////////////////////////////////////////////////////////
+// Opens up to max_accels instances into matchers[0..) and returns how many were opened.
+// With the driver, instance i is /dev/seqdriver<i> (or the single node /dev/seqdriver).
+// Without it, instances cannot be discovered: max_accels are mapped if discover is false,
+// only one otherwise.
+uint32_t open_accels(CSeqMatcher * matchers, uint32_t max_accels, bool discover);
+
+#endif // ACCELS_H
@@ -0,0 +1,71 @@
+#ifndef DAEMON_PROTOCOL_H
+#define DAEMON_PROTOCOL_H
+
+// Requires <stdint.h>, "sequences.h"
+
+// Protocol between the alignment daemon (seqmatcherd) and its clients (CAlignClient)
+// over a Unix domain socket. Only small fixed-size messages go through the socket:
+// the queries and the results are exchanged in a shared-memory region (memfd) created
+// by the client and passed with every request (SCM_RIGHTS). The region must be sealed
+// against shrinking (F_SEAL_SHRINK). The daemon validates its own copy of the queries.
+//
+//  daemon -> client  TDaemonHello    on connection: resident targets and limits
+//  client -> daemon  TDaemonRequest  + region descriptor
+//  daemon -> client  TDaemonReply    when the results are in the region
+//
+// Layout of the region for nq queries and nt targets:
+//  [0, lengths)            int32_t lengths[nq]
+//  [sequences, scores)     char sequences[nq][MAX_SEQ_LENGTH]
+//  [scores, end)           uint32_t scores[nt][nq]  (same layout as scores.bin)
+
+#define DAEMON_MAGIC 0x44514553  // "SEQD"
+#define DAEMON_VERSION 3
+
+typedef enum {DAEMON_OK = 0, DAEMON_BAD_REQUEST = 1, DAEMON_BAD_REGION = 2, DAEMON_ACCEL_ERROR = 3} TDaemonStatus;
+
+// Priority classes of the requests (see CJobScheduler).
+typedef enum {DAEMON_INTERACTIVE = 0, DAEMON_NORMAL = 1, DAEMON_BULK = 2} TDaemonPriority;
+
+struct TDaemonHello {
+  uint32_t magic, version;
+  int32_t nt;             // Resident targets
+  int32_t blockQueries;   // Queries per chunk (requests are computed in chunks)
+};
+
+struct TDaemonRequest {
+  uint32_t magic;
+  int32_t nq;             // Queries in the region
+  uint64_t regionSize;    // Size of the region passed with the request
+  uint32_t priority;      // TDaemonPriority
+  uint32_t reserved;
+};
+
+struct TDaemonReply {
+  uint32_t status;        // TDaemonStatus
+  int32_t nq;
+  uint64_t computeTime;   // Time computing the chunks of the request (ns)
+  uint64_t latency;       // Time from the arrival of the request to the reply (ns)
+};
+
+///////////////////////////////////////////////////////////////////////////////
+inline uint64_t RegionAlign(uint64_t size)
+{
+  return (size + 63) & ~(uint64_t)63;
+}
+
+inline uint64_t RegionSequences(int32_t nq)
+{
+  return RegionAlign((uint64_t)nq * sizeof(int32_t));
+}
+
+inline uint64_t RegionScores(int32_t nq)
+{
+  return RegionSequences(nq) + RegionAlign((uint64_t)nq * MAX_SEQ_LENGTH);
+}
+
+inline uint64_t RegionSize(int32_t nt, int32_t nq)
+{
+  return RegionScores(nq) + (uint64_t)nt * nq * sizeof(uint32_t);
+}
+
+#endif // DAEMON_PROTOCOL_H
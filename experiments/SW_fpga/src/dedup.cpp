@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <unordered_map>
+#include "sequences.h"
+#include "myers.h"
+#include "reorder.h"
+#include "dedup.h"
+
+///////////////////////////////////////////////////////////////////////////////
+uint64_t HashSequence(const char * seq, int32_t length, uint64_t * packed)
+{
+  uint64_t hash = 0x9E3779B97F4A7C15ull ^ (uint64_t)length;
+
+  // Fixed-size inner loops over whole words so that the packing vectorizes.
+  for (int32_t w = 0; w < PACKED_WORDS; ++w) {
+    uint64_t word = 0;
+    int32_t base = w * 32;
+    if (base + 32 <= length) {
+      for (int32_t k = 0; k < 32; ++k)
+        word |= (uint64_t)BaseCode(seq[base + k]) << (2 * k);
+    } else {
+      for (int32_t k = 0; k < 32 && base + k < length; ++k)
+        word |= (uint64_t)BaseCode(seq[base + k]) << (2 * k);
+    }
+    packed[w] = word;
+  }
+
+  for (int32_t w = 0; w < (length + 31) / 32; ++w) {
+    hash = (hash ^ packed[w]) * 0xFF51AFD7ED558CCDull;
+    hash ^= hash >> 32;
+  }
+  return hash;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int32_t CollapseDuplicates(SetSequences * set, int32_t first, int32_t last, int32_t out, TIndexMap & map)
+{
+  std::unordered_multimap<uint64_t, int32_t> table;
+  std::vector<uint64_t> packed;  // packed words of the unique sequences
+  uint64_t words[PACKED_WORDS];
+  int32_t unique = 0;
+
+  if (last <= first)
+    return 0;
+  for (int32_t i = map.size(); i < last; ++i)
+    map.push_back(i);
+  table.reserve(last - first);
+
+  for (int32_t i = first; i < last; ++i) {
+    const char * seq = set->sequences + (size_t)i * MAX_SEQ_LENGTH;
+    int32_t length = set->length[i];
+    uint64_t hash = HashSequence(seq, length, words);
+    int32_t found = -1;
+
+    auto range = table.equal_range(hash);
+    for (auto it = range.first; it != range.second && found < 0; ++it) {
+      int32_t u = it->second;
+      if (set->length[out + u] == length && memcmp(&packed[(size_t)u * PACKED_WORDS], words, sizeof(words)) == 0)
+        found = u;
+    }
+
+    if (found < 0) {
+      found = unique++;
+      table.emplace(hash, found);
+      packed.insert(packed.end(), words, words + PACKED_WORDS);
+      // out + found <= i: the slot was already read (or is this same sequence)
+      if (out + found != i) {
+        memcpy(set->sequences + (size_t)(out + found) * MAX_SEQ_LENGTH, seq, MAX_SEQ_LENGTH);
+        set->length[out + found] = length;
+      }
+    }
+    map[i] = out + found;
+  }
+
+  return unique;
+}
@@ -0,0 +1,26 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+// Requires <stdint.h>, <vector>, "sequences.h", "reorder.h"
+
+// Collapsing of duplicated sequences before they are sent to the engines.
+// Sequences are compared through their 2-bit packed form (32 bases per word),
+// which is all the accelerator sees, so collapsed sequences always get the
+// same results. Candidates are found with a 64-bit hash of the packed words
+// and confirmed by comparing the words.
+
+#define PACKED_WORDS ((MAX_SEQ_LENGTH + 31) / 32)
+
+///////////////////////////////////////////////////////////////////////////////
+// Packs the sequence into PACKED_WORDS words (unused bases are 0) and returns its hash.
+uint64_t HashSequence(const char * seq, int32_t length, uint64_t * packed);
+
+///////////////////////////////////////////////////////////////////////////////
+// Collapses the duplicates among the sequences [first, last) of the set. The unique
+// sequences (first occurrences, in order) are moved to [out, out + unique), with
+// out <= first, and map[i] is set to the new position of sequence i for i in
+// [first, last). The map is extended with the identity if it is shorter than last.
+// Returns the number of unique sequences.
+int32_t CollapseDuplicates(SetSequences * set, int32_t first, int32_t last, int32_t out, TIndexMap & map);
+
+#endif // DEDUP_H
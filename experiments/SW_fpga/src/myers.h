@@ -0,0 +1,113 @@
+#ifndef MYERS_H
+#define MYERS_H
+
+// Requires <stdint.h>, "sequences.h"
+
+// Host counterpart of the bit-parallel (Myers) edit distance computed by
+// String_matching() in the accelerator. The query is the bit-vector and the
+// target is traversed one base at a time. Bases are compared with the same
+// 2-bit code that the hardware extracts from the ASCII value (bits 1 and 2),
+// so results are bit-exact with the accelerator output.
+
+#define MYERS_WORDS ((MAX_SEQ_LENGTH + 63) / 64)
+
+// 2-bit code of a base: A = 00, C = 01, G = 11, T = 10 (case-insensitive).
+inline uint32_t BaseCode(char c)
+{
+  return ((c >> 1) & 1) | (((c >> 2) & 1) << 1);
+}
+
+// Match masks of a query: bit i of eq[code] is set when query[i] has that code.
+struct TPeq {
+  uint64_t eq[4][MYERS_WORDS];
+  int32_t length;
+  int32_t words;
+};
+
+// Vertical delta vectors (positive/negative) of one column of the DP matrix.
+struct TMyersColumn {
+  uint64_t vp[MYERS_WORDS];
+  uint64_t vn[MYERS_WORDS];
+};
+
+///////////////////////////////////////////////////////////////////////////////
+inline void BuildPeq(const char * query, int32_t length, TPeq & peq)
+{
+  peq.length = length;
+  peq.words = (length + 63) / 64;
+  for (int32_t c = 0; c < 4; ++c)
+    for (int32_t w = 0; w < MYERS_WORDS; ++w)
+      peq.eq[c][w] = 0;
+  for (int32_t i = 0; i < length; ++i)
+    peq.eq[BaseCode(query[i])][i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Column before the first target base: D[i][-1] = i.
+inline void MyersInit(TMyersColumn & col, int32_t words)
+{
+  for (int32_t w = 0; w < words; ++w) {
+    col.vp[w] = ~(uint64_t)0;
+    col.vn[w] = 0;
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Advances the column by one target base. The first row is free (HP is shifted
+// in with a 0, as in the hardware), which gives semi-global alignment of the
+// query inside the target. Returns the change of the score in the last row.
+inline int32_t MyersStep(const uint64_t * eq, TMyersColumn & col, int32_t words, int32_t lastBit)
+{
+  uint64_t carry = 0, hpCarry = 0, hnCarry = 0;
+  int32_t delta = 0;
+
+  for (int32_t w = 0; w < words; ++w) {
+    uint64_t vp = col.vp[w], vn = col.vn[w];
+    uint64_t x = eq[w] | vn;
+    uint64_t xp = x & vp;
+    uint64_t s = xp + vp;
+    uint64_t c = (s < xp);
+    s += carry;
+    carry = c | (s < carry);
+    uint64_t d0 = (s ^ vp) | x;
+    uint64_t hn = d0 & vp;
+    uint64_t hp = vn | ~(d0 | vp);
+
+    if (w == (lastBit >> 6))
+      delta = (int32_t)((hp >> (lastBit & 63)) & 1) - (int32_t)((hn >> (lastBit & 63)) & 1);
+
+    uint64_t xs = (hp << 1) | hpCarry;
+    uint64_t hs = (hn << 1) | hnCarry;
+    hpCarry = hp >> 63;
+    hnCarry = hn >> 63;
+    col.vn[w] = xs & d0;
+    col.vp[w] = hs | ~(xs | d0);
+  }
+  return delta;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Same result as String_matching(): the target position where the score of the
+// last row reaches its (first) minimum, and optionally that minimum distance.
+inline int32_t MyersEndPos(const TPeq & peq, const char * target, int32_t tlen, int32_t * distance = NULL)
+{
+  TMyersColumn col;
+  int32_t score = peq.length, minValue = score, minPos = 0;
+
+  if (peq.length > 0) {
+    MyersInit(col, peq.words);
+    for (int32_t j = 0; j < tlen; ++j) {
+      score += MyersStep(peq.eq[BaseCode(target[j])], col, peq.words, peq.length - 1);
+      if (score < minValue) {
+        minValue = score;
+        minPos = j;
+      }
+    }
+  }
+
+  if (distance != NULL)
+    *distance = minValue;
+  return minPos;
+}
+
+#endif // MYERS_H
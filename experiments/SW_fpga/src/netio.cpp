@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <vector>
+#include <string>
+#include "sequences.h"
+#include "netio.h"
+
+#define LISTEN_BACKLOG 16
+
+///////////////////////////////////////////////////////////////////////////////
+// Fills the address of a Unix domain socket. Returns false if the path is too long.
+static bool unix_address(const char * path, struct sockaddr_un & addr)
+{
+  if (strlen(path) >= sizeof(addr.sun_path))
+    return false;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Resolves a TCP "[host:]port".
+static struct addrinfo * tcp_address(const char * endpoint, bool passive)
+{
+  struct addrinfo hints, * res = NULL;
+  std::string host, port(endpoint);
+  size_t colon = port.rfind(':');
+
+  if (colon != std::string::npos) {
+    host = port.substr(0, colon);
+    port = port.substr(colon + 1);
+  }
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = passive ? AI_PASSIVE : 0;
+  if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res) != 0)
+    return NULL;
+  return res;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int listen_endpoint(const char * endpoint)
+{
+  int sock = -1, one = 1;
+
+  if (strchr(endpoint, '/') != NULL) {
+    struct sockaddr_un addr;
+    if (!unix_address(endpoint, addr))
+      return -1;
+    unlink(endpoint);
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, LISTEN_BACKLOG) != 0)) {
+      close(sock);
+      sock = -1;
+    }
+    return sock;
+  }
+
+  struct addrinfo * res = tcp_address(endpoint, true);
+  for (struct addrinfo * ai = res; ai != NULL && sock < 0; ai = ai->ai_next) {
+    sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (sock < 0)
+      continue;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(sock, ai->ai_addr, ai->ai_addrlen) != 0 || listen(sock, LISTEN_BACKLOG) != 0) {
+      close(sock);
+      sock = -1;
+    }
+  }
+  if (res != NULL)
+    freeaddrinfo(res);
+  return sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The messages are written in pieces (header, then data): they must not wait for the
+// acknowledgement of the previous piece. Fails silently on Unix domain sockets.
+static void no_delay(int sock)
+{
+  int one = 1;
+
+  setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int accept_endpoint(int listener)
+{
+  int sock = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+  if (sock >= 0)
+    no_delay(sock);
+  return sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int connect_endpoint(const char * endpoint)
+{
+  int sock = -1;
+
+  if (strchr(endpoint, '/') != NULL) {
+    struct sockaddr_un addr;
+    if (!unix_address(endpoint, addr))
+      return -1;
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock >= 0 && connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+      close(sock);
+      sock = -1;
+    }
+    return sock;
+  }
+
+  struct addrinfo * res = tcp_address(endpoint, false);
+  for (struct addrinfo * ai = res; ai != NULL && sock < 0; ai = ai->ai_next) {
+    sock = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (sock < 0)
+      continue;
+    if (connect(sock, ai->ai_addr, ai->ai_addrlen) != 0) {
+      close(sock);
+      sock = -1;
+    }
+  }
+  if (res != NULL)
+    freeaddrinfo(res);
+  if (sock >= 0)
+    no_delay(sock);
+  return sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool send_all(int fd, const void * buf, size_t size)
+{
+  const char * p = (const char*)buf;
+
+  while (size > 0) {
+    ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool recv_all(int fd, void * buf, size_t size)
+{
+  char * p = (char*)buf;
+
+  while (size > 0) {
+    ssize_t n = recv(fd, p, size, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    size -= n;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool send_sequences(int fd, const SetSequences * set, int32_t first, int32_t n)
+{
+  std::vector<char> packed;
+
+  for (int32_t i = first; i < first + n; ++i)
+    packed.insert(packed.end(), set->sequences + (uint64_t)i * MAX_SEQ_LENGTH,
+      set->sequences + (uint64_t)i * MAX_SEQ_LENGTH + set->length[i]);
+  return send_all(fd, set->length + first, n * sizeof(int32_t)) && send_all(fd, packed.data(), packed.size());
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool recv_sequences(int fd, SetSequences * set, int32_t n)
+{
+  std::vector<char> packed;
+  uint64_t total = 0;
+
+  if (!recv_all(fd, set->length, n * sizeof(int32_t)))
+    return false;
+  for (int32_t i = 0; i < n; ++i) {
+    if (set->length[i] < 0 || set->length[i] > MAX_SEQ_LENGTH)
+      return false;
+    total += set->length[i];
+  }
+  packed.resize(total);
+  if (!recv_all(fd, packed.data(), total))
+    return false;
+
+  const char * p = packed.data();
+  for (int32_t i = 0; i < n; ++i) {
+    memcpy(set->sequences + (uint64_t)i * MAX_SEQ_LENGTH, p, set->length[i]);
+    p += set->length[i];
+  }
+  return true;
+}
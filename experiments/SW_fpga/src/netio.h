@@ -0,0 +1,33 @@
+#ifndef NETIO_H
+#define NETIO_H
+
+// Requires <stdint.h>, <stddef.h>, "sequences.h"
+
+// Stream sockets of the sharded execution (seqcoord, seqworker). An endpoint is
+// the path of a Unix domain socket if it contains a '/', and a TCP "[host:]port"
+// otherwise (all the interfaces when a listening host is omitted).
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns a listening socket, or -1.
+int listen_endpoint(const char * endpoint);
+
+///////////////////////////////////////////////////////////////////////////////
+// Accepts a connection of a listening socket. Returns the socket, or -1.
+int accept_endpoint(int listener);
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns a connected socket, or -1.
+int connect_endpoint(const char * endpoint);
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends or receives the whole buffer, retrying on signals and short transfers.
+bool send_all(int fd, const void * buf, size_t size);
+bool recv_all(int fd, void * buf, size_t size);
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends the sequences [first, first + n) of a set packed (lengths, then the sequences
+// back to back), and receives n of them into the fixed slots of a set with room for them.
+bool send_sequences(int fd, const SetSequences * set, int32_t first, int32_t n);
+bool recv_sequences(int fd, SetSequences * set, int32_t n);
+
+#endif // NETIO_H
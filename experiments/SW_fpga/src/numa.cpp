@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <algorithm>
+#include <vector>
+#include "numa.h"
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define NUMA_LINE 4096
+
+///////////////////////////////////////////////////////////////////////////////
+bool ParseCpuList(const char * list, std::vector<int> & cpus)
+{
+  const char * p = list;
+  char * end;
+
+  cpus.clear();
+  while (*p != '\0') {
+    long first = strtol(p, &end, 10), last;
+    if (end == p || first < 0 || first >= CPU_SETSIZE)
+      return false;
+    last = first;
+    p = end;
+    if (*p == '-') {
+      last = strtol(p + 1, &end, 10);
+      if (end == p + 1 || last < first || last >= CPU_SETSIZE)
+        return false;
+      p = end;
+    }
+    for (long c = first; c <= last; ++c)
+      cpus.push_back(c);
+    if (*p == ',')
+      ++ p;
+    else if (*p != '\0')
+      return false;
+  }
+  return !cpus.empty();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+uint32_t ReadNumaNodes(std::vector<TNumaNode> & nodes)
+{
+  DIR * dir = opendir(NUMA_SYSFS);
+  struct dirent * entry;
+  char path[NUMA_LINE], line[NUMA_LINE];
+
+  nodes.clear();
+  if (dir == NULL)
+    return 0;
+  while ((entry = readdir(dir)) != NULL) {
+    TNumaNode node;
+    char * end;
+    if (strncmp(entry->d_name, "node", 4) != 0)
+      continue;
+    node.id = strtol(entry->d_name + 4, &end, 10);
+    if (end == entry->d_name + 4 || *end != '\0')
+      continue;
+    snprintf(path, sizeof(path), NUMA_SYSFS "/%s/cpulist", entry->d_name);
+    FILE * fp = fopen(path, "r");
+    if (fp == NULL)
+      continue;
+    if (fgets(line, sizeof(line), fp) != NULL) {
+      line[strcspn(line, "\n")] = '\0';
+      // Nodes without CPUs (memory only) run no workers.
+      if (ParseCpuList(line, node.cpus))
+        nodes.push_back(node);
+    }
+    fclose(fp);
+  }
+  closedir(dir);
+  std::sort(nodes.begin(), nodes.end(), [](const TNumaNode & a, const TNumaNode & b) { return a.id < b.id; });
+  return nodes.size();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool BindToNode(const TNumaNode & node)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  for (size_t i = 0; i < node.cpus.size(); ++i)
+    CPU_SET(node.cpus[i], &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,29 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+// Requires <stdint.h>, <vector>
+
+// NUMA topology of the host, read from sysfs (/sys/devices/system/node), so no
+// library is needed. Memory is placed on a node by the first-touch policy of the
+// kernel: a page is allocated on the node of the CPU that writes it first, so a
+// buffer filled by a thread pinned to the node is local to the threads of the node.
+
+typedef struct {
+  int32_t id;               // Node number in the system
+  std::vector<int> cpus;    // Online CPUs of the node
+} TNumaNode;
+
+///////////////////////////////////////////////////////////////////////////////
+// Parses a CPU list such as "0-3,8,10-11". Returns false if it is empty or malformed.
+bool ParseCpuList(const char * list, std::vector<int> & cpus);
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the nodes with CPUs. Returns the number of nodes (0 if the topology is not
+// available, e.g., a kernel without NUMA support).
+uint32_t ReadNumaNodes(std::vector<TNumaNode> & nodes);
+
+///////////////////////////////////////////////////////////////////////////////
+// Pins the calling thread to the CPUs of the node. Returns false if it could not be pinned.
+bool BindToNode(const TNumaNode & node);
+
+#endif // NUMA_H
@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include "util.h"
+#include "sequences.h"
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "accels.h"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+#include "options.h"
+
+#define MAX_THREADS 1024  // Host threads and engine workers accepted
+
+CSeqMatcher seqMatchers[MAX_MODULES];
+uint32_t num_accels = 0;
+uint32_t num_threads = 1;
+uint32_t cpu_workers = 0;
+uint32_t driver_batch = 1;
+bool numa = true;
+const char * dma_backend = NULL;
+static uint32_t max_accels = MAX_MODULES;  // --accels=<n>
+static bool discover_accels = true;         // --accels not given
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the number given to --name into value, if the option is there. Returns false (with
+// an error message) if it is not a number in [min, max].
+static bool read_number(int argc, char const * argv[], const char * name, long min, long max, long & value) {
+  const char * text = GetOption(argc, argv, name);
+  char * end = NULL;
+
+  if (text == NULL)
+    return true;
+  errno = 0;
+  long n = strtol(text, &end, 10);
+  if (end == text || *end != '\0' || errno != 0 || n < min || n > max) {
+    printf("Error: --%s needs a number between %ld and %ld.\n", name, min, max);
+    return false;
+  }
+  value = n;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool read_engine_options(int argc, char const * argv[]) {
+  // hardware_concurrency() is 0 when the number of CPUs is not known.
+  long threads = std::max(std::thread::hardware_concurrency(), 1u), workers = cpu_workers, batch = driver_batch;
+
+  if (!read_number(argc, argv, "threads", 1, MAX_THREADS, threads) ||
+      !read_number(argc, argv, "cpu-workers", 0, MAX_THREADS, workers) ||
+      !read_number(argc, argv, "driver-batch", 1, MAX_DRIVER_BATCH, batch))
+    return false;
+  num_threads = threads;
+  cpu_workers = workers;
+  driver_batch = batch;
+  numa = GetOption(argc, argv, "no-numa") == NULL;
+  dma_backend = GetOption(argc, argv, "dma");
+  discover_accels = GetOption(argc, argv, "accels") == NULL;
+  if (!discover_accels) {
+    const char * text = GetOption(argc, argv, "accels");
+    char * end = NULL;
+    errno = 0;
+    long n = strtol(text, &end, 10);
+    if (end == text || *end != '\0' || errno != 0 || n < 0) {
+      printf("Error: --accels needs a number of accelerators between 0 and %u.\n", MAX_MODULES);
+      return false;
+    }
+    if (n > MAX_MODULES)
+      printf("Warning: Only %u accelerators are supported, using %u.\n", MAX_MODULES, MAX_MODULES);
+    max_accels = (n < MAX_MODULES) ? n : MAX_MODULES;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+bool open_engines() {
+  if (dma_backend != NULL && !CSeqMatcher::SetDMABackend(dma_backend))
+    return false;
+
+  // Open every accelerator instance (compute unit) available.
+  // Without the driver, instances cannot be discovered: --accels gives how many there are.
+  num_accels = open_accels(seqMatchers, max_accels, discover_accels);
+  if (num_accels == 0) {
+    printf("Error opening accelerator! Using the host engine only.\n");
+    if (cpu_workers == 0)
+      cpu_workers = num_threads;
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void close_engines() {
+  for (uint32_t a = 0; a < num_accels; ++a)
+    seqMatchers[a].CloseDriver();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::vector<CSeqMatcher *> engine_accels() {
+  std::vector<CSeqMatcher *> accels;
+
+  for (uint32_t a = 0; a < num_accels; ++a)
+    accels.push_back(&seqMatchers[a]);
+  return accels;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void configure_scheduler(CCoScheduler & scheduler) {
+  scheduler.SetDriverBatch(driver_batch);
+  if (numa) {
+    std::vector<TNumaNode> nodes;
+    ReadNumaNodes(nodes);
+    scheduler.SetNuma(nodes);
+  }
+}
@@ -0,0 +1,36 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+// Requires <stdint.h>, <vector>, "CAccelDriver.hpp", "CSeqMatcher.hpp", "accels.h", "CCoScheduler.hpp"
+
+// Engine options shared by seqmatcher, seqmatcherd and seqworker:
+//   [--threads=<n>] [--cpu-workers=<n>] [--accels=<n>] [--driver-batch=<n>] [--no-numa] [--dma=<backend>]
+
+extern CSeqMatcher seqMatchers[MAX_MODULES];
+extern uint32_t num_accels;       // Accelerator instances opened (at most --accels=<n>)
+extern uint32_t num_threads;      // Host worker threads (--threads=<n>, all the CPUs by default)
+extern uint32_t cpu_workers;      // Host engine workers next to the accelerator (--cpu-workers=<n>)
+extern uint32_t driver_batch;     // Tiles chained by the driver per submission (--driver-batch=<n>)
+extern bool numa;                 // Place the host workers and the targets they read on the NUMA nodes (--no-numa: off)
+extern const char * dma_backend;  // Source of the DMA memory (--dma=<backend>, CDmaBackend.hpp)
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads the engine options. Returns false if one is invalid (with an error message).
+bool read_engine_options(int argc, char const * argv[]);
+
+///////////////////////////////////////////////////////////////////////////////
+// Selects the DMA backend and opens the accelerator instances into seqMatchers. Without
+// accelerators, the host engine takes all the threads. Returns false if the backend
+// cannot be used.
+bool open_engines();
+void close_engines();
+
+///////////////////////////////////////////////////////////////////////////////
+// Accelerators opened, as the scheduler takes them.
+std::vector<CSeqMatcher *> engine_accels();
+
+///////////////////////////////////////////////////////////////////////////////
+// Applies the driver batch and the NUMA placement to a scheduler.
+void configure_scheduler(CCoScheduler & scheduler);
+
+#endif // OPTIONS_H
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include "sequences.h"
+#include "reorder.h"
+
+///////////////////////////////////////////////////////////////////////////////
+void SortByLength(const SetSequences * set, int32_t first, int32_t last, std::vector<int32_t> & order)
+{
+  size_t base = order.size();
+
+  for (int32_t i = first; i < last; ++i)
+    order.push_back(i);
+  std::stable_sort(order.begin() + base, order.end(),
+    [set](int32_t a, int32_t b) { return set->length[a] < set->length[b]; });
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ApplyOrder(SetSequences * set, const std::vector<int32_t> & order)
+{
+  size_t n = order.size();
+
+  if (n == 0)
+    return;
+
+  // The sets live in DMA memory: work on a host copy and write each slot once.
+  char * sequences = (char*)malloc(n * MAX_SEQ_LENGTH);
+  int32_t * length = (int32_t*)malloc(n * sizeof(int32_t));
+  if (sequences == NULL || length == NULL) {
+    printf("Error allocating memory to reorder the sequences.\n");
+    free(sequences);
+    free(length);
+    return;
+  }
+  memcpy(sequences, set->sequences, n * MAX_SEQ_LENGTH);
+  memcpy(length, set->length, n * sizeof(int32_t));
+
+  for (size_t k = 0; k < n; ++k) {
+    memcpy(set->sequences + k * MAX_SEQ_LENGTH, sequences + (size_t)order[k] * MAX_SEQ_LENGTH, MAX_SEQ_LENGTH);
+    set->length[k] = length[order[k]];
+  }
+
+  free(sequences);
+  free(length);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+std::vector<int32_t> InvertOrder(const std::vector<int32_t> & order)
+{
+  std::vector<int32_t> inverse(order.size());
+
+  for (size_t k = 0; k < order.size(); ++k)
+    inverse[order[k]] = k;
+  return inverse;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void ComposeOrder(TIndexMap & map, const std::vector<int32_t> & order)
+{
+  if (order.empty())
+    return;
+
+  std::vector<int32_t> inverse = InvertOrder(order);
+  if (map.empty()) {
+    map = inverse;
+    return;
+  }
+  for (auto & index : map)
+    index = inverse[index];
+}
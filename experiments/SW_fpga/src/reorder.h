@@ -0,0 +1,31 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+// Requires <stdint.h>, <vector>, "sequences.h"
+
+// Reordering of the sequence sets before they are sent to the engines.
+// An order is a permutation where order[k] is the index of the sequence placed at
+// position k. The engines work on the reordered (and possibly collapsed, see
+// dedup.h) set, and an index map tells the position in that set of every original
+// sequence. Empty orders and maps stand for the identity.
+
+typedef std::vector<int32_t> TIndexMap;  // map[original index] = index in the computed set
+
+///////////////////////////////////////////////////////////////////////////////
+// Sorts the sequences [first, last) of the set by increasing length (stable) and
+// appends their original indices to order.
+void SortByLength(const SetSequences * set, int32_t first, int32_t last, std::vector<int32_t> & order);
+
+///////////////////////////////////////////////////////////////////////////////
+// Moves the sequences (and lengths) of the set so that position k holds the former sequence order[k].
+void ApplyOrder(SetSequences * set, const std::vector<int32_t> & order);
+
+///////////////////////////////////////////////////////////////////////////////
+// Returns the inverse permutation (inverse[order[k]] = k).
+std::vector<int32_t> InvertOrder(const std::vector<int32_t> & order);
+
+///////////////////////////////////////////////////////////////////////////////
+// Updates the index map of a set after the computed set was permuted with order.
+void ComposeOrder(TIndexMap & map, const std::vector<int32_t> & order);
+
+#endif // REORDER_H
@@ -0,0 +1,76 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <vector>
+#include "util.h"
+#include "sequences.h"
+#include "seqio.h"
+#include "daemon_protocol.h"
+#include "CAlignClient.hpp"
+
+//  Command-line client of the alignment daemon (seqmatcherd). Aligns the queries of a
+// FASTQ file against the targets resident in the daemon and writes scores.bin with the
+// same layout as seqmatcher (uint32_t, target-major).
+//
+//   seqclient <socket> <query.fq> <num_queries> [--repeat=<n>] [--priority=interactive|normal|bulk]
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char const *argv[]) {
+  CAlignClient client;
+  struct timespec start, end;
+  uint32_t repeat = 1, priority = DAEMON_NORMAL, res = CAlignClient::OK;
+  const char * opt;
+  FILE * fp;
+
+  if (argc < 4) {
+    printf("Usage: %s <socket> <query.fq> <num_queries> [--repeat=<n>] [--priority=interactive|normal|bulk]\n", argv[0]);
+    return 1;
+  }
+  const char* socket_path = argv[1];
+  const char* query = argv[2];
+  int nq = atoi(argv[3]);
+  if (GetOption(argc, argv, "repeat") != NULL)
+    repeat = atoi(GetOption(argc, argv, "repeat"));
+  opt = GetOption(argc, argv, "priority");
+  if (opt != NULL)
+    priority = (strcmp(opt, "interactive") == 0) ? DAEMON_INTERACTIVE : (strcmp(opt, "bulk") == 0) ? DAEMON_BULK : DAEMON_NORMAL;
+
+  SetSequences * seq_query = read_file(query, nq);
+  if (seq_query == NULL)
+    return 1;
+  if (client.Connect(socket_path) != CAlignClient::OK)
+    return 1;
+  if (client.Reserve(nq) != CAlignClient::OK) {
+    printf("Error: Cannot reserve the shared memory for %d queries.\n", nq);
+    return 1;
+  }
+  // The queries are written directly in the region shared with the daemon.
+  memcpy(client.Queries().sequences, seq_query->sequences, (uint64_t)nq * MAX_SEQ_LENGTH);
+  memcpy(client.Queries().length, seq_query->length, nq * sizeof(int32_t));
+
+  for (uint32_t i = 0; i < repeat && res == CAlignClient::OK; ++i) {
+    clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+    res = client.Align(priority);
+    clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+    printf("Request %u: %d targets x %d queries in %.3f ms (%.3f ms in the daemon, %.3f ms computing)\n", i,
+      client.Targets(), nq, CalcTimeDiff(end, start) / 1e6, client.GetLatency() / 1e6, client.GetComputeTime() / 1e6);
+  }
+  if (res != CAlignClient::OK) {
+    printf("Error: The request failed (%u).\n", res);
+    return 1;
+  }
+
+  fp = fopen("scores.bin", "wb");
+  if (fp == NULL || fwrite(client.Scores(), sizeof(uint32_t), (uint64_t)client.Targets() * nq, fp) != (uint64_t)client.Targets() * nq) {
+    printf("Error writing scores.bin\n");
+    return 1;
+  }
+  fclose(fp);
+
+  free_host(seq_query->sequences);
+  free_host(seq_query->length);
+  free(seq_query);
+  return 0;
+}
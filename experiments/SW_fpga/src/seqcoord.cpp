@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+#include "util.h"
+#include "sequences.h"
+#include "seqio.h"
+#include "netio.h"
+#include "reorder.h"
+#include "CResultWriter.hpp"
+#include "shard_protocol.h"
+
+//  Coordinator of a sharded run. Splits the target set into shards of consecutive
+// targets and distributes them to seqworker processes (boards or hosts running the
+// host engine) over TCP or Unix domain sockets. Every worker computes one shard at a
+// time, so faster workers take more shards. The results of every shard are written
+// into a single scores.bin, with the same layout as seqmatcher.
+//
+// A shard whose worker fails (connection lost, error status, or no reply within
+// --timeout seconds) is re-issued to another worker, up to --retries times. A failed
+// worker is not used again in the run. The run fails if a shard exhausts its retries
+// or no worker is left.
+//
+//   seqcoord <target.fq> <num_targets> <query.fq> <num_queries> --workers=<endpoint>[,<endpoint>...]
+//     [--shard-targets=<n>] [--retries=<n>] [--timeout=<s>]
+//
+// An endpoint is "[host:]port" (TCP) or the path of a Unix domain socket (see netio.h).
+
+#define DEFAULT_RETRIES 3
+#define DEFAULT_TIMEOUT 600
+#define SHARDS_PER_WORKER 4   // Default shards per worker: enough to balance unequal workers
+
+typedef enum {PENDING = 0, RUNNING = 1, DONE = 2} TShardState;
+
+struct TShard {
+  int32_t t0, nt;         // Targets [t0, t0 + nt)
+  uint32_t attempts;      // Times it was issued
+  uint32_t state;         // TShardState
+};
+
+struct TWorker {
+  std::string endpoint;
+  int fd;                 // -1: failed or not connected
+  int32_t maxTargets;
+  int32_t shard;          // Shard in progress (-1: idle)
+  struct timespec start;  // Time the shard was issued
+  uint32_t shards, failures;
+  uint64_t rows, computeTime, busyTime;
+};
+
+uint32_t retries = DEFAULT_RETRIES;   // Re-issues of a failed shard (--retries=<n>)
+uint32_t timeout = DEFAULT_TIMEOUT;   // Seconds for a shard (--timeout=<s>)
+
+///////////////////////////////////////////////////////////////////////////////
+inline int32_t min(int32_t a, int32_t b) {
+    return (a < b) ? a : b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Connects to a worker and sends it the query set. Returns false if the worker cannot be used.
+bool connect_worker(TWorker & w, const SetSequences * queries, int32_t nq) {
+  struct TShardHello hello;
+  struct TShardMessage msg = {SHARD_MAGIC, SHARD_QUERIES, -1, nq};
+  struct TShardReply reply;
+  struct timeval tv = {(time_t)timeout, 0};
+
+  w.fd = connect_endpoint(w.endpoint.c_str());
+  if (w.fd < 0) {
+    printf("Warning: Cannot connect to the worker %s (errno %d).\n", w.endpoint.c_str(), errno);
+    return false;
+  }
+  // A worker that stops answering in the middle of a message is detected with the timeout.
+  setsockopt(w.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  setsockopt(w.fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+  if (!recv_all(w.fd, &hello, sizeof(hello)) || hello.magic != SHARD_MAGIC || hello.version != SHARD_VERSION ||
+      !send_all(w.fd, &msg, sizeof(msg)) || !send_sequences(w.fd, queries, 0, nq) ||
+      !recv_all(w.fd, &reply, sizeof(reply)) || reply.status != SHARD_OK || reply.nq != nq) {
+    printf("Warning: The worker %s did not accept the queries.\n", w.endpoint.c_str());
+    close(w.fd);
+    w.fd = -1;
+    return false;
+  }
+  w.maxTargets = hello.maxTargets;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Drops a worker and puts its shard back in the queue. Returns false if the shard has no retries left.
+bool fail_worker(TWorker & w, std::vector<TShard> & shards, std::deque<int32_t> & pending, const char * reason) {
+  bool ok = true;
+
+  printf("Warning: Worker %s failed (%s).", w.endpoint.c_str(), reason);
+  if (w.shard >= 0) {
+    TShard & s = shards[w.shard];
+    s.state = PENDING;
+    if (s.attempts > retries) {
+      ok = false;
+      printf(" Shard %d failed %u times.", w.shard, s.attempts);
+    } else {
+      pending.push_front(w.shard);
+      printf(" Shard %d is re-issued.", w.shard);
+    }
+  }
+  printf("\n");
+  close(w.fd);
+  w.fd = -1;
+  w.shard = -1;
+  ++ w.failures;
+  return ok;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sends a shard to an idle worker.
+bool issue_shard(TWorker & w, int32_t s, std::vector<TShard> & shards, const SetSequences * targets) {
+  struct TShardMessage msg = {SHARD_MAGIC, SHARD_ALIGN, s, shards[s].nt};
+
+  w.shard = s;
+  shards[s].state = RUNNING;
+  ++ shards[s].attempts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &w.start);
+  return send_all(w.fd, &msg, sizeof(msg)) && send_sequences(w.fd, targets, shards[s].t0, shards[s].nt);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Receives the results of the shard of a worker and writes them.
+bool receive_shard(TWorker & w, std::vector<TShard> & shards, int32_t nq, CResultWriter & writer,
+                   std::vector<uint32_t> & scores) {
+  struct TShardReply reply;
+  struct timespec end;
+  TShard & s = shards[w.shard];
+
+  if (!recv_all(w.fd, &reply, sizeof(reply)) || reply.status != SHARD_OK || reply.shard != w.shard ||
+      reply.nt != s.nt || reply.nq != nq)
+    return false;
+  scores.resize((uint64_t)s.nt * nq);
+  if (!recv_all(w.fd, scores.data(), scores.size() * sizeof(uint32_t)))
+    return false;
+  if (writer.WriteTile(scores.data(), s.t0, s.nt, 0, nq, 0, nq) != CResultWriter::OK) {
+    printf("Error writing the results of shard %d.\n", w.shard);
+    exit(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  s.state = DONE;
+  ++ w.shards;
+  w.rows += s.nt;
+  w.computeTime += reply.computeTime;
+  w.busyTime += CalcTimeDiff(end, w.start);
+  w.shard = -1;
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char const *argv[]) {
+  struct timespec start, end, now;
+  std::vector<TWorker> workers;
+  std::vector<TShard> shards;
+  std::deque<int32_t> pending;
+  std::vector<uint32_t> scores;
+  CResultWriter writer;
+  int32_t shard_targets = 0, done = 0, max_shard = 0;
+  bool ok = true;
+
+  if (argc < 5 || GetOption(argc, argv, "workers") == NULL) {
+    printf("Usage: %s <target.fq> <num_targets> <query.fq> <num_queries> --workers=<endpoint>[,<endpoint>...] "
+      "[--shard-targets=<n>] [--retries=<n>] [--timeout=<s>]\n", argv[0]);
+    return 1;
+  }
+  const char* target = argv[1];
+  int32_t nt = atoi(argv[2]);
+  const char* query = argv[3];
+  int32_t nq = atoi(argv[4]);
+  if (GetOption(argc, argv, "shard-targets") != NULL)
+    shard_targets = atoi(GetOption(argc, argv, "shard-targets"));
+  if (GetOption(argc, argv, "retries") != NULL)
+    retries = atoi(GetOption(argc, argv, "retries"));
+  if (GetOption(argc, argv, "timeout") != NULL)
+    timeout = atoi(GetOption(argc, argv, "timeout"));
+  std::string list(GetOption(argc, argv, "workers"));
+  for (size_t p = 0; p <= list.size(); ) {
+    size_t comma = list.find(',', p);
+    if (comma == std::string::npos)
+      comma = list.size();
+    if (comma > p) {
+      TWorker w = {list.substr(p, comma - p), -1, 0, -1, {0, 0}, 0, 0, 0, 0, 0};
+      workers.push_back(w);
+    }
+    p = comma + 1;
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  SetSequences * seq_target = read_file(target, nt);
+  SetSequences * seq_query = read_file(query, nq);
+  if (seq_target == NULL || seq_query == NULL || nt <= 0 || nq <= 0)
+    return 1;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  for (size_t i = 0; i < workers.size(); ++i)
+    if (connect_worker(workers[i], seq_query, nq))
+      max_shard = (max_shard == 0) ? workers[i].maxTargets : min(max_shard, workers[i].maxTargets);
+  if (max_shard == 0) {
+    printf("Error: No worker available.\n");
+    return 1;
+  }
+
+  // Shards must fit every worker, since a failed shard may go to any of them.
+  if (shard_targets <= 0)
+    shard_targets = (nt + SHARDS_PER_WORKER * workers.size() - 1) / (SHARDS_PER_WORKER * workers.size());
+  shard_targets = min(shard_targets, max_shard);
+  for (int32_t t0 = 0; t0 < nt; t0 += shard_targets) {
+    TShard s = {t0, min(shard_targets, nt - t0), 0, PENDING};
+    pending.push_back(shards.size());
+    shards.push_back(s);
+  }
+  printf("seqcoord: %d targets x %d queries in %zu shards of up to %d targets\n", nt, nq, shards.size(), shard_targets);
+  if (writer.Open("scores.bin", nt, nq, TIndexMap(), nt, TIndexMap()) != CResultWriter::OK)
+    return 1;
+
+  while (ok && done < (int32_t)shards.size()) {
+    std::vector<struct pollfd> fds;
+    std::vector<size_t> owner;
+    int wait = -1;
+
+    // Every idle worker takes the next pending shard.
+    for (size_t i = 0; i < workers.size() && ok; ++i) {
+      TWorker & w = workers[i];
+      if (w.fd < 0 || w.shard >= 0 || pending.empty())
+        continue;
+      int32_t s = pending.front();
+      pending.pop_front();
+      if (!issue_shard(w, s, shards, seq_target))
+        ok = fail_worker(w, shards, pending, "cannot send the shard");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    for (size_t i = 0; i < workers.size(); ++i) {
+      TWorker & w = workers[i];
+      if (w.fd < 0 || w.shard < 0)
+        continue;
+      // Wait until the first shard in progress times out.
+      int64_t left = std::max<int64_t>((int64_t)timeout * 1000 - (int64_t)(CalcTimeDiff(now, w.start) / 1000000), 0);
+      if (wait < 0 || left < wait)
+        wait = (int)left;
+      struct pollfd fd = {w.fd, POLLIN, 0};
+      fds.push_back(fd);
+      owner.push_back(i);
+    }
+    if (!ok)
+      break;
+    if (fds.empty()) {
+      printf("Error: No worker left, %zu shards not computed.\n", shards.size() - done);
+      ok = false;
+      break;
+    }
+
+    if (poll(fds.data(), fds.size(), wait) < 0 && errno != EINTR)
+      break;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+    for (size_t k = 0; k < fds.size() && ok; ++k) {
+      TWorker & w = workers[owner[k]];
+      if (fds[k].revents != 0) {
+        int32_t s = w.shard;
+        if (!receive_shard(w, shards, nq, writer, scores)) {
+          ok = fail_worker(w, shards, pending, "connection lost or error status");
+        } else {
+          ++ done;
+          printf("Shard %d (targets %d-%d) done by %s: %d/%zu\n", s, shards[s].t0, shards[s].t0 + shards[s].nt - 1,
+            w.endpoint.c_str(), done, shards.size());
+        }
+      } else if (CalcTimeDiff(now, w.start) / 1000000000 >= timeout) {
+        ok = fail_worker(w, shards, pending, "timeout");
+      }
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  writer.Close();
+
+  for (size_t i = 0; i < workers.size(); ++i) {
+    TWorker & w = workers[i];
+    printf("Worker %s: %u shards, %lu targets, busy %.3f s (%.3f s computing), %u failures\n", w.endpoint.c_str(),
+      w.shards, w.rows, w.busyTime / 1e9, w.computeTime / 1e9, w.failures);
+    if (w.fd >= 0)
+      close(w.fd);
+  }
+  free_host(seq_target->sequences);
+  free_host(seq_target->length);
+  free(seq_target);
+  free_host(seq_query->sequences);
+  free_host(seq_query->length);
+  free(seq_query);
+  if (!ok || done < (int32_t)shards.size()) {
+    printf("Error: The run is incomplete (%d/%zu shards).\n", done, shards.size());
+    return 1;
+  }
+  printf("seqcoord: %zu shards in %.3f s\n", shards.size(), CalcTimeDiff(end, start) / 1e9);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <map>
+#include <vector>
+#include <string>
+#include "sequences.h"
+#include "seqio.h"
+
+const char * spill_dir = NULL; // Keep the sets in memory-mapped files of this directory (--spill-dir=<dir>)
+static std::map<void *, uint64_t> spill_maps; // Size of every set mapped from a file
+
+///////////////////////////////////////////////////////////////////////////////
+// Host memory for the sequence sets. With --spill-dir the sets are mapped from unlinked
+// files, so that sets larger than the RAM are paged from the disk.
+void * alloc_host(uint64_t size) {
+  void * addr = MAP_FAILED;
+
+  if (spill_dir == NULL)
+    return malloc(size);
+
+  std::string path = std::string(spill_dir) + "/seqmatcher.XXXXXX";
+  int fd = mkstemp(&path[0]);
+  if (fd < 0)
+    return NULL;
+  unlink(path.c_str());
+  if (ftruncate(fd, size) == 0)
+    addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED)
+    return NULL;
+  spill_maps[addr] = size;
+  return addr;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void free_host(void * addr) {
+  auto it = spill_maps.find(addr);
+
+  if (it == spill_maps.end()) {
+    free(addr);
+    return;
+  }
+  munmap(addr, it->second);
+  spill_maps.erase(it);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SetSequences* read_file(const char *path, const uint32_t MAX_SEQUENCES) {
+  FILE *file = fopen(path, "rb");
+  if (file == NULL) {
+    perror("Error al abrir el archivo");
+    exit(EXIT_FAILURE);
+  }
+
+  bool ignore = false;
+  char buffer[BUFFER_SIZE];
+
+  SetSequences * customData = (SetSequences *)malloc(sizeof(SetSequences));
+  if (customData == NULL) {
+    printf("Error allocating memory for customData\n");
+    return NULL;
+  }
+
+  // The sets stay in host memory: the tiles are copied to DMA memory when they are computed.
+  // The descriptions are skipped, so that the whole set is in alloc_host() memory (--spill-dir).
+  customData->descriptions = NULL;
+  customData->sequences = (char*)alloc_host((uint64_t)MAX_SEQUENCES * MAX_SEQ_LENGTH * sizeof(char));
+  customData->length = (int32_t*)alloc_host((uint64_t)MAX_SEQUENCES * sizeof(int32_t));
+  if ( (customData->sequences == NULL) || (customData->length == NULL) ) {
+    printf("Error allocating memory for the sequences.\n");
+    free(customData);
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < MAX_SEQUENCES; ++i) {
+    *(customData->sequences + i * MAX_SEQ_LENGTH) = '\0';
+    customData->length[i] = 0;
+  }
+
+
+  int32_t sequenceCount = 0;
+  int32_t cnt=0;
+  while (fgets(buffer, BUFFER_SIZE, file) != NULL) {
+    if (strncmp(buffer, "@T", 2) == 0) {
+      if ((uint32_t)sequenceCount < MAX_SEQUENCES) {
+        ignore=false;
+      }
+      else {
+        break; 
+      }
+      sequenceCount++;
+    }
+    else if (buffer[0] == '+') {
+      ignore=true;
+    }
+    else {
+      if(ignore==false){
+        cnt=0;
+        for (uint32_t jj = 0; jj < MAX_SEQ_LENGTH; ++jj) {
+          if(buffer[jj] != '\n') {
+            *(customData->sequences+(sequenceCount-1)*MAX_SEQ_LENGTH+jj)=buffer[jj];
+            //printf("%c", buffer[jj]);
+            if (buffer[jj] == '\0')
+              break;
+            cnt++;
+          }
+        }
+        // printf("\n");
+        *(customData->length + sequenceCount - 1) = cnt;
+      }
+    }
+  }
+  fclose(file);
+
+  return customData;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+SetSequences* gather_sequences(const SetSequences *set, const std::vector<int32_t> & idx) {
+  SetSequences * subset = (SetSequences *)malloc(sizeof(SetSequences));
+  if (subset == NULL)
+    return NULL;
+
+  subset->descriptions = NULL;
+  subset->sequences = (char*)alloc_host((uint64_t)idx.size() * MAX_SEQ_LENGTH * sizeof(char));
+  subset->length = (int32_t*)alloc_host((uint64_t)idx.size() * sizeof(int32_t));
+  if ( (subset->sequences == NULL) || (subset->length == NULL) ) {
+    printf("Error allocating memory for the sequences.\n");
+    free_sequences(subset);
+    return NULL;
+  }
+  for (size_t i = 0; i < idx.size(); ++i) {
+    memcpy(subset->sequences + i * MAX_SEQ_LENGTH, set->sequences + (uint64_t)idx[i] * MAX_SEQ_LENGTH, MAX_SEQ_LENGTH);
+    subset->length[i] = set->length[idx[i]];
+  }
+  return subset;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void free_sequences(SetSequences *set) {
+  if (set == NULL)
+    return;
+  if (set->sequences != NULL)
+    free_host(set->sequences);
+  if (set->length != NULL)
+    free_host(set->length);
+  free(set->descriptions);
+  free(set);
+}
@@ -0,0 +1,25 @@
+#ifndef SEQIO_H
+#define SEQIO_H
+
+// Requires <stdint.h>, <vector>, "sequences.h"
+
+// Reading of the sequence sets (FASTQ) into host memory.
+
+extern const char * spill_dir;  // If not NULL, the sets are kept in memory-mapped files of this directory
+
+///////////////////////////////////////////////////////////////////////////////
+// Host memory for the sequence sets. With spill_dir the sets are mapped from unlinked
+// files, so that sets larger than the RAM are paged from the disk.
+void * alloc_host(uint64_t size);
+void free_host(void * addr);
+
+///////////////////////////////////////////////////////////////////////////////
+// Reads up to MAX_SEQUENCES sequences of a FASTQ file. The descriptions are not kept.
+SetSequences* read_file(const char *path, const uint32_t MAX_SEQUENCES);
+
+///////////////////////////////////////////////////////////////////////////////
+// New set with the sequences idx of a set, in that order (without descriptions).
+SetSequences* gather_sequences(const SetSequences *set, const std::vector<int32_t> & idx);
+void free_sequences(SetSequences *set);
+
+#endif // SEQIO_H
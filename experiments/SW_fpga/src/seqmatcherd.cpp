@@ -0,0 +1,440 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <deque>
+#include "util.h"
+#include "sequences.h"
+#include "seqio.h"
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "accels.h"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+#include "options.h"
+#include "CJobScheduler.hpp"
+#include "daemon_protocol.h"
+
+//  Alignment daemon. Keeps a target set resident in the DMA memory (read, uploaded
+// and bound to the accelerators once) and aligns the query batches of local clients
+// against it. Clients connect to a Unix domain socket and pass the queries and
+// receive the results in a shared-memory region (see daemon_protocol.h and
+// CAlignClient). Requests are computed in chunks of queries, interleaved by
+// priority class and weight (CJobScheduler): an interactive request preempts a
+// bulk one at the next chunk boundary. The latency of every class is printed
+// on SIGUSR1 and at exit.
+//
+//   seqmatcherd <target.fq> <num_targets> <socket> [--max-queries=<n>] [--chunk-queries=<n>]
+//     [--class-weights=<interactive>,<normal>,<bulk>] [--threads=<n>] [--cpu-workers=<n>]
+//     [--accels=<n>] [--driver-batch=<n>] [--no-numa]
+
+#define MAX_CLIENTS 64
+#define DEFAULT_MAX_QUERIES 1000
+#define DEFAULT_CHUNK_QUERIES 64
+
+int32_t max_queries = DEFAULT_MAX_QUERIES; // Queries computed at once, i.e., size of the DMA query buffer (--max-queries=<n>)
+int32_t chunk_queries = DEFAULT_CHUNK_QUERIES; // Queries per chunk, i.e., preemption granularity (--chunk-queries=<n>)
+volatile sig_atomic_t stop = 0, report = 0;
+
+// Resident state: DMA buffers and engines bound to them.
+SetSequences * seq_target = NULL;      // Host copy of the targets (host engine)
+SetSequences dma_targets, dma_queries;
+SetSequences host_queries;             // Window of the queries of the current chunk (host engine)
+uint32_t * dma_output = NULL;
+CDmaBuffer dma_buffers[5];               // Target and query sequences and lengths, output
+int32_t nt = 0;
+
+// Request accepted and not answered yet. Its region stays mapped until the reply.
+struct TRequest {
+  CJobScheduler::TJob job;
+  int conn;
+  char * region;
+  uint64_t mapSize;
+  uint64_t busyTime;    // Time computing its chunks (ns)
+};
+std::deque<TRequest *> requests;
+
+///////////////////////////////////////////////////////////////////////////////
+void on_signal(int sig) {
+  if (sig == SIGUSR1)
+    report = 1;
+  else
+    stop = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+inline int32_t min(int32_t a, int32_t b) {
+    return (a < b) ? a : b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocates the DMA buffers, uploads the targets and binds the buffers to the accelerators.
+bool make_resident() {
+  dma_targets.descriptions = dma_queries.descriptions = host_queries.descriptions = NULL;
+  dma_buffers[0] = CSeqMatcher::AllocDMABuffer((uint64_t)nt * MAX_SEQ_LENGTH, 1);
+  dma_buffers[1] = CSeqMatcher::AllocDMABuffer(nt * sizeof(int32_t), 1);
+  dma_buffers[2] = CSeqMatcher::AllocDMABuffer((uint64_t)max_queries * MAX_SEQ_LENGTH, 1);
+  dma_buffers[3] = CSeqMatcher::AllocDMABuffer(max_queries * sizeof(int32_t), 1);
+  dma_buffers[4] = CSeqMatcher::AllocDMABuffer((uint64_t)nt * max_queries * sizeof(uint32_t));
+  dma_targets.sequences = dma_buffers[0].As<char>();
+  dma_targets.length = dma_buffers[1].As<int32_t>();
+  dma_queries.sequences = dma_buffers[2].As<char>();
+  dma_queries.length = dma_buffers[3].As<int32_t>();
+  dma_output = dma_buffers[4].As<uint32_t>();
+  if (dma_targets.sequences == NULL || dma_targets.length == NULL || dma_queries.sequences == NULL ||
+      dma_queries.length == NULL || dma_output == NULL) {
+    printf("Error allocating DMA memory for %d targets and %d queries (try a smaller --max-queries).\n", nt, max_queries);
+    return false;
+  }
+
+  memcpy(dma_targets.sequences, seq_target->sequences, (uint64_t)nt * MAX_SEQ_LENGTH);
+  memcpy(dma_targets.length, seq_target->length, nt * sizeof(int32_t));
+  CSeqMatcher::FlushDMA(dma_targets.sequences, (uint64_t)nt * MAX_SEQ_LENGTH);
+  CSeqMatcher::FlushDMA(dma_targets.length, nt * sizeof(int32_t));
+  for (uint32_t a = 0; a < num_accels; ++a) {
+    if (seqMatchers[a].InitConfig(dma_targets.sequences, dma_targets.length, dma_queries.sequences,
+          dma_queries.length, dma_output, MAX_SEQ_LENGTH) != CSeqMatcher::OK) {
+      printf("Error configuring accelerator %u.\n", a);
+      return false;
+    }
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void free_resident() {
+  for (uint32_t b = 0; b < 5; ++b)
+    dma_buffers[b].Reset();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Aligns the queries [q0, q0 + count) of a client region with nq queries (layout in
+// daemon_protocol.h). count is at most max_queries.
+uint32_t align_chunk(CCoScheduler & scheduler, char * region, int32_t nq, int32_t q0, int32_t count) {
+  int32_t * lengths = (int32_t*)region;
+  char * sequences = region + RegionSequences(nq);
+  uint32_t * scores = (uint32_t*)(region + RegionScores(nq));
+
+  // The client can still write to its region: the queries are copied to the DMA buffers
+  // first, and only the copy is validated and read by the engines (the host one included).
+  memcpy(dma_queries.sequences, sequences + (uint64_t)q0 * MAX_SEQ_LENGTH, (uint64_t)count * MAX_SEQ_LENGTH);
+  memcpy(dma_queries.length, lengths + q0, count * sizeof(int32_t));
+  for (int32_t q = 0; q < count; ++q)
+    if (dma_queries.length[q] < 0 || dma_queries.length[q] > MAX_SEQ_LENGTH)
+      return DAEMON_BAD_REQUEST;
+  CSeqMatcher::FlushDMA(dma_queries.sequences, (uint64_t)count * MAX_SEQ_LENGTH);
+  CSeqMatcher::FlushDMA(dma_queries.length, count * sizeof(int32_t));
+  host_queries.sequences = dma_queries.sequences;
+  host_queries.length = dma_queries.length;
+  if (scheduler.Run(nt, 0, count, dma_output) != CCoScheduler::OK)
+    return DAEMON_ACCEL_ERROR;
+  for (int32_t t = 0; t < nt; ++t)
+    memcpy(scores + (uint64_t)t * nq + q0, dma_output + (uint64_t)t * count, count * sizeof(uint32_t));
+  return DAEMON_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void send_reply(int conn, uint32_t status, int32_t nq, uint64_t busyTime, const struct timespec & arrival) {
+  struct TDaemonReply reply;
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  reply.status = status;
+  reply.nq = nq;
+  reply.computeTime = busyTime;
+  reply.latency = CalcTimeDiff(now, arrival);
+  if (write(conn, &reply, sizeof(reply)) != sizeof(reply))
+    printf("Warning: Cannot reply to a client.\n");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Answers a request (if its client is still there) and releases it.
+void finish_request(TRequest * req, uint32_t status, CJobScheduler & jobs) {
+  if (status != DAEMON_OK)
+    jobs.Cancel(&req->job);
+  if (req->conn >= 0)
+    send_reply(req->conn, status, req->job.nq, req->busyTime, req->job.arrival);
+  munmap(req->region, req->mapSize);
+  for (size_t i = 0; i < requests.size(); ++i)
+    if (requests[i] == req)
+      requests.erase(requests.begin() + i);
+  delete req;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Receives a request and its region and queues it. Returns false if the connection
+// must be closed.
+bool receive_request(int conn, CJobScheduler & jobs) {
+  struct TDaemonRequest request;
+  struct timespec arrival;
+  struct msghdr msg;
+  struct iovec iov;
+  union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr * cmsg;
+  struct stat info;
+  uint32_t status = DAEMON_OK;
+  char * region = (char*)MAP_FAILED;
+  int fd = -1;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &request;
+  iov.iov_len = sizeof(request);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  do {
+    n = recvmsg(conn, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0)
+    return false;
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  clock_gettime(CLOCK_MONOTONIC_RAW, &arrival);
+
+  if (n != sizeof(request) || request.magic != DAEMON_MAGIC || request.nq <= 0 || request.priority >= JOB_CLASSES) {
+    status = DAEMON_BAD_REQUEST;
+  } else if (fd < 0 || fstat(fd, &info) != 0 || (uint64_t)info.st_size < RegionSize(nt, request.nq) ||
+             request.regionSize < RegionSize(nt, request.nq)) {
+    status = DAEMON_BAD_REGION;
+  } else if ((fcntl(fd, F_GET_SEALS) & F_SEAL_SHRINK) == 0) {
+    // A region that can shrink while it is mapped would fault the daemon (SIGBUS).
+    status = DAEMON_BAD_REGION;
+  } else {
+    region = (char*)mmap(NULL, RegionSize(nt, request.nq), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED)
+      status = DAEMON_BAD_REGION;
+  }
+  if (fd >= 0)
+    close(fd);
+
+  if (status != DAEMON_OK) {
+    send_reply(conn, status, request.nq, 0, arrival);
+    return true;
+  }
+
+  TRequest * req = new TRequest;
+  req->job.nq = request.nq;
+  req->job.cls = request.priority;
+  req->job.arrival = arrival;
+  req->job.user = req;
+  req->conn = conn;
+  req->region = region;
+  req->mapSize = RegionSize(nt, request.nq);
+  req->busyTime = 0;
+  requests.push_back(req);
+  jobs.Submit(&req->job);
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The client left: its pending requests are dropped.
+void drop_requests(int conn, CJobScheduler & jobs) {
+  for (size_t i = requests.size(); i > 0; --i) {
+    TRequest * req = requests[i - 1];
+    if (req->conn == conn) {
+      req->conn = -1;
+      finish_request(req, DAEMON_BAD_REQUEST, jobs);
+    }
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the next chunk chosen by the job scheduler, if any.
+void run_chunk(CCoScheduler & scheduler, CJobScheduler & jobs) {
+  CJobScheduler::TChunk chunk;
+  struct timespec start, end;
+  uint32_t status;
+
+  if (!jobs.Next(chunk))
+    return;
+  TRequest * req = (TRequest*)chunk.job->user;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  status = align_chunk(scheduler, req->region, req->job.nq, chunk.q0, chunk.count);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  req->busyTime += CalcTimeDiff(end, start);
+  if (status != DAEMON_OK)
+    finish_request(req, status, jobs);
+  else if (jobs.Complete(chunk, CalcTimeDiff(end, start)))
+    finish_request(req, DAEMON_OK, jobs);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int open_socket(const char * path) {
+  struct sockaddr_un addr;
+  int sock;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    printf("Error: Socket path too long: %s\n", path);
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, path);
+  unlink(path);
+
+  sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, MAX_CLIENTS) != 0) {
+    printf("Error: Cannot listen on %s (errno %d).\n", path, errno);
+    if (sock >= 0)
+      close(sock);
+    return -1;
+  }
+  return sock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char const *argv[]) {
+  struct TDaemonHello hello;
+  struct sigaction action;
+
+  if (argc < 4) {
+    printf("Usage: %s <target.fq> <num_targets> <socket> [--max-queries=<n>] [--chunk-queries=<n>] "
+      "[--class-weights=<i>,<n>,<b>] [--threads=<n>] [--cpu-workers=<n>] [--accels=<n>] [--driver-batch=<n>] [--no-numa] [--dma=<backend>]\n", argv[0]);
+    return 1;
+  }
+  CSeqMatcher::SetLogging(false);
+
+  const char* target = argv[1];
+  nt = atoi(argv[2]);
+  const char* socket_path = argv[3];
+  if (!read_engine_options(argc, argv))
+    return 1;
+  if (GetOption(argc, argv, "max-queries") != NULL)
+    max_queries = atoi(GetOption(argc, argv, "max-queries"));
+  if (GetOption(argc, argv, "chunk-queries") != NULL)
+    chunk_queries = atoi(GetOption(argc, argv, "chunk-queries"));
+  chunk_queries = min(chunk_queries, max_queries);
+  CJobScheduler jobs(chunk_queries);
+  if (GetOption(argc, argv, "class-weights") != NULL) {
+    double w[JOB_CLASSES] = {0, 0, 0};
+    char end = 0;
+    if (sscanf(GetOption(argc, argv, "class-weights"), "%lf,%lf,%lf%c", &w[0], &w[1], &w[2], &end) != JOB_CLASSES ||
+        !(w[0] > 0 && w[1] > 0 && w[2] > 0)) {
+      printf("Error: --class-weights needs %u positive weights (<interactive>,<normal>,<bulk>).\n", JOB_CLASSES);
+      return 1;
+    }
+    for (uint32_t c = 0; c < JOB_CLASSES; ++c)
+      jobs.SetWeight(c, w[c]);
+  }
+
+  if (!open_engines())
+    return 1;
+
+  seq_target = read_file(target, nt);
+  if (seq_target == NULL || nt <= 0 || max_queries <= 0 || !make_resident())
+    return 1;
+
+  // The engines are calibrated once, with the first targets as queries.
+  std::vector<CSeqMatcher *> accels = engine_accels();
+  CHostMatcher host(seq_target, &host_queries);
+  CCoScheduler scheduler(accels, USE_DRIVER, &host, cpu_workers);
+  configure_scheduler(scheduler);
+  int32_t nc = min(nt, max_queries);
+  memcpy(dma_queries.sequences, seq_target->sequences, (uint64_t)nc * MAX_SEQ_LENGTH);
+  memcpy(dma_queries.length, seq_target->length, nc * sizeof(int32_t));
+  CSeqMatcher::FlushDMA(dma_queries.sequences, (uint64_t)nc * MAX_SEQ_LENGTH);
+  CSeqMatcher::FlushDMA(dma_queries.length, nc * sizeof(int32_t));
+  host_queries.sequences = seq_target->sequences;
+  host_queries.length = seq_target->length;
+  if (scheduler.Calibrate(nt, 0, nc, dma_output) != CCoScheduler::OK) {
+    printf("Error calibrating the engines.\n");
+    return 1;
+  }
+
+  int listener = open_socket(socket_path);
+  if (listener < 0)
+    return 1;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGUSR1, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  printf("seqmatcherd: %d targets resident, %u accelerators, %u host workers, chunks of %d queries, listening on %s\n",
+    nt, num_accels, cpu_workers, chunk_queries, socket_path);
+  fflush(stdout);
+
+  hello.magic = DAEMON_MAGIC;
+  hello.version = DAEMON_VERSION;
+  hello.nt = nt;
+  hello.blockQueries = chunk_queries;
+
+  // Event loop: the listener and the connected clients are checked between chunks,
+  // so new requests are scheduled at the next chunk boundary.
+  std::vector<struct pollfd> fds(1);
+  fds[0].fd = listener;
+  fds[0].events = POLLIN;
+  while (!stop) {
+    if (report) {
+      jobs.PrintStats();
+      scheduler.PrintFaults();
+      fflush(stdout);
+      report = 0;
+    }
+    if (poll(fds.data(), fds.size(), jobs.Pending() ? 0 : -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    for (size_t i = fds.size() - 1; i > 0; --i) {
+      if (fds[i].revents == 0)
+        continue;
+      if ((fds[i].revents & POLLIN) == 0 || !receive_request(fds[i].fd, jobs)) {
+        drop_requests(fds[i].fd, jobs);
+        close(fds[i].fd);
+        fds.erase(fds.begin() + i);
+      }
+    }
+    if (fds[0].revents & POLLIN) {
+      int conn = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+      if (conn >= 0 && fds.size() <= MAX_CLIENTS && write(conn, &hello, sizeof(hello)) == sizeof(hello)) {
+        struct pollfd client = {conn, POLLIN, 0};
+        fds.push_back(client);
+      } else if (conn >= 0) {
+        close(conn);
+      }
+    }
+    run_chunk(scheduler, jobs);
+  }
+
+  jobs.PrintStats();
+  scheduler.PrintFaults();
+  scheduler.PrintNuma();
+  while (!requests.empty())
+    finish_request(requests.front(), DAEMON_BAD_REQUEST, jobs);
+
+  for (size_t i = 0; i < fds.size(); ++i)
+    close(fds[i].fd);
+  unlink(socket_path);
+  free_resident();
+  close_engines();
+  free_host(seq_target->sequences);
+  free_host(seq_target->length);
+  free(seq_target);
+  printf("seqmatcherd: stopped.\n");
+  return 0;
+}
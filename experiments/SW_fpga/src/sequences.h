@@ -0,0 +1,19 @@
+#ifndef SEQUENCES_H
+#define SEQUENCES_H
+
+// Requires <stdint.h>
+
+// Layout of the sequence sets shared with the accelerator. Every sequence
+// occupies a fixed slot of MAX_SEQ_LENGTH bytes, so sequence i starts at
+// sequences + i * MAX_SEQ_LENGTH.
+
+#define MAX_SEQ_LENGTH 360
+#define MAX_DESCRIPTION_LENGTH 724
+#define BUFFER_SIZE (MAX_SEQ_LENGTH + MAX_DESCRIPTION_LENGTH)
+
+typedef struct {
+  char *sequences, *descriptions;
+  int32_t *length;
+} SetSequences;
+
+#endif // SEQUENCES_H
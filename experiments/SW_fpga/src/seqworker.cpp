@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include "util.h"
+#include "sequences.h"
+#include "seqio.h"
+#include "netio.h"
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+#include "CAccelDriver.hpp"
+#include "CSeqMatcher.hpp"
+#include "accels.h"
+#include "CHostMatcher.hpp"
+#include "numa.h"
+#include "CCoScheduler.hpp"
+#include "options.h"
+#include "shard_protocol.h"
+
+//  Worker of a sharded run (see seqcoord and shard_protocol.h). Listens on a TCP port
+// or a Unix domain socket, receives the query set of the coordinator and computes the
+// target shards it sends, one at a time, with the accelerators and/or the host engine
+// (CCoScheduler). Serves one coordinator at a time.
+//
+//   seqworker <endpoint> [--max-targets=<n>] [--max-queries=<n>] [--threads=<n>]
+//     [--cpu-workers=<n>] [--accels=<n>] [--driver-batch=<n>] [--fail-after=<n>] [--no-numa]
+//
+// --fail-after=<n> drops the connection and exits after n shards without replying,
+// to test the recovery of the coordinator.
+
+#define DEFAULT_MAX_TARGETS 4096
+#define DEFAULT_MAX_QUERIES 1000
+
+int32_t max_targets = DEFAULT_MAX_TARGETS; // Largest shard, i.e., size of the DMA target buffer (--max-targets=<n>)
+int32_t max_queries = DEFAULT_MAX_QUERIES; // Queries computed at once, i.e., size of the DMA query buffer (--max-queries=<n>)
+int32_t fail_after = -1;       // Shards computed before a simulated failure (--fail-after=<n>)
+volatile sig_atomic_t stop = 0;
+
+// Buffers bound to the engines. The host engine reads the host copies.
+SetSequences dma_targets, dma_queries;
+SetSequences host_targets;             // Targets of the current shard
+SetSequences host_queries;             // Window of the queries of the current block
+SetSequences query_set;                // Queries of the coordinator
+int32_t query_capacity = 0, nq = 0;
+uint32_t * dma_output = NULL;
+CDmaBuffer dma_buffers[5];               // Target and query sequences and lengths, output
+std::vector<uint32_t> scores;          // Results of the current shard (scores[t * nq + q])
+bool calibrated = false;
+
+///////////////////////////////////////////////////////////////////////////////
+void on_signal(int /*sig*/) {
+  stop = 1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+inline int32_t min(int32_t a, int32_t b) {
+    return (a < b) ? a : b;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Allocates the buffers for max_targets x max_queries and binds them to the accelerators.
+bool alloc_buffers() {
+  dma_targets.descriptions = dma_queries.descriptions = NULL;
+  host_targets.descriptions = host_queries.descriptions = query_set.descriptions = NULL;
+  query_set.sequences = NULL;
+  query_set.length = NULL;
+  dma_buffers[0] = CSeqMatcher::AllocDMABuffer((uint64_t)max_targets * MAX_SEQ_LENGTH, 1);
+  dma_buffers[1] = CSeqMatcher::AllocDMABuffer(max_targets * sizeof(int32_t), 1);
+  dma_buffers[2] = CSeqMatcher::AllocDMABuffer((uint64_t)max_queries * MAX_SEQ_LENGTH, 1);
+  dma_buffers[3] = CSeqMatcher::AllocDMABuffer(max_queries * sizeof(int32_t), 1);
+  dma_buffers[4] = CSeqMatcher::AllocDMABuffer((uint64_t)max_targets * max_queries * sizeof(uint32_t));
+  dma_targets.sequences = dma_buffers[0].As<char>();
+  dma_targets.length = dma_buffers[1].As<int32_t>();
+  dma_queries.sequences = dma_buffers[2].As<char>();
+  dma_queries.length = dma_buffers[3].As<int32_t>();
+  dma_output = dma_buffers[4].As<uint32_t>();
+  host_targets.sequences = (char*)alloc_host((uint64_t)max_targets * MAX_SEQ_LENGTH);
+  host_targets.length = (int32_t*)alloc_host(max_targets * sizeof(int32_t));
+  if (dma_targets.sequences == NULL || dma_targets.length == NULL || dma_queries.sequences == NULL ||
+      dma_queries.length == NULL || dma_output == NULL || host_targets.sequences == NULL || host_targets.length == NULL) {
+    printf("Error allocating memory for %d targets and %d queries (try a smaller --max-targets or --max-queries).\n",
+      max_targets, max_queries);
+    return false;
+  }
+
+  for (uint32_t a = 0; a < num_accels; ++a) {
+    if (seqMatchers[a].InitConfig(dma_targets.sequences, dma_targets.length, dma_queries.sequences,
+          dma_queries.length, dma_output, MAX_SEQ_LENGTH) != CSeqMatcher::OK) {
+      printf("Error configuring accelerator %u.\n", a);
+      return false;
+    }
+  }
+  return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+void free_buffers() {
+  for (uint32_t b = 0; b < 5; ++b)
+    dma_buffers[b].Reset();
+  free_host(host_targets.sequences);
+  free_host(host_targets.length);
+  if (query_set.sequences != NULL) {
+    free_host(query_set.sequences);
+    free_host(query_set.length);
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Receives the query set. The buffers only grow.
+uint32_t receive_queries(int conn, int32_t n) {
+  if (n > query_capacity) {
+    if (query_set.sequences != NULL) {
+      free_host(query_set.sequences);
+      free_host(query_set.length);
+    }
+    query_set.sequences = (char*)alloc_host((uint64_t)n * MAX_SEQ_LENGTH);
+    query_set.length = (int32_t*)alloc_host(n * sizeof(int32_t));
+    query_capacity = n;
+    if (query_set.sequences == NULL || query_set.length == NULL) {
+      query_set.sequences = NULL;
+      query_set.length = NULL;
+      query_capacity = 0;
+      return SHARD_BAD_REQUEST;
+    }
+  }
+  nq = 0;
+  if (!recv_sequences(conn, &query_set, n))
+    return SHARD_BAD_REQUEST;
+  nq = n;
+  return SHARD_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Computes the nt targets of host_targets against all the queries, in blocks of max_queries.
+uint32_t align_shard(CCoScheduler & scheduler, int32_t nt) {
+  memcpy(dma_targets.sequences, host_targets.sequences, (uint64_t)nt * MAX_SEQ_LENGTH);
+  memcpy(dma_targets.length, host_targets.length, nt * sizeof(int32_t));
+  CSeqMatcher::FlushDMA(dma_targets.sequences, (uint64_t)nt * MAX_SEQ_LENGTH);
+  CSeqMatcher::FlushDMA(dma_targets.length, nt * sizeof(int32_t));
+  scores.resize((uint64_t)nt * nq);
+
+  for (int32_t q0 = 0; q0 < nq; q0 += max_queries) {
+    int32_t count = min(max_queries, nq - q0);
+    memcpy(dma_queries.sequences, query_set.sequences + (uint64_t)q0 * MAX_SEQ_LENGTH, (uint64_t)count * MAX_SEQ_LENGTH);
+    memcpy(dma_queries.length, query_set.length + q0, count * sizeof(int32_t));
+    CSeqMatcher::FlushDMA(dma_queries.sequences, (uint64_t)count * MAX_SEQ_LENGTH);
+    CSeqMatcher::FlushDMA(dma_queries.length, count * sizeof(int32_t));
+    host_queries.sequences = query_set.sequences + (uint64_t)q0 * MAX_SEQ_LENGTH;
+    host_queries.length = query_set.length + q0;
+    // The engines are calibrated with the first block they see.
+    if (!calibrated && scheduler.Calibrate(nt, 0, count, dma_output) != CCoScheduler::OK)
+      return SHARD_ACCEL_ERROR;
+    calibrated = true;
+    if (scheduler.Run(nt, 0, count, dma_output) != CCoScheduler::OK)
+      return SHARD_ACCEL_ERROR;
+    for (int32_t t = 0; t < nt; ++t)
+      memcpy(scores.data() + (uint64_t)t * nq + q0, dma_output + (uint64_t)t * count, count * sizeof(uint32_t));
+  }
+  return SHARD_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Serves the messages of a coordinator until it disconnects. Returns the shards computed.
+uint32_t serve(int conn, CCoScheduler & scheduler, uint32_t computed) {
+  struct pollfd fd = {conn, POLLIN, 0};
+  struct TShardMessage msg;
+  struct TShardReply reply;
+  struct timespec start, end;
+
+  nq = 0;
+  while (!stop) {
+    if (poll(&fd, 1, -1) < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+    if (!recv_all(conn, &msg, sizeof(msg)) || msg.magic != SHARD_MAGIC)
+      break;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.shard = msg.shard;
+    if (msg.command == SHARD_QUERIES && msg.n > 0) {
+      reply.status = receive_queries(conn, msg.n);
+      reply.nq = nq;
+      if (reply.status != SHARD_OK) {
+        send_all(conn, &reply, sizeof(reply));
+        break;
+      }
+    } else if (msg.command == SHARD_ALIGN && msg.n > 0 && msg.n <= max_targets) {
+      if (!recv_sequences(conn, &host_targets, msg.n))
+        break;
+      scheduler.TargetsChanged();
+      clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+      reply.status = (nq > 0) ? align_shard(scheduler, msg.n) : (uint32_t)SHARD_NO_QUERIES;
+      clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+      reply.computeTime = CalcTimeDiff(end, start);
+      if (reply.status == SHARD_OK) {
+        reply.nt = msg.n;
+        reply.nq = nq;
+      }
+      if (fail_after >= 0 && (int32_t)computed >= fail_after) {
+        printf("seqworker: simulated failure after %u shards.\n", computed);
+        fflush(stdout);
+        _exit(2);
+      }
+      ++ computed;
+    } else {
+      // The sequences of the message cannot be skipped: the connection is dropped.
+      reply.status = SHARD_BAD_REQUEST;
+      send_all(conn, &reply, sizeof(reply));
+      break;
+    }
+
+    if (!send_all(conn, &reply, sizeof(reply)))
+      break;
+    if (reply.nt > 0 && !send_all(conn, scores.data(), scores.size() * sizeof(uint32_t)))
+      break;
+  }
+  return computed;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+int main(int argc, char const *argv[]) {
+  struct TShardHello hello;
+  struct sigaction action;
+  uint32_t computed = 0;
+
+  if (argc < 2) {
+    printf("Usage: %s <endpoint> [--max-targets=<n>] [--max-queries=<n>] [--threads=<n>] [--cpu-workers=<n>] "
+      "[--accels=<n>] [--driver-batch=<n>] [--fail-after=<n>] [--no-numa] [--dma=<backend>]\n", argv[0]);
+    return 1;
+  }
+  CSeqMatcher::SetLogging(false);
+
+  const char* endpoint = argv[1];
+  if (!read_engine_options(argc, argv))
+    return 1;
+  if (GetOption(argc, argv, "max-targets") != NULL)
+    max_targets = atoi(GetOption(argc, argv, "max-targets"));
+  if (GetOption(argc, argv, "max-queries") != NULL)
+    max_queries = atoi(GetOption(argc, argv, "max-queries"));
+  if (GetOption(argc, argv, "fail-after") != NULL)
+    fail_after = atoi(GetOption(argc, argv, "fail-after"));
+  if (max_targets <= 0 || max_queries <= 0)
+    return 1;
+
+  if (!open_engines())
+    return 1;
+  if (!alloc_buffers())
+    return 1;
+
+  std::vector<CSeqMatcher *> accels = engine_accels();
+  CHostMatcher host(&host_targets, &host_queries);
+  CCoScheduler scheduler(accels, USE_DRIVER, &host, cpu_workers);
+  configure_scheduler(scheduler);
+
+  int listener = listen_endpoint(endpoint);
+  if (listener < 0) {
+    printf("Error: Cannot listen on %s (errno %d).\n", endpoint, errno);
+    return 1;
+  }
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  printf("seqworker: %u accelerators, %u host workers, shards of up to %d targets, listening on %s\n",
+    num_accels, cpu_workers, max_targets, endpoint);
+  fflush(stdout);
+
+  hello.magic = SHARD_MAGIC;
+  hello.version = SHARD_VERSION;
+  hello.maxTargets = max_targets;
+  hello.blockQueries = max_queries;
+  while (!stop) {
+    struct pollfd fd = {listener, POLLIN, 0};
+    if (poll(&fd, 1, -1) < 0)
+      continue;
+    int conn = accept_endpoint(listener);
+    if (conn < 0)
+      continue;
+    if (send_all(conn, &hello, sizeof(hello)))
+      computed = serve(conn, scheduler, computed);
+    close(conn);
+  }
+
+  close(listener);
+  if (strchr(endpoint, '/') != NULL)
+    unlink(endpoint);
+  free_buffers();
+  close_engines();
+  scheduler.PrintFaults();
+  scheduler.PrintNuma();
+  printf("seqworker: stopped after %u shards.\n", computed);
+  return 0;
+}
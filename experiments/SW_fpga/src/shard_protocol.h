@@ -0,0 +1,47 @@
+#ifndef SHARD_PROTOCOL_H
+#define SHARD_PROTOCOL_H
+
+// Requires <stdint.h>
+
+// Protocol between the coordinator of a sharded run (seqcoord) and its workers
+// (seqworker) over a stream socket (TCP or Unix domain, see netio.h). The target
+// set is split into shards of consecutive targets, and every worker computes the
+// shards it receives against the whole query set, one shard at a time.
+//
+//  worker -> coord   TShardHello                  on connection: limits of the worker
+//  coord -> worker   TShardMessage (SHARD_QUERIES) + sequences: the query set
+//  worker -> coord   TShardReply                  (nt = 0) when the queries are stored
+//  coord -> worker   TShardMessage (SHARD_ALIGN)   + sequences: the targets of a shard
+//  worker -> coord   TShardReply                  + uint32_t scores[nt][nq] (layout of scores.bin)
+//
+// The sequences follow the message packed: int32_t lengths[n], then the n sequences
+// back to back (sum of the lengths bytes). All the fields are in host byte order,
+// so the coordinator and the workers must have the same endianness.
+
+#define SHARD_MAGIC 0x48514553  // "SEQH"
+#define SHARD_VERSION 1
+
+typedef enum {SHARD_QUERIES = 0, SHARD_ALIGN = 1} TShardCommand;
+typedef enum {SHARD_OK = 0, SHARD_BAD_REQUEST = 1, SHARD_NO_QUERIES = 2, SHARD_ACCEL_ERROR = 3} TShardStatus;
+
+struct TShardHello {
+  uint32_t magic, version;
+  int32_t maxTargets;     // Largest shard accepted
+  int32_t blockQueries;   // Queries computed at once by the worker
+};
+
+struct TShardMessage {
+  uint32_t magic;
+  uint32_t command;       // TShardCommand
+  int32_t shard;          // Shard number (echoed in the reply)
+  int32_t n;              // Sequences that follow
+};
+
+struct TShardReply {
+  uint32_t status;        // TShardStatus (the scores only follow with SHARD_OK)
+  int32_t shard;
+  int32_t nt, nq;
+  uint64_t computeTime;   // Time computing the shard in the worker (ns)
+};
+
+#endif // SHARD_PROTOCOL_H
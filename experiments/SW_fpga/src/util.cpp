@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 #include "util.h"
 
@@ -10,3 +11,20 @@ uint64_t CalcTimeDiff(const struct timespec & time2, const struct timespec & tim
     (time2.tv_sec - time1.tv_sec - 1) * 1e9 + (1e9 - time1.tv_nsec) + time2.tv_nsec;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+const char * GetOption(int argc, char const * argv[], const char * name)
+{
+  size_t len = strlen(name);
+
+  for (int i = 1; i < argc; ++i) {
+    const char * arg = argv[i];
+    if (strncmp(arg, "--", 2) != 0 || strncmp(arg + 2, name, len) != 0)
+      continue;
+    if (arg[2 + len] == '\0')
+      return arg + 2 + len;
+    if (arg[2 + len] == '=')
+      return arg + 3 + len;
+  }
+  return NULL;
+}
+
@@ -4,5 +4,10 @@
 ///////////////////////////////////////////////////////////////////////////////
 uint64_t CalcTimeDiff(const struct timespec & time2, const struct timespec & time1);
 
+///////////////////////////////////////////////////////////////////////////////
+// Returns the value of an optional "--name=value" argument ("" for a bare "--name"),
+// or NULL if the option is not present in the command line.
+const char * GetOption(int argc, char const * argv[], const char * name);
+
 #endif // UTIL_HPP
 
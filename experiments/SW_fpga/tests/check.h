@@ -0,0 +1,28 @@
+/*** Checks of the unit tests (make test). A failed check prints its location and the
+ *** test goes on; main() returns check_report(), which is 1 if any check failed.
+ ***/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+// Requires <stdio.h>
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      ++failures; \
+    } \
+  } while (0)
+
+static int check_report(const char * name)
+{
+  if (failures)
+    printf("%s: %d checks failed\n", name, failures);
+  else
+    printf("%s: OK\n", name);
+  return failures ? 1 : 0;
+}
+
+#endif // CHECK_H
@@ -0,0 +1,47 @@
+/*** Simulated register block of an accelerator instance for the tests of the
+ *** command rings (driver/seqring.h). Out of the kernel the registers are plain
+ *** memory: the simulated kernel takes the start bit when a job is programmed, and
+ *** the tests signal its end by calling seq_sched_complete(), as the IRQ handler does.
+ *** A job is identified by its number of targets (n_seq_t), which the simulation
+ *** reads back from the nseqt register.
+ ***/
+
+#ifndef SEQSIM_H
+#define SEQSIM_H
+
+// Requires <stdint.h>, <string.h>, "../driver/seqring.h"
+
+static void sim_reset(struct TRegs * regs)
+{
+  memset(regs, 0, sizeof(*regs));
+  regs->control = SEQ_AP_IDLE;
+}
+
+// Job started by the driver since the last call (its n_seq_t), or -1. The kernel becomes busy.
+static int sim_started(struct TRegs * regs)
+{
+  if (!(regs->control & 1))
+    return -1;
+  regs->control = 0;
+  return (int)regs->nseqt;
+}
+
+// The running job finishes: the kernel is idle again and the IRQ handler runs.
+static struct seq_ctx * sim_done(struct seq_sched * sched, struct TRegs * regs)
+{
+  regs->control = SEQ_AP_IDLE | 0x2;
+  return seq_sched_complete(sched, regs);
+}
+
+static struct write_message sim_job(uint32_t id, uint32_t notify)
+{
+  struct write_message msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.n_seq_t = id;
+  msg.wait_type = CHAIN;
+  msg.notify = notify;
+  return msg;
+}
+
+#endif // SEQSIM_H
@@ -0,0 +1,247 @@
+/*** Tests of the DMA arena (src/CDmaArena.hpp) on a malloc-backed fake of the CMA pool,
+ *** with synthetic physical addresses: sub-allocation and coalescing, translation of
+ *** interior pointers, reservations, the buffer handles and the cache maintenance.
+ *** Run with make test.
+ ***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <utility>
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+#include "check.h"
+
+// Pool of Capacity bytes taken with malloc. The physical addresses of the regions are
+// apart, so that a translation with the wrong region is detected.
+class CFakeBackend : public CDmaBackend {
+  public:
+    uint64_t capacity, taken, nextPhys;
+    uint32_t allocs, frees;
+    std::map<void *, uint64_t> live;      // Region -> size
+    uint32_t flushes, invalidates;
+    uint64_t lastPhys, lastSize;          // Last cache maintenance
+
+    CFakeBackend(uint64_t Capacity)
+      : capacity(Capacity), taken(0), nextPhys(0x80000000ull), allocs(0), frees(0),
+        flushes(0), invalidates(0), lastPhys(0), lastSize(0) {}
+
+    void * Alloc(uint64_t Size, bool /*Cacheable*/, uint64_t & PhysAddr) {
+      void * virtAddr;
+      if (taken + Size > capacity || posix_memalign(&virtAddr, DMA_ALIGN, Size) != 0)
+        return NULL;
+      taken += Size;
+      live[virtAddr] = Size;
+      PhysAddr = nextPhys;
+      nextPhys += Size + (1 << 30);
+      ++allocs;
+      return virtAddr;
+    }
+    void Free(void * VirtAddr, uint64_t Size) {
+      CHECK(live.count(VirtAddr) == 1 && live[VirtAddr] == Size);
+      live.erase(VirtAddr);
+      taken -= Size;
+      free(VirtAddr);
+      ++frees;
+    }
+    const char * Name() const { return "fake"; }
+    void Flush(void * /*VirtAddr*/, uint64_t PhysAddr, uint64_t Size) {
+      ++flushes;
+      lastPhys = PhysAddr;
+      lastSize = Size;
+    }
+    void Invalidate(void * /*VirtAddr*/, uint64_t PhysAddr, uint64_t Size) {
+      ++invalidates;
+      lastPhys = PhysAddr;
+      lastSize = Size;
+    }
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// Small buffers are aligned, do not overlap and share one region.
+static void test_sub_allocation()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend);
+  std::vector<char *> buffers;
+
+  for (uint32_t i = 0; i < 16; ++i) {
+    char * buffer = (char *)arena.Alloc(1000 + i * 5000);
+    CHECK(buffer != NULL);
+    CHECK((uint64_t)buffer % DMA_ALIGN == 0);
+    for (char * other : buffers)
+      CHECK(buffer >= other + 1000 || other >= buffer + 1000 + i * 5000);
+    buffers.push_back(buffer);
+  }
+  CHECK(arena.GetStats().regions == 1);
+  CHECK(arena.GetStats().buffers == 16);
+  CHECK(backend.allocs == 1);
+  for (char * buffer : buffers)
+    CHECK(arena.Free(buffer));
+  CHECK(!arena.Free(buffers[0]));
+  CHECK(arena.GetStats().used == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Any address inside a region translates, not only the start of the buffers; addresses
+// out of the arena give 0.
+static void test_translation()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend);
+  char * a = (char *)arena.Alloc(3 << 20);
+  char * b = (char *)arena.Alloc(7 << 20);   // Larger than a region: a region of its own
+
+  CHECK(a != NULL && b != NULL);
+  CHECK(arena.GetStats().regions == 2);
+  uint64_t physA = arena.PhysAddr(a), physB = arena.PhysAddr(b);
+  CHECK(physA != 0 && physB != 0);
+  // Offsets in every granule of the buffers, which cross 2 MB boundaries.
+  for (uint64_t offset = 0; offset < (3 << 20); offset += 123457)
+    CHECK(arena.PhysAddr(a + offset) == physA + offset);
+  for (uint64_t offset = 0; offset < (7 << 20); offset += 654321)
+    CHECK(arena.PhysAddr(b + offset) == physB + offset);
+  CHECK(arena.PhysAddr(b + (7 << 20) - 1) == physB + (7 << 20) - 1);
+
+  int local;
+  std::vector<char> heap(100);
+  CHECK(arena.PhysAddr(&local) == 0);
+  CHECK(arena.PhysAddr(heap.data()) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Freed neighbours coalesce, so a larger buffer fits where they were (first fit).
+static void test_coalescing()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend, 1 << 20);
+  char * a = (char *)arena.Alloc(256 << 10);
+  char * b = (char *)arena.Alloc(256 << 10);
+  char * c = (char *)arena.Alloc(256 << 10);
+  char * d = (char *)arena.Alloc(256 << 10);
+
+  CHECK(a != NULL && b == a + (256 << 10) && c == b + (256 << 10) && d == c + (256 << 10));
+  CHECK(arena.Free(b));
+  CHECK(arena.Free(a));
+  CHECK(arena.Free(c));
+  char * e = (char *)arena.Alloc(768 << 10);
+  CHECK(e == a);
+  CHECK(arena.GetStats().regions == 1);
+  CHECK(arena.Free(e));
+  CHECK(arena.Free(d));
+  char * f = (char *)arena.Alloc(1 << 20);
+  CHECK(f == a);
+  CHECK(arena.GetStats().regions == 1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// A reservation is used by the next buffers; regions are kept until Release().
+static void test_reserve_release()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend, 1 << 20);
+
+  CHECK(arena.Reserve(10 << 20) == CDmaArena::OK);
+  CHECK(backend.allocs == 1);
+  CHECK(arena.Reserve(10 << 20) == CDmaArena::OK);
+  CHECK(backend.allocs == 1);
+  for (uint32_t i = 0; i < 5; ++i)
+    CHECK(arena.Alloc(2 << 20) != NULL);
+  CHECK(backend.allocs == 1);
+  CHECK(arena.GetStats().reserved == (10 << 20));
+  CHECK(!arena.SetBackend(&backend));
+
+  CHECK(arena.Release() == 5);
+  CHECK(backend.frees == 1 && backend.live.empty());
+  CHECK(arena.GetStats().regions == 0 && arena.GetStats().used == 0);
+  CHECK(arena.SetBackend(&backend));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// When the pool has no room for a region of the default size, a region of the size of
+// the buffer is tried; when it has no room at all, Alloc() fails.
+static void test_exhausted()
+{
+  CFakeBackend backend(3 << 20);
+  CDmaArena arena(&backend, 4 << 20);
+
+  void * a = arena.Alloc(2 << 20);
+  CHECK(a != NULL);
+  CHECK(arena.GetStats().reserved == (2 << 20));
+  CHECK(arena.Alloc(2 << 20) == NULL);
+  CHECK(!arena.Allocate(2 << 20));
+  CHECK(arena.Reserve(2 << 20) == CDmaArena::ERROR_ALLOCATING);
+  CHECK(arena.Free(a));
+  CHECK(arena.Alloc(2 << 20) == a);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The handles are move-only and return their buffer when they are destroyed or reset.
+static void test_handles()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend);
+
+  {
+    CDmaBuffer a = arena.Allocate(5000);
+    CHECK(a && a.Size() == 5000);
+    CHECK(a.PhysAddr() == arena.PhysAddr(a.Get()));
+    CDmaBuffer b(std::move(a));
+    CHECK(!a && a.Get() == NULL && b);
+    CHECK(arena.GetStats().buffers == 1);
+
+    CDmaBuffer c = arena.Allocate(100);
+    void * old = c.Get();
+    c = std::move(b);                // The buffer of c is returned
+    CHECK(arena.GetStats().buffers == 1);
+    CHECK(c && c.Get() != old && !b);
+    c.Reset();
+    CHECK(!c && arena.GetStats().buffers == 0);
+    CDmaBuffer d = arena.Allocate(100);
+    CHECK(arena.GetStats().buffers == 1);
+  }
+  CHECK(arena.GetStats().buffers == 0);
+  CHECK(arena.GetStats().used == 0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Cache maintenance reaches the backend only for cacheable regions, with the physical
+// address of the range, clipped to the buffer.
+static void test_cache_maintenance()
+{
+  CFakeBackend backend(64 << 20);
+  CDmaArena arena(&backend);
+  CDmaBuffer uncached = arena.Allocate(8192);
+  CDmaBuffer cached = arena.Allocate(8192, true);
+
+  CHECK(arena.GetStats().regions == 2);
+  uncached.Flush();
+  uncached.Invalidate();
+  CHECK(backend.flushes == 0 && backend.invalidates == 0);
+
+  cached.Flush();
+  CHECK(backend.flushes == 1 && backend.lastPhys == cached.PhysAddr() && backend.lastSize == 8192);
+  cached.Invalidate(4096, 100);
+  CHECK(backend.invalidates == 1 && backend.lastPhys == cached.PhysAddr() + 4096 && backend.lastSize == 100);
+  cached.Flush(4096, 1 << 20);
+  CHECK(backend.flushes == 2 && backend.lastSize == 4096);
+  cached.Flush(8192);
+  CHECK(backend.flushes == 2);
+}
+
+int main()
+{
+  test_sub_allocation();
+  test_translation();
+  test_coalescing();
+  test_reserve_release();
+  test_exhausted();
+  test_handles();
+  test_cache_maintenance();
+  return check_report("test_dma_arena");
+}
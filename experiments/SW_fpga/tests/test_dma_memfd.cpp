@@ -0,0 +1,107 @@
+/*** Tests of the memfd DMA backend (src/CDmaBackend.hpp), the default of the builds
+ *** without libxlnk_cma: selection by specification, zeroed page-rounded regions with
+ *** unique synthetic physical addresses, and the host allocation path of CAccelDriver
+ *** on top of it. Run with make test.
+ ***/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include "CDmaBackend.hpp"
+#include "CDmaArena.hpp"
+#include "CAccelDriver.hpp"
+#include "check.h"
+
+///////////////////////////////////////////////////////////////////////////////
+// The backend is chosen at runtime by its specification (the unknown ones print an error).
+static void test_create()
+{
+  CDmaBackend * backend = CDmaBackend::Create("memfd");
+
+  CHECK(backend != NULL && strcmp(backend->Name(), "memfd") == 0);
+  delete backend;
+  CHECK(strcmp(DEFAULT_DMA_BACKEND, "memfd") == 0);
+  CHECK(CDmaBackend::Create("cma") == NULL);   // No libxlnk_cma in this build
+  CHECK(CDmaBackend::Create("bogus") == NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Regions are whole pages of zeroes, and their physical addresses never overlap.
+static void test_regions()
+{
+  CMemfdBackend backend;
+  std::vector<std::pair<char *, uint64_t>> regions;
+  std::vector<uint64_t> phys;
+  const uint64_t sizes[] = {1, 4096, 4097, 3 << 20};
+  uint64_t physAddr = 0;
+
+  CHECK(backend.Alloc(0, false, physAddr) == NULL);
+  for (uint64_t size : sizes) {
+    char * region = (char *)backend.Alloc(size, false, physAddr);
+    CHECK(region != NULL);
+    if (region == NULL)
+      continue;
+    CHECK((uint64_t)region % 4096 == 0 && physAddr % 4096 == 0);
+    uint64_t bytes = (size + 4095) / 4096 * 4096;
+    bool zero = true;
+    for (uint64_t i = 0; i < bytes; ++i)
+      zero = zero && region[i] == 0;
+    CHECK(zero);
+    memset(region, 0x5A, bytes);            // The whole rounded size is usable
+    for (uint32_t r = 0; r < regions.size(); ++r)
+      CHECK(physAddr >= phys[r] + (regions[r].second + 4095) / 4096 * 4096 || physAddr + bytes <= phys[r]);
+    regions.push_back(std::make_pair(region, size));
+    phys.push_back(physAddr);
+  }
+  for (auto & region : regions)
+    backend.Free(region.first, region.second);
+
+  // The memory of a freed region is not reused: a new one is zeroed again.
+  char * region = (char *)backend.Alloc(4096, false, physAddr);
+  CHECK(region != NULL && region[0] == 0 && region[4095] == 0);
+  CHECK(physAddr >= phys.back() + (3 << 20));
+  backend.Free(region, 4096);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The host stack allocates its DMA buffers through CAccelDriver: on memfd, any address
+// inside a buffer translates, and the data goes through.
+static void test_accel_driver()
+{
+  CHECK(CAccelDriver::SetDMABackend("memfd"));
+  CHECK(strcmp(CAccelDriver::DMAArena().GetBackend()->Name(), "memfd") == 0);
+  {
+    CDmaBuffer sequences = CAccelDriver::AllocDMABuffer(100000);
+    CDmaBuffer output = CAccelDriver::AllocDMABuffer(4096, 1);
+    CHECK(sequences && output);
+    uint64_t phys = CAccelDriver::GetDMAPhysicalAddr(sequences.Get());
+    CHECK(phys != 0 && phys == sequences.PhysAddr());
+    CHECK(CAccelDriver::GetDMAPhysicalAddr(sequences.As<char>() + 77777) == phys + 77777);
+    CHECK(output.PhysAddr() != 0 && output.PhysAddr() != phys);
+
+    memset(sequences.Get(), 'A', sequences.Size());
+    CAccelDriver::FlushDMA(sequences.Get(), sequences.Size());
+    output.As<uint32_t>()[0] = 42;
+    output.Flush();
+    output.Invalidate();
+    CHECK(sequences.As<char>()[99999] == 'A' && output.As<uint32_t>()[0] == 42);
+  }
+  CHECK(CAccelDriver::DMAArena().GetStats().buffers == 0);
+  int local;
+  CHECK(CAccelDriver::GetDMAPhysicalAddr(&local) == 0);
+}
+
+int main()
+{
+  CAccelDriver::SetLogging(false);
+  test_create();
+  test_regions();
+  test_accel_driver();
+  return check_report("test_dma_memfd");
+}
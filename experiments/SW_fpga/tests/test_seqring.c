@@ -0,0 +1,149 @@
+/*** Tests of the command ring of the seqdriver (driver/seqring.h): batches of CHAIN
+ *** descriptors written at once, chained by the IRQ handler, with notifications only
+ *** for the flagged descriptors and at the end of the batch. Run with make test.
+ ***/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../driver/seqring.h"
+#include "check.h"
+#include "seqsim.h"
+
+// A batch runs in order, started by the completions, and notifies once at its end.
+static void test_batch_chains(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx ctx;
+  struct write_message jobs[5];
+  uint32_t i;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&ctx);
+  for (i = 0; i < 5; i++)
+    jobs[i] = sim_job(100 + i, 0);
+
+  CHECK(seq_sched_submit(&sched, &ctx, jobs, 5, &regs) == 0);
+  CHECK(ctx.flag == 0);
+  CHECK(regs.gier == 1 && regs.ier == 1);
+  for (i = 0; i < 5; i++) {
+    CHECK(sim_started(&regs) == (int)(100 + i));
+    CHECK(sim_done(&sched, &regs) == ((i == 4) ? &ctx : NULL));
+  }
+  CHECK(sim_started(&regs) == -1);
+  CHECK(sched.running == NULL);
+  CHECK(regs.gier == 0 && regs.ier == 0);
+  CHECK(ctx.flag == 1);
+  CHECK(seq_ctx_collect(&sched, &ctx) == 5);
+  CHECK(ctx.flag == 1);
+}
+
+// The owner is notified after every flagged descriptor (every N completions), and the
+// collection returns the jobs finished since the previous one.
+static void test_notify_every_n(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx ctx;
+  struct write_message jobs[6];
+  uint32_t i;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&ctx);
+  for (i = 0; i < 6; i++)
+    jobs[i] = sim_job(i, (i % 2) == 1);
+
+  CHECK(seq_sched_submit(&sched, &ctx, jobs, 6, &regs) == 0);
+  for (i = 0; i < 6; i++) {
+    CHECK(sim_started(&regs) == (int)i);
+    CHECK(sim_done(&sched, &regs) == ((i % 2) == 1 ? &ctx : NULL));
+    if (i % 2 == 1) {
+      CHECK(ctx.flag == 1);
+      CHECK(seq_ctx_collect(&sched, &ctx) == 2);
+      CHECK(ctx.flag == (i == 5));  // Rearmed while jobs remain
+    }
+  }
+}
+
+// A batch is queued whole or not at all, and the ring wraps around.
+static void test_ring_full(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx ctx;
+  struct write_message jobs[SEQ_RING_SIZE];
+  uint32_t i, next = 0, expected = 0;
+  int round;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&ctx);
+  for (i = 0; i < SEQ_RING_SIZE; i++)
+    jobs[i] = sim_job(next++, 0);
+
+  CHECK(seq_sched_submit(&sched, &ctx, jobs, SEQ_RING_SIZE, &regs) == 0);
+  // The first job left the ring when it started: one descriptor is free.
+  CHECK(seq_ring_pending(&ctx.ring) == SEQ_RING_SIZE - 1);
+  jobs[0] = sim_job(next++, 0);
+  jobs[1] = sim_job(next++, 0);
+  CHECK(seq_sched_submit(&sched, &ctx, jobs, 2, &regs) == -1);
+  CHECK(seq_ring_pending(&ctx.ring) == SEQ_RING_SIZE - 1);
+  next -= 2;
+
+  // Keep the ring nearly full for several turns of its descriptors.
+  for (round = 0; round < 3 * SEQ_RING_SIZE; round++) {
+    jobs[0] = sim_job(next++, 0);
+    CHECK(seq_sched_submit(&sched, &ctx, jobs, 1, &regs) == 0);
+    CHECK(sim_started(&regs) == (int)expected);
+    expected++;
+    CHECK(sim_done(&sched, &regs) == NULL);
+  }
+  while (sched.running) {
+    CHECK(sim_started(&regs) == (int)expected);
+    expected++;
+    sim_done(&sched, &regs);
+  }
+  CHECK(expected == next);
+  CHECK(seq_ctx_collect(&sched, &ctx) == next);
+}
+
+// A descriptor is programmed completely before the start bit is set.
+static void test_program(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx ctx;
+  struct write_message job = sim_job(7, 1);
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&ctx);
+  job.seq_t = 0x123456789ull;
+  job.seq_q = 0x2000000000ull;
+  job.n_seq_q = 9;
+  job.length_seq_t = 0x300000010ull;
+  job.length_seq_q = 0x400000020ull;
+  job.min_pos = 0xABCDEF000ull;
+
+  CHECK(seq_sched_submit(&sched, &ctx, &job, 1, &regs) == 0);
+  CHECK(regs.bit_set_ref_1 == 0x23456789 && regs.bit_set_ref_2 == 0x1);
+  CHECK(regs.bit_set_pat_1 == 0 && regs.bit_set_pat_2 == 0x20);
+  CHECK(regs.nseqt == 7 && regs.nseqp == 9);
+  CHECK(regs.length_ref_1 == 0x10 && regs.length_ref_2 == 0x3);
+  CHECK(regs.length_pat_1 == 0x20 && regs.length_pat_2 == 0x4);
+  CHECK(regs.output_1 == 0xBCDEF000 && regs.output_2 == 0xA);
+  CHECK(sim_started(&regs) == 7);
+  CHECK(sim_done(&sched, &regs) == &ctx);
+}
+
+int main(void)
+{
+  test_batch_chains();
+  test_notify_every_n();
+  test_ring_full();
+  test_program();
+  return check_report("test_seqring");
+}
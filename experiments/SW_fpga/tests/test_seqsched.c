@@ -0,0 +1,215 @@
+/*** Tests of the job scheduling of the seqdriver (driver/seqring.h) with several open
+ *** files sharing an instance, against a mock register file: turns across the files,
+ *** completions delivered to the owner of each job, files closed with jobs queued or
+ *** running, and jobs abandoned while the kernel is busy. Run with make test.
+ ***/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "../driver/seqring.h"
+#include "check.h"
+#include "seqsim.h"
+
+// Queues n jobs with ids first, first + 1, ... (flagged as read() does for a single job).
+static int submit(struct seq_sched * sched, struct seq_ctx * ctx, struct TRegs * regs,
+  uint32_t first, uint32_t n, uint32_t notify)
+{
+  struct write_message jobs[SEQ_RING_SIZE];
+  uint32_t i;
+
+  for (i = 0; i < n; i++)
+    jobs[i] = sim_job(first + i, notify);
+  return seq_sched_submit(sched, ctx, jobs, n, regs);
+}
+
+// The files take turns: a file with many jobs does not delay the jobs of another one.
+static void test_turns(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a, b, c;
+  const int order[] = {100, 101, 200, 300, 102, 201, 103, 202, 104, 105};
+  uint32_t i;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+  seq_ctx_init(&b);
+  seq_ctx_init(&c);
+
+  CHECK(submit(&sched, &a, &regs, 100, 6, 0) == 0);
+  CHECK(submit(&sched, &b, &regs, 200, 3, 0) == 0);
+  CHECK(submit(&sched, &c, &regs, 300, 1, 0) == 0);
+  for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+    CHECK(sim_started(&regs) == order[i]);
+    sim_done(&sched, &regs);
+  }
+  CHECK(sim_started(&regs) == -1);
+  CHECK(seq_ctx_collect(&sched, &a) == 6);
+  CHECK(seq_ctx_collect(&sched, &b) == 3);
+  CHECK(seq_ctx_collect(&sched, &c) == 1);
+}
+
+// Every completion goes to the owner of the job, and only the owner is notified.
+static void test_owner(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a, b;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+  seq_ctx_init(&b);
+
+  CHECK(submit(&sched, &a, &regs, 1, 1, 1) == 0);
+  CHECK(submit(&sched, &b, &regs, 2, 1, 1) == 0);
+  CHECK(a.flag == 0 && b.flag == 0);
+  CHECK(sim_started(&regs) == 1);
+  CHECK(sim_done(&sched, &regs) == &a);
+  CHECK(a.flag == 1 && b.flag == 0);
+  CHECK(sim_started(&regs) == 2);
+  CHECK(sim_done(&sched, &regs) == &b);
+  CHECK(b.flag == 1);
+  CHECK(seq_ctx_collect(&sched, &a) == 1 && seq_ctx_collect(&sched, &b) == 1);
+}
+
+// A file closed with queued jobs loses them; its running job still finishes, and the
+// other files go on.
+static void test_close(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a, b, c;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+  seq_ctx_init(&b);
+  seq_ctx_init(&c);
+
+  CHECK(submit(&sched, &a, &regs, 10, 3, 0) == 0);
+  CHECK(submit(&sched, &b, &regs, 20, 3, 0) == 0);
+  CHECK(submit(&sched, &c, &regs, 30, 1, 0) == 0);
+  CHECK(sim_started(&regs) == 10);
+
+  // b is queued (not running): its jobs are dropped, and the ready list still links a and c.
+  CHECK(seq_sched_drop(&sched, &b) == 0);
+  CHECK(seq_ring_pending(&b.ring) == 0);
+  // a is running: release() must wait for its completion, which notifies it (idle).
+  CHECK(seq_sched_drop(&sched, &a) == 1);
+  CHECK(sim_done(&sched, &regs) == &a);
+  CHECK(sched.running != &a);
+  CHECK(sim_started(&regs) == 30);
+  CHECK(sim_done(&sched, &regs) == &c);
+  CHECK(sim_started(&regs) == -1);
+  CHECK(sched.ready_head == NULL && sched.ready_tail == NULL);
+
+  // The tail of the ready list is dropped: new jobs are appended after the remaining file.
+  CHECK(submit(&sched, &a, &regs, 40, 2, 0) == 0);
+  CHECK(submit(&sched, &b, &regs, 50, 1, 0) == 0);
+  CHECK(seq_sched_drop(&sched, &b) == 0);
+  CHECK(sched.ready_tail == &a);
+  CHECK(submit(&sched, &c, &regs, 60, 1, 0) == 0);
+  CHECK(sim_started(&regs) == 40);
+  sim_done(&sched, &regs);
+  CHECK(sim_started(&regs) == 41);
+  sim_done(&sched, &regs);
+  CHECK(sim_started(&regs) == 60);
+  sim_done(&sched, &regs);
+}
+
+// A job abandoned while the kernel is still busy faults the instance: nothing starts
+// until the kernel is idle or its late completion arrives, which is not delivered.
+static void test_abort_busy(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a, b;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+  seq_ctx_init(&b);
+
+  CHECK(submit(&sched, &a, &regs, 1, 2, 1) == 0);
+  CHECK(submit(&sched, &b, &regs, 5, 1, 1) == 0);
+  CHECK(sim_started(&regs) == 1);
+  CHECK(seq_sched_abort(&sched, &a, &regs) == 1);
+  CHECK(sched.faulted == 1 && sched.running == NULL);
+  CHECK(a.flag == 1 && a.done == 0);
+  CHECK(regs.gier == 1);  // Kept on for the late completion
+  CHECK(sim_started(&regs) == -1);
+
+  // The late completion releases the instance and starts the job of b.
+  CHECK(sim_done(&sched, &regs) == NULL);
+  CHECK(sched.faulted == 0);
+  CHECK(a.done == 0);
+  CHECK(sim_started(&regs) == 5);
+  CHECK(sim_done(&sched, &regs) == &b);
+}
+
+// The kernel of a faulted instance becomes idle without an interrupt: the next submission
+// (or an abort used as a probe) finds it idle and releases it.
+static void test_fault_probe(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a, b;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+  seq_ctx_init(&b);
+
+  CHECK(submit(&sched, &a, &regs, 1, 1, 1) == 0);
+  CHECK(sim_started(&regs) == 1);
+  CHECK(seq_sched_abort(&sched, &a, &regs) == 1);
+  CHECK(sched.faulted == 1);
+
+  // Still busy: the job waits.
+  CHECK(submit(&sched, &b, &regs, 2, 1, 1) == 0);
+  CHECK(sim_started(&regs) == -1);
+  // Idle (IRQ lost): the owner's probe releases the instance and the queued job starts.
+  regs.control = SEQ_AP_IDLE;
+  CHECK(seq_sched_abort(&sched, &a, &regs) == 0);
+  CHECK(sched.faulted == 0);
+  CHECK(sim_started(&regs) == 2);
+  CHECK(sim_done(&sched, &regs) == &b);
+  CHECK(regs.gier == 0);
+}
+
+// A job abandoned when the kernel is already idle (its IRQ was lost) does not fault the
+// instance.
+static void test_abort_idle(void)
+{
+  struct TRegs regs;
+  struct seq_sched sched;
+  struct seq_ctx a;
+
+  sim_reset(&regs);
+  seq_sched_init(&sched);
+  seq_ctx_init(&a);
+
+  CHECK(submit(&sched, &a, &regs, 1, 1, 1) == 0);
+  CHECK(sim_started(&regs) == 1);
+  regs.control = SEQ_AP_IDLE;
+  CHECK(seq_sched_abort(&sched, &a, &regs) == 1);
+  CHECK(sched.faulted == 0);
+  CHECK(regs.gier == 0);
+  CHECK(submit(&sched, &a, &regs, 2, 1, 1) == 0);
+  CHECK(sim_started(&regs) == 2);
+  CHECK(sim_done(&sched, &regs) == &a);
+}
+
+int main(void)
+{
+  test_turns();
+  test_owner();
+  test_close();
+  test_abort_busy();
+  test_fault_probe();
+  test_abort_idle();
+  return check_report("test_seqsched");
+}
@@ -19,13 +19,14 @@ if [[ -z "$config_file" || ! -f "$config_file" ]]; then
 	echo "Config file is missing or does not exist."
 else
 	# Execute the Python script and read its output into variables
-	IFS=$';' read -r executable num_threads_p lengths_p nset_p vaccel_p <<< $(python3 parse_config.py "$config_file")
+	IFS=$';' read -r executable num_threads_p lengths_p nset_p vaccel_p numa_p <<< $(python3 parse_config.py "$config_file")
 
 	# Convert comma-separated strings back into arrays (if needed)
 	IFS=',' read -r -a num_threads <<< "$num_threads_p"
 	IFS=',' read -r -a lengths <<< "$lengths_p"
 	IFS=',' read -r -a nset <<< "$nset_p"
 	IFS=',' read -r -a vaccel <<< "$vaccel_p"
+	IFS=',' read -r -a numa <<< "$numa_p"
 
 	# Configuration
 	echo "Executable: $executable"
@@ -33,6 +34,7 @@ else
 	echo "Lengths: ${lengths[*]}"
 	echo "NSet: ${nset[*]}"
 	echo "VAccel: ${vaccel[*]}"
+	echo "NUMA placement: ${numa[*]}"
 
 	benchmark="benchmark.csv"
 	[ -f "benchmark.csv" ] && rm "benchmark.csv"
@@ -45,7 +47,7 @@ else
 		cd ../..
 	fi
 
-	echo "Number of sequences,String lengths,time_ns,energy_J,Accel ID,Threads,Time Start,Time End" > "$benchmark"
+	echo "Number of sequences,String lengths,time_ns,energy_J,Accel ID,Threads,NUMA,Time Start,Time End" > "$benchmark"
 	for acc in "${vaccel[@]}"; do
 		if [[ "$executable" == "./SW_fpga/seqmatcher" ]]; then
 			# fpgautil -b bitstream/accel_v$acc/design_1.bit
@@ -61,19 +63,24 @@ else
 				for s in $(seq 0 $(( ${#lengths[@]} - 1 ))); do
 					#if [[ $SEQ_MAX_ACCEL -ge ${lengths[s]} ]]; then
 						if [[ -f "data/$n/${lengths[s]}.fq" && -s "data/$n/${lengths[s]}.fq" ]]; then
-              rm -f Scores.bin
-							time_start=$(date +%s)
-							if [[ "$executable" == "./SW_fpga/seqmatcher" ]]; then
-								echo Running $executable "data/$n/${lengths[s]}.fq" "data/$n/${lengths[s]}.fq" $n $n
-								$executable "data/$n/${lengths[s]}.fq" "data/$n/${lengths[s]}.fq" $n $n
-							fi
-							time_end=$(date +%s)
-							time=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; else print 0 }' times.txt)
-							energy=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; else print 0 }' energy.txt)
-							echo "${n},${lengths[s]},$time,$energy,$acc,$nth,$time_start,$time_end" >> "$benchmark"
-								[ -f "Scores.bin" ] && md5sum "Scores.bin" > golden/acc${acc}_${n}_${lengths[s]}_${nth}.md5 && rm "Scores.bin"
-							rm times.txt
-							rm energy.txt
+							# NUMA placement of the host workers on and off (--no-numa), to measure its effect.
+							for placement in "${numa[@]}"; do
+								numa_opt=""
+								[[ "$placement" == "off" ]] && numa_opt="--no-numa"
+								rm -f Scores.bin
+								time_start=$(date +%s)
+								if [[ "$executable" == "./SW_fpga/seqmatcher" ]]; then
+									echo Running $executable "data/$n/${lengths[s]}.fq" "data/$n/${lengths[s]}.fq" $n $n $numa_opt
+									$executable "data/$n/${lengths[s]}.fq" "data/$n/${lengths[s]}.fq" $n $n $numa_opt
+								fi
+								time_end=$(date +%s)
+								time=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; else print 0 }' times.txt)
+								energy=$(awk '{ sum += $1; n++ } END { if (n > 0) print sum / n; else print 0 }' energy.txt)
+								echo "${n},${lengths[s]},$time,$energy,$acc,$nth,$placement,$time_start,$time_end" >> "$benchmark"
+									[ -f "Scores.bin" ] && md5sum "Scores.bin" > golden/acc${acc}_${n}_${lengths[s]}_${nth}.md5 && rm "Scores.bin"
+								rm times.txt
+								rm energy.txt
+							done
 						else
 							echo "File data/$n/${lengths[s]}.fq not found"
 						fi
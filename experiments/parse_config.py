@@ -12,3 +12,4 @@ print(','.join(map(str, config.get('num_threads', []))), end=';')
 print(','.join(map(str, config.get('length', []))), end=';')
 print(','.join(map(str, config.get('nset', []))), end=';')
 print(','.join(map(str, config.get('vaccel', []))), end=';')
+print(','.join(map(str, config.get('numa', ['on']))), end=';')
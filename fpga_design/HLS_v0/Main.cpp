@@ -1,8 +1,46 @@
 #include <cstdint>
 #include <stdio.h>
+#include <string.h>
 
 #include "globals.h"
 
+// Resources of the device (xczu7ev, ZCU104)
+#define DEVICE_LUT 230400
+#define DEVICE_FF 460800
+
+#define STR_(x) #x
+#define STR(x) STR_(x)
+
+/**
+ * First-order resource estimate of the workers with P queries (String_matching_multi),
+ * from the widths of their registers and datapath, not from synthesis. Per worker:
+ * - Shared: target (2L+9 FF) and the selection of its base (about L/2 LUT).
+ * - Per query: pattern, VP and VN (4L FF), scores, position and length (40 FF),
+ *   mask, adder and updates (about 6L LUT), score (about 4*11 LUT).
+ * - Input FIFO (2 entries): 2L+49 bits plus 2L+9 per query.
+ * A worker computes P pairs in the length of the target, reading it once. The table gives
+ * them for NUM_WORKERS workers, and the workers that fit in 80% of the LUTs.
+ */
+void print_resource_estimate() {
+	const uint32_t L = MAX_SEQ_LENGTH;
+	const uint32_t P[] = {1, 2, 4, 8};
+
+	printf("Resource estimate (compiled with %d queries per worker):\n", QUERIES_PER_WORKER);
+	printf("%4s %10s %10s %18s %18s %14s %14s\n", "P", "LUT/worker", "FF/worker",
+		"LUT/FF % (" STR(NUM_WORKERS) ")", "pairs/cycle (" STR(NUM_WORKERS) ")", "workers (80%)", "target b/pair");
+	for (uint32_t i = 0; i < sizeof(P)/sizeof(P[0]); i++) {
+		uint32_t fifo = 2 * (2*L + 49 + P[i] * (2*L + 9));
+		uint32_t lut = L/2 + P[i] * (6*L + 4*SCORE_BITS_S) + fifo / 64; // FIFO in LUTRAM (64 bits per LUT)
+		uint32_t ff = 2*L + 9 + P[i] * (4*L + 2*SCORE_BITS_S + 2*POS_BITS_U);
+		uint32_t fit = (uint32_t)(0.8 * DEVICE_LUT / lut);
+		printf("%4u %10u %10u %8.1f%% /%6.1f%% %18.2f %6u (%5.2f) %14.1f\n", P[i], lut, ff,
+			100.0 * lut * NUM_WORKERS / DEVICE_LUT, 100.0 * ff * NUM_WORKERS / DEVICE_FF,
+			(double)NUM_WORKERS * P[i] / AVG_SEQ_LENGTH, fit, (double)fit * P[i] / AVG_SEQ_LENGTH,
+			2.0 * AVG_SEQ_LENGTH / P[i]);
+	}
+	printf("\n");
+}
+
 int main(int, char **){
 
 	/**
@@ -97,6 +135,8 @@ int main(int, char **){
 	}
 	printf("\n");
 
+	print_resource_estimate();
+
 	return 0;
 
 }
@@ -17,7 +17,7 @@
 /**
  * TODO
  * PRIMARY
- * - (E&R) One worker, several queries
+ * - (E&R) One worker, several queries: String_matching_multi (QUERIES_PER_WORKER > 1), to be synthesized
  * SECONDARY
  * - (E&R) Inster golden reference in SW
  * - (E&R) Try array of 1 bit (do the luts map better?)
@@ -129,6 +129,87 @@ void read_in(
 	}
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/**
+ * Read module with buffer, for the workers with several queries: every message
+ * carries one target and the next QUERIES_PER_WORKER queries of the block
+ */
+void read_in_multi(
+	sequence_chain *seq_target, int nseq_target, uint32_t * length_target,
+	sequence_chain *seq_query, int nseq_query, uint32_t * length_query,
+	hls::stream<msg_in_multi_t>& worker_in) {
+
+	uint32_t * p_lengths_target, * p_lengths_query = length_query;
+	ap_uint<32> seq_query_offset = 0, seq_target_offset = 0;
+
+	msg_in_multi_t in;
+	in.id = 0;
+
+	uint32_t remainingQuerries;
+	int32_t block;
+
+	sequence_chain_m block_query[QUERY_BLOCK_SIZE][2]; // all chain over 2 bits
+	ap_uint<POS_BITS_U> block_length_query[QUERY_BLOCK_SIZE];
+	// A group of queries is read at once
+	#pragma HLS ARRAY_PARTITION variable=block_query cyclic factor=QUERIES_PER_WORKER dim=1
+	#pragma HLS ARRAY_PARTITION variable=block_length_query cyclic factor=QUERIES_PER_WORKER dim=1
+
+	iter_Q_block: for (int j = 0; j < nseq_query; j+=QUERY_BLOCK_SIZE) {
+	#pragma HLS LOOP_TRIPCOUNT avg=NUM_QUERY_BLOCKS max=NUM_QUERY_BLOCKS
+
+		p_lengths_target = length_target;
+		seq_target_offset = 0;
+		remainingQuerries = nseq_query - j;
+		block = remainingQuerries > QUERY_BLOCK_SIZE ? QUERY_BLOCK_SIZE : remainingQuerries;
+		in.id = j;
+
+		// Save Target in table
+		read_Q_block: for (int s = 0; s < block; s++) {
+		#pragma HLS LOOP_TRIPCOUNT avg=QUERY_BLOCK_SIZE max=QUERY_BLOCK_SIZE
+
+			ap_uint<POS_BITS_U> l_query = (ap_uint<POS_BITS_U>)*p_lengths_query;
+			block_query[s][0] = 0;
+			block_query[s][1] = 0;
+			bit_process(seq_query, seq_query_offset, l_query, block_query[s][0], block_query[s][1]);
+			seq_query_offset += MAX_SEQ_LENGTH;
+			block_length_query[s] = l_query; // Pass to the next sequence in the target
+			p_lengths_query++;
+
+		}
+
+		// Compare all references/targets entries with the block of specimen entries.
+		iter_ref: for (int i = 0; i < nseq_target; i++) {
+		#pragma HLS LOOP_TRIPCOUNT avg=AVG_NUM_TARGETS max=AVG_NUM_TARGETS
+
+			in.length_ref = (ap_uint<POS_BITS_U>)*p_lengths_target;
+			bit_process(seq_target, seq_target_offset, in.length_ref, in.bit1_ref, in.bit2_ref);
+			seq_target_offset += MAX_SEQ_LENGTH;
+			p_lengths_target++;  // Pass to the next sequence in the DB
+
+			// For each DB entry, send the specimens of the block in groups
+			copy_Q_groups: for (int s = 0; s < block; s+=QUERIES_PER_WORKER) {
+			#pragma HLS LOOP_TRIPCOUNT avg=QUERY_BLOCK_SIZE/QUERIES_PER_WORKER max=QUERY_BLOCK_SIZE/QUERIES_PER_WORKER
+
+				in.num_pat = block - s > QUERIES_PER_WORKER ? QUERIES_PER_WORKER : block - s;
+				copy_Q_group: for (int p = 0; p < QUERIES_PER_WORKER; p++) {
+				#pragma HLS unroll
+					// The unused slots of the last group repeat its first query (results discarded)
+					int q = p < in.num_pat ? s + p : s;
+					in.bit1_pat[p] = block_query[q][0];
+					in.bit2_pat[p] = block_query[q][1];
+					in.length_pat[p] = block_length_query[q];
+				}
+
+				worker_in.write(in);
+				in.id += in.num_pat;
+
+			}
+
+			in.id += nseq_query - block;
+		}
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /**
  * Write module
@@ -147,6 +228,31 @@ void write_out(hls::stream<msg_out_t>& worker_out, int32_t * output, uint32_t ns
   }
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/**
+ * Write module for the workers with several queries
+ */
+void write_out_multi(hls::stream<msg_out_multi_t>& worker_out, int32_t * output, uint32_t nseqt, uint32_t nseqq) {
+
+  write_blocks: for (int j = 0; j < nseqq; j+=QUERY_BLOCK_SIZE) {
+  #pragma HLS LOOP_TRIPCOUNT avg=NUM_QUERY_BLOCKS max=NUM_QUERY_BLOCKS
+
+    uint32_t block = nseqq - j > QUERY_BLOCK_SIZE ? QUERY_BLOCK_SIZE : nseqq - j;
+    uint32_t groups = (block + QUERIES_PER_WORKER - 1) / QUERIES_PER_WORKER;
+
+    write_messages: for (uint32_t m = 0; m < nseqt * groups; m++) {
+    #pragma HLS LOOP_TRIPCOUNT avg=AVG_NUM_TARGETS*AVG_NUM_QUERY/QUERIES_PER_WORKER max=AVG_NUM_TARGETS*AVG_NUM_QUERY/QUERIES_PER_WORKER
+
+      msg_out_multi_t out = worker_out.read();
+      write_group: for (int p = 0; p < QUERIES_PER_WORKER; p++) {
+      #pragma HLS PIPELINE II=1
+        if (p < out.num_pat)
+          output[out.id + p] = (int32_t)out.pos[p];
+      }
+    }
+  }
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /**
  * Module to compare sequences
@@ -191,6 +297,79 @@ void String_matching( hls::stream<msg_in_t>& msg_in, hls::stream<msg_out_t>& msg
   msg_out.write(out);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/**
+ * Module to compare one target with several queries: the bit vectors of the
+ * QUERIES_PER_WORKER queries advance together on every base of the target, so
+ * the target is read once for all the pairs of the message.
+ *
+ * Resources (first-order estimate per worker, L = MAX_SEQ_LENGTH bits): every query
+ * adds the registers of its pattern, VP and VN (4L FF) and the datapath of one pair
+ * (mask, the L-bit adder and the updates, about 6L LUT), while the target registers
+ * (2L FF) and the selection of its base are shared. The input FIFO grows by 2L+9
+ * bits per query. Main.cpp prints the estimate for several values.
+ */
+void String_matching_multi( hls::stream<msg_in_multi_t>& msg_in, hls::stream<msg_out_multi_t>& msg_out )
+{
+  // Read from FIFO
+  msg_in_multi_t in = msg_in.read();
+
+  ap_int<SCORE_BITS_S> score_list[QUERIES_PER_WORKER], min_value[QUERIES_PER_WORKER];
+  ap_int<POS_BITS_U> min_pos[QUERIES_PER_WORKER];
+  sequence_chain_m VN[QUERIES_PER_WORKER], VP[QUERIES_PER_WORKER];
+  #pragma HLS ARRAY_PARTITION variable=score_list complete
+  #pragma HLS ARRAY_PARTITION variable=min_value complete
+  #pragma HLS ARRAY_PARTITION variable=min_pos complete
+  #pragma HLS ARRAY_PARTITION variable=VN complete
+  #pragma HLS ARRAY_PARTITION variable=VP complete
+
+  init_queries: for (int p = 0; p < QUERIES_PER_WORKER; p++) {
+  #pragma HLS unroll
+    score_list[p] = in.length_pat[p];
+    min_value[p] = score_list[p];
+    min_pos[p] = 0;
+    VN[p] = 0;
+    VP[p] = ~0;
+  }
+
+  // Load the reference or target sequence, which has to be traversed one nucleotide at a time
+  comp_cells: for(int j = 0; j < in.length_ref; j++) {
+    #pragma HLS LOOP_TRIPCOUNT avg=AVG_SEQ_LENGTH max=MAX_SEQ_LENGTH
+    #pragma HLS PIPELINE II=1
+
+    ap_uint<1> base1 = in.bit1_ref.range(j, j), base2 = in.bit2_ref.range(j, j);
+
+    comp_queries: for (int p = 0; p < QUERIES_PER_WORKER; p++) {
+    #pragma HLS unroll
+      sequence_chain_m D0, HN, HP, X, mask;
+
+      mask = mask_pattern_2bit_v2(in.bit1_pat[p], in.bit2_pat[p], base1, base2);
+      X = _mm512_or_si512(mask, VN[p]);
+      D0 = _mm512_or_si512(_mm512_xor_si512( sum(_mm512_and_si512(X, VP[p]), VP[p]), VP[p]), X);
+      HN = _mm512_and_si512(D0, VP[p]);
+      HP = _mm512_or_si512(VN[p], ~(_mm512_or_si512(D0, VP[p])));
+      score_list[p] += HP.range(in.length_pat[p]-1, in.length_pat[p]-1) - HN.range(in.length_pat[p]-1, in.length_pat[p]-1);
+      if (score_list[p] < min_value[p]) {
+        min_value[p] = score_list[p];
+        min_pos[p] = j;
+      }
+      X = shift_left(HP);
+      VN[p] = _mm512_and_si512(X, D0);
+      VP[p] = _mm512_or_si512(shift_left(HN), ~(_mm512_or_si512(X, D0)));
+    }
+  }
+
+  // Copy output
+  msg_out_multi_t out;
+  copy_queries: for (int p = 0; p < QUERIES_PER_WORKER; p++) {
+  #pragma HLS unroll
+    out.pos[p] = min_pos[p];
+  }
+  out.num_pat = in.num_pat;
+  out.id = in.id;
+  msg_out.write(out);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /**
  * Top module
@@ -209,18 +388,35 @@ void SeqMatcherHW(
 #pragma HLS INTERFACE mode=m_axi depth=1024 port=length_query offset=slave bundle=port_q
 #pragma HLS INTERFACE mode=m_axi depth=1024 num_write_outstanding=32 port=output offset=slave bundle=port_t latency=20
 
+#if QUERIES_PER_WORKER > 1
+  hls_thread_local hls::split::round_robin<msg_in_multi_t, NUM_WORKERS> split1;
+  hls_thread_local hls::merge::round_robin<msg_out_multi_t, NUM_WORKERS, NUM_WORKERS> merge1;
+#else
   hls_thread_local hls::split::round_robin<msg_in_t, NUM_WORKERS> split1;
   hls_thread_local hls::merge::round_robin<msg_out_t, NUM_WORKERS, NUM_WORKERS> merge1;
+#endif
   hls_thread_local hls::task t[NUM_WORKERS];
   #pragma HLS dataflow
+  HLS_EMU_REGION(region);
+
+#if QUERIES_PER_WORKER > 1
+  HLS_EMU_CALL(region, read_in_multi(bit_set_target, nseqt, length_target, bit_set_query, nseqq, length_query, split1.in));
+
+  workers_loop: for (int i = 0; i < NUM_WORKERS; i++) {
+  #pragma HLS unroll
+    t[i](String_matching_multi, split1.out[i], merge1.in[i]);
+  }
 
-  read_in(bit_set_target, nseqt, length_target, bit_set_query, nseqq, length_query, split1.in);
+  HLS_EMU_CALL(region, write_out_multi(merge1.out, output, nseqt, nseqq));
+#else
+  HLS_EMU_CALL(region, read_in(bit_set_target, nseqt, length_target, bit_set_query, nseqq, length_query, split1.in));
 
   workers_loop: for (int i = 0; i < NUM_WORKERS; i++) {
   #pragma HLS unroll
     t[i](String_matching, split1.out[i], merge1.in[i]);
   }
 
-  write_out(merge1.out, output, nseqt, nseqq);
+  HLS_EMU_CALL(region, write_out(merge1.out, output, nseqt, nseqq));
+#endif
 }
 
@@ -9,6 +9,13 @@
 #include "hls_np_channel.h"
 #include <ap_int.h>
 
+// Sequential functions of the dataflow: threads in the native model (sw_emu/hls_stream.h),
+// direct calls in Vitis HLS
+#ifndef HLS_EMU_REGION
+#define HLS_EMU_REGION(r)
+#define HLS_EMU_CALL(r, call) call
+#endif
+
 // Debug
 // #define DEBUG
 
@@ -19,6 +26,9 @@
 // Design parameters
 #define NUM_WORKERS 42
 #define QUERY_BLOCK_SIZE 10240
+#ifndef QUERIES_PER_WORKER
+#define QUERIES_PER_WORKER 1 // Queries compared by a worker in one pass over the target (>1: String_matching_multi)
+#endif
 
 // Stats
 #define AVG_SEQ_LENGTH 150
@@ -61,6 +71,27 @@ struct msg_out_t
     uint32_t id; // querries x targets = ...
 };
 
+// One target and QUERIES_PER_WORKER queries of the block. The pairs have consecutive ids
+// (id + p); the last group of a block can have fewer valid queries (num_pat).
+struct msg_in_multi_t
+{
+    sequence_chain_m bit1_ref;
+    sequence_chain_m bit2_ref;
+    ap_uint<POS_BITS_U> length_ref;
+    sequence_chain_m bit1_pat[QUERIES_PER_WORKER];
+    sequence_chain_m bit2_pat[QUERIES_PER_WORKER];
+    ap_uint<POS_BITS_U> length_pat[QUERIES_PER_WORKER];
+    ap_uint<8> num_pat;
+    uint32_t id; // of the first pair
+};
+
+struct msg_out_multi_t
+{
+    ap_uint<POS_BITS_U> pos[QUERIES_PER_WORKER];
+    ap_uint<8> num_pat;
+    uint32_t id; // of the first pair
+};
+
 
 
 extern void SeqMatcherHW(sequence_chain *bit_set_target, int nseqt, uint32_t * length_target, // Target
@@ -0,0 +1,57 @@
+#ifndef HLS_NP_CHANNEL_EMU_H
+#define HLS_NP_CHANNEL_EMU_H
+
+// Software emulation of the 1-to-N and N-to-1 channels of hls_np_channel.h. Each channel is
+// a process with its own thread that moves the elements between its streams in round robin:
+// element k written to a splitter goes to out[k % N], and a merger reads in[0], in[1], ...
+// in turn, so the order of the results is the same as in the hardware.
+
+#include "hls_stream.h"
+
+namespace hls {
+namespace split {
+
+template<typename __STREAM_T__, int N_OUT_PORTS, int IN_DEPTH = 0, int OUT_DEPTH = 0>
+class round_robin {
+  emu::process process_;
+  int next_;
+
+public:
+  stream<__STREAM_T__, IN_DEPTH> in;
+  stream<__STREAM_T__, OUT_DEPTH> out[N_OUT_PORTS];
+
+  round_robin() : next_(0) {
+    process_.start([this]() {
+      out[next_].write(in.read());
+      next_ = (next_ + 1) % N_OUT_PORTS;
+    });
+  }
+  ~round_robin() { process_.stop(); }
+};
+
+} // namespace split
+
+namespace merge {
+
+template<typename __STREAM_T__, int N_IN_PORTS, int IN_DEPTH = 0, int OUT_DEPTH = 0>
+class round_robin {
+  emu::process process_;
+  int next_;
+
+public:
+  stream<__STREAM_T__, IN_DEPTH> in[N_IN_PORTS];
+  stream<__STREAM_T__, OUT_DEPTH> out;
+
+  round_robin() : next_(0) {
+    process_.start([this]() {
+      out.write(in[next_].read());
+      next_ = (next_ + 1) % N_IN_PORTS;
+    });
+  }
+  ~round_robin() { process_.stop(); }
+};
+
+} // namespace merge
+} // namespace hls
+
+#endif
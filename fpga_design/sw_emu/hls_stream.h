@@ -0,0 +1,184 @@
+#ifndef HLS_STREAM_EMU_H
+#define HLS_STREAM_EMU_H
+
+// Software emulation of hls::stream for the native build of the kernel (CMakeLists.txt).
+// A stream is a bounded FIFO between threads: read() blocks while it is empty and write()
+// while it is full, as the FIFOs of the hardware. The processes of hls_task.h and
+// hls_np_channel.h run on their own threads; when one is stopped, its blocked reads and
+// writes leave through hls::emu::stopped. The sequential functions of the dataflow also run
+// on their own threads (HLS_EMU_REGION below), concurrently as in the hardware, so they can
+// stream a block larger than the FIFOs.
+
+#include <stddef.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#ifndef HLS_EMU_STREAM_DEPTH
+#define HLS_EMU_STREAM_DEPTH 16   // Capacity of the streams declared without a depth
+#endif
+#define HLS_EMU_POLL_MS 1         // A blocked process checks its stop request this often
+
+namespace hls {
+namespace emu {
+
+// Thrown out of a blocked read or write of a process that is stopped.
+struct stopped {};
+
+// Stop request of the process running on this thread (NULL: not a process, e.g., the testbench).
+inline std::atomic<bool> *& stop_request() {
+  static thread_local std::atomic<bool> * request = NULL;
+  return request;
+}
+
+inline void check_stop() {
+  if (stop_request() != NULL && stop_request()->load())
+    throw stopped();
+}
+
+// Thread that runs a body again and again (a free-running process of the dataflow) until
+// it is stopped. The object that owns it must stop it before its streams are destroyed.
+class process {
+  std::atomic<bool> stop_;
+  std::thread thread_;
+
+public:
+  process() : stop_(false) {}
+  ~process() { stop(); }
+
+  template<typename F> void start(F body) {
+    if (thread_.joinable())
+      return;
+    thread_ = std::thread([this, body]() {
+      stop_request() = &stop_;
+      try {
+        while (!stop_.load())
+          body();
+      } catch (stopped &) {}
+    });
+  }
+
+  void stop() {
+    stop_ = true;
+    if (thread_.joinable())
+      thread_.join();
+  }
+};
+
+// Sequential functions of a dataflow region, each on its own thread. The region waits for
+// them when it is destroyed (at the end of the top function).
+class region {
+  std::vector<std::thread> threads_;
+
+public:
+  region() {}
+  ~region() {
+    for (auto & thread : threads_)
+      thread.join();
+  }
+  region(const region &) = delete;
+  region & operator=(const region &) = delete;
+
+  template<typename F> void run(F body) { threads_.emplace_back(body); }
+};
+
+} // namespace emu
+
+// The kernel declares its dataflow region with HLS_EMU_REGION(r) and calls its sequential
+// functions with HLS_EMU_CALL(r, f(...)); Vitis HLS (globals.h) calls them directly.
+#define HLS_EMU_REGION(r) hls::emu::region r
+#define HLS_EMU_CALL(r, call) r.run([&]() { call; })
+
+// As in Vitis HLS, a stream with a depth is also a stream<T> (the type of the arguments of the
+// functions that use it).
+template<typename __STREAM_T__, int DEPTH = 0>
+class stream;
+
+template<typename __STREAM_T__>
+class stream<__STREAM_T__, 0> {
+  std::deque<__STREAM_T__> queue_;
+  size_t capacity_;
+  mutable std::mutex lock_;
+  std::condition_variable not_empty_, not_full_;
+
+protected:
+  explicit stream(size_t capacity) : capacity_(capacity) {}
+
+public:
+  stream() : capacity_(HLS_EMU_STREAM_DEPTH) {}
+  stream(const char *) : capacity_(HLS_EMU_STREAM_DEPTH) {}
+  stream(const stream &) = delete;
+  stream & operator=(const stream &) = delete;
+
+  bool empty() const { std::lock_guard<std::mutex> guard(lock_); return queue_.empty(); }
+  bool full() const { std::lock_guard<std::mutex> guard(lock_); return queue_.size() >= capacity_; }
+  size_t size() const { std::lock_guard<std::mutex> guard(lock_); return queue_.size(); }
+
+  void read(__STREAM_T__ & value) {
+    std::unique_lock<std::mutex> guard(lock_);
+    while (queue_.empty()) {
+      emu::check_stop();
+      not_empty_.wait_for(guard, std::chrono::milliseconds(HLS_EMU_POLL_MS));
+    }
+    value = queue_.front();
+    queue_.pop_front();
+    guard.unlock();
+    not_full_.notify_one();
+  }
+
+  __STREAM_T__ read() {
+    __STREAM_T__ value;
+    read(value);
+    return value;
+  }
+
+  bool read_nb(__STREAM_T__ & value) {
+    std::unique_lock<std::mutex> guard(lock_);
+    if (queue_.empty())
+      return false;
+    value = queue_.front();
+    queue_.pop_front();
+    guard.unlock();
+    not_full_.notify_one();
+    return true;
+  }
+
+  void write(const __STREAM_T__ & value) {
+    std::unique_lock<std::mutex> guard(lock_);
+    while (queue_.size() >= capacity_) {
+      emu::check_stop();
+      not_full_.wait_for(guard, std::chrono::milliseconds(HLS_EMU_POLL_MS));
+    }
+    queue_.push_back(value);
+    guard.unlock();
+    not_empty_.notify_one();
+  }
+
+  bool write_nb(const __STREAM_T__ & value) {
+    std::unique_lock<std::mutex> guard(lock_);
+    if (queue_.size() >= capacity_)
+      return false;
+    queue_.push_back(value);
+    guard.unlock();
+    not_empty_.notify_one();
+    return true;
+  }
+
+  void operator>>(__STREAM_T__ & value) { read(value); }
+  void operator<<(const __STREAM_T__ & value) { write(value); }
+};
+
+template<typename __STREAM_T__, int DEPTH>
+class stream : public stream<__STREAM_T__, 0> {
+public:
+  stream() : stream<__STREAM_T__, 0>(DEPTH) {}
+  stream(const char *) : stream<__STREAM_T__, 0>(DEPTH) {}
+};
+
+} // namespace hls
+
+#endif
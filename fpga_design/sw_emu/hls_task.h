@@ -0,0 +1,35 @@
+#ifndef HLS_TASK_EMU_H
+#define HLS_TASK_EMU_H
+
+// Software emulation of hls::task: the function runs on its own thread, again and again,
+// as a free-running process of the dataflow (it reads its inputs from streams every time).
+// The tasks are declared hls_thread_local, so they are started by the first call of the top
+// function and keep running with the same streams in the next calls. They are stopped at
+// exit, before the streams they use (declared earlier) are destroyed. They are static rather
+// than thread_local: the sequential functions of the dataflow (HLS_EMU_CALL) run on other
+// threads and must see the same streams.
+
+#include "hls_stream.h"
+
+#define hls_thread_local static
+
+namespace hls {
+
+class task {
+  emu::process process_;
+
+public:
+  task() {}
+  template<typename F, typename... Args> task(F function, Args &... args) { (*this)(function, args...); }
+  task(const task &) = delete;
+  task & operator=(const task &) = delete;
+
+  // Starts the task (only the first call: it keeps running afterwards).
+  template<typename F, typename... Args> void operator()(F function, Args &... args) {
+    process_.start([function, &args...]() { function(args...); });
+  }
+};
+
+} // namespace hls
+
+#endif